@@ -7,12 +7,26 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/audio_encoder.h"
 
+#include <cstring>
 #include <new>
 
 #include "glog/logging.h"
 
 namespace webmlive {
 
+int32 AudioBufferCapacity(const AudioConfig& config, int32 duration_ms) {
+  if (config.format_tag != kAudioFormatPcm &&
+      config.format_tag != kAudioFormatIeeeFloat) {
+    return 0;
+  }
+  int64 bytes_per_second = config.bytes_per_second;
+  if (bytes_per_second == 0) {
+    bytes_per_second = static_cast<int64>(config.sample_rate) *
+        config.channels * (config.bits_per_sample / 8);
+  }
+  return static_cast<int32>(bytes_per_second * duration_ms / 1000);
+}
+
 AudioBuffer::AudioBuffer()
     : timestamp_(0),
       duration_(0),
@@ -90,4 +104,23 @@ void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
   buffer_.swap(ptr_buffer->buffer_);
 }
 
+int AudioBuffer::Reserve(int32 capacity) {
+  if (capacity <= 0) {
+    LOG(ERROR) << "AudioBuffer cannot Reserve " << capacity << " bytes.";
+    return kInvalidArg;
+  }
+  if (capacity > buffer_capacity_) {
+    buffer_.reset(new (std::nothrow) uint8[capacity]);  // NOLINT
+    if (!buffer_) {
+      LOG(ERROR) << "AudioBuffer Reserve cannot allocate buffer.";
+      buffer_capacity_ = 0;
+      buffer_length_ = 0;
+      return kNoMemory;
+    }
+    buffer_capacity_ = capacity;
+    buffer_length_ = 0;
+  }
+  return kSuccess;
+}
+
 }  // namespace webmlive
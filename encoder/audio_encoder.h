@@ -45,6 +45,11 @@ struct AudioConfig {
   uint32 channel_mask;            // Channels present in audio stream.
 };
 
+// Returns the buffer capacity in bytes required to store |duration_ms|
+// milliseconds of audio described by |config|. Returns 0 when |config| does
+// not describe a PCM or IEEE float stream.
+int32 AudioBufferCapacity(const AudioConfig& config, int32 duration_ms);
+
 class AudioBuffer {
  public:
   enum {
@@ -73,6 +78,12 @@ class AudioBuffer {
   // must have non-NULL buffers.
   void Swap(AudioBuffer* ptr_buffer);
 
+  // Allocates storage for at least |capacity| bytes when |buffer_capacity_| is
+  // smaller than |capacity|, and returns |kSuccess|. Sample data is discarded
+  // when allocation occurs. Returns |kInvalidArg| when |capacity| is <= 0.
+  // Returns |kNoMemory| when memory allocation fails.
+  int Reserve(int32 capacity);
+
   // Accessors/Mutators.
   int64 timestamp() const { return timestamp_; }
   void set_timestamp(int64 timestamp) { timestamp_ = timestamp; }
@@ -96,13 +107,23 @@ class AudioBuffer {
 // implementor class to receive |AudioBuffer| pointers.
 class AudioSamplesCallbackInterface {
  public:
+  enum {
+    // Returned by |OnSamplesReceived| when |ptr_sample_buffer| is NULL or
+    // empty, or cannot be stored.
+    kInvalidArg = -2,
+    kSuccess = 0,
+    // Returned by |OnSamplesReceived| when |ptr_sample_buffer| is dropped.
+    kDropped = 1,
+  };
   virtual ~AudioSamplesCallbackInterface() {}
 
   // Passes an |AudioBuffer| pointer to the |AudioSamplesCallbackInterface|
   // implementation, allowing it to take ownership of the contents. Argument
   // is non-const to allow for use of |AudioBuffer::Swap| by the implementor.
-  // Return true to signal success. Returning false terminates sample delivery.
-  virtual bool OnSamplesReceived(AudioBuffer* ptr_sample_buffer) = 0;
+  // Returns |kSuccess|, or |kDropped| when the implementor is too busy to
+  // accept the samples. Other values are errors that terminate sample
+  // delivery.
+  virtual int OnSamplesReceived(AudioBuffer* ptr_sample_buffer) = 0;
 };
 
 struct VorbisConfig {
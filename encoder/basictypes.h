@@ -8,6 +8,10 @@
 #ifndef WEBMLIVE_ENCODER_BASICTYPES_H_
 #define WEBMLIVE_ENCODER_BASICTYPES_H_
 
+#if !defined _MSC_VER && !defined _WIN32
+#include <stdint.h>
+#endif
+
 typedef signed char         schar;
 typedef signed char         int8;
 typedef short               int16;   // NOLINT
@@ -20,8 +24,9 @@ typedef unsigned int        uint32;
 typedef __int64             int64;
 typedef unsigned __int64    uint64;
 #else
-typedef long long           int64;   // NOLINT
-typedef unsigned long long  uint64;  // NOLINT
+// Match the libyuv and libvpx definitions: long on LP64 systems.
+typedef int64_t             int64;
+typedef uint64_t            uint64;
 #endif
 
 #define WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TypeName) \
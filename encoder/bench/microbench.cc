@@ -0,0 +1,866 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+// Microbenchmarks for the encoder's hot components. Each case runs its
+// operation in growing batches until a batch takes at least --min_time
+// milliseconds, and reports the rate of that batch. Results are
+// written as JSON, and may be compared against a report from an earlier run
+// to catch throughput regressions, e.g. when updating the libvpx, libyuv or
+// libwebm snapshots in third_party.
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/clock.h"
+#include "encoder/data_sink.h"
+#include "encoder/video_encoder.h"
+#include "encoder/vorbis_encoder.h"
+#include "encoder/webm_encoder.h"
+#include "encoder/webm_mux.h"
+#include "glog/logging.h"
+#include "libvpx/vpx/vpx_codec.h"
+#include "libwebm/mkvmuxerutil.hpp"
+#include "libyuv/version.h"
+
+namespace {
+
+// Version of the report layout. Increment when fields are renamed or removed.
+const int kReportVersion = 1;
+
+// Defaults for --min_time and --max_regression.
+const int kDefaultMinTimeMs = 500;
+const double kDefaultMaxRegressionPercent = 10.0;
+
+// Number of distinct frames generated for the encode and mux cases. Frames are
+// reused in a loop with increasing timestamps.
+const int kNumSourceFrames = 60;
+const int kFrameDurationMs = 33;
+
+// Duration of each audio buffer passed to the Vorbis encoder.
+const int kAudioBufferDurationMs = 20;
+
+// Size of the chunks passed to |DataSink::WriteData()|.
+const int32 kChunkSize = 64 * 1024;
+
+struct Options {
+  Options()
+      : list_cases(false),
+        min_time_ms(kDefaultMinTimeMs),
+        max_regression_percent(kDefaultMaxRegressionPercent) {}
+
+  bool list_cases;
+  std::string filter;
+  int64 min_time_ms;
+  std::string output_file;
+  std::string baseline_file;
+  double max_regression_percent;
+};
+
+struct Result {
+  Result() : iterations(0), ns_per_op(0), ops_per_second(0) {}
+
+  std::string name;
+  int64 iterations;
+  double ns_per_op;
+  double ops_per_second;
+};
+
+// A benchmark case. |Init()| performs setup that is excluded from timing, and
+// |Run()| performs the measured operation |iterations| times. Both return
+// false upon failure.
+class BenchmarkCase {
+ public:
+  explicit BenchmarkCase(const std::string& name) : name_(name) {}
+  virtual ~BenchmarkCase() {}
+  virtual bool Init() = 0;
+  virtual bool Run(int64 iterations) = 0;
+  const std::string& name() const { return name_; }
+
+ private:
+  std::string name_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BenchmarkCase);
+};
+
+typedef std::vector<std::unique_ptr<BenchmarkCase> > BenchmarkCaseList;
+
+// Returns "<width>x<height>".
+std::string SizeName(int width, int height) {
+  std::ostringstream name;
+  name << width << "x" << height;
+  return name.str();
+}
+
+// Fills |ptr_frame| with an I420 frame of moving texture. Consecutive values
+// of |frame_num| produce different frames, so encoders do real work.
+bool MakeI420Frame(int width, int height, int frame_num, int64 timestamp,
+                   webmlive::VideoFrame* ptr_frame) {
+  const int32 y_size = width * height;
+  const int32 frame_size = y_size + 2 * (y_size / 4);
+  std::unique_ptr<uint8[]> data(
+      new (std::nothrow) uint8[frame_size]);  // NOLINT
+  if (!data) {
+    return false;
+  }
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int value = (x + 3 * frame_num) ^ (y + 2 * frame_num);
+      data[y * width + x] = static_cast<uint8>(value & 0xff);
+    }
+  }
+  memset(data.get() + y_size, 128, frame_size - y_size);
+
+  webmlive::VideoConfig config;
+  config.format = webmlive::kVideoFormatI420;
+  config.width = width;
+  config.height = height;
+  config.stride = width;
+  config.frame_rate = 1000.0 / kFrameDurationMs;
+  return ptr_frame->Init(config, true, timestamp, kFrameDurationMs, data.get(),
+                         frame_size) == webmlive::VideoFrame::kSuccess;
+}
+
+// Returns a |WebmEncoderConfig| for encoding |width| by |height| video with
+// |codec| at |speed| on |num_threads| threads.
+webmlive::WebmEncoderConfig EncodeConfig(webmlive::VideoFormat codec,
+                                         int speed, int num_threads,
+                                         int width, int height) {
+  webmlive::WebmEncoderConfig config =
+      webmlive::WebmEncoder::DefaultConfig();
+  config.actual_video_config.format = webmlive::kVideoFormatI420;
+  config.actual_video_config.width = width;
+  config.actual_video_config.height = height;
+  config.actual_video_config.stride = width;
+  config.actual_video_config.frame_rate = 1000.0 / kFrameDurationMs;
+  config.vpx_config.codec = codec;
+  config.vpx_config.speed = speed;
+  config.vpx_config.thread_count = num_threads;
+  config.vpx_config.bitrate = 2000;
+  return config;
+}
+
+//
+// BufferPool cases.
+//
+
+// Moves 720p frames through a |BufferPool<VideoFrame>|: on one thread, or
+// from a producer thread to a consumer thread, which is how the pipeline
+// uses the pool.
+class BufferPoolCase : public BenchmarkCase {
+ public:
+  explicit BufferPoolCase(bool two_threads)
+      : BenchmarkCase(std::string("buffer_pool/commit_decommit/") +
+                      (two_threads ? "two_threads" : "one_thread")),
+        two_threads_(two_threads) {}
+
+  bool Init() override {
+    if (!MakeI420Frame(1280, 720, 0, 0, &in_frame_) ||
+        !MakeI420Frame(1280, 720, 1, 0, &out_frame_)) {
+      return false;
+    }
+    const int32 capacity = webmlive::VideoFrameCapacity(in_frame_.config());
+    return pool_.Init(false, FramePool::kDefaultBufferCount, capacity) ==
+           FramePool::kSuccess;
+  }
+
+  bool Run(int64 iterations) override {
+    if (!two_threads_) {
+      for (int64 i = 0; i < iterations; ++i) {
+        if (pool_.Commit(&in_frame_) || pool_.Decommit(&out_frame_)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // The pool drops the newest frame when full; commits that return |kFull|
+    // are retried so that every frame reaches the consumer.
+    std::atomic<bool> failed(false);
+    std::thread producer([this, iterations, &failed]() {
+      for (int64 i = 0; i < iterations && !failed.load();) {
+        const int status = pool_.Commit(&in_frame_);
+        if (status == FramePool::kFull) {
+          std::this_thread::yield();
+        } else if (status) {
+          failed = true;
+        } else {
+          ++i;
+        }
+      }
+    });
+    for (int64 i = 0; i < iterations && !failed.load();) {
+      const int status = pool_.Decommit(&out_frame_);
+      if (status == FramePool::kEmpty) {
+        std::this_thread::yield();
+      } else if (status) {
+        failed = true;
+      } else {
+        ++i;
+      }
+    }
+    producer.join();
+    return !failed.load();
+  }
+
+ private:
+  typedef webmlive::BufferPool<webmlive::VideoFrame> FramePool;
+
+  bool two_threads_;
+  FramePool pool_;
+  webmlive::VideoFrame in_frame_;
+  webmlive::VideoFrame out_frame_;
+};
+
+//
+// Pixel format conversion cases.
+//
+
+// Converts |format_name| frames to I420 through |VideoFrame::Init()|.
+class ConvertCase : public BenchmarkCase {
+ public:
+  ConvertCase(const std::string& format_name, int width, int height)
+      : BenchmarkCase("video_frame/convert_to_i420/" + format_name + "/" +
+                      SizeName(width, height)),
+        format_name_(format_name),
+        width_(width),
+        height_(height),
+        frame_length_(0) {}
+
+  bool Init() override {
+    webmlive::VideoConfig requested;
+    requested.width = width_;
+    requested.height = height_;
+    if (!webmlive::InitRawVideoConfig(format_name_, requested, &config_,
+                                      &frame_length_)) {
+      return false;
+    }
+    data_.reset(new (std::nothrow) uint8[frame_length_]);  // NOLINT
+    if (!data_) {
+      return false;
+    }
+    for (int32 i = 0; i < frame_length_; ++i) {
+      data_[i] = static_cast<uint8>(i * 7);
+    }
+    return Run(1);
+  }
+
+  bool Run(int64 iterations) override {
+    for (int64 i = 0; i < iterations; ++i) {
+      if (frame_.Init(config_, true, i, kFrameDurationMs, data_.get(),
+                      frame_length_)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::string format_name_;
+  int width_;
+  int height_;
+  webmlive::VideoConfig config_;
+  int32 frame_length_;
+  std::unique_ptr<uint8[]> data_;
+  webmlive::VideoFrame frame_;
+};
+
+//
+// Video encode cases.
+//
+
+// Encodes 720p frames with |VideoEncoder|, which wraps |VpxEncoder|. Frames
+// the encoder drops count as operations.
+class EncodeCase : public BenchmarkCase {
+ public:
+  EncodeCase(webmlive::VideoFormat codec, int speed, int num_threads)
+      : BenchmarkCase(CaseName(codec, speed, num_threads)),
+        config_(EncodeConfig(codec, speed, num_threads, 1280, 720)),
+        frame_num_(0) {}
+
+  bool Init() override {
+    for (int i = 0; i < kNumSourceFrames; ++i) {
+      std::unique_ptr<webmlive::VideoFrame> frame(
+          new (std::nothrow) webmlive::VideoFrame());  // NOLINT
+      if (!frame || !MakeI420Frame(config_.actual_video_config.width,
+                                   config_.actual_video_config.height, i, 0,
+                                   frame.get())) {
+        return false;
+      }
+      raw_frames_.push_back(std::move(frame));
+    }
+    return encoder_.Init(config_) == webmlive::VideoEncoder::kSuccess;
+  }
+
+  bool Run(int64 iterations) override {
+    for (int64 i = 0; i < iterations; ++i, ++frame_num_) {
+      webmlive::VideoFrame* const ptr_raw_frame =
+          raw_frames_[frame_num_ % kNumSourceFrames].get();
+      ptr_raw_frame->set_timestamp(frame_num_ * kFrameDurationMs);
+      const int32 status = encoder_.EncodeFrame(*ptr_raw_frame, &vpx_frame_);
+      if (status != webmlive::VideoEncoder::kSuccess &&
+          status != webmlive::VideoEncoder::kDropped) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  static std::string CaseName(webmlive::VideoFormat codec, int speed,
+                              int num_threads) {
+    std::ostringstream name;
+    name << "vpx_encoder/encode_frame/"
+         << (codec == webmlive::kVideoFormatVP9 ? "vp9" : "vp8")
+         << "/1280x720/speed_" << speed << "/threads_" << num_threads;
+    return name.str();
+  }
+
+  webmlive::WebmEncoderConfig config_;
+  webmlive::VideoEncoder encoder_;
+  std::vector<std::unique_ptr<webmlive::VideoFrame> > raw_frames_;
+  webmlive::VideoFrame vpx_frame_;
+  int64 frame_num_;
+};
+
+//
+// Vorbis encode case.
+//
+
+// Encodes 20 ms buffers of 44.1 kHz stereo tone, and reads all compressed
+// audio after each buffer.
+class VorbisCase : public BenchmarkCase {
+ public:
+  VorbisCase()
+      : BenchmarkCase("vorbis_encoder/encode_read/44100hz_stereo_20ms"),
+        buffer_num_(0) {}
+
+  bool Init() override {
+    const int32 num_blocks =
+        config_.sample_rate * kAudioBufferDurationMs / 1000;
+    samples_.resize(num_blocks * config_.channels);
+    for (int32 i = 0; i < num_blocks; ++i) {
+      const double kPi = 3.14159265358979;
+      const int16 sample = static_cast<int16>(
+          8000 * sin(2 * kPi * 1000 * i / config_.sample_rate));
+      for (int c = 0; c < config_.channels; ++c) {
+        samples_[i * config_.channels + c] = sample;
+      }
+    }
+    config_.block_align = config_.channels * config_.bits_per_sample / 8;
+    config_.bytes_per_second = config_.sample_rate * config_.block_align;
+    return encoder_.Init(config_, webmlive::VorbisConfig()) ==
+           webmlive::VorbisEncoder::kSuccess;
+  }
+
+  bool Run(int64 iterations) override {
+    for (int64 i = 0; i < iterations; ++i, ++buffer_num_) {
+      if (raw_buffer_.Init(config_, buffer_num_ * kAudioBufferDurationMs,
+                           kAudioBufferDurationMs,
+                           reinterpret_cast<const uint8*>(&samples_[0]),
+                           static_cast<int32>(samples_.size() *
+                                              sizeof(samples_[0]))) ||
+          encoder_.Encode(raw_buffer_)) {
+        return false;
+      }
+      int status;
+      while ((status = encoder_.ReadCompressedAudio(&vorbis_buffer_)) ==
+             webmlive::VorbisEncoder::kSuccess) {
+      }
+      if (status != webmlive::VorbisEncoder::kNoSamples) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  webmlive::AudioConfig config_;
+  webmlive::VorbisEncoder encoder_;
+  std::vector<int16> samples_;
+  webmlive::AudioBuffer raw_buffer_;
+  webmlive::AudioBuffer vorbis_buffer_;
+  int64 buffer_num_;
+};
+
+//
+// Muxer case.
+//
+
+// Writes compressed 720p VP8 frames to a |LiveWebmMuxer| producing one second
+// chunks, and reads each chunk as soon as it is ready. Clusters are written by
+// libwebm, or by |LiveClusterWriter| when |live_cluster_writer| is true.
+class MuxCase : public BenchmarkCase {
+ public:
+  explicit MuxCase(bool live_cluster_writer)
+      : BenchmarkCase(CaseName(live_cluster_writer)),
+        live_cluster_writer_(live_cluster_writer),
+        frame_num_(0) {}
+
+  bool Init() override {
+    const webmlive::WebmEncoderConfig config =
+        EncodeConfig(webmlive::kVideoFormatVP8, -6, 1, 1280, 720);
+    webmlive::VideoEncoder encoder;
+    if (encoder.Init(config) != webmlive::VideoEncoder::kSuccess) {
+      return false;
+    }
+    webmlive::VideoFrame raw_frame;
+    for (int i = 0; i < kNumSourceFrames; ++i) {
+      std::unique_ptr<webmlive::VideoFrame> frame(
+          new (std::nothrow) webmlive::VideoFrame());  // NOLINT
+      if (!frame ||
+          !MakeI420Frame(1280, 720, i, i * kFrameDurationMs, &raw_frame) ||
+          encoder.EncodeFrame(raw_frame, frame.get()) !=
+              webmlive::VideoEncoder::kSuccess) {
+        return false;
+      }
+      vpx_frames_.push_back(std::move(frame));
+    }
+
+    webmlive::VideoConfig vpx_config = config.actual_video_config;
+    vpx_config.format = webmlive::kVideoFormatVP8;
+    webmlive::LiveWebmMuxer::Options muxer_options;
+    muxer_options.cluster_duration_milliseconds = 1000;
+    muxer_options.live_cluster_writer = live_cluster_writer_;
+    return muxer_.Init(muxer_options, "video") ==
+               webmlive::LiveWebmMuxer::kSuccess &&
+           muxer_.AddTrack(vpx_config) == webmlive::LiveWebmMuxer::kSuccess;
+  }
+
+  bool Run(int64 iterations) override {
+    for (int64 i = 0; i < iterations; ++i, ++frame_num_) {
+      webmlive::VideoFrame* const ptr_frame =
+          vpx_frames_[frame_num_ % kNumSourceFrames].get();
+      ptr_frame->set_timestamp(frame_num_ * kFrameDurationMs);
+      if (muxer_.WriteVideoFrame(*ptr_frame)) {
+        return false;
+      }
+      int32 chunk_length = 0;
+      if (muxer_.ChunkReady(&chunk_length) && muxer_.ReadChunk(&chunk_)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  static std::string CaseName(bool live_cluster_writer) {
+    std::string name = "live_webm_muxer/write_read_chunk/vp8_1280x720";
+    if (live_cluster_writer) {
+      name += "/live_cluster_writer";
+    }
+    return name;
+  }
+
+  const bool live_cluster_writer_;
+  webmlive::LiveWebmMuxer muxer_;
+  std::vector<std::unique_ptr<webmlive::VideoFrame> > vpx_frames_;
+  webmlive::LiveWebmMuxer::WriteBuffer chunk_;
+  int64 frame_num_;
+};
+
+//
+// DataSink cases.
+//
+
+// Sink that accepts and discards buffers.
+class DiscardSink : public webmlive::DataSinkInterface {
+ public:
+  DiscardSink() : bytes_written_(0) {}
+  ~DiscardSink() override {}
+  bool WriteData(const webmlive::SharedDataSinkBuffer& buffer) override {
+    bytes_written_ += buffer->data.size();
+    return true;
+  }
+  std::string Name() const override { return "DiscardSink"; }
+
+ private:
+  int64 bytes_written_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DiscardSink);
+};
+
+// Passes 64 KB chunks to a |DataSink| with |num_sinks| attached sinks. Each
+// operation includes acquiring the chunk buffer from the |DataSink| pool.
+class DataSinkCase : public BenchmarkCase {
+ public:
+  explicit DataSinkCase(int num_sinks)
+      : BenchmarkCase(CaseName(num_sinks)),
+        num_sinks_(num_sinks) {}
+
+  bool Init() override {
+    for (int i = 0; i < num_sinks_; ++i) {
+      std::unique_ptr<DiscardSink> sink(
+          new (std::nothrow) DiscardSink());  // NOLINT
+      if (!sink) {
+        return false;
+      }
+      data_sink_.AddDataSink(sink.get());
+      sinks_.push_back(std::move(sink));
+    }
+    return true;
+  }
+
+  bool Run(int64 iterations) override {
+    for (int64 i = 0; i < iterations; ++i) {
+      webmlive::SharedDataSinkBuffer buffer =
+          data_sink_.AcquireBuffer(kChunkSize);
+      if (!buffer) {
+        return false;
+      }
+      buffer->data.resize(kChunkSize);
+      buffer->id = "chunk";
+      if (!data_sink_.WriteData(buffer)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  static std::string CaseName(int num_sinks) {
+    std::ostringstream name;
+    name << "data_sink/write_data/64k/sinks_" << num_sinks;
+    return name.str();
+  }
+
+  int num_sinks_;
+  std::vector<std::unique_ptr<DiscardSink> > sinks_;
+  webmlive::DataSink data_sink_;
+};
+
+// Adds |ptr_case| to |ptr_cases|. Returns false when |ptr_case| is NULL.
+bool AddCase(BenchmarkCase* ptr_case, BenchmarkCaseList* ptr_cases) {
+  if (!ptr_case) {
+    return false;
+  }
+  ptr_cases->push_back(std::unique_ptr<BenchmarkCase>(ptr_case));
+  return true;
+}
+
+// Creates all cases. Returns false when out of memory.
+bool CreateCases(BenchmarkCaseList* ptr_cases) {
+  bool ok = true;
+  ok &= AddCase(new (std::nothrow) BufferPoolCase(false),  // NOLINT
+                ptr_cases);
+  ok &= AddCase(new (std::nothrow) BufferPoolCase(true),  // NOLINT
+                ptr_cases);
+
+  const char* const kFormats[] = {"YUY2", "UYVY", "RGB24", "RGBA"};
+  const int kSizes[][2] = {{640, 360}, {1280, 720}, {1920, 1080}};
+  for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); ++f) {
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+      ok &= AddCase(new (std::nothrow) ConvertCase(  // NOLINT
+                        kFormats[f], kSizes[s][0], kSizes[s][1]),
+                    ptr_cases);
+    }
+  }
+
+  // VP8 speeds are negative for real time mode; VP9 uses 5 to 8 for live
+  // encoding.
+  const int kVp8Speeds[] = {-6, -12};
+  const int kVp9Speeds[] = {6, 8};
+  const int kThreadCounts[] = {1, 4};
+  for (size_t s = 0; s < 2; ++s) {
+    for (size_t t = 0; t < 2; ++t) {
+      ok &= AddCase(new (std::nothrow) EncodeCase(  // NOLINT
+                        webmlive::kVideoFormatVP8, kVp8Speeds[s],
+                        kThreadCounts[t]),
+                    ptr_cases);
+    }
+  }
+  for (size_t s = 0; s < 2; ++s) {
+    for (size_t t = 0; t < 2; ++t) {
+      ok &= AddCase(new (std::nothrow) EncodeCase(  // NOLINT
+                        webmlive::kVideoFormatVP9, kVp9Speeds[s],
+                        kThreadCounts[t]),
+                    ptr_cases);
+    }
+  }
+
+  ok &= AddCase(new (std::nothrow) VorbisCase(), ptr_cases);  // NOLINT
+  ok &= AddCase(new (std::nothrow) MuxCase(false), ptr_cases);  // NOLINT
+  ok &= AddCase(new (std::nothrow) MuxCase(true), ptr_cases);  // NOLINT
+
+  const int kSinkCounts[] = {1, 4, 16};
+  for (size_t i = 0; i < sizeof(kSinkCounts) / sizeof(kSinkCounts[0]); ++i) {
+    ok &= AddCase(new (std::nothrow) DataSinkCase(kSinkCounts[i]),  // NOLINT
+                  ptr_cases);
+  }
+  return ok;
+}
+
+// Runs |ptr_case| in growing batches until a batch takes at least
+// |min_time_ms|, and stores the rate of that batch in |ptr_result|. Returns
+// false when the case fails.
+bool RunCase(BenchmarkCase* ptr_case, int64 min_time_ms, Result* ptr_result) {
+  if (!ptr_case->Init()) {
+    return false;
+  }
+  const int64 min_time_us = min_time_ms * 1000;
+  int64 iterations = 1;
+  for (;;) {
+    const int64 start_time_us = webmlive::SteadyTimeUs();
+    if (!ptr_case->Run(iterations)) {
+      return false;
+    }
+    const int64 elapsed_us = webmlive::SteadyTimeUs() - start_time_us;
+    if (elapsed_us >= min_time_us) {
+      ptr_result->name = ptr_case->name();
+      ptr_result->iterations = iterations;
+      ptr_result->ns_per_op = elapsed_us * 1000.0 / iterations;
+      ptr_result->ops_per_second = iterations * 1000000.0 / elapsed_us;
+      return true;
+    }
+
+    // Aim the next batch at the minimum time, growing by at most 10x and at
+    // least 2x.
+    int64 next_iterations = iterations * 10;
+    if (elapsed_us > 0) {
+      next_iterations = std::min(
+          next_iterations,
+          static_cast<int64>(iterations * 1.2 * min_time_us / elapsed_us));
+    }
+    iterations = std::max(next_iterations, iterations * 2);
+  }
+}
+
+// Returns the libwebm version as "<major>.<minor>.<build>.<revision>".
+std::string LibwebmVersion() {
+  int32 major = 0, minor = 0, build = 0, revision = 0;
+  mkvmuxer::GetVersion(&major, &minor, &build, &revision);
+  std::ostringstream version;
+  version << major << "." << minor << "." << build << "." << revision;
+  return version.str();
+}
+
+// Returns the JSON report for |results|. Each result is on its own line so
+// that |ReadBaseline()| can parse reports without a JSON library.
+std::string FormatReport(const Options& options,
+                         const std::vector<Result>& results) {
+  std::ostringstream report;
+  report.setf(std::ios::fixed);
+  report.precision(1);
+  report << "{\n"
+         << "  \"version\": " << kReportVersion << ",\n"
+         << "  \"libvpx\": \"" << vpx_codec_version_str() << "\",\n"
+         << "  \"libyuv\": \"" << LIBYUV_VERSION << "\",\n"
+         << "  \"libwebm\": \"" << LibwebmVersion() << "\",\n"
+         << "  \"min_time_ms\": " << options.min_time_ms << ",\n"
+         << "  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    report << (i > 0 ? ",\n" : "\n")
+           << "    {\"name\": \"" << results[i].name << "\""
+           << ", \"iterations\": " << results[i].iterations
+           << ", \"ns_per_op\": " << results[i].ns_per_op
+           << ", \"ops_per_second\": " << results[i].ops_per_second << "}";
+  }
+  report << "\n  ]\n}\n";
+  return report.str();
+}
+
+// Reads the |ops_per_second| value of each case in the report in |file_name|
+// into |ptr_rates|. Returns false when the file cannot be read.
+bool ReadBaseline(const std::string& file_name,
+                  std::map<std::string, double>* ptr_rates) {
+  std::ifstream baseline(file_name.c_str());
+  if (!baseline) {
+    return false;
+  }
+  const std::string kNameKey = "\"name\": \"";
+  const std::string kRateKey = "\"ops_per_second\": ";
+  std::string line;
+  while (std::getline(baseline, line)) {
+    const size_t name_pos = line.find(kNameKey);
+    const size_t rate_pos = line.find(kRateKey);
+    if (name_pos == std::string::npos || rate_pos == std::string::npos) {
+      continue;
+    }
+    const size_t name_start = name_pos + kNameKey.length();
+    const size_t name_end = line.find('"', name_start);
+    if (name_end == std::string::npos) {
+      continue;
+    }
+    (*ptr_rates)[line.substr(name_start, name_end - name_start)] =
+        strtod(line.c_str() + rate_pos + kRateKey.length(), NULL);
+  }
+  return true;
+}
+
+// Prints a comparison of |results| against |baseline_rates| to stderr.
+// Returns the number of cases slower than the baseline by more than
+// |max_regression_percent|.
+int CompareToBaseline(const std::vector<Result>& results,
+                      const std::map<std::string, double>& baseline_rates,
+                      double max_regression_percent) {
+  int num_regressions = 0;
+  fprintf(stderr, "\n%-56s %14s %14s %9s\n", "case", "ops/s", "baseline",
+          "change");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    const std::map<std::string, double>::const_iterator baseline =
+        baseline_rates.find(result.name);
+    if (baseline == baseline_rates.end() || baseline->second <= 0) {
+      fprintf(stderr, "%-56s %14.1f %14s %9s\n", result.name.c_str(),
+              result.ops_per_second, "-", "new");
+      continue;
+    }
+    const double change_percent =
+        100.0 * (result.ops_per_second / baseline->second - 1.0);
+    const bool regressed = change_percent < -max_regression_percent;
+    if (regressed) {
+      ++num_regressions;
+    }
+    fprintf(stderr, "%-56s %14.1f %14.1f %+8.1f%%%s\n", result.name.c_str(),
+            result.ops_per_second, baseline->second, change_percent,
+            regressed ? " REGRESSION" : "");
+  }
+  return num_regressions;
+}
+
+// Returns true when |arg_index| + 1 is within |argc|.
+bool ArgHasValue(int arg_index, int argc) {
+  return arg_index + 1 < argc;
+}
+
+void Usage(const char** argv) {
+  printf("Usage: %s <args>\n", argv[0]);
+  printf("  Runs the encoder component microbenchmarks and prints a JSON\n");
+  printf("  report to stdout.\n");
+  printf("    -h | -? | --help               Show this message and exit.\n");
+  printf("    --list                         List case names and exit.\n");
+  printf("    --filter <substring>           Run only cases whose names\n");
+  printf("                                   contain the substring.\n");
+  printf("    --min_time <ms>                Minimum time per case.\n");
+  printf("                                   Default is 500.\n");
+  printf("    --output <file>                Write the report to a file\n");
+  printf("                                   instead of stdout.\n");
+  printf("    --baseline <file>              Compare against the report\n");
+  printf("                                   of an earlier run, and fail\n");
+  printf("                                   on regressions.\n");
+  printf("    --max_regression <percent>     Slowdown tolerated by\n");
+  printf("                                   --baseline. Default is 10.\n");
+}
+
+// Parses the command line into |ptr_options|. Returns false when the program
+// must exit.
+bool ParseCommandLine(int argc, const char** argv, Options* ptr_options) {
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("-?", argv[i]) ||
+        !strcmp("--help", argv[i])) {
+      Usage(argv);
+      return false;
+    } else if (!strcmp("--list", argv[i])) {
+      ptr_options->list_cases = true;
+    } else if (!strcmp("--filter", argv[i]) && ArgHasValue(i, argc)) {
+      ptr_options->filter = argv[++i];
+    } else if (!strcmp("--min_time", argv[i]) && ArgHasValue(i, argc)) {
+      ptr_options->min_time_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--output", argv[i]) && ArgHasValue(i, argc)) {
+      ptr_options->output_file = argv[++i];
+    } else if (!strcmp("--baseline", argv[i]) && ArgHasValue(i, argc)) {
+      ptr_options->baseline_file = argv[++i];
+    } else if (!strcmp("--max_regression", argv[i]) && ArgHasValue(i, argc)) {
+      ptr_options->max_regression_percent = strtod(argv[++i], NULL);
+    } else {
+      LOG(WARNING) << "argument unknown or unparseable: " << argv[i];
+    }
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+
+  // The components log at INFO level in their hot paths; keep logging out of
+  // the measurements.
+  FLAGS_minloglevel = google::GLOG_WARNING;
+
+  Options options;
+  if (!ParseCommandLine(argc, argv, &options)) {
+    return EXIT_SUCCESS;
+  }
+  if (options.min_time_ms <= 0) {
+    LOG(ERROR) << "Invalid --min_time value: " << options.min_time_ms;
+    return EXIT_FAILURE;
+  }
+
+  BenchmarkCaseList cases;
+  if (!CreateCases(&cases)) {
+    LOG(ERROR) << "Out of memory.";
+    return EXIT_FAILURE;
+  }
+
+  int exit_code = EXIT_SUCCESS;
+  std::vector<Result> results;
+  for (size_t i = 0; i < cases.size(); ++i) {
+    const std::string& name = cases[i]->name();
+    if (name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    if (options.list_cases) {
+      printf("%s\n", name.c_str());
+      continue;
+    }
+    fprintf(stderr, "%s...\n", name.c_str());
+    Result result;
+    if (!RunCase(cases[i].get(), options.min_time_ms, &result)) {
+      LOG(ERROR) << "case failed: " << name;
+      exit_code = EXIT_FAILURE;
+      continue;
+    }
+    results.push_back(result);
+
+    // Release encoder and muxer state before the next case runs.
+    cases[i].reset();
+  }
+  if (options.list_cases) {
+    return EXIT_SUCCESS;
+  }
+
+  const std::string report = FormatReport(options, results);
+  if (options.output_file.empty()) {
+    fwrite(report.data(), 1, report.length(), stdout);
+  } else {
+    std::ofstream output(options.output_file.c_str(), std::ios::binary);
+    if (!(output << report)) {
+      LOG(ERROR) << "cannot write report file: " << options.output_file;
+      exit_code = EXIT_FAILURE;
+    }
+  }
+
+  if (!options.baseline_file.empty()) {
+    std::map<std::string, double> baseline_rates;
+    if (!ReadBaseline(options.baseline_file, &baseline_rates)) {
+      LOG(ERROR) << "cannot read baseline file: " << options.baseline_file;
+      exit_code = EXIT_FAILURE;
+    } else if (CompareToBaseline(results, baseline_rates,
+                                 options.max_regression_percent) > 0) {
+      exit_code = EXIT_FAILURE;
+    }
+  }
+
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
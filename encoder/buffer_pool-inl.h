@@ -8,8 +8,13 @@
 #ifndef WEBMLIVE_ENCODER_BUFFER_POOL_INL_H_
 #define WEBMLIVE_ENCODER_BUFFER_POOL_INL_H_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/buffer_pool.h"
@@ -17,104 +22,446 @@
 
 namespace webmlive {
 
+// The fence pairs with the one in |Wait()|: either the waiter observes the
+// state published before |Notify()|, or |Notify()| observes the waiter.
+inline void BufferPoolSignal::Notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  condition_.notify_all();
+}
+
+template <typename Predicate>
+inline bool BufferPoolSignal::Wait(std::chrono::milliseconds timeout,
+                                   Predicate ready) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_waiters_.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  const bool is_ready = condition_.wait_for(lock, timeout, ready);
+  num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return is_ready;
+}
+
 template <class Type>
 inline BufferPool<Type>::~BufferPool() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  while (!inactive_buffers_.empty()) {
-    delete inactive_buffers_.front();
-    inactive_buffers_.pop();
+  for (size_t i = 0; i < ring_.size(); ++i) {
+    delete ring_[i];
+  }
+  if (ptr_lease_ && !lease_in_ring_) {
+    delete ptr_lease_;
   }
-  while (!active_buffers_.empty()) {
-    delete active_buffers_.front();
-    active_buffers_.pop();
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  while (!overflow_buffers_.empty()) {
+    delete overflow_buffers_.front();
+    overflow_buffers_.pop();
+  }
+  while (!spare_buffers_.empty()) {
+    delete spare_buffers_.front();
+    spare_buffers_.pop();
   }
 }
 
-// Obtains lock and populates |inactive_buffers_| with |Type| pointers.
 template <class Type>
 inline int BufferPool<Type>::Init(bool allow_growth, int num_buffers) {
-  if (num_buffers <= 0) {
+  return Init(allow_growth, num_buffers, 0);
+}
+
+template <class Type>
+inline int BufferPool<Type>::Init(bool allow_growth,
+                                  int num_buffers,
+                                  int32 buffer_capacity) {
+  BufferPoolOptions options;
+  options.drop_policy = allow_growth ? kNeverDropBuffers : kDropNewestBuffer;
+  options.num_buffers = num_buffers;
+  options.buffer_capacity = buffer_capacity;
+  return Init(options);
+}
+
+// Populates |ring_| with |num_buffers| + 1 |Type| pointers. The extra position
+// allows the ring to hold |num_buffers| active buffer objects. Adds one more
+// position for |kDropOldestBuffer| to hold the newest buffer object until the
+// consumer drops the oldest.
+template <class Type>
+inline int BufferPool<Type>::Init(const BufferPoolOptions& options) {
+  if (options.num_buffers <= 0 || options.buffer_capacity < 0 ||
+      options.max_overflow_buffers < 0) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!inactive_buffers_.empty() || !active_buffers_.empty()) {
+  if (options.drop_policy != kDropNewestBuffer &&
+      options.drop_policy != kDropOldestBuffer &&
+      options.drop_policy != kDecimateBuffers &&
+      options.drop_policy != kNeverDropBuffers) {
+    return kInvalidArg;
+  }
+  if (!ring_.empty()) {
     return kAlreadyInitialized;
   }
-  for (int i = 0; i < num_buffers; ++i) {
-    Type* const ptr_buffer = new (std::nothrow) Type;  // NOLINT
-    if (!ptr_buffer) {
+  const int num_positions = options.drop_policy == kDropOldestBuffer ?
+      options.num_buffers + 2 : options.num_buffers + 1;
+  ring_.assign(num_positions, NULL);
+  for (size_t i = 0; i < ring_.size(); ++i) {
+    ring_[i] = new (std::nothrow) Type;  // NOLINT
+    if (!ring_[i]) {
+      return kNoMemory;
+    }
+    if (options.buffer_capacity > 0 &&
+        ring_[i]->Reserve(options.buffer_capacity)) {
       return kNoMemory;
     }
-    inactive_buffers_.push(ptr_buffer);
   }
-  allow_growth_ = allow_growth;
+  drop_policy_ = options.drop_policy;
+  max_overflow_buffers_ = options.max_overflow_buffers;
+  num_buffers_ = options.num_buffers;
+  buffer_capacity_ = options.buffer_capacity;
+  read_index_.store(0, std::memory_order_relaxed);
+  write_index_.store(0, std::memory_order_relaxed);
   return kSuccess;
 }
 
-// Obtains lock, copies |ptr_buffer| data into front buffer object from
-// |inactive_buffers_|, and moves the filled buffer object into
-// |active_buffers_|.
+template <class Type>
+inline int BufferPool<Type>::AdmitBuffer(bool* ptr_use_overflow,
+                                         bool* ptr_drop_oldest) {
+  *ptr_use_overflow = false;
+  *ptr_drop_oldest = false;
+
+  // Buffer objects must not be written to |ring_| while older buffer objects
+  // remain in |overflow_buffers_|. Only the producer increments
+  // |overflow_count_|, so a zero value cannot become non-zero behind its back.
+  const int32 overflow_count = overflow_count_.load(std::memory_order_acquire);
+  if (overflow_count > 0) {
+    if (max_overflow_buffers_ > 0 && overflow_count >= max_overflow_buffers_) {
+      num_dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+      return kFull;
+    }
+    *ptr_use_overflow = true;
+    return kSuccess;
+  }
+
+  const int32 write_index = write_index_.load(std::memory_order_relaxed);
+  const int32 read_index = read_index_.load(std::memory_order_acquire);
+  const bool ring_full = NextIndex(write_index) == read_index;
+  int32 num_active = write_index - read_index;
+  if (num_active < 0) {
+    num_active += static_cast<int32>(ring_.size());
+  }
+  num_active -= pending_drops_.load(std::memory_order_acquire);
+
+  switch (drop_policy_) {
+    case kDropNewestBuffer:
+      break;
+    case kDropOldestBuffer:
+      *ptr_drop_oldest = !ring_full && num_active >= num_buffers_;
+      break;
+    case kDecimateBuffers:
+      if (ring_full) {
+        break;
+      }
+      if (num_active < std::max(num_buffers_ / 2, 1)) {
+        decimate_phase_ = false;
+        break;
+      }
+      decimate_phase_ = !decimate_phase_;
+      if (decimate_phase_) {
+        num_decimated_.fetch_add(1, std::memory_order_relaxed);
+        return kDropped;
+      }
+      break;
+    case kNeverDropBuffers:
+      *ptr_use_overflow = ring_full;
+      return kSuccess;
+  }
+  if (ring_full) {
+    num_dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+    return kFull;
+  }
+  return kSuccess;
+}
+
+// Copies |ptr_buffer| data into the buffer object at |write_index_|, and then
+// publishes it by advancing |write_index_|. Falls back to |CommitOverflow()|
+// when the ring is full or overflow buffer objects are waiting.
 template <class Type>
 inline int BufferPool<Type>::Commit(Type* ptr_buffer) {
   if (!ptr_buffer || !ptr_buffer->buffer()) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (inactive_buffers_.empty()) {
-    if (allow_growth_) {
-      Type* const ptr_buffer = new (std::nothrow) Type;  // NOLINT
-      if (!ptr_buffer) {
-        return kNoMemory;
-      }
-      inactive_buffers_.push(ptr_buffer);
-    } else {
-      return kFull;
-    }
+  if (ring_.empty()) {
+    return kNoBuffers;
+  }
+  if (ptr_lease_) {
+    return kLeaseError;
+  }
+
+  bool use_overflow = false;
+  bool drop_oldest = false;
+  const int status = AdmitBuffer(&use_overflow, &drop_oldest);
+  if (status) {
+    return status;
+  }
+  if (use_overflow) {
+    return CommitOverflow(ptr_buffer);
   }
 
-  // Copy user data into front buffer object from |inactive_buffers_|.
-  Type* const ptr_pool_buffer = inactive_buffers_.front();
+  // Copy user data into the free buffer object, and then make it visible to
+  // the consumer.
+  const int32 write_index = write_index_.load(std::memory_order_relaxed);
+  if (Exchange(ptr_buffer, ring_[write_index])) {
+    return kNoMemory;
+  }
+  write_index_.store(NextIndex(write_index), std::memory_order_release);
+  if (drop_oldest) {
+    pending_drops_.fetch_add(1, std::memory_order_release);
+  }
+  num_committed_.fetch_add(1, std::memory_order_relaxed);
+  ptr_signal_->Notify();
+  return kSuccess;
+}
+
+// Obtains lock, copies |ptr_buffer| data into a spare or newly allocated buffer
+// object, and pushes it into |overflow_buffers_|.
+template <class Type>
+inline int BufferPool<Type>::CommitOverflow(Type* ptr_buffer) {
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  Type* const ptr_pool_buffer = AcquireOverflowBuffer();
+  if (!ptr_pool_buffer) {
+    return kNoMemory;
+  }
   if (Exchange(ptr_buffer, ptr_pool_buffer)) {
+    spare_buffers_.push(ptr_pool_buffer);
     return kNoMemory;
   }
+  overflow_buffers_.push(ptr_pool_buffer);
+  overflow_count_.store(static_cast<int32>(overflow_buffers_.size()),
+                        std::memory_order_release);
+  num_committed_.fetch_add(1, std::memory_order_relaxed);
+  num_overflowed_.fetch_add(1, std::memory_order_relaxed);
+  ptr_signal_->Notify();
+  return kSuccess;
+}
+
+template <class Type>
+inline Type* BufferPool<Type>::AcquireOverflowBuffer() {
+  if (!spare_buffers_.empty()) {
+    Type* const ptr_pool_buffer = spare_buffers_.front();
+    spare_buffers_.pop();
+    return ptr_pool_buffer;
+  }
+  Type* const ptr_pool_buffer = new (std::nothrow) Type;  // NOLINT
+  if (!ptr_pool_buffer) {
+    return NULL;
+  }
+  if (buffer_capacity_ > 0 && ptr_pool_buffer->Reserve(buffer_capacity_)) {
+    delete ptr_pool_buffer;
+    return NULL;
+  }
+  return ptr_pool_buffer;
+}
 
-  // Move the now active buffer object into the active queue.
-  inactive_buffers_.pop();
-  active_buffers_.push(ptr_pool_buffer);
+// Leases the buffer object at |write_index_| when |AdmitBuffer()| accepts the
+// buffer for |ring_|, or an overflow buffer object when it selects overflow
+// storage.
+template <class Type>
+inline int BufferPool<Type>::AcquireWriteBuffer(Type** ptr_buffer) {
+  if (!ptr_buffer) {
+    return kInvalidArg;
+  }
+  if (ring_.empty()) {
+    return kNoBuffers;
+  }
+  if (ptr_lease_) {
+    return kLeaseError;
+  }
+  bool use_overflow = false;
+  const int status = AdmitBuffer(&use_overflow, &lease_drops_oldest_);
+  if (status) {
+    return status;
+  }
+  if (!use_overflow) {
+    ptr_lease_ = ring_[write_index_.load(std::memory_order_relaxed)];
+    lease_in_ring_ = true;
+    *ptr_buffer = ptr_lease_;
+    return kSuccess;
+  }
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  ptr_lease_ = AcquireOverflowBuffer();
+  if (!ptr_lease_) {
+    return kNoMemory;
+  }
+  lease_in_ring_ = false;
+  *ptr_buffer = ptr_lease_;
   return kSuccess;
 }
 
-// Obtains lock, copies front buffer object from |active_buffers_| to
-// |ptr_buffer|, and moves the consumed buffer object back into
-// |inactive_buffers_|.
+template <class Type>
+inline int BufferPool<Type>::PublishWriteBuffer() {
+  if (!ptr_lease_) {
+    return kLeaseError;
+  }
+  if (!ptr_lease_->buffer()) {
+    CancelWriteBuffer();
+    return kInvalidArg;
+  }
+  if (lease_in_ring_) {
+    const int32 write_index = write_index_.load(std::memory_order_relaxed);
+    write_index_.store(NextIndex(write_index), std::memory_order_release);
+    if (lease_drops_oldest_) {
+      pending_drops_.fetch_add(1, std::memory_order_release);
+    }
+  } else {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_buffers_.push(ptr_lease_);
+    overflow_count_.store(static_cast<int32>(overflow_buffers_.size()),
+                          std::memory_order_release);
+    num_overflowed_.fetch_add(1, std::memory_order_relaxed);
+  }
+  ptr_lease_ = NULL;
+  lease_drops_oldest_ = false;
+  num_committed_.fetch_add(1, std::memory_order_relaxed);
+  ptr_signal_->Notify();
+  return kSuccess;
+}
+
+template <class Type>
+inline void BufferPool<Type>::CancelWriteBuffer() {
+  if (!ptr_lease_) {
+    return;
+  }
+  if (!lease_in_ring_) {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    spare_buffers_.push(ptr_lease_);
+  }
+  ptr_lease_ = NULL;
+  lease_drops_oldest_ = false;
+}
+
+// Copies the buffer object at |read_index_| to |ptr_buffer|, and then returns
+// the position to the producer by advancing |read_index_|. Falls back to
+// |DecommitOverflow()| when the oldest active buffer object is in overflow
+// storage.
 template <class Type>
 inline int BufferPool<Type>::Decommit(Type* ptr_buffer) {
   if (!ptr_buffer) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (active_buffers_.empty()) {
+  if (ptr_borrowed_) {
+    return kLeaseError;
+  }
+  ApplyPendingDrops();
+  const ActiveStorage storage = OldestActiveStorage();
+  if (storage == kNoActiveBuffer) {
     return kEmpty;
   }
+  if (storage == kActiveInOverflow) {
+    return DecommitOverflow(ptr_buffer);
+  }
 
   // Put active buffer data in user buffer.
-  Type* const ptr_active_buffer = active_buffers_.front();
+  const int32 read_index = read_index_.load(std::memory_order_relaxed);
+  if (Exchange(ring_[read_index], ptr_buffer)) {
+    return kNoMemory;
+  }
+  read_index_.store(NextIndex(read_index), std::memory_order_release);
+  return kSuccess;
+}
+
+template <class Type>
+inline int BufferPool<Type>::Decommit(Type* ptr_buffer,
+                                      std::chrono::milliseconds timeout) {
+  if (!ptr_buffer) {
+    return kInvalidArg;
+  }
+  if (!WaitForActive(timeout)) {
+    return kEmpty;
+  }
+  return Decommit(ptr_buffer);
+}
+
+template <class Type>
+inline bool BufferPool<Type>::WaitForActive(
+    std::chrono::milliseconds timeout) {
+  if (!IsEmpty()) {
+    return true;
+  }
+  return ptr_signal_->Wait(timeout, [this]() { return !IsEmpty(); });
+}
+
+// Obtains lock, copies front buffer object from |overflow_buffers_| to
+// |ptr_buffer|, and moves the consumed buffer object into |spare_buffers_|.
+template <class Type>
+inline int BufferPool<Type>::DecommitOverflow(Type* ptr_buffer) {
+  if (overflow_count_.load(std::memory_order_acquire) == 0) {
+    return kEmpty;
+  }
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  if (overflow_buffers_.empty()) {
+    return kEmpty;
+  }
+  Type* const ptr_active_buffer = overflow_buffers_.front();
   if (Exchange(ptr_active_buffer, ptr_buffer)) {
     return kNoMemory;
   }
+  overflow_buffers_.pop();
+  spare_buffers_.push(ptr_active_buffer);
+  overflow_count_.store(static_cast<int32>(overflow_buffers_.size()),
+                        std::memory_order_release);
+  return kSuccess;
+}
 
-  // Put the now inactive buffer back in the pool.
-  active_buffers_.pop();
-  inactive_buffers_.push(ptr_active_buffer);
+template <class Type>
+inline int BufferPool<Type>::BorrowActiveBuffer(Type** ptr_buffer) {
+  if (!ptr_buffer) {
+    return kInvalidArg;
+  }
+  if (ptr_borrowed_) {
+    return kLeaseError;
+  }
+  ApplyPendingDrops();
+  const ActiveStorage storage = OldestActiveStorage();
+  if (storage == kActiveInRing) {
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    ptr_borrowed_ = ring_[read_index];
+    *ptr_buffer = ptr_borrowed_;
+    return kSuccess;
+  }
+  if (storage == kNoActiveBuffer) {
+    return kEmpty;
+  }
+
+  // The producer only pushes to the back of |overflow_buffers_|, so the front
+  // buffer object is safe to use after the lock is released.
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  if (overflow_buffers_.empty()) {
+    return kEmpty;
+  }
+  ptr_borrowed_ = overflow_buffers_.front();
+  *ptr_buffer = ptr_borrowed_;
   return kSuccess;
 }
 
+// The borrowed buffer object is always the oldest active buffer object, so
+// releasing it is the same as dropping it.
+template <class Type>
+inline void BufferPool<Type>::ReleaseActiveBuffer() {
+  if (ptr_borrowed_) {
+    DropActiveBuffer();
+  }
+}
+
 template <class Type>
 inline void BufferPool<Type>::Flush() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  while (!active_buffers_.empty()) {
-    inactive_buffers_.push(active_buffers_.front());
-    active_buffers_.pop();
+  ptr_borrowed_ = NULL;
+  pending_drops_.store(0, std::memory_order_relaxed);
+  read_index_.store(write_index_.load(std::memory_order_acquire),
+                    std::memory_order_release);
+  if (overflow_count_.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    while (!overflow_buffers_.empty()) {
+      spare_buffers_.push(overflow_buffers_.front());
+      overflow_buffers_.pop();
+    }
+    overflow_count_.store(0, std::memory_order_release);
   }
 }
 
@@ -139,10 +486,20 @@ inline int BufferPool<Type>::ActiveBufferTimestamp(int64* ptr_timestamp) {
   if (!ptr_timestamp) {
     return kInvalidArg;
   }
+  ApplyPendingDrops();
+  const ActiveStorage storage = OldestActiveStorage();
+  if (storage == kActiveInRing) {
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    *ptr_timestamp = ring_[read_index]->timestamp();
+    return kSuccess;
+  }
+  if (storage == kNoActiveBuffer) {
+    return kEmpty;
+  }
   int status = kEmpty;
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!active_buffers_.empty()) {
-    *ptr_timestamp = active_buffers_.front()->timestamp();
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  if (!overflow_buffers_.empty()) {
+    *ptr_timestamp = overflow_buffers_.front()->timestamp();
     status = kSuccess;
   }
   return status;
@@ -150,17 +507,77 @@ inline int BufferPool<Type>::ActiveBufferTimestamp(int64* ptr_timestamp) {
 
 template <class Type>
 inline void BufferPool<Type>::DropActiveBuffer() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!active_buffers_.empty()) {
-    inactive_buffers_.push(active_buffers_.front());
-    active_buffers_.pop();
+  ptr_borrowed_ = NULL;
+  const ActiveStorage storage = OldestActiveStorage();
+  if (storage == kActiveInRing) {
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    read_index_.store(NextIndex(read_index), std::memory_order_release);
+    return;
+  }
+  if (storage == kActiveInOverflow) {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (!overflow_buffers_.empty()) {
+      spare_buffers_.push(overflow_buffers_.front());
+      overflow_buffers_.pop();
+    }
+    overflow_count_.store(static_cast<int32>(overflow_buffers_.size()),
+                          std::memory_order_release);
   }
 }
 
 template <class Type>
 inline bool BufferPool<Type>::IsEmpty() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return active_buffers_.empty();
+  return RingEmpty() && overflow_count_.load(std::memory_order_acquire) == 0;
+}
+
+template <class Type>
+inline bool BufferPool<Type>::IsFull() const {
+  const int32 overflow_count = overflow_count_.load(std::memory_order_acquire);
+  if (overflow_count > 0 || drop_policy_ == kNeverDropBuffers) {
+    return max_overflow_buffers_ > 0 &&
+           overflow_count >= max_overflow_buffers_;
+  }
+  const int32 write_index = write_index_.load(std::memory_order_relaxed);
+  return NextIndex(write_index) == read_index_.load(std::memory_order_acquire);
+}
+
+template <class Type>
+inline BufferPoolStats BufferPool<Type>::GetStats() const {
+  BufferPoolStats stats;
+  stats.num_committed = num_committed_.load(std::memory_order_relaxed);
+  stats.num_overflowed = num_overflowed_.load(std::memory_order_relaxed);
+  stats.num_dropped_newest =
+      num_dropped_newest_.load(std::memory_order_relaxed);
+  stats.num_dropped_oldest =
+      num_dropped_oldest_.load(std::memory_order_relaxed);
+  stats.num_decimated = num_decimated_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+// Advances |read_index_| past the requested number of buffer objects before
+// subtracting them from |pending_drops_|, so the producer never sees the
+// pool as fuller than it is. Requests that would drop the newest active
+// buffer object are discarded; they can only occur when a drop was requested
+// and the consumer read the buffer objects in the meantime.
+template <class Type>
+inline void BufferPool<Type>::ApplyPendingDrops() {
+  const int32 requested = pending_drops_.load(std::memory_order_acquire);
+  if (requested == 0 || ptr_borrowed_) {
+    return;
+  }
+  const int32 write_index = write_index_.load(std::memory_order_acquire);
+  int32 read_index = read_index_.load(std::memory_order_relaxed);
+  int32 num_active = write_index - read_index;
+  if (num_active < 0) {
+    num_active += static_cast<int32>(ring_.size());
+  }
+  const int32 num_drops = std::min(requested, std::max(num_active - 1, 0));
+  for (int32 i = 0; i < num_drops; ++i) {
+    read_index = NextIndex(read_index);
+  }
+  read_index_.store(read_index, std::memory_order_release);
+  pending_drops_.fetch_sub(requested, std::memory_order_release);
+  num_dropped_oldest_.fetch_add(num_drops, std::memory_order_relaxed);
 }
 
 }  // namespace webmlive
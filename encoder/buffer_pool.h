@@ -8,88 +8,429 @@
 #ifndef WEBMLIVE_ENCODER_BUFFER_POOL_H_
 #define WEBMLIVE_ENCODER_BUFFER_POOL_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
 
 namespace webmlive {
 
+// Behavior of |BufferPool::Commit()| and |BufferPool::AcquireWriteBuffer()|
+// when the consumer falls behind the producer.
+enum BufferDropPolicy {
+  // Drop the buffer being committed when the pool is full.
+  kDropNewestBuffer = 0,
+
+  // Drop the oldest active buffer object to make room for the buffer being
+  // committed. The consumer performs the drop the next time it reads from the
+  // pool; until then the pool holds one buffer object more than
+  // |BufferPoolOptions::num_buffers|. Falls back to dropping the newest
+  // buffer when the consumer has not read from the pool since the last drop.
+  kDropOldestBuffer = 1,
+
+  // Once the pool is half full drop every other committed buffer, so that
+  // drops are spread evenly in time instead of arriving as a run of
+  // consecutive drops when the pool fills. Drops the newest buffer when the
+  // pool is full.
+  kDecimateBuffers = 2,
+
+  // Never drop while overflow storage is available: buffers committed while
+  // the pool is full are stored in overflow buffer objects. Overflow storage
+  // is bounded by |BufferPoolOptions::max_overflow_buffers|, after which the
+  // newest buffer is dropped.
+  kNeverDropBuffers = 3,
+};
+
+struct BufferPoolOptions {
+  static const int kDefaultBufferCount = 4;
+  BufferPoolOptions()
+      : drop_policy(kDropNewestBuffer),
+        num_buffers(kDefaultBufferCount),
+        buffer_capacity(0),
+        max_overflow_buffers(0) {}
+
+  BufferDropPolicy drop_policy;
+
+  // Number of buffer objects the pool holds without dropping or growing.
+  int num_buffers;
+
+  // Capacity in bytes preallocated in each buffer object using
+  // |Type::Reserve()|. 0 disables preallocation.
+  int32 buffer_capacity;
+
+  // Maximum number of overflow buffer objects when |drop_policy| is
+  // |kNeverDropBuffers|. 0 means unbounded.
+  int max_overflow_buffers;
+};
+
+// Drop and growth counters maintained by |BufferPool|. All counts are numbers
+// of buffers.
+struct BufferPoolStats {
+  BufferPoolStats()
+      : num_committed(0),
+        num_overflowed(0),
+        num_dropped_newest(0),
+        num_dropped_oldest(0),
+        num_decimated(0) {}
+
+  // Buffers made available to the consumer.
+  int64 num_committed;
+
+  // Committed buffers stored in overflow buffer objects.
+  int64 num_overflowed;
+
+  // Buffers dropped by the producer because the pool was full.
+  int64 num_dropped_newest;
+
+  // Active buffers dropped by the consumer under |kDropOldestBuffer|.
+  int64 num_dropped_oldest;
+
+  // Buffers dropped by |kDecimateBuffers| before the pool was full.
+  int64 num_decimated;
+};
+
+// Wakes threads waiting for buffer objects to become active. A signal may be
+// shared by several |BufferPool|s so that one consumer thread can wait for
+// input from all of them.
+class BufferPoolSignal {
+ public:
+  BufferPoolSignal() : num_waiters_(0) {}
+
+  // Wakes all threads blocked in |Wait()|. Does not touch |mutex_| when no
+  // thread is waiting.
+  void Notify();
+
+  // Blocks until |ready()| returns true or |timeout| expires. Returns the
+  // final value of |ready()|. |ready| is re-evaluated each time |Notify()| is
+  // called.
+  template <typename Predicate>
+  bool Wait(std::chrono::milliseconds timeout, Predicate ready);
+
+ private:
+  std::atomic<int32> num_waiters_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BufferPoolSignal);
+};
+
 // Buffer pooling object used to pass data between threads. In order to be
 // managed by this class Buffer objects must implement the following methods:
 //   uint8* buffer() const;
 //   int64 timestamp() const;
 //   int Clone(Type*);
 //   int Swap(Type*);
+//   int Reserve(int32);
+//
+// Threading notes:
+// - The pool is a single-producer/single-consumer ring. Exactly one thread may
+//   call |Commit()|, and exactly one other thread may call the remaining
+//   methods. |Init()| must complete before either thread uses the pool.
+// - The ring is sized by |Init()|. Moving buffer objects through the ring is
+//   wait-free: the producer and consumer communicate only through
+//   |read_index_| and |write_index_|.
+// - What happens when the consumer falls behind is controlled by the
+//   |BufferDropPolicy| passed to |Init()|. Drop counts are available from
+//   |GetStats()|.
+// - When the policy is |kNeverDropBuffers| and the ring is full, buffer
+//   objects are stored in |overflow_buffers_| instead of being dropped. The
+//   overflow queue is protected by |overflow_mutex_|, and is used only until
+//   the consumer catches up.
+// - Under |kDropOldestBuffer| the producer cannot touch active buffer
+//   objects, so it asks the consumer to drop them through |pending_drops_|.
+// - The producer may call |AcquireWriteBuffer()| and |PublishWriteBuffer()|
+//   in place of |Commit()| to fill pool storage directly and avoid a copy.
+// - The consumer may call |BorrowActiveBuffer()| and |ReleaseActiveBuffer()|
+//   in place of |Decommit()| to read pool storage in place.
+// - The consumer may block in |WaitForActive()| or the timed |Decommit()|
+//   instead of polling. |Commit()| wakes it through |ptr_signal_|.
 template <class Type>
 class BufferPool {
  public:
   enum {
+    // |AcquireWriteBuffer()| called while a lease is outstanding, or
+    // |PublishWriteBuffer()| called without one. Also returned by
+    // |BorrowActiveBuffer()| and |Decommit()| while a buffer object is
+    // borrowed.
+    kLeaseError = -5,
     // |Init()| called more than once.
     kAlreadyInitialized = -4,
-    // |Push| called before |Init|.
+    // |Commit()| called before |Init()|.
     kNoBuffers = -3,
     kNoMemory = -2,
     kInvalidArg = -1,
     kSuccess = 0,
 
-    // No buffer objects waiting in |active_buffers_|.
+    // No buffer objects waiting to be read.
     kEmpty = 1,
 
-    // No buffer objects available in |inactive_buffers_|.
+    // No buffer objects available for writing.
     kFull = 2,
+
+    // Buffer dropped by |kDecimateBuffers| to relieve pressure on the pool.
+    kDropped = 3,
   };
 
-  static const int32 kDefaultBufferCount = 4;
-  BufferPool() : allow_growth_(false) {}
+  static const int32 kDefaultBufferCount =
+      BufferPoolOptions::kDefaultBufferCount;
+  BufferPool()
+      : drop_policy_(kDropNewestBuffer),
+        max_overflow_buffers_(0),
+        num_buffers_(0),
+        decimate_phase_(false),
+        buffer_capacity_(0),
+        read_index_(0),
+        write_index_(0),
+        pending_drops_(0),
+        ptr_lease_(NULL),
+        lease_in_ring_(false),
+        lease_drops_oldest_(false),
+        ptr_borrowed_(NULL),
+        overflow_count_(0),
+        num_committed_(0),
+        num_overflowed_(0),
+        num_dropped_newest_(0),
+        num_dropped_oldest_(0),
+        num_decimated_(0),
+        ptr_signal_(&signal_) {}
   ~BufferPool();
 
-  // Allocates |num_buffers| buffer objects, pushes them into
-  // |inactive_buffers_|, and returns |kSuccess|. Returns |kInvalidArg| when
-  // |num_buffers| is <= 0. Returns |kAlreadyInitialized| when |Init()| has
-  // already been called.
+  // Allocates |num_buffers| buffer objects, stores them in |ring_|, and
+  // returns |kSuccess|. Returns |kInvalidArg| when |num_buffers| is <= 0.
+  // Returns |kAlreadyInitialized| when |Init()| has already been called.
+  // |allow_growth| selects |kNeverDropBuffers| with unbounded overflow
+  // storage; otherwise the pool uses |kDropNewestBuffer|.
   int Init(bool allow_growth, int num_buffers);
 
-  // Grabs a buffer object pointer from |inactive_buffers_|, copies the data
-  // from |ptr_buffer|, and pushes it into |active_buffers_|. Returns |kSuccess|
-  // when able to store the data. Returns |kFull| when |inactive_buffers_| is
-  // empty AND |allow_growth_| is false. Avoids copy using |Type::Swap| whenever
-  // possible.
+  // Behaves as |Init()| above, and preallocates |buffer_capacity| bytes of
+  // storage in each buffer object using |Type::Reserve()|. Buffer objects
+  // allocated later because |allow_growth| is true are preallocated as well.
+  // Once every buffer object has storage |Commit()| and |Decommit()| move
+  // data using |Type::Swap()| and never allocate, provided the consumer's
+  // buffer object also has storage.
+  int Init(bool allow_growth, int num_buffers, int32 buffer_capacity);
+
+  // Behaves as |Init()| above using the drop policy and limits in |options|.
+  // Returns |kInvalidArg| when |options| contains a negative or unknown value.
+  int Init(const BufferPoolOptions& options);
+
+  // Copies the data from |ptr_buffer| into the next free buffer object in
+  // |ring_| and makes it available to the consumer. Returns |kSuccess| when
+  // able to store the data. Returns |kFull| when the drop policy drops the
+  // buffer because the pool is full, and |kDropped| when |kDecimateBuffers|
+  // drops it early. Avoids copy using |Type::Swap| whenever possible.
+  // Producer thread only.
   int Commit(Type* ptr_buffer);
 
-  // Grabs a buffer object from |active_buffers_| and copies it to |ptr_buffer|.
-  // Returns |kSuccess| when able to copy the buffer. Returns |kEmpty| when
-  // |active_buffers_| contains no buffer objects.
+  // Leases the next free buffer object to the producer, writes its address to
+  // |ptr_buffer|, and returns |kSuccess|. The buffer object remains owned by
+  // the pool, and is invisible to the consumer until |PublishWriteBuffer()|
+  // is called. Returns |kFull| or |kDropped| under the same conditions as
+  // |Commit()|.
+  // |Commit()| must not be called while a lease is outstanding. Producer
+  // thread only.
+  int AcquireWriteBuffer(Type** ptr_buffer);
+
+  // Makes the buffer object leased by |AcquireWriteBuffer()| available to the
+  // consumer and returns |kSuccess|. Returns |kInvalidArg| and cancels the
+  // lease when the leased buffer object has no storage. Producer thread only.
+  int PublishWriteBuffer();
+
+  // Returns the leased buffer object to the pool without publishing it.
+  // Producer thread only.
+  void CancelWriteBuffer();
+
+  // Copies the oldest active buffer object to |ptr_buffer|. Returns |kSuccess|
+  // when able to copy the buffer. Returns |kEmpty| when the pool contains no
+  // active buffer objects. Returns |kLeaseError| while a buffer object is
+  // borrowed. Consumer thread only.
   int Decommit(Type* ptr_buffer);
 
-  // Drops all queued buffer objects by moving them all from |active_buffers_|
-  // to |inactive_buffers_|.
+  // Waits up to |timeout| for an active buffer object, and then behaves as
+  // |Decommit()| above. Returns |kEmpty| when |timeout| expires. Consumer
+  // thread only.
+  int Decommit(Type* ptr_buffer, std::chrono::milliseconds timeout);
+
+  // Blocks until the pool contains an active buffer object or |timeout|
+  // expires. Returns true when an active buffer object is available. Consumer
+  // thread only.
+  bool WaitForActive(std::chrono::milliseconds timeout);
+
+  // Writes the address of the oldest active buffer object to |ptr_buffer| and
+  // returns |kSuccess|. The buffer object remains the oldest active buffer
+  // object, and the producer cannot reuse it, until |ReleaseActiveBuffer()| is
+  // called. Returns |kEmpty| when the pool contains no active buffer objects.
+  // Consumer thread only.
+  int BorrowActiveBuffer(Type** ptr_buffer);
+
+  // Returns the buffer object obtained from |BorrowActiveBuffer()| to the
+  // producer. Consumer thread only.
+  void ReleaseActiveBuffer();
+
+  // Drops all active buffer objects, including a borrowed buffer object.
+  // Consumer thread only.
   void Flush();
 
   // Writes timestamp of buffer available in next call to |Decommit()| to
   // |ptr_timestamp| and returns |kSuccess|. Returns |kEmpty| when there are no
-  // buffers to read in |active_buffers_|. Returns |kInvalidArg| when
-  // |ptr_timestamp| is NULL.
+  // buffers to read. Returns |kInvalidArg| when |ptr_timestamp| is NULL.
+  // Consumer thread only.
   int ActiveBufferTimestamp(int64* ptr_timestamp);
 
-  // Drops front buffer from |active_buffers_| by moving it back into
-  // |inactive_buffers_|.
+  // Drops the oldest active buffer object. Releases the buffer object when it
+  // is borrowed. Consumer thread only.
   void DropActiveBuffer();
 
-  // Returns true when |active_buffers_| is empty.
+  // Returns true when the pool contains no active buffer objects.
   bool IsEmpty() const;
 
+  // Returns true when the pool is at its size limit: |Commit()| would drop
+  // the buffer under |kDropNewestBuffer|, or return |kFull| under
+  // |kNeverDropBuffers|. Producer thread only.
+  bool IsFull() const;
+
+  // Returns a snapshot of the drop and growth counters. May be called from
+  // any thread.
+  BufferPoolStats GetStats() const;
+
+  // Replaces the signal notified by |Commit()|. Used to share one signal
+  // between pools read by the same consumer thread. Must be called before
+  // the producer and consumer threads start using the pool.
+  void set_signal(BufferPoolSignal* ptr_signal) {
+    ptr_signal_ = ptr_signal ? ptr_signal : &signal_;
+  }
+
  private:
   // Moves or copies |ptr_source| to |ptr_target| using |Type::Swap| or
   // |Type::Clone| based on presence of non-NULL buffer pointer in
   // |ptr_target|.
   int Exchange(Type* ptr_source, Type* ptr_target);
 
-  bool allow_growth_;
-  mutable std::mutex mutex_;
-  std::queue<Type*> inactive_buffers_;
-  std::queue<Type*> active_buffers_;
+  // Returns the ring position that follows |index|.
+  int32 NextIndex(int32 index) const {
+    return (index + 1 == static_cast<int32>(ring_.size())) ? 0 : index + 1;
+  }
+
+  // Returns true when |ring_| contains no active buffer objects.
+  bool RingEmpty() const {
+    return read_index_.load(std::memory_order_acquire) ==
+           write_index_.load(std::memory_order_acquire);
+  }
+
+  // Storage holding the oldest active buffer object.
+  enum ActiveStorage {
+    kNoActiveBuffer,
+    kActiveInRing,
+    kActiveInOverflow,
+  };
+
+  // Returns the storage holding the oldest active buffer object. Loads
+  // |overflow_count_| before checking |ring_|: the producer stops writing to
+  // |ring_| once overflow buffer objects are waiting, so an empty ring seen
+  // after a non-zero count stays empty until the consumer drains the overflow
+  // queue. Checking the ring first would let the producer fill the ring and
+  // spill into overflow between the two loads, and the consumer would then
+  // read a newer overflow buffer object ahead of older ones in the ring.
+  // Consumer thread only.
+  ActiveStorage OldestActiveStorage() const {
+    const bool overflow_waiting =
+        overflow_count_.load(std::memory_order_acquire) > 0;
+    if (!RingEmpty()) {
+      return kActiveInRing;
+    }
+    return overflow_waiting ? kActiveInOverflow : kNoActiveBuffer;
+  }
+
+  // Applies |drop_policy_| before the producer writes a buffer object.
+  // Returns |kSuccess| when the buffer may be written, and sets
+  // |ptr_use_overflow| when it must be written to |overflow_buffers_|, and
+  // |ptr_drop_oldest| when the consumer must drop the oldest active buffer
+  // object once the buffer is published. Returns |kFull| or |kDropped| when
+  // the buffer must be dropped. Producer thread only.
+  int AdmitBuffer(bool* ptr_use_overflow, bool* ptr_drop_oldest);
+
+  // Drops active buffer objects requested through |pending_drops_|, always
+  // leaving the newest active buffer object. Consumer thread only.
+  void ApplyPendingDrops();
+
+  // Returns a buffer object from |spare_buffers_|, or allocates a new one.
+  // Returns NULL when allocation fails. |overflow_mutex_| must be held.
+  Type* AcquireOverflowBuffer();
+
+  // Slow path used by |Commit()| when |ring_| is full or the consumer has not
+  // yet drained |overflow_buffers_|.
+  int CommitOverflow(Type* ptr_buffer);
+
+  // Slow path used by |Decommit()| when |ring_| is empty.
+  int DecommitOverflow(Type* ptr_buffer);
+
+  BufferDropPolicy drop_policy_;
+  int max_overflow_buffers_;
+
+  // Number of active buffer objects the ring holds before |drop_policy_|
+  // applies. |ring_| may have more positions than this.
+  int32 num_buffers_;
+
+  // Used only by the producer when |drop_policy_| is |kDecimateBuffers|. The
+  // pool drops a buffer whenever the phase flips to true.
+  bool decimate_phase_;
+
+  // Capacity in bytes preallocated in each buffer object. 0 when |Init()| was
+  // called without a capacity.
+  int32 buffer_capacity_;
+
+  // Buffer objects. Positions from |read_index_| up to (but not including)
+  // |write_index_| are active. One position is always left unused to
+  // distinguish a full ring from an empty ring.
+  std::vector<Type*> ring_;
+
+  // Next position read by the consumer. Written only by the consumer.
+  std::atomic<int32> read_index_;
+
+  // Next position written by the producer. Written only by the producer.
+  std::atomic<int32> write_index_;
+
+  // Number of active buffer objects the producer has asked the consumer to
+  // drop under |kDropOldestBuffer|. Incremented by the producer after
+  // publishing, decremented by the consumer after dropping.
+  std::atomic<int32> pending_drops_;
+
+  // Buffer object leased by |AcquireWriteBuffer()|, or NULL. |lease_in_ring_|
+  // is true when |ptr_lease_| is the buffer object at |write_index_|. Used
+  // only by the producer.
+  Type* ptr_lease_;
+  bool lease_in_ring_;
+
+  // True when publishing |ptr_lease_| must request a drop of the oldest
+  // active buffer object.
+  bool lease_drops_oldest_;
+
+  // Buffer object borrowed by |BorrowActiveBuffer()|, or NULL. Always the
+  // oldest active buffer object. Used only by the consumer.
+  Type* ptr_borrowed_;
+
+  // Overflow storage used by |kNeverDropBuffers|. All buffer objects in
+  // |overflow_buffers_| are newer than those in |ring_|.
+  std::mutex overflow_mutex_;
+  std::queue<Type*> overflow_buffers_;
+  std::queue<Type*> spare_buffers_;
+  std::atomic<int32> overflow_count_;
+
+  // |BufferPoolStats| counters.
+  std::atomic<int64> num_committed_;
+  std::atomic<int64> num_overflowed_;
+  std::atomic<int64> num_dropped_newest_;
+  std::atomic<int64> num_dropped_oldest_;
+  std::atomic<int64> num_decimated_;
+
+  // Signal notified when buffer objects become active. |ptr_signal_| points
+  // to |signal_| unless |set_signal()| is called.
+  BufferPoolSignal signal_;
+  BufferPoolSignal* ptr_signal_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BufferPool);
 };
 
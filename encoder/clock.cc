@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/clock.h"
+
+#include <chrono>
+
+namespace webmlive {
+
+namespace {
+
+// Stateless, so safe to use from any thread once static initialization is
+// done.
+SystemClock g_system_clock;
+
+}  // namespace
+
+int64 SystemClock::NowMs() {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  using std::chrono::steady_clock;
+  return duration_cast<milliseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+int64 SystemClock::WallTimeMs() {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  using std::chrono::system_clock;
+  return duration_cast<milliseconds>(
+      system_clock::now().time_since_epoch()).count();
+}
+
+int64 SystemClock::AdvanceTo(int64 time_ms) {
+  const int64 wait_ms = time_ms - NowMs();
+  return wait_ms > 0 ? wait_ms : 0;
+}
+
+ClockInterface* GetSystemClock() {
+  return &g_system_clock;
+}
+
+int64 SteadyTimeUs() {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  using std::chrono::steady_clock;
+  return duration_cast<microseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+SimulatedClock::SimulatedClock()
+    : start_wall_time_ms_(GetSystemClock()->WallTimeMs()),
+      now_ms_(0) {}
+
+SimulatedClock::SimulatedClock(int64 start_wall_time_ms)
+    : start_wall_time_ms_(start_wall_time_ms),
+      now_ms_(0) {}
+
+int64 SimulatedClock::NowMs() {
+  return now_ms_;
+}
+
+int64 SimulatedClock::WallTimeMs() {
+  return start_wall_time_ms_ + now_ms_;
+}
+
+int64 SimulatedClock::AdvanceTo(int64 time_ms) {
+  int64 now_ms = now_ms_;
+  while (time_ms > now_ms &&
+         !now_ms_.compare_exchange_weak(now_ms, time_ms)) {
+  }
+  return 0;
+}
+
+}  // namespace webmlive
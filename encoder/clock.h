@@ -0,0 +1,95 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CLOCK_H_
+#define WEBMLIVE_ENCODER_CLOCK_H_
+
+#include <atomic>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Time source for the encoding pipeline. Everything that derives timing from
+// the clock instead of from media timestamps, such as source pacing, upload
+// throughput and manifest availability times, reads it from one instance so
+// that the whole pipeline agrees on what time it is.
+class ClockInterface {
+ public:
+  virtual ~ClockInterface() {}
+
+  // Returns milliseconds on a monotonic time line with an arbitrary origin.
+  // Use for measuring elapsed time.
+  virtual int64 NowMs() = 0;
+
+  // Returns wall clock time in milliseconds since the Unix epoch (UTC).
+  virtual int64 WallTimeMs() = 0;
+
+  // Moves the clock toward |time_ms| on the |NowMs()| time line, and returns
+  // the number of milliseconds the caller must still wait for the clock to
+  // reach |time_ms|. Returns 0 when |time_ms| is not in the future. Never
+  // moves the clock backward.
+  virtual int64 AdvanceTo(int64 time_ms) = 0;
+};
+
+// Clock that follows the system clocks. Cannot be moved: |AdvanceTo()|
+// returns the real time left until |time_ms|.
+class SystemClock : public ClockInterface {
+ public:
+  SystemClock() {}
+  ~SystemClock() override {}
+
+  int64 NowMs() override;
+  int64 WallTimeMs() override;
+  int64 AdvanceTo(int64 time_ms) override;
+
+ private:
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SystemClock);
+};
+
+// Returns the process wide |SystemClock|. Used wherever a clock is optional
+// and none is provided.
+ClockInterface* GetSystemClock();
+
+// Returns microseconds on the system monotonic clock. For measuring processing
+// time, which a |SimulatedClock| does not model.
+int64 SteadyTimeUs();
+
+// Clock that only moves when told to. Media sources move it to the timestamp
+// of each frame or buffer they deliver instead of sleeping, so input runs as
+// fast as the encoder accepts it while every time derived from the clock
+// still matches the media timeline. Thread safe.
+class SimulatedClock : public ClockInterface {
+ public:
+  // Starts the clock at 0, at the current system wall time.
+  SimulatedClock();
+
+  // Starts the clock at 0, at |start_wall_time_ms| milliseconds since the
+  // Unix epoch. Runs starting from the same wall time produce the same
+  // session names and manifest times.
+  explicit SimulatedClock(int64 start_wall_time_ms);
+  ~SimulatedClock() override {}
+
+  // Returns the time the clock was last moved to.
+  int64 NowMs() override;
+
+  // Returns the start wall time plus |NowMs()|.
+  int64 WallTimeMs() override;
+
+  // Moves the clock to |time_ms| when it is later than |NowMs()|. Always
+  // returns 0.
+  int64 AdvanceTo(int64 time_ms) override;
+
+ private:
+  const int64 start_wall_time_ms_;
+  std::atomic<int64> now_ms_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SimulatedClock);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CLOCK_H_
@@ -7,6 +7,7 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/dash_writer.h"
 
+#include <cmath>
 #include <ctime>
 #include <ios>
 #include <sstream>
@@ -131,6 +132,7 @@ bool DashWriter::Init(const WebmEncoderConfig& webm_config) {
   }
 
   name_ = webm_config.dash_name;
+  ptr_clock_ = webm_config.ptr_clock ? webm_config.ptr_clock : GetSystemClock();
 
   if (!webm_config.disable_audio) {
     config_.audio_as.enabled = true;
@@ -186,7 +188,7 @@ bool DashWriter::WriteManifest(std::string* out_manifest) {
 
   manifest << "<?xml version=\"1.0\"?>\n";
 
-  time_t raw_time = time(NULL);
+  time_t raw_time = static_cast<time_t>(ptr_clock_->WallTimeMs() / 1000);
 
   // Open the MPD element.
   manifest << "<MPD "
@@ -10,6 +10,7 @@
 
 #include <string>
 
+#include "encoder/clock.h"
 #include "encoder/webm_encoder.h"
 
 namespace webmlive {
@@ -99,7 +100,7 @@ struct DashConfig {
 
 class DashWriter {
  public:
-  DashWriter() : initialized_(false){}
+  DashWriter() : initialized_(false), ptr_clock_(NULL) {}
   ~DashWriter() {}
 
   DashConfig config() const { return config_; }
@@ -127,6 +128,9 @@ class DashWriter {
   void ResetIndent();
 
   bool initialized_;
+
+  // Source of the manifest availability start time. Not owned.
+  ClockInterface* ptr_clock_;
   DashConfig config_;
   std::string indent_;
   std::string name_;
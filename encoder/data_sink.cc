@@ -7,71 +7,562 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/data_sink.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <vector>
 
 #include "glog/logging.h"
 
 namespace webmlive {
 
+namespace {
+
+size_t SizeClassBytes(int size_class) {
+  return DataSinkBufferPool::kMinSizeClass << size_class;
+}
+
+// Returns the smallest size class that holds |size| bytes, or -1 when |size|
+// is larger than the largest size class.
+int SizeClassForRequest(size_t size) {
+  for (int i = 0; i < DataSinkBufferPool::kNumSizeClasses; ++i) {
+    if (size <= SizeClassBytes(i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Returns the largest size class that a buffer with |capacity| bytes can
+// serve, or -1 when |capacity| is below the smallest size class or more than
+// twice the largest.
+int SizeClassForCapacity(size_t capacity) {
+  const int largest = DataSinkBufferPool::kNumSizeClasses - 1;
+  if (capacity < SizeClassBytes(0) ||
+      capacity >= 2 * SizeClassBytes(largest)) {
+    return -1;
+  }
+  int size_class = 0;
+  while (size_class < largest && capacity >= SizeClassBytes(size_class + 1)) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+}  // namespace
+
+//
+// DataSinkBufferPool
+//
+struct DataSinkBufferPool::FreeLists {
+  explicit FreeLists(int max_free) : max_free_buffers(max_free) {}
+  ~FreeLists() {
+    for (auto& buffers : free_buffers) {
+      for (auto ptr_buffer : buffers) {
+        delete ptr_buffer;
+      }
+    }
+  }
+
+  const int max_free_buffers;
+  std::mutex mutex;
+  std::vector<DataSinkBuffer*> free_buffers[kNumSizeClasses];
+};
+
+DataSinkBufferPool::DataSinkBufferPool()
+    : free_lists_(new (std::nothrow) FreeLists(  // NOLINT
+          kDefaultMaxFreeBuffers)) {
+}
+
+DataSinkBufferPool::DataSinkBufferPool(int max_free_buffers)
+    : free_lists_(new (std::nothrow) FreeLists(  // NOLINT
+          max_free_buffers)) {
+}
+
+DataSinkBufferPool::~DataSinkBufferPool() {
+}
+
+SharedDataSinkBuffer DataSinkBufferPool::Acquire(size_t size_hint) {
+  const int size_class = SizeClassForRequest(size_hint);
+  DataSinkBuffer* ptr_buffer = NULL;
+  if (free_lists_ && size_class >= 0) {
+    std::lock_guard<std::mutex> lock(free_lists_->mutex);
+    std::vector<DataSinkBuffer*>& buffers =
+        free_lists_->free_buffers[size_class];
+    if (!buffers.empty()) {
+      ptr_buffer = buffers.back();
+      buffers.pop_back();
+    }
+  }
+
+  if (!ptr_buffer) {
+    ptr_buffer = new (std::nothrow) DataSinkBuffer;  // NOLINT
+    if (!ptr_buffer) {
+      LOG(ERROR) << "Out of memory.";
+      return SharedDataSinkBuffer();
+    }
+    ptr_buffer->data.reserve(size_class >= 0 ? SizeClassBytes(size_class) :
+                                               size_hint);
+  }
+
+  const std::weak_ptr<FreeLists> free_lists = free_lists_;
+  return SharedDataSinkBuffer(ptr_buffer,
+                              [free_lists](DataSinkBuffer* ptr_released) {
+                                Recycle(free_lists, ptr_released);
+                              });
+}
+
+void DataSinkBufferPool::Recycle(const std::weak_ptr<FreeLists>& free_lists,
+                                 DataSinkBuffer* ptr_buffer) {
+  const std::shared_ptr<FreeLists> lists = free_lists.lock();
+  const int size_class = SizeClassForCapacity(ptr_buffer->data.capacity());
+  if (lists && size_class >= 0) {
+    ptr_buffer->id.clear();
+    ptr_buffer->stream.clear();
+    ptr_buffer->data.clear();
+    ptr_buffer->keyframe = true;
+    ptr_buffer->droppable = false;
+    ptr_buffer->continuation = false;
+    ptr_buffer->last_fragment = true;
+    std::lock_guard<std::mutex> lock(lists->mutex);
+    std::vector<DataSinkBuffer*>& buffers = lists->free_buffers[size_class];
+    if (static_cast<int>(buffers.size()) < lists->max_free_buffers) {
+      buffers.push_back(ptr_buffer);
+      return;
+    }
+  }
+  delete ptr_buffer;
+}
+
 //
 // SharedBufferQueue
 //
-bool SharedBufferQueue::EnqueueBuffer(const SharedDataSinkBuffer& buffer) {
+void SharedBufferQueue::Init(const Options& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+}
+
+// Obtains lock and stores |buffer| in |buffer_q_|. When the queue is full
+// applies |options_.overflow_policy|. Calls the watermark callback after
+// releasing the lock.
+int SharedBufferQueue::EnqueueBuffer(const SharedDataSinkBuffer& buffer) {
   if (buffer.get() == NULL) {
     LOG(ERROR) << "Empty SharedDataSinkBuffer.";
+    return kInvalidArg;
+  }
+  bool watermark_reached = false;
+  size_t num_buffers = 0;
+  WatermarkCallback callback;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const size_t capacity = options_.capacity;
+    if (buffer->droppable && skipping_streams_.count(buffer->stream) > 0) {
+      if (!buffer->keyframe) {
+        ++num_dropped_;
+        VLOG(1) << "skipping to key frame, dropping buffer id: " << buffer->id;
+        return kDropped;
+      }
+      // |buffer| starts a decodable run of its stream.
+      skipping_streams_.erase(buffer->stream);
+    }
+    if (capacity > 0 && buffer_q_.size() >= capacity && !closed_) {
+      switch (options_.overflow_policy) {
+        case kDropToNextKeyframeWhenFull:
+          if (buffer->droppable && !buffer->keyframe) {
+            ++num_dropped_;
+            skipping_streams_.insert(buffer->stream);
+            LOG(WARNING) << "queue full, dropping to next key frame from id: "
+                         << buffer->id;
+            return kDropped;
+          }
+          if (DropQueuedRun() > 0) {
+            // |buffer| starts a decodable run when it is a droppable key
+            // frame of the stream that lost its run.
+            if (buffer->droppable) {
+              skipping_streams_.erase(buffer->stream);
+            }
+            break;
+          }
+          // Nothing droppable is queued; wait for space.
+          not_full_.wait(lock, [this, capacity]() {
+            return closed_ || buffer_q_.size() < capacity;
+          });
+          break;
+        case kBlockWhenFull:
+          not_full_.wait(lock, [this, capacity]() {
+            return closed_ || buffer_q_.size() < capacity;
+          });
+          break;
+        case kDropNewestWhenFull:
+          if (buffer->droppable) {
+            ++num_dropped_;
+            LOG(WARNING) << "queue full, dropping buffer id: " << buffer->id;
+            return kDropped;
+          }
+          // Stream headers and manifests are never dropped; wait for space.
+          not_full_.wait(lock, [this, capacity]() {
+            return closed_ || buffer_q_.size() < capacity;
+          });
+          break;
+        case kDropOldestWhenFull:
+          if (DropOldestBuffer()) {
+            break;
+          }
+          // Nothing droppable is queued; wait for space.
+          not_full_.wait(lock, [this, capacity]() {
+            return closed_ || buffer_q_.size() < capacity;
+          });
+          break;
+      }
+    }
+    if (closed_) {
+      LOG(ERROR) << "cannot enqueue buffer, queue closed.";
+      return kClosed;
+    }
+    buffer_q_.push_back(buffer);
+    watermark_reached = CheckWatermark();
+    if (watermark_reached) {
+      num_buffers = buffer_q_.size();
+      callback = options_.watermark_callback;
+    }
+  }
+  not_empty_.notify_one();
+  if (watermark_reached) {
+    LOG(WARNING) << "queue high watermark reached: " << num_buffers;
+    if (callback) {
+      callback(num_buffers);
+    }
+  }
+  return kSuccess;
+}
+
+bool SharedBufferQueue::WouldBlock(const SharedDataSinkBuffer& buffer) {
+  if (buffer.get() == NULL) {
     return false;
   }
   std::lock_guard<std::mutex> lock(mutex_);
-  buffer_q_.push(buffer);
+  const size_t capacity = options_.capacity;
+  if (closed_ || capacity == 0 || buffer_q_.size() < capacity) {
+    return false;
+  }
+  if (buffer->droppable && !buffer->keyframe &&
+      skipping_streams_.count(buffer->stream) > 0) {
+    return false;
+  }
+  switch (options_.overflow_policy) {
+    case kDropToNextKeyframeWhenFull:
+      if (buffer->droppable && !buffer->keyframe) {
+        return false;
+      }
+      return !HasDroppableBuffer();
+    case kBlockWhenFull:
+      return true;
+    case kDropNewestWhenFull:
+      return !buffer->droppable;
+    case kDropOldestWhenFull:
+      return !HasDroppableBuffer();
+  }
   return true;
 }
 
 SharedDataSinkBuffer SharedBufferQueue::DequeueBuffer() {
   SharedDataSinkBuffer buffer;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock() && !buffer_q_.empty()) {
-    buffer = buffer_q_.front();
-    buffer_q_.pop();
+  SpaceCallback space_callback;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !buffer_q_.empty(); });
+    if (buffer_q_.empty()) {
+      return SharedDataSinkBuffer();
+    }
+    buffer = PopFront(&space_callback);
+  }
+  if (space_callback) {
+    space_callback();
   }
   return buffer;
 }
 
+SharedDataSinkBuffer SharedBufferQueue::DequeueBuffer(
+    std::chrono::milliseconds timeout) {
+  SharedDataSinkBuffer buffer;
+  SpaceCallback space_callback;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait_for(lock, timeout,
+                        [this]() { return closed_ || !buffer_q_.empty(); });
+    if (buffer_q_.empty()) {
+      return SharedDataSinkBuffer();
+    }
+    buffer = PopFront(&space_callback);
+  }
+  if (space_callback) {
+    space_callback();
+  }
+  return buffer;
+}
+
+SharedDataSinkBuffer SharedBufferQueue::TryDequeueBuffer() {
+  SharedDataSinkBuffer buffer;
+  SpaceCallback space_callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_q_.empty()) {
+      return SharedDataSinkBuffer();
+    }
+    buffer = PopFront(&space_callback);
+  }
+  if (space_callback) {
+    space_callback();
+  }
+  return buffer;
+}
+
+void SharedBufferQueue::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+}
+
 size_t SharedBufferQueue::GetNumBuffers() {
   std::lock_guard<std::mutex> lock(mutex_);
   return buffer_q_.size();
 }
 
+int64 SharedBufferQueue::GetNumDropped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_dropped_;
+}
+
+SharedDataSinkBuffer SharedBufferQueue::PopFront(
+    SpaceCallback* ptr_space_callback) {
+  const size_t capacity = options_.capacity;
+  if (capacity > 0 && buffer_q_.size() >= capacity) {
+    *ptr_space_callback = options_.space_callback;
+  }
+  SharedDataSinkBuffer buffer = buffer_q_.front();
+  buffer_q_.pop_front();
+  CheckWatermark();
+  not_full_.notify_one();
+  return buffer;
+}
+
+bool SharedBufferQueue::HasDroppableBuffer() const {
+  return std::any_of(buffer_q_.begin(), buffer_q_.end(),
+                     [](const SharedDataSinkBuffer& queued_buffer) {
+                       return queued_buffer->droppable;
+                     });
+}
+
+bool SharedBufferQueue::DropOldestBuffer() {
+  const std::deque<SharedDataSinkBuffer>::iterator buffer_iter =
+      std::find_if(buffer_q_.begin(), buffer_q_.end(),
+                   [](const SharedDataSinkBuffer& queued_buffer) {
+                     return queued_buffer->droppable;
+                   });
+  if (buffer_iter == buffer_q_.end()) {
+    return false;
+  }
+  LOG(WARNING) << "queue full, dropping buffer id: " << (*buffer_iter)->id;
+  buffer_q_.erase(buffer_iter);
+  ++num_dropped_;
+  return true;
+}
+
+size_t SharedBufferQueue::DropQueuedRun() {
+  typedef std::deque<SharedDataSinkBuffer>::iterator QueueIterator;
+  QueueIterator buffer_iter = buffer_q_.begin();
+  while (buffer_iter != buffer_q_.end() && !(*buffer_iter)->droppable) {
+    ++buffer_iter;
+  }
+  if (buffer_iter == buffer_q_.end()) {
+    return 0;
+  }
+  const std::string stream = (*buffer_iter)->stream;
+  const std::string run_id = (*buffer_iter)->id;
+  buffer_iter = buffer_q_.erase(buffer_iter);
+  size_t num_erased = 1;
+
+  // Buffers of other streams, and buffers that are not droppable, stay
+  // queued.
+  bool found_keyframe = false;
+  while (buffer_iter != buffer_q_.end()) {
+    const DataSinkBuffer& queued_buffer = **buffer_iter;
+    if (queued_buffer.stream != stream || !queued_buffer.droppable) {
+      ++buffer_iter;
+      continue;
+    }
+    if (queued_buffer.keyframe) {
+      found_keyframe = true;
+      break;
+    }
+    buffer_iter = buffer_q_.erase(buffer_iter);
+    ++num_erased;
+  }
+
+  // Without a queued key frame the stream's next buffers depend on dropped
+  // data until its next key frame buffer arrives.
+  if (!found_keyframe) {
+    skipping_streams_.insert(stream);
+  }
+  num_dropped_ += num_erased;
+  LOG(WARNING) << "queue full, dropping " << num_erased
+               << " buffers from id: " << run_id;
+  return num_erased;
+}
+
+bool SharedBufferQueue::CheckWatermark() {
+  if (options_.high_watermark == 0) {
+    return false;
+  }
+  const bool above_watermark = buffer_q_.size() >= options_.high_watermark;
+  const bool watermark_reached = above_watermark && !above_watermark_;
+  above_watermark_ = above_watermark;
+  return watermark_reached;
+}
+
 //
 // DataSink
 //
+DataSink::DataSink() {
+  data_sinks_ = MakeSinkList(DataSinkList(), &data_sinks_released_);
+}
+
+// Publishes a copy of the current sink set with |data_sink| appended.
 void DataSink::AddDataSink(DataSinkInterface* data_sink) {
   std::lock_guard<std::mutex> lock(mutex_);
-  data_sinks_.push_back(data_sink);
+  const SharedDataSinkList current_sinks = std::atomic_load(&data_sinks_);
+  DataSinkList sinks;
+  if (current_sinks) {
+    sinks = *current_sinks;
+  }
+  sinks.push_back(data_sink);
+  std::shared_ptr<bool> new_sinks_released;
+  const SharedDataSinkList new_sinks =
+      MakeSinkList(sinks, &new_sinks_released);
+  if (!new_sinks) {
+    LOG(ERROR) << "AddDataSink: out of memory.";
+    return;
+  }
+  std::atomic_store(&data_sinks_, new_sinks);
+  data_sinks_released_ = new_sinks_released;
+}
+
+// Publishes a copy of the current sink set without |data_sink|, and then
+// waits for the old set to be destroyed; at that point no |WriteData()| call
+// can still be using |data_sink|.
+bool DataSink::RemoveDataSink(DataSinkInterface* data_sink) {
+  std::shared_ptr<bool> old_sinks_released;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const SharedDataSinkList current_sinks = std::atomic_load(&data_sinks_);
+    DataSinkList sinks;
+    if (current_sinks) {
+      sinks = *current_sinks;
+    }
+    const DataSinkList::iterator sink_iter =
+        std::find(sinks.begin(), sinks.end(), data_sink);
+    if (sink_iter == sinks.end()) {
+      LOG(ERROR) << "RemoveDataSink: sink not found.";
+      return false;
+    }
+    sinks.erase(sink_iter);
+    std::shared_ptr<bool> new_sinks_released;
+    const SharedDataSinkList new_sinks =
+        MakeSinkList(sinks, &new_sinks_released);
+    if (!new_sinks) {
+      LOG(ERROR) << "RemoveDataSink: out of memory.";
+      return false;
+    }
+    old_sinks_released = data_sinks_released_;
+    std::atomic_store(&data_sinks_, new_sinks);
+    data_sinks_released_ = new_sinks_released;
+  }
+
+  // Wait for the old set's deleter rather than for its use count: the count
+  // reaches zero before the deleter runs, and the deleter still uses
+  // |release_mutex_| and |sinks_released_|. The deleter sets the flag and
+  // signals while holding |release_mutex_|, so once the flag is seen here
+  // the deleter no longer needs this object beyond unlocking the mutex.
+  std::unique_lock<std::mutex> lock(release_mutex_);
+  sinks_released_.wait(lock, [&old_sinks_released]() {
+    return *old_sinks_released;
+  });
+  return true;
 }
 
 bool DataSink::WriteData(const std::string& id,
                          const uint8* ptr_data, int data_length) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  SharedDataSinkBuffer buffer;
-  buffer.reset(new (std::nothrow) DataSinkBuffer);
-
+  SharedDataSinkBuffer buffer = AcquireBuffer(data_length);
   if (!buffer.get()) {
-    LOG(ERROR) << "Out of memory.";
     return false;
   }
 
   buffer->data.assign(ptr_data, ptr_data + data_length);
   buffer->id = id;
+  return WriteData(buffer);
+}
 
-  for (auto data_sink : data_sinks_) {
+bool DataSink::WriteData(const SharedDataSinkBuffer& buffer) {
+  if (!buffer.get()) {
+    LOG(ERROR) << "Empty SharedDataSinkBuffer.";
+    return false;
+  }
+
+  const SharedDataSinkList data_sinks = std::atomic_load(&data_sinks_);
+  if (!data_sinks) {
+    return true;
+  }
+  bool write_ok = true;
+  for (auto data_sink : *data_sinks) {
     if (!data_sink->WriteData(buffer)) {
-      // Log and ignore the error.
       LOG(ERROR) << "WriteData failed on sink with name: " << data_sink->Name();
+      write_ok = false;
     }
   }
+  return write_ok;
+}
 
-  return true;
+bool DataSink::WriteWouldBlock(const SharedDataSinkBuffer& buffer) {
+  const SharedDataSinkList data_sinks = std::atomic_load(&data_sinks_);
+  if (!data_sinks) {
+    return false;
+  }
+  for (auto data_sink : *data_sinks) {
+    if (data_sink->WriteWouldBlock(buffer)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SharedDataSinkBuffer DataSink::AcquireBuffer(size_t size_hint) {
+  return buffer_pool_.Acquire(size_hint);
+}
+
+DataSink::SharedDataSinkList DataSink::MakeSinkList(
+    const DataSinkList& sinks, std::shared_ptr<bool>* ptr_released) {
+  const std::shared_ptr<bool> released(
+      new (std::nothrow) bool(false));  // NOLINT
+  DataSinkList* const ptr_sinks =
+      new (std::nothrow) DataSinkList(sinks);  // NOLINT
+  if (!released || !ptr_sinks) {
+    delete ptr_sinks;
+    return SharedDataSinkList();
+  }
+  *ptr_released = released;
+  return SharedDataSinkList(
+      ptr_sinks, [this, released](const DataSinkList* ptr_list) {
+        delete ptr_list;
+        std::lock_guard<std::mutex> lock(release_mutex_);
+        *released = true;
+        sinks_released_.notify_all();
+      });
 }
 
 }  // namespace webmlive
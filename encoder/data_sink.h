@@ -8,9 +8,13 @@
 #ifndef WEBMLIVE_ENCODER_DATA_SINK_H_
 #define WEBMLIVE_ENCODER_DATA_SINK_H_
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -19,54 +23,318 @@
 namespace webmlive {
 
 struct DataSinkBuffer {
+  DataSinkBuffer()
+      : keyframe(true),
+        droppable(false),
+        continuation(false),
+        last_fragment(true) {}
+
   std::string id;
   std::vector<uint8> data;
+
+  // Name of the stream |data| belongs to, such as the id of the muxer that
+  // produced it. Chunk |id|s change from chunk to chunk; |stream| does not.
+  std::string stream;
+
+  // True when |data| can be decoded without the earlier buffers of |stream|,
+  // given the stream headers. Set for chunks that begin with a video key
+  // frame and for chunks containing only audio. A leading fragment is set
+  // only once its cluster's first video block is known to be a key frame.
+  bool keyframe;
+
+  // True when sinks may discard |data| to shed load. False for stream headers
+  // and manifests.
+  bool droppable;
+
+  // Progressive output sends a chunk as a series of fragments with the same
+  // |id|. |continuation| is true when |data| continues the chunk started by an
+  // earlier buffer, and |last_fragment| is true when |data| ends the chunk.
+  // The last fragment may be empty. Whole chunks have the defaults. Dropping
+  // a fragment truncates its chunk at an element boundary; only
+  // |SharedBufferQueue::kDropToNextKeyframeWhenFull| keeps such a stream
+  // decodable.
+  bool continuation;
+  bool last_fragment;
 };
 typedef std::shared_ptr<DataSinkBuffer> SharedDataSinkBuffer;
 
+// Recycling allocator for |DataSinkBuffer|s. Buffers are grouped into
+// power-of-two size classes by the capacity of their |data| vector, and are
+// returned to the pool by the |SharedDataSinkBuffer| deleter when the last
+// reference is released. Buffers released after the pool is destroyed are
+// deleted. All methods are thread safe.
+class DataSinkBufferPool {
+ public:
+  // Size classes run from |kMinSizeClass| to
+  // |kMinSizeClass| << (|kNumSizeClasses| - 1) bytes: 16 KB to 4 MB.
+  static const int kNumSizeClasses = 9;
+  static const size_t kMinSizeClass = 16 * 1024;
+
+  // Maximum number of idle buffers kept per size class.
+  static const int kDefaultMaxFreeBuffers = 8;
+
+  DataSinkBufferPool();
+  explicit DataSinkBufferPool(int max_free_buffers);
+  ~DataSinkBufferPool();
+
+  // Returns an empty buffer whose |data| capacity is at least |size_hint|
+  // bytes, reusing an idle buffer when one is available. Buffers larger than
+  // the largest size class are allocated at |size_hint| and are not pooled
+  // unless their capacity fits a size class when released. Returns an empty
+  // |SharedDataSinkBuffer| when out of memory.
+  SharedDataSinkBuffer Acquire(size_t size_hint);
+
+ private:
+  struct FreeLists;
+
+  // |SharedDataSinkBuffer| deleter. Returns |ptr_buffer| to |free_lists| when
+  // the pool still exists and has room for it, or deletes it.
+  static void Recycle(const std::weak_ptr<FreeLists>& free_lists,
+                      DataSinkBuffer* ptr_buffer);
+
+  // Idle buffers. Shared with outstanding buffer deleters via weak
+  // references so that buffers may outlive the pool.
+  std::shared_ptr<FreeLists> free_lists_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DataSinkBufferPool);
+};
+
+// Bounded multiple-producer/multiple-consumer queue of |DataSinkBuffer|s.
+// Producers block or shed buffers according to |Options::overflow_policy|
+// when the queue is full. Consumers block in |DequeueBuffer()| until a buffer
+// is available or the queue is closed.
 class SharedBufferQueue {
  public:
-  SharedBufferQueue() {}
+  // |EnqueueBuffer()| status codes.
+  enum {
+    kClosed = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // The buffer was shed by |Options::overflow_policy|.
+    kDropped = 1,
+  };
+
+  // Behavior of |EnqueueBuffer()| when the queue holds |Options::capacity|
+  // buffers.
+  enum OverflowPolicy {
+    // Block the producer until space is available or the queue is closed.
+    kBlockWhenFull = 0,
+
+    // Drop the buffer being enqueued when it is droppable. Blocks as
+    // |kBlockWhenFull| for buffers that are not droppable.
+    kDropNewestWhenFull = 1,
+
+    // Drop the oldest queued droppable buffer to make room. Blocks as
+    // |kBlockWhenFull| when no droppable buffer is queued.
+    kDropOldestWhenFull = 2,
+
+    // Drop whole runs of droppable buffers up to the next key frame buffer
+    // of the same |DataSinkBuffer::stream| so that the data that reaches the
+    // sink stays decodable: an incoming non-key frame buffer is dropped along
+    // with every following non-key frame buffer of its stream, and an
+    // incoming key frame buffer makes room by dropping the oldest run of
+    // queued droppable buffers. Blocks as |kBlockWhenFull| when nothing can
+    // be dropped.
+    kDropToNextKeyframeWhenFull = 3,
+  };
+
+  // Called with the number of queued buffers each time the queue depth
+  // reaches |Options::high_watermark|. The callback is re-armed once the
+  // queue depth falls below the watermark. Called without |mutex_| held.
+  typedef std::function<void(size_t num_buffers)> WatermarkCallback;
+
+  // Called each time a consumer takes a buffer from a full queue. Producers
+  // that must not block use it with |WouldBlock()| to retry once there is
+  // room. Called without |mutex_| held.
+  typedef std::function<void()> SpaceCallback;
+
+  struct Options {
+    static const size_t kDefaultCapacity = 64;
+    Options()
+        : capacity(kDefaultCapacity),
+          overflow_policy(kBlockWhenFull),
+          high_watermark(kDefaultCapacity * 3 / 4) {}
+
+    // Maximum number of queued buffers. 0 means unbounded.
+    size_t capacity;
+
+    // Behavior when |capacity| is reached.
+    OverflowPolicy overflow_policy;
+
+    // Queue depth that triggers |watermark_callback|. 0 disables the
+    // watermark.
+    size_t high_watermark;
+    WatermarkCallback watermark_callback;
+
+    // Optional. See |SpaceCallback|.
+    SpaceCallback space_callback;
+  };
+
+  SharedBufferQueue()
+      : closed_(false),
+        above_watermark_(false),
+        num_dropped_(0) {}
   ~SharedBufferQueue() {}
 
-  // Enqueues |buffer| and returns true. Returns false upon failure. Blocks on
-  // |mutex_|.
-  bool EnqueueBuffer(const SharedDataSinkBuffer& buffer);
+  // Replaces the queue options. Must be called before the queue is used.
+  void Init(const Options& options);
+
+  // Enqueues |buffer| and returns |kSuccess|. Returns |kDropped| when
+  // |buffer| is dropped because the queue is full, |kInvalidArg| when
+  // |buffer| is empty, and |kClosed| when the queue is closed. Blocks while
+  // the queue is full when |overflow_policy| is |kBlockWhenFull|.
+  int EnqueueBuffer(const SharedDataSinkBuffer& buffer);
+
+  // Returns true when |EnqueueBuffer(buffer)| would wait for space instead of
+  // storing or dropping |buffer| right away. Only meaningful while no other
+  // producer uses the queue.
+  bool WouldBlock(const SharedDataSinkBuffer& buffer);
 
-  // Returns a buffer if one is available. Does not block waiting on |mutex_|;
-  // gives up and returns empty |std::shared_ptr| when unable to obtain lock.
+  // Blocks until a buffer is available and returns it. Returns an empty
+  // |std::shared_ptr| when the queue is closed and no buffers remain.
   SharedDataSinkBuffer DequeueBuffer();
 
-  // Returns number of buffers queued. Blocks on |mutex_| acquisition.
+  // Behaves as |DequeueBuffer()|, but gives up and returns an empty
+  // |std::shared_ptr| when |timeout| expires.
+  SharedDataSinkBuffer DequeueBuffer(std::chrono::milliseconds timeout);
+
+  // Returns a buffer if one is available without waiting.
+  SharedDataSinkBuffer TryDequeueBuffer();
+
+  // Closes the queue. Wakes all blocked producers and consumers. Subsequent
+  // calls to |EnqueueBuffer()| fail; consumers drain remaining buffers.
+  void Close();
+
+  // Returns number of buffers queued.
   size_t GetNumBuffers();
 
+  // Returns number of buffers dropped by |Options::overflow_policy|.
+  int64 GetNumDropped();
+
  private:
+  // Pops and returns the front buffer. |mutex_| must be held and |buffer_q_|
+  // must not be empty. Wakes a producer blocked on a full queue, and sets
+  // |*ptr_space_callback| to |Options::space_callback| when the queue was
+  // full; the caller runs it after releasing |mutex_|.
+  SharedDataSinkBuffer PopFront(SpaceCallback* ptr_space_callback);
+
+  // Returns true when a droppable buffer is queued. |mutex_| must be held.
+  bool HasDroppableBuffer() const;
+
+  // Updates |above_watermark_|, and returns true when the queue depth has just
+  // reached the high watermark. |mutex_| must be held.
+  bool CheckWatermark();
+
+  // Erases the oldest droppable buffer in |buffer_q_|. Returns false when no
+  // queued buffer is droppable. |mutex_| must be held.
+  bool DropOldestBuffer();
+
+  // Erases the oldest droppable buffer in |buffer_q_| and the droppable
+  // non-key frame buffers of its stream that follow it, stopping at the
+  // stream's next droppable key frame buffer. Adds the stream to
+  // |skipping_streams_| when there is none. Returns the number of buffers
+  // erased. |mutex_| must be held.
+  size_t DropQueuedRun();
+
+  Options options_;
+  bool closed_;
+  bool above_watermark_;
+
+  // Streams whose droppable buffers |kDropToNextKeyframeWhenFull| discards
+  // until a droppable key frame buffer of the same stream arrives.
+  std::set<std::string> skipping_streams_;
+  int64 num_dropped_;
   std::mutex mutex_;
-  std::queue<const SharedDataSinkBuffer> buffer_q_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<SharedDataSinkBuffer> buffer_q_;
 };
 
 class DataSinkInterface {
  public:
   virtual ~DataSinkInterface() {}
+
+  // Accepts |buffer| and returns true. Data shed by an overflow policy counts
+  // as accepted. Returns false when the sink has failed or is closed, and can
+  // no longer take data.
   virtual bool WriteData(const SharedDataSinkBuffer& buffer) = 0;
   virtual std::string Name() const = 0;
+
+  // Returns true when |WriteData(buffer)| would block until the sink makes
+  // room. Sinks that never block need not override it.
+  virtual bool WriteWouldBlock(const SharedDataSinkBuffer& buffer) {
+    return false;
+  }
 };
 
+// Fans out |SharedDataSinkBuffer|s to a set of |DataSinkInterface|s. The sink
+// set is an immutable snapshot replaced wholesale by |AddDataSink()| and
+// |RemoveDataSink()|, so |WriteData()| does not wait for them and sinks can be
+// attached or detached while data is flowing.
 class DataSink {
  public:
-  DataSink() {}
+  typedef std::vector<DataSinkInterface*> DataSinkList;
+  typedef std::shared_ptr<const DataSinkList> SharedDataSinkList;
+
+  DataSink();
   ~DataSink() {}
 
-  // Adds |data_sink| to |data_sinks_|.
+  // Adds |data_sink| to |data_sinks_|. |data_sink| receives all data passed
+  // to |WriteData()| calls that begin after this method returns.
   void AddDataSink(DataSinkInterface* data_sink);
 
+  // Removes |data_sink| from |data_sinks_|, and blocks until |WriteData()|
+  // calls still using the previous sink set have returned. |data_sink| may be
+  // destroyed once this method returns. Returns false when |data_sink| was not
+  // found. Must not be called from within |DataSinkInterface::WriteData()|.
+  bool RemoveDataSink(DataSinkInterface* data_sink);
+
   // Writes |id| and |ptr_data| to all data sinks in |data_sinks_|. Returns
-  // true when the data has been sent to all sinks.
+  // true when the data has been sent to all sinks. Sinks with a full queue
+  // either block this call or shed data, depending on their
+  // |SharedBufferQueue::OverflowPolicy|.
   bool WriteData(const std::string& id, const uint8* ptr_data, int data_length);
 
+  // Passes |buffer| to all data sinks in |data_sinks_| without copying it.
+  // |buffer| must not be modified after this call. Returns false when
+  // |buffer| is empty, or when any sink fails; the other sinks still receive
+  // |buffer|. Concurrent calls may reach the sinks in any order.
+  bool WriteData(const SharedDataSinkBuffer& buffer);
+
+  // Returns true when passing |buffer| to |WriteData()| would block in at
+  // least one sink. Callers that must not block, such as |WorkerPool| tasks,
+  // hold |buffer| until the sink's |SharedBufferQueue::SpaceCallback| runs.
+  bool WriteWouldBlock(const SharedDataSinkBuffer& buffer);
+
+  // Returns an empty buffer from |buffer_pool_| with at least |size_hint|
+  // bytes of capacity. Use for data passed to |WriteData()|.
+  SharedDataSinkBuffer AcquireBuffer(size_t size_hint);
+
  private:
+  // Returns a sink set holding |sinks|. Once the set is destroyed its deleter
+  // sets |*ptr_released|, a flag created by this method, under
+  // |release_mutex_| and signals |sinks_released_|. Returns an empty
+  // |SharedDataSinkList| when out of memory.
+  SharedDataSinkList MakeSinkList(const DataSinkList& sinks,
+                                  std::shared_ptr<bool>* ptr_released);
+
+  DataSinkBufferPool buffer_pool_;
+
+  // Serializes |AddDataSink()| and |RemoveDataSink()|. Not used by
+  // |WriteData()|.
   std::mutex mutex_;
-  std::vector<DataSinkInterface*> data_sinks_;
+
+  // Protects the released flags of the sink sets. |sinks_released_| is
+  // signaled each time a sink set is destroyed, which happens when the last
+  // |WriteData()| call using a replaced set returns.
+  std::mutex release_mutex_;
+  std::condition_variable sinks_released_;
+
+  // Current sink set. Accessed only through |std::atomic_load()| and
+  // |std::atomic_store()|. |data_sinks_released_| is its released flag, and
+  // is protected by |mutex_|.
+  SharedDataSinkList data_sinks_;
+  std::shared_ptr<bool> data_sinks_released_;
 };
 
 }  // namespace webmlive
@@ -0,0 +1,154 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/encoder_host.h"
+
+#include <new>
+#include <utility>
+
+#include "encoder/time_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+EncoderHost::~EncoderHost() {
+  StopAll();
+}
+
+int EncoderHost::Init(int num_workers,
+                      const ThreadOptions& worker_thread_options) {
+  if (!pool_.Init(num_workers, worker_thread_options)) {
+    LOG(ERROR) << "worker pool Init failed.";
+    return kInitFailed;
+  }
+  return kSuccess;
+}
+
+int EncoderHost::AddSession(const EncoderSessionConfig& config) {
+  if (!config.enable_file_output && !config.enable_http_upload) {
+    LOG(ERROR) << "File output or HTTP upload must be enabled.";
+    return kInvalidArg;
+  }
+  std::unique_ptr<Session> session(new (std::nothrow) Session());  // NOLINT
+  if (!session) {
+    LOG(ERROR) << "cannot construct session!";
+    return kNoMemory;
+  }
+
+  int status = session->encoder.Init(config.enc_config, &session->data_sink,
+                                     &pool_);
+  if (status) {
+    LOG(ERROR) << "WebmEncoder Init failed, status=" << status;
+    return kInitFailed;
+  }
+
+  // The mux stage leaves chunks with the encoder rather than wait on a full
+  // sink queue; the queues restart it once they have room.
+  SharedBufferQueue::Options queue_options = config.queue_options;
+  WebmEncoder* const ptr_encoder = &session->encoder;
+  queue_options.space_callback = [ptr_encoder]() {
+    ptr_encoder->OnSinkSpaceAvailable();
+  };
+
+  if (config.enable_file_output) {
+    FileWriterSettings writer_settings;
+    writer_settings.dash_mode = config.enc_config.dash_encode;
+    writer_settings.directory = config.enc_config.dash_dir;
+    writer_settings.queue_options = queue_options;
+    writer_settings.ptr_clock = config.enc_config.ptr_clock;
+    FileWriter& writer = session->file_writer;
+    if (!writer.Init(writer_settings) || !writer.Run(&pool_)) {
+      LOG(ERROR) << "file writer start failed.";
+      return kInitFailed;
+    }
+    session->file_writer_running = true;
+    session->data_sink.AddDataSink(&writer);
+  }
+
+  if (config.enable_http_upload) {
+    HttpUploaderSettings uploader_settings = config.uploader_settings;
+    if (!uploader_settings.ptr_clock) {
+      uploader_settings.ptr_clock = config.enc_config.ptr_clock;
+    }
+    if (uploader_settings.session_id.empty()) {
+      ClockInterface* const ptr_clock = uploader_settings.ptr_clock ?
+          uploader_settings.ptr_clock : GetSystemClock();
+      const int64 wall_time_ms = ptr_clock->WallTimeMs();
+      uploader_settings.session_id =
+          LocalDateString(wall_time_ms) + LocalTimeString(wall_time_ms);
+    }
+    uploader_settings.queue_options = queue_options;
+    if (!session->uploader.Init(uploader_settings) ||
+        !session->uploader.Run()) {
+      LOG(ERROR) << "uploader start failed.";
+      StopSession(false, session.get());
+      return kInitFailed;
+    }
+    session->uploader_running = true;
+    session->data_sink.AddDataSink(&session->uploader);
+  }
+
+  status = session->encoder.Run();
+  if (status) {
+    LOG(ERROR) << "WebmEncoder Run failed, status=" << status;
+    StopSession(false, session.get());
+    return kRunFailed;
+  }
+  sessions_.push_back(std::move(session));
+  LOG(INFO) << "session " << sessions_.size() - 1 << " running.";
+  return kSuccess;
+}
+
+void EncoderHost::StopAll() {
+  for (size_t i = 0; i < sessions_.size(); ++i) {
+    LOG(INFO) << "stopping session " << i << "...";
+    StopSession(true, sessions_[i].get());
+  }
+  sessions_.clear();
+  pool_.Stop();
+}
+
+bool EncoderHost::AllSessionsFinished() const {
+  for (size_t i = 0; i < sessions_.size(); ++i) {
+    if (!sessions_[i]->encoder.finished()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int64 EncoderHost::encoded_duration(int index) const {
+  CHECK(index >= 0 && index < num_sessions());
+  return sessions_[index]->encoder.encoded_duration();
+}
+
+bool EncoderHost::GetUploaderStats(int index, HttpUploaderStats* ptr_stats) {
+  CHECK(index >= 0 && index < num_sessions());
+  Session* const ptr_session = sessions_[index].get();
+  return ptr_session->uploader_running &&
+         ptr_session->uploader.GetStats(ptr_stats);
+}
+
+void EncoderHost::StopSession(bool stop_encoder, Session* ptr_session) {
+  if (stop_encoder) {
+    ptr_session->encoder.Stop();
+  }
+  // Detach the sinks before stopping them; |RemoveDataSink()| returns once no
+  // write can still reach the sink.
+  if (ptr_session->uploader_running) {
+    ptr_session->data_sink.RemoveDataSink(&ptr_session->uploader);
+    ptr_session->uploader.Stop();
+    ptr_session->uploader_running = false;
+  }
+  if (ptr_session->file_writer_running) {
+    ptr_session->data_sink.RemoveDataSink(&ptr_session->file_writer);
+    ptr_session->file_writer.Stop();
+    ptr_session->file_writer_running = false;
+  }
+}
+
+}  // namespace webmlive
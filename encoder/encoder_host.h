@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ENCODER_HOST_H_
+#define WEBMLIVE_ENCODER_ENCODER_HOST_H_
+
+#include <memory>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/file_writer.h"
+#include "encoder/http_uploader.h"
+#include "encoder/thread_util.h"
+#include "encoder/webm_encoder.h"
+#include "encoder/worker_pool.h"
+
+namespace webmlive {
+
+// Settings for one |EncoderHost| session.
+struct EncoderSessionConfig {
+  EncoderSessionConfig()
+      : enable_file_output(true),
+        enable_http_upload(true) {}
+
+  // WebM encoder settings.
+  WebmEncoderConfig enc_config;
+
+  // Output enable flags. At least one must be true.
+  bool enable_file_output;
+  bool enable_http_upload;
+
+  // Uploader settings. The queue options are replaced by |queue_options|.
+  HttpUploaderSettings uploader_settings;
+
+  // Output queue settings. Applied to the file writer and uploader queues.
+  // |SharedBufferQueue::Options::space_callback| is replaced.
+  SharedBufferQueue::Options queue_options;
+};
+
+// Runs independent encoding sessions in one process. The encode, mux and file
+// write stages of every session run on one shared |WorkerPool| sized to the
+// machine, instead of on threads owned by each session. No stage waits on a
+// full output queue, so any number of sessions can share any pool size.
+//
+// Each session keeps a control thread that runs its media source and waits
+// for stop requests, and its upload thread when HTTP upload is enabled:
+// uploads block on the network, and would stall the shared workers.
+class EncoderHost {
+ public:
+  enum {
+    kRunFailed = -4,
+    kInitFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  EncoderHost() {}
+
+  // Stops all sessions.
+  ~EncoderHost();
+
+  // Starts the worker pool with |num_workers| workers, or one per CPU when
+  // |num_workers| is 0. Returns |kSuccess|, or |kInitFailed|.
+  int Init(int num_workers, const ThreadOptions& worker_thread_options);
+
+  // Starts a session using |config| and returns |kSuccess|. The session's
+  // index is |num_sessions()| - 1 after the call. Returns |kInvalidArg| when
+  // |config| enables no output, and |kInitFailed| or |kRunFailed| when the
+  // session cannot be started.
+  int AddSession(const EncoderSessionConfig& config);
+
+  // Stops all sessions, writing their final chunks, and then stops the
+  // worker pool.
+  void StopAll();
+
+  // Returns true when every session's encoder has stopped on its own; see
+  // |WebmEncoder::finished()|.
+  bool AllSessionsFinished() const;
+
+  int num_sessions() const { return static_cast<int>(sessions_.size()); }
+  int num_workers() const { return pool_.num_workers(); }
+
+  // Returns the encoded duration of session |index| in milliseconds.
+  int64 encoded_duration(int index) const;
+
+  // Returns upload stats of session |index|. Returns false when the session
+  // does not upload.
+  bool GetUploaderStats(int index, HttpUploaderStats* ptr_stats);
+
+ private:
+  struct Session {
+    Session() : file_writer_running(false), uploader_running(false) {}
+    DataSink data_sink;
+    FileWriter file_writer;
+    HttpUploader uploader;
+    WebmEncoder encoder;
+    bool file_writer_running;
+    bool uploader_running;
+  };
+
+  // Stops |ptr_session|'s encoder when |stop_encoder| is true, and then
+  // detaches and stops its uploader and file writer.
+  void StopSession(bool stop_encoder, Session* ptr_session);
+
+  WorkerPool pool_;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(EncoderHost);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ENCODER_HOST_H_
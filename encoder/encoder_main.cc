@@ -7,18 +7,32 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/encoder_base.h"
 
+#ifdef _WIN32
 #include <conio.h>
+#endif
+#include <signal.h>
 #include <stdio.h>
-#include <tchar.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "encoder/buffer_util.h"
 #include "encoder/capture_source_list.h"
+#include "encoder/clock.h"
+#include "encoder/encoder_host.h"
 #include "encoder/file_writer.h"
 #include "encoder/http_uploader.h"
+#include "encoder/process_stats.h"
+#include "encoder/thread_util.h"
 #include "encoder/time_util.h"
 #include "encoder/webm_encoder.h"
 #include "glog/logging.h"
@@ -33,19 +47,111 @@ enum {
 
 const std::string kCodecVp8 = "vp8";
 const std::string kCodecVp9 = "vp9";
+const std::string kQueuePolicyBlock = "block";
+const std::string kQueuePolicyDropNewest = "drop_newest";
+const std::string kQueuePolicyDropOldest = "drop_oldest";
+const std::string kQueuePolicyDropToKeyframe = "drop_to_keyframe";
+const std::string kPoolPolicyDropNewest = "newest";
+const std::string kPoolPolicyDropOldest = "oldest";
+const std::string kPoolPolicyDecimate = "decimate";
+const std::string kThreadStageMux = "mux";
+const std::string kThreadStageAudio = "audio";
+const std::string kThreadStageVideo = "video";
+const std::string kThreadStageWriter = "writer";
+const std::string kThreadStageUpload = "upload";
+const std::string kThreadStageWorker = "worker";
+const std::string kBenchmarkSinkNull = "null";
+const std::string kBenchmarkSinkFile = "file";
+const std::string kBenchmarkSinkHttp = "http";
 typedef std::vector<std::string> StringVector;
 
+// Interval between status line updates.
+const int kStatusIntervalMs = 100;
+
+#ifdef _WIN32
+const char kQuitPrompt[] = "Press the any key to quit...";
+#else
+const char kQuitPrompt[] = "Press Ctrl-C to quit...";
+#endif
+
+// Interval between benchmark limit checks.
+const int kBenchmarkPollIntervalMs = 10;
+
+// Benchmark duration used when neither a duration nor a frame count is set.
+const int64 kDefaultBenchmarkDurationMs = 10000;
+
+// Version of the benchmark report layout. Increment when fields are renamed
+// or removed.
+const int kBenchmarkReportVersion = 1;
+
+// Set by |OnStopSignal()|.
+volatile sig_atomic_t g_stop_signaled = 0;
+
 struct WebmEncoderConfig {
-  WebmEncoderConfig() : enable_file_output(true), enable_http_upload(true) {}
+  WebmEncoderConfig()
+      : enable_file_output(true),
+        enable_http_upload(true),
+        num_sessions(1),
+        num_workers(0),
+        simulated_clock(false),
+        simulated_start_time(0),
+        benchmark(false),
+        benchmark_duration(0),
+        benchmark_frames(0),
+        benchmark_sink(kBenchmarkSinkNull) {}
   // Uploader settings.
   webmlive::HttpUploaderSettings uploader_settings;
 
   // WebM encoder settings.
   webmlive::WebmEncoderConfig enc_config;
 
+  // Output queue settings. Applied to the file writer and uploader queues.
+  webmlive::SharedBufferQueue::Options queue_options;
+
+  // File writer thread settings.
+  webmlive::ThreadOptions writer_thread_options;
+
+  // Worker pool thread settings. Used when |num_sessions| is greater than 1.
+  webmlive::ThreadOptions worker_thread_options;
+
   bool enable_file_output;
   bool enable_http_upload;
   bool list_devices;
+
+  // Number of encoding sessions, and number of worker pool threads shared by
+  // the sessions. 0 workers means one per CPU.
+  int num_sessions;
+  int num_workers;
+
+  // Run on a |SimulatedClock| starting at |simulated_start_time| seconds
+  // since the Unix epoch, or at the current time when it is 0.
+  bool simulated_clock;
+  int64 simulated_start_time;
+
+  // Benchmark mode. Encodes until |benchmark_duration| milliseconds of media
+  // or |benchmark_frames| video frames have been encoded, writes to the
+  // |benchmark_sink| output, and prints a JSON report to |benchmark_output|,
+  // or to stdout when it is empty.
+  bool benchmark;
+  int64 benchmark_duration;
+  int64 benchmark_frames;
+  std::string benchmark_sink;
+  std::string benchmark_output;
+};
+
+// Data sink that discards everything. Used by benchmark mode to measure the
+// encoder without output costs.
+class NullDataSink : public webmlive::DataSinkInterface {
+ public:
+  NullDataSink() {}
+  ~NullDataSink() override {}
+  bool WriteData(const webmlive::SharedDataSinkBuffer& /* buffer */) override {
+    return true;
+  }
+  std::string Name() const override { return "NullDataSink"; }
+
+ private:
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(NullDataSink);
 };
 
 }  // anonymous namespace
@@ -60,6 +166,13 @@ void Usage(const char** argv) {
   printf("    --disable_file_output          Disables local file output.\n");
   printf("    --disable_http_upload          Disables upload of output to\n");
   printf("                                   HTTP servers.\n");
+  printf("    --known_size_clusters          Write cluster sizes instead\n");
+  printf("                                   of the EBML unknown size.\n");
+  printf("    --progressive_clusters         Output clusters in fragments\n");
+  printf("                                   as they are muxed, for lower\n");
+  printf("                                   latency.\n");
+  printf("    --live_cluster_writer          Write clusters without libwebm\n");
+  printf("                                   frame queueing.\n");
   printf("    --adev <audio source name>     Audio capture device name.\n");
   printf("    --adevidx <source index>       Select audio capture device by\n");
   printf("                                   index. Ignored when --adev is\n");
@@ -68,6 +181,74 @@ void Usage(const char** argv) {
   printf("    --vdevidx <source index>       Select video capture device by\n");
   printf("                                   index. Ignored when --vdev is\n");
   printf("                                   used.\n");
+  printf("  File input options:\n");
+  printf("    Reads input from files instead of capture devices. Each\n");
+  printf("    enabled stream needs a file. Encoding stops at the end of\n");
+  printf("    the input.\n");
+  printf("    --input_video <Y4M file>       I420 video input file.\n");
+  printf("    --input_audio <WAV file>       16 bit PCM or 32 bit float\n");
+  printf("                                   audio input file.\n");
+  printf("    --input_fast                   Read input as fast as the\n");
+  printf("                                   encoder accepts it instead\n");
+  printf("                                   of in real time.\n");
+  printf("  Pipe input options:\n");
+  printf("    Reads raw input from FIFOs, or from stdin when the name is\n");
+  printf("    -. Video frame size and rate come from --vwidth, --vheight\n");
+  printf("    and --vframe_rate. Audio is interleaved PCM described by\n");
+  printf("    --achannels, --arate and --asize (16, or 32 for float).\n");
+  printf("    Encoding stops when every pipe is closed.\n");
+  printf("    --input_video_pipe <name>      Raw video frame pipe.\n");
+  printf("    --input_audio_pipe <name>      Raw audio pipe.\n");
+  printf("    --input_video_fourcc <format>  I420 (default), YV12, YUY2,\n");
+  printf("                                   YUYV, UYVY, RGB24 or RGBA.\n");
+  printf("    --input_timestamps <name>      Video timestamp pipe; one\n");
+  printf("                                   millisecond value per line\n");
+  printf("                                   per frame. Frame rate based\n");
+  printf("                                   when not specified.\n");
+  printf("    --input_fast                   Stall the writer instead of\n");
+  printf("                                   dropping input when the\n");
+  printf("                                   encoder falls behind.\n");
+  printf("  Test pattern options:\n");
+  printf("    Encodes generated input instead of capturing. Video size\n");
+  printf("    and format options are as for pipe input; the default is\n");
+  printf("    640x480 at 30 fps. --input_fast generates input as fast as\n");
+  printf("    the encoder accepts it.\n");
+  printf("    --test_pattern <pattern>       bars, noise or text. Noise\n");
+  printf("                                   is the worst case for the\n");
+  printf("                                   video encoder.\n");
+  printf("    --test_audio <pattern>         tone (default) or noise.\n");
+  printf("    --test_duration <ms>           Stop after this much output.\n");
+  printf("                                   Default is 0: run until\n");
+  printf("                                   stopped.\n");
+  printf("  Simulated clock options:\n");
+  printf("    Runs file and test pattern input as fast as the encoder\n");
+  printf("    accepts it on a clock that follows the input timestamps,\n");
+  printf("    so manifest times, upload rates and output names match a\n");
+  printf("    real time run. Implies --input_fast.\n");
+  printf("    --simulated_clock              Enables the simulated clock.\n");
+  printf("    --simulated_start_time <secs>  Clock start time in seconds\n");
+  printf("                                   since the Unix epoch.\n");
+  printf("                                   Implies --simulated_clock.\n");
+  printf("                                   Default is the current\n");
+  printf("                                   time.\n");
+  printf("  Benchmark options:\n");
+  printf("    Encodes as fast as possible and prints a JSON report of\n");
+  printf("    throughput, per-stage latency, drops, output size, peak\n");
+  printf("    memory and CPU time per thread. Uses the bars test\n");
+  printf("    pattern unless another input is set, runs on the\n");
+  printf("    simulated clock, and supports one session only.\n");
+  printf("    --benchmark                    Enables benchmark mode.\n");
+  printf("    --benchmark_duration <ms>      Stop after this much encoded\n");
+  printf("                                   media. Default is 10000\n");
+  printf("                                   unless --benchmark_frames\n");
+  printf("                                   is set.\n");
+  printf("    --benchmark_frames <count>     Stop after this many encoded\n");
+  printf("                                   video frames.\n");
+  printf("    --benchmark_sink <sink>        Output: null (default),\n");
+  printf("                                   file, or http, which posts\n");
+  printf("                                   to --url.\n");
+  printf("    --benchmark_output <file>      Report file. Default is\n");
+  printf("                                   stdout.\n");
   printf("  DASH encoding options:\n");
   printf("    When the --dash argument is present an MPD file is produced\n");
   printf("    that allows the WebM output to be consumed by DASH WebM\n");
@@ -96,6 +277,45 @@ void Usage(const char** argv) {
   printf("                                   Sent with all POSTs.\n");
   printf("    --session-id                   Session identifier. Generated\n");
   printf("                                   for you if not specified.\n");
+  printf("  Output queue options:\n");
+  printf("    Applies to the file writer and the HTTP uploader.\n");
+  printf("    --sink_queue_length <buffers>  Maximum number of buffers\n");
+  printf("                                   waiting for output. 0 means\n");
+  printf("                                   unbounded. Default is 64.\n");
+  printf("    --sink_queue_policy <policy>   Behavior when the queue is\n");
+  printf("                                   full:\n");
+  printf("                                     block: stall the encoder\n");
+  printf("                                       (default).\n");
+  printf("                                     drop_newest: discard new\n");
+  printf("                                       buffers.\n");
+  printf("                                     drop_oldest: discard the\n");
+  printf("                                       oldest queued buffer.\n");
+  printf("                                     drop_to_keyframe: discard\n");
+  printf("                                       chunks up to the next\n");
+  printf("                                       key frame chunk.\n");
+  printf("  Multi-session options:\n");
+  printf("    Runs several encoding sessions in one process. Every\n");
+  printf("    session uses the same capture and encoder settings, and\n");
+  printf("    writes DASH output; _<n> is appended to the DASH name and\n");
+  printf("    session ID of session n. The encode, mux and file write\n");
+  printf("    stages of all sessions run on one shared worker pool.\n");
+  printf("    --sessions <count>             Number of sessions. Default\n");
+  printf("                                   is 1. Pipe input supports one\n");
+  printf("                                   session only.\n");
+  printf("    --workers <count>              Worker pool threads. Default\n");
+  printf("                                   is one per CPU.\n");
+  printf("  Thread options:\n");
+  printf("    <stage> is one of mux, audio, video, writer, upload or\n");
+  printf("    worker. mux, audio, video and writer do not apply when\n");
+  printf("    running more than one session; use worker instead.\n");
+  printf("    --thread_cpus <stage>:<cpus>   CPUs the stage may run on,\n");
+  printf("                                   for example video:0-3,8.\n");
+  printf("                                   Also caps --vpx_threads for\n");
+  printf("                                   the video stage; the libvpx\n");
+  printf("                                   threads are not pinned.\n");
+  printf("    --thread_nice <stage>:<nice>   Nice value, -20 to 19.\n");
+  printf("    --thread_fifo <stage>:<prio>   Real time priority, 1 to 99.\n");
+  printf("                                   Requires privileges.\n");
   printf("  Audio source configuration options:\n");
   printf("    --adisable                     Disable audio capture.\n");
   printf("    --amanual                      Attempt manual configuration.\n");
@@ -118,6 +338,12 @@ void Usage(const char** argv) {
   printf("    --vwidth <width>                   Width in pixels.\n");
   printf("    --vheight <height>                 Height in pixels.\n");
   printf("    --vframe_rate <width>              Frames per second.\n");
+  printf("    --vpool_drop_policy <policy>       Frame to discard when the\n");
+  printf("                                       encoder falls behind:\n");
+  printf("                                         newest (default)\n");
+  printf("                                         oldest\n");
+  printf("                                         decimate: every other\n");
+  printf("                                           queued frame.\n");
   printf("  VPx encoder options:\n");
   printf("    --vpx_bitrate <kbps>               Video bitrate.\n");
   printf("    --vpx_codec <codec>                Video codec, vp8 or vp9.\n");
@@ -168,10 +394,31 @@ void Usage(const char** argv) {
 }
 
 void ListCaptureDevices() {
+#ifdef _WIN32
   const std::string audio_sources = webmlive::GetAudioSourceList();
   const std::string video_sources = webmlive::GetVideoSourceList();
   printf("Audio devices:\n%s\nVideo devices:\n%s\n",
          audio_sources.c_str(), video_sources.c_str());
+#else
+  printf("Capture devices are supported only on Windows.\n");
+#endif
+}
+
+// Signal handler for SIGINT and SIGTERM. Asks the main loop to stop the
+// encoder so that its output is finalized.
+void OnStopSignal(int /* signal_number */) {
+  g_stop_signaled = 1;
+}
+
+// Returns true when the user asked to stop: a key press on Windows, or
+// SIGINT or SIGTERM.
+bool StopRequested() {
+#ifdef _WIN32
+  if (_kbhit()) {
+    return true;
+  }
+#endif
+  return g_stop_signaled != 0;
 }
 
 // Parses name value pairs in the format name:value from |unparsed_entries|,
@@ -198,6 +445,48 @@ int StoreStringMapEntries(const StringVector& unparsed_entries,
   return kSuccess;
 }
 
+// Returns the thread settings for the pipeline stage named |stage|, or NULL
+// when |stage| is unknown.
+webmlive::ThreadOptions* StageThreadOptions(const std::string& stage,
+                                            WebmEncoderConfig* ptr_config) {
+  webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
+  if (stage == kThreadStageMux)
+    return &enc_config.mux_thread_options;
+  if (stage == kThreadStageAudio)
+    return &enc_config.audio_thread_options;
+  if (stage == kThreadStageVideo)
+    return &enc_config.video_thread_options;
+  if (stage == kThreadStageWriter)
+    return &ptr_config->writer_thread_options;
+  if (stage == kThreadStageUpload)
+    return &ptr_config->uploader_settings.thread_options;
+  if (stage == kThreadStageWorker)
+    return &ptr_config->worker_thread_options;
+  return NULL;
+}
+
+// Parses a thread option argument in the format stage:value, stores the value
+// in |ptr_value|, and returns the settings for the stage. Returns NULL when
+// |arg| is malformed or names an unknown stage.
+webmlive::ThreadOptions* ParseThreadArg(const std::string& arg,
+                                        WebmEncoderConfig* ptr_config,
+                                        std::string* ptr_value) {
+  const size_t sep = arg.find(":");
+  if (sep == std::string::npos) {
+    LOG(ERROR) << "cannot parse thread option, should be stage:value, got="
+               << arg;
+    return NULL;
+  }
+  webmlive::ThreadOptions* const ptr_options =
+      StageThreadOptions(arg.substr(0, sep), ptr_config);
+  if (!ptr_options) {
+    LOG(ERROR) << "unknown thread stage: " << arg.substr(0, sep);
+    return NULL;
+  }
+  *ptr_value = arg.substr(sep + 1);
+  return ptr_options;
+}
+
 // Returns true when |arg_index| + 1 is <= |argc|, and |argv[arg_index+1]| is
 // non-null. Command line parser helper function.
 bool ArgHasValue(int arg_index, int argc, const char** argv) {
@@ -228,6 +517,77 @@ void ParseCommandLine(int argc, const char** argv, WebmEncoderConfig* config) {
       config->enable_file_output = false;
     } else if (!strcmp("--disable_http_upload", argv[i])) {
       config->enable_http_upload = false;
+    } else if (!strcmp("--known_size_clusters", argv[i])) {
+      enc_config.known_size_clusters = true;
+    } else if (!strcmp("--progressive_clusters", argv[i])) {
+      enc_config.progressive_clusters = true;
+    } else if (!strcmp("--live_cluster_writer", argv[i])) {
+      enc_config.live_cluster_writer = true;
+    }
+
+    //
+    // File, pipe and test pattern input options.
+    //
+    else if (!strcmp("--input_video", argv[i]) && ArgHasValue(i, argc, argv)) {
+      enc_config.input_video_file = argv[++i];
+    } else if (!strcmp("--input_audio", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_audio_file = argv[++i];
+    } else if (!strcmp("--input_video_pipe", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_video_pipe = argv[++i];
+    } else if (!strcmp("--input_audio_pipe", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_audio_pipe = argv[++i];
+    } else if (!strcmp("--input_video_fourcc", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_video_fourcc = argv[++i];
+    } else if (!strcmp("--input_timestamps", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_timestamp_pipe = argv[++i];
+    } else if (!strcmp("--test_pattern", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_test_pattern = argv[++i];
+    } else if (!strcmp("--test_audio", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_test_audio = argv[++i];
+    } else if (!strcmp("--test_duration", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      enc_config.input_test_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--input_fast", argv[i])) {
+      enc_config.input_realtime = false;
+    } else if (!strcmp("--simulated_clock", argv[i])) {
+      config->simulated_clock = true;
+      enc_config.input_realtime = false;
+    } else if (!strcmp("--simulated_start_time", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      config->simulated_start_time = strtol(argv[++i], NULL, 10);
+      config->simulated_clock = true;
+      enc_config.input_realtime = false;
+    }
+
+    //
+    // Benchmark options.
+    //
+    else if (!strcmp("--benchmark", argv[i])) {
+      config->benchmark = true;
+    } else if (!strcmp("--benchmark_duration", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      config->benchmark_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--benchmark_frames", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      config->benchmark_frames = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--benchmark_sink", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      const std::string sink = argv[++i];
+      if (sink == kBenchmarkSinkNull || sink == kBenchmarkSinkFile ||
+          sink == kBenchmarkSinkHttp)
+        config->benchmark_sink = sink;
+      else
+        LOG(ERROR) << "Invalid --benchmark_sink value: " << sink;
+    } else if (!strcmp("--benchmark_output", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      config->benchmark_output = argv[++i];
     }
 
     //
@@ -263,6 +623,78 @@ void ParseCommandLine(int argc, const char** argv, WebmEncoderConfig* config) {
       uploader_settings.session_id = argv[++i];
     }
 
+    //
+    // Output queue options.
+    //
+    else if (!strcmp("--sink_queue_length", argv[i]) &&
+             ArgHasValue(i, argc, argv)) {
+      const long length = strtol(argv[++i], NULL, 10);  // NOLINT
+      if (length < 0) {
+        LOG(ERROR) << "Invalid --sink_queue_length value: " << length;
+      } else {
+        config->queue_options.capacity = static_cast<size_t>(length);
+        config->queue_options.high_watermark =
+            config->queue_options.capacity * 3 / 4;
+      }
+    } else if (!strcmp("--sink_queue_policy", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      const std::string policy = argv[++i];
+      if (policy == kQueuePolicyBlock)
+        config->queue_options.overflow_policy =
+            webmlive::SharedBufferQueue::kBlockWhenFull;
+      else if (policy == kQueuePolicyDropNewest)
+        config->queue_options.overflow_policy =
+            webmlive::SharedBufferQueue::kDropNewestWhenFull;
+      else if (policy == kQueuePolicyDropOldest)
+        config->queue_options.overflow_policy =
+            webmlive::SharedBufferQueue::kDropOldestWhenFull;
+      else if (policy == kQueuePolicyDropToKeyframe)
+        config->queue_options.overflow_policy =
+            webmlive::SharedBufferQueue::kDropToNextKeyframeWhenFull;
+      else
+        LOG(ERROR) << "Invalid --sink_queue_policy value: " << policy;
+    }
+
+    //
+    // Multi-session options.
+    //
+    else if (!strcmp("--sessions", argv[i]) && ArgHasValue(i, argc, argv)) {
+      config->num_sessions = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--workers", argv[i]) && ArgHasValue(i, argc, argv)) {
+      config->num_workers = strtol(argv[++i], NULL, 10);
+    }
+
+    //
+    // Thread options.
+    //
+    else if (!strcmp("--thread_cpus", argv[i]) && ArgHasValue(i, argc, argv)) {
+      std::string cpu_list;
+      webmlive::ThreadOptions* const ptr_options =
+          ParseThreadArg(argv[++i], config, &cpu_list);
+      if (ptr_options &&
+          !webmlive::ParseCpuList(cpu_list, &ptr_options->cpus)) {
+        LOG(ERROR) << "Invalid --thread_cpus CPU list: " << cpu_list;
+      }
+    } else if (!strcmp("--thread_nice", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      std::string nice_value;
+      webmlive::ThreadOptions* const ptr_options =
+          ParseThreadArg(argv[++i], config, &nice_value);
+      if (ptr_options) {
+        ptr_options->realtime = false;
+        ptr_options->priority = strtol(nice_value.c_str(), NULL, 10);
+      }
+    } else if (!strcmp("--thread_fifo", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      std::string fifo_priority;
+      webmlive::ThreadOptions* const ptr_options =
+          ParseThreadArg(argv[++i], config, &fifo_priority);
+      if (ptr_options) {
+        ptr_options->realtime = true;
+        ptr_options->priority = strtol(fifo_priority.c_str(), NULL, 10);
+      }
+    }
+
     //
     // Audio source configuration options.
     //
@@ -303,6 +735,17 @@ void ParseCommandLine(int argc, const char** argv, WebmEncoderConfig* config) {
     } else if (!strcmp("--vframe_rate", argv[i]) &&
                ArgHasValue(i, argc, argv)) {
       enc_config.requested_video_config.frame_rate = strtod(argv[++i], NULL);
+    } else if (!strcmp("--vpool_drop_policy", argv[i]) &&
+               ArgHasValue(i, argc, argv)) {
+      const std::string policy = argv[++i];
+      if (policy == kPoolPolicyDropNewest)
+        enc_config.video_drop_policy = webmlive::kDropNewestBuffer;
+      else if (policy == kPoolPolicyDropOldest)
+        enc_config.video_drop_policy = webmlive::kDropOldestBuffer;
+      else if (policy == kPoolPolicyDecimate)
+        enc_config.video_drop_policy = webmlive::kDecimateBuffers;
+      else
+        LOG(ERROR) << "Invalid --vpool_drop_policy value: " << policy;
     }
 
     //
@@ -421,13 +864,34 @@ void ParseCommandLine(int argc, const char** argv, WebmEncoderConfig* config) {
   StoreStringMapEntries(unparsed_vars, &uploader_settings.form_variables);
 }
 
+// Returns the wall time at which the run starts in milliseconds since the Unix
+// epoch: |config.simulated_start_time| when it is set, and the current time
+// otherwise.
+int64 StartWallTimeMs(const WebmEncoderConfig& config) {
+  if (config.simulated_clock && config.simulated_start_time > 0) {
+    return config.simulated_start_time * 1000;
+  }
+  return webmlive::GetSystemClock()->WallTimeMs();
+}
+
+// Returns the session ID for a run starting at |wall_time_ms|.
+std::string SessionId(int64 wall_time_ms) {
+  return webmlive::LocalDateString(wall_time_ms) +
+         webmlive::LocalTimeString(wall_time_ms);
+}
+
 // Calls |Init| and |Run| on |ptr_writer| to start the file writer thread, which
 // writes buffers when |WriteData| is called on the writer via |DataSink|.
 bool StartWriter(WebmEncoderConfig* ptr_config,
                  webmlive::FileWriter* ptr_writer,
                  webmlive::DataSink* ptr_data_sink) {
-  if (!ptr_writer->Init(ptr_config->enc_config.dash_encode,
-                        ptr_config->enc_config.dash_dir)) {
+  webmlive::FileWriterSettings writer_settings;
+  writer_settings.dash_mode = ptr_config->enc_config.dash_encode;
+  writer_settings.directory = ptr_config->enc_config.dash_dir;
+  writer_settings.queue_options = ptr_config->queue_options;
+  writer_settings.thread_options = ptr_config->writer_thread_options;
+  writer_settings.ptr_clock = ptr_config->enc_config.ptr_clock;
+  if (!ptr_writer->Init(writer_settings)) {
     LOG(ERROR) << "writer Init failed.";
     return false;
   }
@@ -448,8 +912,10 @@ bool StartUploader(WebmEncoderConfig* ptr_config,
                    webmlive::DataSink* ptr_data_sink) {
   if (ptr_config->uploader_settings.session_id.empty()) {
     ptr_config->uploader_settings.session_id =
-        webmlive::LocalDateString() + webmlive::LocalTimeString();
+        SessionId(StartWallTimeMs(*ptr_config));
   }
+  ptr_config->uploader_settings.ptr_clock = ptr_config->enc_config.ptr_clock;
+  ptr_config->uploader_settings.queue_options = ptr_config->queue_options;
   if (!ptr_uploader->Init(ptr_config->uploader_settings)) {
     LOG(ERROR) << "uploader Init failed.";
     return false;
@@ -466,6 +932,8 @@ bool StartUploader(WebmEncoderConfig* ptr_config,
 
 int EncoderMain(WebmEncoderConfig* ptr_config) {
   webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
+  // Declared first to outlive the encoder and the sinks.
+  std::unique_ptr<webmlive::SimulatedClock> simulated_clock;
   webmlive::FileWriter file_writer;
   webmlive::HttpUploader uploader;
   webmlive::DataSink data_sink;
@@ -475,6 +943,17 @@ int EncoderMain(WebmEncoderConfig* ptr_config) {
     return EXIT_FAILURE;
   }
 
+  if (ptr_config->simulated_clock) {
+    simulated_clock.reset(
+        new (std::nothrow) webmlive::SimulatedClock(  // NOLINT
+            StartWallTimeMs(*ptr_config)));
+    if (!simulated_clock) {
+      LOG(ERROR) << "Out of memory.";
+      return EXIT_FAILURE;
+    }
+    enc_config.ptr_clock = simulated_clock.get();
+  }
+
   // Init the WebM encoder.
   webmlive::WebmEncoder encoder;
   int status = encoder.Init(enc_config, &data_sink);
@@ -506,17 +985,19 @@ int EncoderMain(WebmEncoderConfig* ptr_config) {
   }
 
   webmlive::HttpUploaderStats stats;
-  printf("\nPress the any key to quit...\n");
+  printf("\n%s\n", kQuitPrompt);
 
-  while (!_kbhit()) {
+  while (!StopRequested() && !encoder.finished()) {
     // Output current duration and upload progress
     if (uploader.GetStats(&stats)) {
-      printf("\rencoded duration: %04f seconds, uploaded: %I64d @ %d kBps",
+      printf("\rencoded duration: %04f seconds, uploaded: %lld @ %d kBps",
              (encoder.encoded_duration() / 1000.0),
-             stats.bytes_sent_current + stats.total_bytes_uploaded,
+             static_cast<long long>(  // NOLINT
+                 stats.bytes_sent_current + stats.total_bytes_uploaded),
              static_cast<int>(stats.bytes_per_second / 1000));
     }
-    Sleep(100);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kStatusIntervalMs));
   }
 
   LOG(INFO) << "stopping encoder...";
@@ -533,11 +1014,355 @@ int EncoderMain(WebmEncoderConfig* ptr_config) {
   return EXIT_SUCCESS;
 }
 
+// Returns |str| as a quoted JSON string.
+std::string JsonString(const std::string& str) {
+  std::string json = "\"";
+  for (size_t i = 0; i < str.length(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(str[i]);
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (c < 0x20) {
+      const char kHexDigits[] = "0123456789abcdef";
+      json += "\\u00";
+      json += kHexDigits[c >> 4];
+      json += kHexDigits[c & 0xf];
+    } else {
+      json += c;
+    }
+  }
+  return json + "\"";
+}
+
+// Writes |summary| to |report| as the JSON object member |name|.
+void WriteLatencyJson(const char* name,
+                      const webmlive::LatencySummary& summary,
+                      std::ostringstream* report) {
+  *report << "    \"" << name << "\": {"
+          << "\"count\": " << summary.count
+          << ", \"mean\": " << summary.mean_us
+          << ", \"p50\": " << summary.p50_us
+          << ", \"p90\": " << summary.p90_us
+          << ", \"p99\": " << summary.p99_us
+          << ", \"max\": " << summary.max_us << "}";
+}
+
+// Returns a description of the benchmark input in |config|.
+std::string BenchmarkInputName(const webmlive::WebmEncoderConfig& config) {
+  if (!config.input_test_pattern.empty()) {
+    return "test_pattern:" + config.input_test_pattern;
+  }
+  if (!config.input_video_file.empty() || !config.input_audio_file.empty()) {
+    return "file:" + (config.input_video_file.empty() ?
+        config.input_audio_file : config.input_video_file);
+  }
+  return "pipe:" + (config.input_video_pipe.empty() ?
+      config.input_audio_pipe : config.input_video_pipe);
+}
+
+// Writes the benchmark report for a run of |wall_time_seconds| to
+// |config.benchmark_output|, or to stdout. Returns false when the report
+// file cannot be written.
+bool WriteBenchmarkReport(const WebmEncoderConfig& config,
+                          const webmlive::WebmEncoderConfig& enc_config,
+                          double wall_time_seconds,
+                          int64 encoded_duration_ms,
+                          const webmlive::WebmEncoderStats& stats,
+                          const webmlive::ProcessStats& process_stats) {
+  const webmlive::VideoConfig& video_config = enc_config.actual_video_config;
+  const webmlive::AudioConfig& audio_config = enc_config.actual_audio_config;
+  const double fps = wall_time_seconds > 0 ?
+      stats.video_frames_encoded / wall_time_seconds : 0;
+  const int64 video_frames_dropped_by_pool =
+      stats.video_pool.num_dropped_newest +
+      stats.video_pool.num_dropped_oldest +
+      stats.video_pool.num_decimated;
+  const int64 audio_buffers_dropped =
+      stats.audio_pool.num_dropped_newest +
+      stats.audio_pool.num_dropped_oldest;
+
+  std::ostringstream report;
+  report.setf(std::ios::fixed);
+  report.precision(3);
+  report << "{\n"
+         << "  \"version\": " << kBenchmarkReportVersion << ",\n"
+         << "  \"config\": {"
+         << "\"input\": " << JsonString(BenchmarkInputName(enc_config))
+         << ", \"sink\": " << JsonString(config.benchmark_sink)
+         << ", \"codec\": " << JsonString(
+             enc_config.vpx_config.codec == webmlive::kVideoFormatVP9 ?
+                 kCodecVp9 : kCodecVp8)
+         << ", \"width\": " << video_config.width
+         << ", \"height\": " << video_config.height
+         << ", \"frame_rate\": " << video_config.frame_rate
+         << ", \"video_bitrate_kbps\": " << enc_config.vpx_config.bitrate
+         << ", \"audio_channels\": " << audio_config.channels
+         << ", \"audio_sample_rate\": " << audio_config.sample_rate
+         << "},\n"
+         << "  \"wall_time_seconds\": " << wall_time_seconds << ",\n"
+         << "  \"encoded_duration_ms\": " << encoded_duration_ms << ",\n"
+         << "  \"video\": {"
+         << "\"frames_received\": " << stats.video_pool.num_committed
+         << ", \"frames_encoded\": " << stats.video_frames_encoded
+         << ", \"frames_muxed\": " << stats.video_frames_muxed
+         << ", \"frames_dropped_by_pool\": " << video_frames_dropped_by_pool
+         << ", \"frames_dropped_by_encoder\": "
+         << stats.video_frames_dropped_by_encoder
+         << ", \"fps\": " << fps << "},\n"
+         << "  \"audio\": {"
+         << "\"buffers_received\": " << stats.audio_pool.num_committed
+         << ", \"buffers_muxed\": " << stats.audio_buffers_muxed
+         << ", \"buffers_dropped\": " << audio_buffers_dropped << "},\n"
+         << "  \"chunks_out\": " << stats.chunks_out << ",\n"
+         << "  \"bytes_out\": " << stats.bytes_out << ",\n"
+         << "  \"latency_us\": {\n";
+  WriteLatencyJson("encode", stats.encode_latency, &report);
+  report << ",\n";
+  WriteLatencyJson("mux", stats.mux_latency, &report);
+  report << ",\n";
+  WriteLatencyJson("sink", stats.sink_latency, &report);
+  report << "\n  },\n"
+         << "  \"peak_rss_bytes\": " << process_stats.peak_rss_bytes << ",\n"
+         << "  \"cpu_seconds\": {"
+         << "\"user\": " << process_stats.user_seconds
+         << ", \"system\": " << process_stats.system_seconds
+         << ", \"threads\": [";
+  for (size_t i = 0; i < process_stats.threads.size(); ++i) {
+    const webmlive::ThreadCpuStats& thread = process_stats.threads[i];
+    report << (i > 0 ? ",\n" : "\n")
+           << "    {\"name\": " << JsonString(thread.name)
+           << ", \"id\": " << thread.thread_id
+           << ", \"user\": " << thread.user_seconds
+           << ", \"system\": " << thread.system_seconds << "}";
+  }
+  report << "\n  ]}\n}\n";
+
+  const std::string report_text = report.str();
+  if (config.benchmark_output.empty()) {
+    fwrite(report_text.data(), 1, report_text.length(), stdout);
+    return true;
+  }
+  FILE* const report_file = fopen(config.benchmark_output.c_str(), "wb");
+  if (!report_file) {
+    LOG(ERROR) << "cannot open benchmark report file: "
+               << config.benchmark_output;
+    return false;
+  }
+  const bool write_ok =
+      fwrite(report_text.data(), 1, report_text.length(), report_file) ==
+      report_text.length();
+  fclose(report_file);
+  if (!write_ok) {
+    LOG(ERROR) << "cannot write benchmark report file: "
+               << config.benchmark_output;
+  }
+  return write_ok;
+}
+
+// Runs one encoding session as fast as the input allows until the benchmark
+// limit is reached, and writes the benchmark report.
+int BenchmarkMain(WebmEncoderConfig* ptr_config) {
+  webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
+  if (enc_config.input_video_file.empty() &&
+      enc_config.input_audio_file.empty() &&
+      enc_config.input_video_pipe.empty() &&
+      enc_config.input_audio_pipe.empty() &&
+      enc_config.input_test_pattern.empty()) {
+    enc_config.input_test_pattern = "bars";
+  }
+  if (ptr_config->benchmark_duration <= 0 &&
+      ptr_config->benchmark_frames <= 0) {
+    ptr_config->benchmark_duration = kDefaultBenchmarkDurationMs;
+  }
+  if (ptr_config->benchmark_duration > 0 &&
+      enc_config.input_test_duration == 0) {
+    // Let the test pattern end on its own so that the output is finalized
+    // at exactly the requested duration.
+    enc_config.input_test_duration = ptr_config->benchmark_duration;
+  }
+  enc_config.input_realtime = false;
+
+  ptr_config->simulated_clock = true;
+  ptr_config->enable_file_output =
+      ptr_config->benchmark_sink == kBenchmarkSinkFile;
+  ptr_config->enable_http_upload =
+      ptr_config->benchmark_sink == kBenchmarkSinkHttp;
+  if (ptr_config->enable_http_upload &&
+      ptr_config->uploader_settings.target_url.empty()) {
+    LOG(ERROR) << "--benchmark_sink http requires --url.";
+    return EXIT_FAILURE;
+  }
+
+  // Declared first to outlive the encoder and the sinks.
+  webmlive::SimulatedClock simulated_clock(StartWallTimeMs(*ptr_config));
+  enc_config.ptr_clock = &simulated_clock;
+  webmlive::FileWriter file_writer;
+  webmlive::HttpUploader uploader;
+  NullDataSink null_sink;
+  webmlive::DataSink data_sink;
+
+  webmlive::WebmEncoder encoder;
+  int status = encoder.Init(enc_config, &data_sink);
+  if (status) {
+    LOG(ERROR) << "WebmEncoder Init failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+  if (ptr_config->enable_file_output &&
+      !StartWriter(ptr_config, &file_writer, &data_sink)) {
+    LOG(ERROR) << "start_writer failed.";
+    return EXIT_FAILURE;
+  }
+  if (ptr_config->enable_http_upload &&
+      !StartUploader(ptr_config, &uploader, &data_sink)) {
+    LOG(ERROR) << "start_uploader failed.";
+    return EXIT_FAILURE;
+  }
+  if (!ptr_config->enable_file_output && !ptr_config->enable_http_upload) {
+    data_sink.AddDataSink(&null_sink);
+  }
+
+  const int64 start_time_us = webmlive::SteadyTimeUs();
+  status = encoder.Run();
+  if (status) {
+    LOG(ERROR) << "start_encoder failed, status=" << status;
+    if (ptr_config->enable_http_upload)
+      uploader.Stop();
+    if (ptr_config->enable_file_output)
+      file_writer.Stop();
+    return EXIT_FAILURE;
+  }
+
+  while (!StopRequested() && !encoder.finished()) {
+    if (ptr_config->benchmark_duration > 0 &&
+        encoder.encoded_duration() >= ptr_config->benchmark_duration) {
+      break;
+    }
+    if (ptr_config->benchmark_frames > 0 &&
+        encoder.GetStats().video_frames_encoded >=
+            ptr_config->benchmark_frames) {
+      break;
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kBenchmarkPollIntervalMs));
+  }
+
+  // Per-thread CPU times are read while the pipeline threads still exist.
+  webmlive::ProcessStats process_stats;
+  if (!webmlive::GetProcessStats(&process_stats)) {
+    LOG(WARNING) << "process stats unavailable.";
+  }
+
+  encoder.Stop();
+  if (ptr_config->enable_http_upload) {
+    uploader.Stop();
+  }
+  if (ptr_config->enable_file_output) {
+    file_writer.Stop();
+  }
+  const double wall_time_seconds =
+      (webmlive::SteadyTimeUs() - start_time_us) / 1000000.0;
+
+  const bool report_ok = WriteBenchmarkReport(*ptr_config, encoder.config(),
+                                              wall_time_seconds,
+                                              encoder.encoded_duration(),
+                                              encoder.GetStats(),
+                                              process_stats);
+  return report_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs |ptr_config->num_sessions| encoding sessions on one |EncoderHost|.
+int HostMain(WebmEncoderConfig* ptr_config) {
+  // Each session follows its own input timestamps, so each gets its own
+  // simulated clock. Declared before |host| to outlive the sessions.
+  std::vector<std::unique_ptr<webmlive::SimulatedClock> > simulated_clocks;
+  webmlive::EncoderHost host;
+  if (host.Init(ptr_config->num_workers, ptr_config->worker_thread_options)) {
+    LOG(ERROR) << "EncoderHost Init failed.";
+    return EXIT_FAILURE;
+  }
+
+  const int64 start_wall_time_ms = StartWallTimeMs(*ptr_config);
+  std::string session_id = ptr_config->uploader_settings.session_id;
+  if (session_id.empty()) {
+    session_id = SessionId(start_wall_time_ms);
+  }
+  for (int i = 0; i < ptr_config->num_sessions; ++i) {
+    std::ostringstream suffix;
+    suffix << "_" << i;
+    webmlive::EncoderSessionConfig session_config;
+    session_config.enc_config = ptr_config->enc_config;
+    session_config.enc_config.dash_encode = true;
+    session_config.enc_config.dash_name += suffix.str();
+    session_config.enable_file_output = ptr_config->enable_file_output;
+    session_config.enable_http_upload = ptr_config->enable_http_upload;
+    session_config.uploader_settings = ptr_config->uploader_settings;
+    session_config.uploader_settings.session_id = session_id + suffix.str();
+    if (ptr_config->simulated_clock) {
+      std::unique_ptr<webmlive::SimulatedClock> simulated_clock(
+          new (std::nothrow) webmlive::SimulatedClock(  // NOLINT
+              start_wall_time_ms));
+      if (!simulated_clock) {
+        LOG(ERROR) << "Out of memory.";
+        return EXIT_FAILURE;
+      }
+      session_config.enc_config.ptr_clock = simulated_clock.get();
+      session_config.uploader_settings.ptr_clock = simulated_clock.get();
+      simulated_clocks.push_back(std::move(simulated_clock));
+    }
+    session_config.queue_options = ptr_config->queue_options;
+    const int status = host.AddSession(session_config);
+    if (status) {
+      LOG(ERROR) << "cannot start session " << i << ", status=" << status;
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("\n%d sessions on %d workers. %s\n",
+         host.num_sessions(), host.num_workers(), kQuitPrompt);
+
+  while (!StopRequested() && !host.AllSessionsFinished()) {
+    // Output the duration of the session furthest behind.
+    int64 min_duration = host.encoded_duration(0);
+    for (int i = 1; i < host.num_sessions(); ++i) {
+      min_duration = std::min(min_duration, host.encoded_duration(i));
+    }
+    printf("\rminimum encoded duration: %04f seconds",
+           min_duration / 1000.0);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kStatusIntervalMs));
+  }
+
+  LOG(INFO) << "stopping sessions...";
+  host.StopAll();
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, const char** argv) {
   google::InitGoogleLogging(argv[0]);
+  signal(SIGINT, OnStopSignal);
+  signal(SIGTERM, OnStopSignal);
   WebmEncoderConfig config;
   ParseCommandLine(argc, argv, &config);
-  const int exit_code = EncoderMain(&config);
+  int exit_code = EXIT_FAILURE;
+  if (config.num_sessions < 1) {
+    LOG(ERROR) << "Invalid --sessions value: " << config.num_sessions;
+  } else if (config.benchmark) {
+    if (config.num_sessions > 1) {
+      LOG(ERROR) << "--benchmark supports one session only.";
+    } else {
+      exit_code = BenchmarkMain(&config);
+    }
+  } else if (config.num_sessions > 1) {
+    // Sessions would split one stream of frames between them.
+    if (!config.enc_config.input_video_pipe.empty() ||
+        !config.enc_config.input_audio_pipe.empty()) {
+      LOG(ERROR) << "pipe input supports one session only.";
+    } else {
+      exit_code = HostMain(&config);
+    }
+  } else {
+    exit_code = EncoderMain(&config);
+  }
   google::ShutdownGoogleLogging();
   return exit_code;
 }
@@ -0,0 +1,553 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/file_media_source.h"
+
+#include "encoder/encoder_base.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Read only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Maps |file_name| and returns true. Returns false when the file cannot be
+  // opened or mapped, or is empty.
+  bool Open(const std::string& file_name);
+
+  const uint8* data() const { return ptr_data_; }
+  uint64 size() const { return size_; }
+
+ private:
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#else
+  int fd_;
+#endif
+  const uint8* ptr_data_;
+  uint64 size_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : file_(INVALID_HANDLE_VALUE),
+      mapping_(NULL),
+      ptr_data_(NULL),
+      size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  if (ptr_data_) {
+    UnmapViewOfFile(ptr_data_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+  }
+}
+
+bool MappedFile::Open(const std::string& file_name) {
+  file_ = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "cannot open " << file_name;
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_, &file_size) || file_size.QuadPart <= 0) {
+    LOG(ERROR) << "cannot read size of " << file_name;
+    return false;
+  }
+  mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping_) {
+    LOG(ERROR) << "cannot map " << file_name;
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<const uint8*>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!ptr_data_) {
+    LOG(ERROR) << "cannot map view of " << file_name;
+    return false;
+  }
+  size_ = static_cast<uint64>(file_size.QuadPart);
+  return true;
+}
+#else
+MappedFile::MappedFile() : fd_(-1), ptr_data_(NULL), size_(0) {}
+
+MappedFile::~MappedFile() {
+  if (ptr_data_) {
+    munmap(const_cast<uint8*>(ptr_data_), size_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+bool MappedFile::Open(const std::string& file_name) {
+  fd_ = open(file_name.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    LOG(ERROR) << "cannot open " << file_name;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) != 0 || file_stat.st_size <= 0) {
+    LOG(ERROR) << "cannot read size of " << file_name;
+    return false;
+  }
+  const size_t length = static_cast<size_t>(file_stat.st_size);
+  void* const ptr_map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (ptr_map == MAP_FAILED) {
+    LOG(ERROR) << "cannot map " << file_name;
+    return false;
+  }
+
+  // Input is read once, front to back.
+  madvise(ptr_map, length, MADV_SEQUENTIAL);
+  ptr_data_ = reinterpret_cast<const uint8*>(ptr_map);
+  size_ = length;
+  return true;
+}
+#endif  // _WIN32
+
+namespace {
+
+const char kY4mSignature[] = "YUV4MPEG2 ";
+const char kY4mFrameTag[] = "FRAME";
+
+// Time between delivery attempts when the encoder refuses input.
+const int kRetryIntervalMs = 1;
+
+// WAVE format tags that differ from |AudioFormat| values.
+const uint16 kWaveFormatExtensible = 0xFFFE;
+
+uint16 ReadLE16(const uint8* ptr_data) {
+  return static_cast<uint16>(ptr_data[0] | (ptr_data[1] << 8));
+}
+
+uint32 ReadLE32(const uint8* ptr_data) {
+  return static_cast<uint32>(ptr_data[0]) |
+         (static_cast<uint32>(ptr_data[1]) << 8) |
+         (static_cast<uint32>(ptr_data[2]) << 16) |
+         (static_cast<uint32>(ptr_data[3]) << 24);
+}
+
+// Returns the offset of the first '\n' at or after |offset|, or |size| when
+// there is none.
+uint64 FindNewline(const uint8* ptr_data, uint64 offset, uint64 size) {
+  const void* const ptr_newline =
+      memchr(ptr_data + offset, '\n', static_cast<size_t>(size - offset));
+  if (!ptr_newline) {
+    return size;
+  }
+  return static_cast<const uint8*>(ptr_newline) - ptr_data;
+}
+
+}  // namespace
+
+FileMediaSource::FileMediaSource()
+    : realtime_(true),
+      ptr_clock_(NULL),
+      start_time_ms_(0),
+      video_frame_size_(0),
+      frame_rate_numerator_(0),
+      frame_rate_denominator_(0),
+      video_offset_(0),
+      num_frames_delivered_(0),
+      audio_data_offset_(0),
+      audio_data_size_(0),
+      audio_bytes_delivered_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+FileMediaSource::~FileMediaSource() {
+  Stop();
+}
+
+int FileMediaSource::Init(const WebmEncoderConfig& config,
+                          AudioSamplesCallbackInterface* ptr_audio_callback,
+                          VideoFrameCallbackInterface* ptr_video_callback,
+                          VideoFrameAllocatorInterface* ptr_video_allocator) {
+  realtime_ = config.input_realtime;
+  ptr_clock_ = config.ptr_clock ? config.ptr_clock : GetSystemClock();
+  delivery_.Init(realtime_, ptr_audio_callback, ptr_video_callback,
+                 ptr_video_allocator,
+                 std::bind(&FileMediaSource::WaitToRetry, this));
+
+  if (!config.disable_video) {
+    if (config.input_video_file.empty()) {
+      LOG(ERROR) << "video enabled without a Y4M input file.";
+      return WebmEncoder::kNoVideoSource;
+    }
+    if (!ptr_video_callback && !ptr_video_allocator) {
+      LOG(ERROR) << "NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const int status = OpenVideo(config.input_video_file);
+    if (status) {
+      return status;
+    }
+  }
+  if (!config.disable_audio) {
+    if (config.input_audio_file.empty()) {
+      LOG(ERROR) << "audio enabled without a WAV input file.";
+      return WebmEncoder::kNoAudioSource;
+    }
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const int status = OpenAudio(config.input_audio_file);
+    if (status) {
+      return status;
+    }
+  }
+  return kSuccess;
+}
+
+int FileMediaSource::Run() {
+  if (thread_) {
+    LOG(ERROR) << "file source already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  start_time_ms_ = ptr_clock_->NowMs();
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&FileMediaSource::DeliveryThread,  // NOLINT
+                                this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot start file source thread.";
+    return WebmEncoder::kRunFailed;
+  }
+  return kSuccess;
+}
+
+int FileMediaSource::CheckStatus() {
+  return status_.load();
+}
+
+void FileMediaSource::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  if (thread_) {
+    thread_->join();
+    thread_.reset();
+  }
+}
+
+int FileMediaSource::OpenVideo(const std::string& file_name) {
+  video_file_.reset(new (std::nothrow) MappedFile());  // NOLINT
+  if (!video_file_) {
+    return WebmEncoder::kNoMemory;
+  }
+  if (!video_file_->Open(file_name)) {
+    return kFileOpenError;
+  }
+  const uint8* const ptr_data = video_file_->data();
+  const uint64 size = video_file_->size();
+  const size_t signature_length = sizeof(kY4mSignature) - 1;
+  if (size < signature_length ||
+      memcmp(ptr_data, kY4mSignature, signature_length)) {
+    LOG(ERROR) << file_name << " is not a Y4M file.";
+    return kUnsupportedFile;
+  }
+  const uint64 header_end = FindNewline(ptr_data, 0, size);
+  if (header_end == size) {
+    LOG(ERROR) << file_name << " has no Y4M stream header.";
+    return kUnsupportedFile;
+  }
+
+  // Parse the stream header parameters; each is a tag letter followed by a
+  // value.
+  frame_rate_numerator_ = 30;
+  frame_rate_denominator_ = 1;
+  int64 width = 0;
+  int64 height = 0;
+  std::istringstream header(std::string(
+      reinterpret_cast<const char*>(ptr_data) + signature_length,
+      reinterpret_cast<const char*>(ptr_data) + header_end));
+  std::string param;
+  while (header >> param) {
+    const std::string value = param.substr(1);
+    switch (param[0]) {
+      case 'W':
+        width = strtol(value.c_str(), NULL, 10);
+        break;
+      case 'H':
+        height = strtol(value.c_str(), NULL, 10);
+        break;
+      case 'F': {
+        char* ptr_end = NULL;
+        frame_rate_numerator_ = strtol(value.c_str(), &ptr_end, 10);
+        frame_rate_denominator_ =
+            *ptr_end == ':' ? strtol(ptr_end + 1, NULL, 10) : 0;
+        break;
+      }
+      case 'C':
+        // All 8 bit 4:2:0 variants share the I420 layout; they differ only
+        // in chroma siting.
+        if (value != "420" && value != "420jpeg" && value != "420paldv" &&
+            value != "420mpeg2") {
+          LOG(ERROR) << "unsupported Y4M colorspace " << value;
+          return kUnsupportedFile;
+        }
+        break;
+      default:
+        // Interlacing, aspect ratio and extensions do not affect decoding.
+        break;
+    }
+  }
+  if (width <= 0 || height <= 0 ||
+      frame_rate_numerator_ <= 0 || frame_rate_denominator_ <= 0) {
+    LOG(ERROR) << "invalid Y4M stream header in " << file_name;
+    return kUnsupportedFile;
+  }
+
+  // Frame sizes are int32; check the dimensions before multiplying them.
+  const int64 kMaxFrameSize = std::numeric_limits<int32>::max();
+  if (width > kMaxFrameSize || height > kMaxFrameSize) {
+    LOG(ERROR) << "Y4M frame dimensions too large in " << file_name;
+    return kUnsupportedFile;
+  }
+  const int64 chroma_width = (width + 1) / 2;
+  const int64 chroma_height = (height + 1) / 2;
+  const int64 frame_size = width * height + 2 * chroma_width * chroma_height;
+  if (frame_size > kMaxFrameSize) {
+    LOG(ERROR) << "Y4M frame size too large in " << file_name << ": "
+               << width << "x" << height;
+    return kUnsupportedFile;
+  }
+  video_config_.width = static_cast<int32>(width);
+  video_config_.height = static_cast<int32>(height);
+  video_config_.format = kVideoFormatI420;
+  video_config_.stride = video_config_.width;
+  video_config_.frame_rate =
+      static_cast<double>(frame_rate_numerator_) / frame_rate_denominator_;
+  video_frame_size_ = static_cast<int32>(frame_size);
+  video_offset_ = header_end + 1;
+  LOG(INFO) << "Y4M input " << file_name << ": " << video_config_.width
+            << "x" << video_config_.height << " @ "
+            << video_config_.frame_rate << " fps";
+  return kSuccess;
+}
+
+int FileMediaSource::OpenAudio(const std::string& file_name) {
+  audio_file_.reset(new (std::nothrow) MappedFile());  // NOLINT
+  if (!audio_file_) {
+    return WebmEncoder::kNoMemory;
+  }
+  if (!audio_file_->Open(file_name)) {
+    return kFileOpenError;
+  }
+  const uint8* const ptr_data = audio_file_->data();
+  const uint64 size = audio_file_->size();
+  if (size < 12 || memcmp(ptr_data, "RIFF", 4) ||
+      memcmp(ptr_data + 8, "WAVE", 4)) {
+    LOG(ERROR) << file_name << " is not a WAV file.";
+    return kUnsupportedFile;
+  }
+
+  // Walk the RIFF chunks until the data chunk; the format chunk precedes it.
+  bool have_format = false;
+  uint64 pos = 12;
+  while (pos + 8 <= size) {
+    const uint8* const ptr_chunk = ptr_data + pos;
+    const uint64 chunk_size = ReadLE32(ptr_chunk + 4);
+    const uint64 body = pos + 8;
+    if (!memcmp(ptr_chunk, "fmt ", 4) && chunk_size >= 16 &&
+        body + 16 <= size) {
+      const uint8* const ptr_format = ptr_data + body;
+      audio_config_.format_tag = ReadLE16(ptr_format);
+      audio_config_.channels = ReadLE16(ptr_format + 2);
+      audio_config_.sample_rate = ReadLE32(ptr_format + 4);
+      audio_config_.bytes_per_second = ReadLE32(ptr_format + 8);
+      audio_config_.block_align = ReadLE16(ptr_format + 12);
+      audio_config_.bits_per_sample = ReadLE16(ptr_format + 14);
+      if (audio_config_.format_tag == kWaveFormatExtensible &&
+          chunk_size >= 40 && body + 40 <= size) {
+        audio_config_.valid_bits_per_sample = ReadLE16(ptr_format + 18);
+        audio_config_.channel_mask = ReadLE32(ptr_format + 20);
+
+        // The sub format GUID begins with the format tag.
+        audio_config_.format_tag = ReadLE16(ptr_format + 24);
+      }
+      have_format = true;
+    } else if (!memcmp(ptr_chunk, "data", 4)) {
+      // Streamed WAV files may carry a placeholder size; clamp to the file.
+      audio_data_offset_ = body;
+      audio_data_size_ = std::min(chunk_size, size - body);
+      break;
+    }
+    pos = body + chunk_size + (chunk_size & 1);
+  }
+  if (!have_format || audio_data_offset_ == 0) {
+    LOG(ERROR) << file_name << " has no WAV format or data chunk.";
+    return kUnsupportedFile;
+  }
+  const bool pcm16 = audio_config_.format_tag == kAudioFormatPcm &&
+                     audio_config_.bits_per_sample == 16;
+  const bool float32 = audio_config_.format_tag == kAudioFormatIeeeFloat &&
+                       audio_config_.bits_per_sample == 32;
+  if ((!pcm16 && !float32) || audio_config_.channels == 0 ||
+      audio_config_.sample_rate == 0 || audio_config_.block_align == 0) {
+    LOG(ERROR) << "unsupported WAV format in " << file_name
+               << ": format_tag=" << audio_config_.format_tag
+               << " bits_per_sample=" << audio_config_.bits_per_sample;
+    return kUnsupportedFile;
+  }
+  LOG(INFO) << "WAV input " << file_name << ": "
+            << audio_config_.channels << " channels @ "
+            << audio_config_.sample_rate << " Hz";
+  return kSuccess;
+}
+
+void FileMediaSource::DeliveryThread() {
+  bool video_done = !video_file_;
+  bool audio_done = !audio_file_;
+  const int64 kNoTimestamp = std::numeric_limits<int64>::max();
+  while (!video_done || !audio_done) {
+    const int64 video_timestamp = video_done ? kNoTimestamp :
+        num_frames_delivered_ * kTimebase * frame_rate_denominator_ /
+        frame_rate_numerator_;
+    const int64 audio_timestamp = audio_done ? kNoTimestamp :
+        static_cast<int64>(audio_bytes_delivered_ / audio_config_.block_align *
+                           kTimebase / audio_config_.sample_rate);
+    const bool send_video = video_timestamp < audio_timestamp;
+    if (!WaitForTimestamp(std::min(video_timestamp, audio_timestamp))) {
+      LOG(INFO) << "file source stopped.";
+      return;
+    }
+    const int status = send_video ?
+        DeliverVideoFrame(&video_done) : DeliverAudioBuffer(&audio_done);
+    if (status) {
+      LOG(ERROR) << "file source delivery failed: " << status;
+      status_.store(status);
+      return;
+    }
+  }
+  LOG(INFO) << "file source reached end of input: " << num_frames_delivered_
+            << " frames, " << audio_bytes_delivered_ << " audio bytes.";
+  status_.store(kEndOfStream);
+}
+
+int FileMediaSource::DeliverVideoFrame(bool* ptr_done) {
+  const uint8* const ptr_data = video_file_->data();
+  const uint64 size = video_file_->size();
+  const size_t tag_length = sizeof(kY4mFrameTag) - 1;
+  if (video_offset_ + tag_length > size) {
+    *ptr_done = true;
+    return kSuccess;
+  }
+  if (memcmp(ptr_data + video_offset_, kY4mFrameTag, tag_length)) {
+    LOG(ERROR) << "Y4M frame header missing at offset " << video_offset_;
+    return kUnsupportedFile;
+  }
+  const uint64 frame_offset = FindNewline(ptr_data, video_offset_, size) + 1;
+  if (frame_offset + video_frame_size_ > size) {
+    LOG(WARNING) << "ignoring truncated Y4M frame at offset " << video_offset_;
+    *ptr_done = true;
+    return kSuccess;
+  }
+
+  const int64 timestamp = num_frames_delivered_ * kTimebase *
+      frame_rate_denominator_ / frame_rate_numerator_;
+  const int64 duration =
+      kTimebase * frame_rate_denominator_ / frame_rate_numerator_;
+  const int status = delivery_.DeliverVideoFrame(
+      video_config_, timestamp, duration, ptr_data + frame_offset,
+      video_frame_size_);
+  if (status == MediaDelivery::kStopped) {
+    return kSuccess;
+  }
+  if (status) {
+    return status;
+  }
+  video_offset_ = frame_offset + video_frame_size_;
+  ++num_frames_delivered_;
+  return kSuccess;
+}
+
+int FileMediaSource::DeliverAudioBuffer(bool* ptr_done) {
+  const uint32 block_align = audio_config_.block_align;
+  const uint64 remaining = audio_data_size_ - audio_bytes_delivered_;
+  if (remaining < block_align) {
+    *ptr_done = true;
+    return kSuccess;
+  }
+  const uint64 blocks_per_buffer = std::max<uint64>(
+      audio_config_.sample_rate * kAudioBufferDurationMs / kTimebase, 1);
+  const uint64 num_blocks =
+      std::min(blocks_per_buffer, remaining / block_align);
+  const int32 length = static_cast<int32>(num_blocks * block_align);
+  const uint64 first_block = audio_bytes_delivered_ / block_align;
+  const int64 timestamp =
+      static_cast<int64>(first_block * kTimebase / audio_config_.sample_rate);
+  const int64 duration =
+      static_cast<int64>(num_blocks * kTimebase / audio_config_.sample_rate);
+  const uint8* const ptr_samples =
+      audio_file_->data() + audio_data_offset_ + audio_bytes_delivered_;
+  const int status = delivery_.DeliverAudioBuffer(
+      audio_config_, timestamp, duration, ptr_samples, length);
+  if (status == MediaDelivery::kStopped) {
+    return kSuccess;
+  }
+  if (status) {
+    return status;
+  }
+  audio_bytes_delivered_ += length;
+  return kSuccess;
+}
+
+bool FileMediaSource::WaitForTimestamp(int64 timestamp) {
+  const int64 wait_ms = ptr_clock_->AdvanceTo(start_time_ms_ + timestamp);
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (realtime_ && wait_ms > 0) {
+    wake_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                   [this]() { return stop_; });
+  }
+  return !stop_;
+}
+
+bool FileMediaSource::WaitToRetry() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  wake_.wait_for(lock, std::chrono::milliseconds(kRetryIntervalMs),
+                 [this]() { return stop_; });
+  return !stop_;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,134 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/clock.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+class MappedFile;
+
+// Media source that reads I420 video from a Y4M file and PCM or IEEE float
+// audio from a WAV file. The files are memory mapped, and frames and buffers
+// are copied straight from the mapping into the encoder's pools.
+//
+// Input is delivered in timestamp order from a single thread, either paced to
+// real time or as fast as the encoder accepts it. When not paced, a video
+// frame or audio buffer refused because the encoder's pool is full is offered
+// again until it is accepted, so no input is dropped under the default pool
+// drop policies. |CheckStatus()| returns |kEndOfStream| once both files have
+// been delivered.
+class FileMediaSource : public MediaSourceInterface {
+ public:
+  enum {
+    // The input file could not be opened or mapped.
+    kFileOpenError = -301,
+
+    // The input file is not a supported Y4M or WAV file.
+    kUnsupportedFile = -300,
+  };
+
+  // Duration of each delivered audio buffer.
+  static const int kAudioBufferDurationMs = 20;
+
+  FileMediaSource();
+  ~FileMediaSource() override;
+
+  // Opens |config.input_video_file| unless |config.disable_video| is true, and
+  // |config.input_audio_file| unless |config.disable_audio| is true. Returns
+  // |WebmEncoder::kNoVideoSource| or |WebmEncoder::kNoAudioSource| when an
+  // enabled stream has no file.
+  int Init(const WebmEncoderConfig& config,
+           AudioSamplesCallbackInterface* ptr_audio_callback,
+           VideoFrameCallbackInterface* ptr_video_callback,
+           VideoFrameAllocatorInterface* ptr_video_allocator) override;
+  int Run() override;
+  int CheckStatus() override;
+  void Stop() override;
+  AudioConfig actual_audio_config() const override { return audio_config_; }
+  VideoConfig actual_video_config() const override { return video_config_; }
+
+ private:
+  // Maps |file_name| and parses its Y4M stream header.
+  int OpenVideo(const std::string& file_name);
+
+  // Maps |file_name| and parses its WAV header.
+  int OpenAudio(const std::string& file_name);
+
+  // Delivery thread. Sends frames and buffers in timestamp order until both
+  // files are exhausted or |Stop()| is called.
+  void DeliveryThread();
+
+  // Deliver the next video frame or audio buffer. Set |*ptr_done| to true
+  // when the stream is exhausted. Return |kSuccess| or a |WebmEncoder| status
+  // code.
+  int DeliverVideoFrame(bool* ptr_done);
+  int DeliverAudioBuffer(bool* ptr_done);
+
+  // Moves |ptr_clock_| to |timestamp| milliseconds after the start of
+  // delivery, and waits for it to get there when pacing to real time.
+  // Returns false when |Stop()| is called.
+  bool WaitForTimestamp(int64 timestamp);
+
+  // Sleeps briefly before input refused by the encoder is offered again.
+  // Returns false when |Stop()| is called.
+  bool WaitToRetry();
+
+  bool realtime_;
+
+  // Paces delivery. Not owned. |start_time_ms_| is the |ptr_clock_| time at
+  // which delivery started.
+  ClockInterface* ptr_clock_;
+  int64 start_time_ms_;
+  MediaDelivery delivery_;
+
+  // Video input. |video_offset_| is the offset of the next FRAME header in
+  // |video_file_|.
+  std::unique_ptr<MappedFile> video_file_;
+  VideoConfig video_config_;
+  int32 video_frame_size_;
+  int32 frame_rate_numerator_;
+  int32 frame_rate_denominator_;
+  uint64 video_offset_;
+  int64 num_frames_delivered_;
+
+  // Audio input. |audio_data_offset_| and |audio_data_size_| locate the WAV
+  // data chunk in |audio_file_|.
+  std::unique_ptr<MappedFile> audio_file_;
+  AudioConfig audio_config_;
+  uint64 audio_data_offset_;
+  uint64 audio_data_size_;
+  uint64 audio_bytes_delivered_;
+
+  // Delivery thread state. |stop_| is protected by |mutex_|, and |wake_|
+  // interrupts pacing waits when it is set.
+  std::shared_ptr<std::thread> thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+
+  // |kSuccess| while delivering, then |kEndOfStream| or an error status.
+  std::atomic<int> status_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FileMediaSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
@@ -7,12 +7,11 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/file_writer.h"
 
-#include <condition_variable>
 #include <cstdio>
 #include <ctime>
 #include <functional>
 #include <memory>
-#include <mutex>
+#include <new>
 #include <string>
 #include <thread>
 #include <vector>
@@ -23,11 +22,19 @@
 
 namespace webmlive {
 
-bool FileWriter::Init(bool dash_mode, const std::string& directory) {
-  if (!dash_mode) {
-    file_name_ = LocalDateString() + LocalTimeString() + ".webm";
+bool FileWriter::Init(const FileWriterSettings& settings) {
+  buffer_q_.Init(settings.queue_options);
+  queue_options_ = settings.queue_options;
+  thread_options_ = settings.thread_options;
+  if (!settings.dash_mode) {
+    ClockInterface* const ptr_clock =
+        settings.ptr_clock ? settings.ptr_clock : GetSystemClock();
+    const int64 wall_time_ms = ptr_clock->WallTimeMs();
+    file_name_ = LocalDateString(wall_time_ms) +
+                 LocalTimeString(wall_time_ms) + ".webm";
   }
-  directory_ = directory;
+  dash_mode_ = settings.dash_mode;
+  directory_ = settings.directory;
   return true;
 }
 
@@ -46,50 +53,66 @@ bool FileWriter::Run() {
   return true;
 }
 
-bool FileWriter::Stop() {
-  // Tell WriterThread() to stop.
-  mutex_.lock();
-  stop_ = true;
-  mutex_.unlock();
+bool FileWriter::Run(WorkerPool* ptr_pool) {
+  if (!ptr_pool) {
+    LOG(ERROR) << "NULL worker pool.";
+    return false;
+  }
+  runner_.reset(new (std::nothrow) SerialTaskRunner(ptr_pool));  // NOLINT
+  if (!runner_) {
+    LOG(ERROR) << "Out of memory.";
+    return false;
+  }
+  return true;
+}
 
-  // Wake and wait for WriterThread() to exit.
-  wake_condition_.notify_one();
+// Closes |buffer_q_|, which wakes WriterThread() and causes it to exit once
+// all queued buffers are written. In |WorkerPool| mode waits for the queued
+// writer tasks instead.
+bool FileWriter::Stop() {
+  buffer_q_.Close();
+  if (runner_) {
+    runner_->WaitIdle();
+    WriteQueuedBuffers();
+    return true;
+  }
   thread_->join();
   return true;
 }
 
-// Stores data in |buffer_q_| and returns true.
+// Stores data in |buffer_q_| and returns true, including when the overflow
+// policy drops the buffer. Returns false once a file write has failed, or
+// when the queue is closed.
 bool FileWriter::WriteData(const SharedDataSinkBuffer& buffer) {
-  if (!buffer_q_.EnqueueBuffer(buffer)) {
-    LOG(ERROR) << "Write buffer enqueue failed.";
+  if (write_failed_.load()) {
+    LOG(ERROR) << "FileWriter stopped after a failed write.";
     return false;
   }
-  // Wake WriterThread().
-  LOG(INFO) << "waking WriterThread with " << buffer->data.size() << " bytes";
-  wake_condition_.notify_one();
-  return true;
-}
-
-// Try to obtain lock on |mutex_|, and return the value of |stop_| if lock is
-// obtained. Returns false if unable to obtain the lock.
-bool FileWriter::StopRequested() {
-  bool stop_requested = false;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    stop_requested = stop_;
+  const int status = buffer_q_.EnqueueBuffer(buffer);
+  if (status == SharedBufferQueue::kDropped) {
+    return true;
   }
-  return stop_requested;
+  if (status) {
+    LOG(ERROR) << "Write buffer enqueue failed: " << status;
+    return false;
+  }
+  if (runner_ && !write_scheduled_.exchange(true)) {
+    runner_->Post(std::bind(&FileWriter::WriteQueuedBuffers, this));
+  }
+  VLOG(1) << "queued " << buffer->data.size() << " bytes for WriterThread";
+  return true;
 }
 
-// Idle the upload thread while awaiting user data.
-void FileWriter::WaitForUserData() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  wake_condition_.wait(lock);  // Unlock |mutex_| and idle the thread while we
-                               // wait for the next chunk of user data.
+bool FileWriter::WriteWouldBlock(const SharedDataSinkBuffer& buffer) {
+  return buffer_q_.WouldBlock(buffer);
 }
 
-// Writes |data| contents to file and returns true upon success.
+// Writes |data| contents to file and returns true upon success. Fragments of
+// a progressive chunk share an id, so they are appended to the same file.
 bool FileWriter::WriteFile(const SharedDataSinkBuffer& buffer) const {
+  if (buffer->data.empty()) {
+    return true;
+  }
   std::string file_name;
   if (dash_mode_) {
     file_name = directory_ + buffer->id;
@@ -108,17 +131,35 @@ bool FileWriter::WriteFile(const SharedDataSinkBuffer& buffer) const {
   return (bytes_written == buffer->data.size());
 }
 
-// Runs until StopRequested() returns true.
+// Runs until |buffer_q_| is closed and empty.
 void FileWriter::WriterThread() {
-  while (!StopRequested() || buffer_q_.GetNumBuffers() > 0) {
+  ApplyThreadOptions(thread_options_, "webmlive-writer");
+  for (;;) {
     SharedDataSinkBuffer buffer = buffer_q_.DequeueBuffer();
     if (buffer.get() == NULL) {
-      // Wait for a buffer.
-      WaitForUserData();
-      continue;
+      // |buffer_q_| closed and drained.
+      break;
+    }
+    if (!WriteFile(buffer)) {
+      LOG(ERROR) << "Write failed for id: " << buffer->id;
+      write_failed_.store(true);
+    }
+  }
+}
+
+void FileWriter::WriteQueuedBuffers() {
+  // Clear the flag before reading the queue: buffers that arrive during the
+  // run queue another run.
+  write_scheduled_.store(false);
+  const size_t num_buffers = buffer_q_.GetNumBuffers();
+  for (size_t i = 0; i < num_buffers; ++i) {
+    const SharedDataSinkBuffer buffer = buffer_q_.TryDequeueBuffer();
+    if (!buffer) {
+      break;
     }
     if (!WriteFile(buffer)) {
       LOG(ERROR) << "Write failed for id: " << buffer->id;
+      write_failed_.store(true);
     }
   }
 }
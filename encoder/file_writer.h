@@ -8,55 +8,103 @@
 #ifndef WEBMLIVE_ENCODER_FILE_WRITER_H_
 #define WEBMLIVE_ENCODER_FILE_WRITER_H_
 
-#include <condition_variable>
+#include <atomic>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "encoder/buffer_util.h"
+#include "encoder/clock.h"
 #include "encoder/data_sink.h"
+#include "encoder/thread_util.h"
+#include "encoder/worker_pool.h"
 
 namespace webmlive {
 
+struct FileWriterSettings {
+  FileWriterSettings() : dash_mode(false), ptr_clock(NULL) {}
+
+  // Write each buffer to a file named after its |id| in |directory| when
+  // true. Otherwise write all buffers to one file in |directory|.
+  bool dash_mode;
+
+  // Output directory. Prepended to file names as is.
+  std::string directory;
+
+  // Write queue configuration. Controls how much data may wait to be
+  // written, and whether |FileWriter::WriteData()| blocks or sheds data when
+  // the writer falls behind.
+  SharedBufferQueue::Options queue_options;
+
+  // Scheduling settings applied to the writer thread.
+  ThreadOptions thread_options;
+
+  // Clock used to name the output file after the wall time when
+  // |dash_mode| is false. Not owned. The system clock is used when NULL.
+  ClockInterface* ptr_clock;
+};
+
 // Writes SharedDataSinkBuffer contents to file(s). When in DASH mode writes
 // are to multiple files named according to the |id| member of the
 // SharedDataSinkBuffer. Otherwise writes all SharedDataSinkBuffer contents to
 // a single file.
 class FileWriter : public DataSinkInterface {
  public:
-  FileWriter() : dash_mode_(true), stop_(false) {}
+  FileWriter()
+      : dash_mode_(true), write_failed_(false), write_scheduled_(false) {}
   virtual ~FileWriter() {}
 
-  // Readies the writer and returns true. Must be called before Run().
-  bool Init(bool dash_mode, const std::string& directory);
+  // Readies the writer using |settings| and returns true. Must be called
+  // before Run().
+  bool Init(const FileWriterSettings& settings);
 
   // Runs the writer thread and returns true upon success.
   bool Run();
 
-  // Stops the writer thread. Blocks until thread stops. Returns true upon
-  // success.
+  // Writes on |ptr_pool| instead of a dedicated thread, and returns true upon
+  // success. A full |buffer_q_| applies its overflow policy as in thread
+  // mode. Producers running on |ptr_pool| must not call |WriteData()| while
+  // |WriteWouldBlock()| returns true: the writer task that makes room may be
+  // queued behind them.
+  bool Run(WorkerPool* ptr_pool);
+
+  // Stops the writer thread, or waits for the writer tasks when running on a
+  // |WorkerPool|. Blocks until all queued buffers are written. Returns true
+  // upon success.
   bool Stop();
 
-  // DataSinkInferface methods.
+  // DataSinkInferface methods. |WriteData()| blocks or drops |buffer| when
+  // |buffer_q_| is full, depending on the queue options. It returns false
+  // once writing a file has failed.
   bool WriteData(const SharedDataSinkBuffer& buffer) override;
   std::string Name() const override { return "FileWriter"; }
+  bool WriteWouldBlock(const SharedDataSinkBuffer& buffer) override;
 
  private:
-  bool StopRequested();
-  void WaitForUserData();
   bool WriteFile(const SharedDataSinkBuffer& buffer) const;
   void WriterThread();
 
+  // Writes the buffers queued in |buffer_q_| when the run starts. Buffers
+  // queued during the run schedule another run. Used in |WorkerPool| mode.
+  void WriteQueuedBuffers();
+
   bool dash_mode_;
-  bool stop_;
   std::string directory_;
   std::string file_name_;  // Used only when |dash_mode_| is false.
-  std::mutex mutex_;
-  std::condition_variable wake_condition_;
   std::shared_ptr<std::thread> thread_;
+  ThreadOptions thread_options_;
+  SharedBufferQueue::Options queue_options_;
   SharedBufferQueue buffer_q_;
+
+  // Set by the writer when |WriteFile()| fails.
+  std::atomic<bool> write_failed_;
+
+  // |WorkerPool| mode state. |write_scheduled_| is true while a run of
+  // |WriteQueuedBuffers()| is queued on |runner_| and has not yet started,
+  // which limits the writer to one queued run.
+  std::unique_ptr<SerialTaskRunner> runner_;
+  std::atomic<bool> write_scheduled_;
 };
 
 }  // namespace webmlive
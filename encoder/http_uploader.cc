@@ -9,11 +9,9 @@
 
 #include <cassert>
 #include <ctime>
-#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
 #include <vector>
@@ -38,6 +36,14 @@ static const char kFormName[] = "webm_file";
 static const char kWebmMimeType[] = "video/webm";
 static const char kContentIdHeader[] = "X-Content-Id: ";
 static const char kSessionIdHeader[] = "X-Session-Id: ";
+static const char kContentFragmentHeader[] = "X-Content-Fragment: ";
+static const char kFirstFragment[] = "first";
+static const char kContinuationFragment[] = "continuation";
+static const char kLastFragment[] = "last";
+
+// Posted in place of the data of an empty buffer; libcurl reads its upload
+// data from a callback when |CURLOPT_POSTFIELDS| is NULL.
+static const uint8 kNoData[1] = {0};
 
 class HttpUploaderImpl {
  public:
@@ -56,6 +62,9 @@ class HttpUploaderImpl {
   // Enqueues user data for upload.
   bool EnqueueBuffer(const SharedDataSinkBuffer& buffer);
 
+  // Returns true when |EnqueueBuffer(buffer)| would wait for |buffer_q_|.
+  bool EnqueueWouldBlock(const SharedDataSinkBuffer& buffer);
+
   // Stops the uploader.
   bool Stop();
 
@@ -66,8 +75,9 @@ class HttpUploaderImpl {
   // Pass our callbacks, |ProgressCallback| and |WriteCallback|, to libcurl.
   CURLcode SetCurlCallbacks();
 
-  // Pass user HTTP headers to libcurl, and disable HTTP 100 responses.
-  CURLcode SetHeaders(const std::string& content_id);
+  // Pass user HTTP headers to libcurl, and disable HTTP 100 responses. Adds
+  // the X-Content-Fragment header when |buffer| is a fragment of a chunk.
+  CURLcode SetHeaders(const DataSinkBuffer& buffer);
 
   // Configures libcurl to POST data buffers as file data in a form/multipart
   // HTTP POST.
@@ -79,9 +89,6 @@ class HttpUploaderImpl {
   // Upload user data with libcurl.
   bool Upload(const SharedDataSinkBuffer& buffer);
 
-  // Wakes up |UploadThread| when users pass data through |UploadBuffer|.
-  void WaitForUserData();
-
   // Libcurl progress callback function.  Acquires |mutex_| and updates
   // |stats_|.
   static int ProgressCallback(void* ptr_this,
@@ -93,12 +100,12 @@ class HttpUploaderImpl {
   static size_t WriteCallback(char* buffer, size_t size, size_t nitems,
                               void* ptr_this);
 
-  // Acquires |mutex_|, resets |stats_| and sets |start_ticks_|.
+  // Acquires |mutex_|, resets |stats_| and sets |start_time_ms_|.
   void ResetStats();
 
-  // Thread function. Wakes when |WaitForUserData| is notified by
-  // |UploadBuffer|, and calls |Upload| to POST user data to the HTTP server
-  // using libcurl.
+  // Thread function. Blocks in |buffer_q_| until user data is available, and
+  // calls |Upload| to POST user data to the HTTP server using libcurl. Exits
+  // when |buffer_q_| is closed and empty.
   void UploadThread();
 
   // Frees HTTP header list.
@@ -113,10 +120,6 @@ class HttpUploaderImpl {
   // users of the uploader to base all Upload calls on |UploadComplete|.
   bool upload_complete_;
 
-  // Condition variable used to wake |UploadThread| when a user code passes a
-  // buffer to |UploadBuffer|.
-  std::condition_variable wake_condition_;
-
   // Mutex for synchronization of public method calls with |UploadThread|
   // activity. Mutable so |UploadComplete()| can be a const method.
   mutable std::mutex mutex_;
@@ -124,8 +127,12 @@ class HttpUploaderImpl {
   // Thread object.
   std::shared_ptr<std::thread> upload_thread_;
 
-  // Uploader start time.  Reset when via |ResetStatts| when |Init| is called.
-  clock_t start_ticks_;
+  // Clock used for upload throughput. Not owned.
+  ClockInterface* ptr_clock_;
+
+  // Uploader start time in |ptr_clock_| milliseconds. Reset via
+  // |ResetStats()|.
+  int64 start_time_ms_;
 
   // Libcurl pointer.
   CURL* ptr_curl_;
@@ -145,10 +152,9 @@ class HttpUploaderImpl {
   // Basic stats stored by |ProgressCallback|.
   HttpUploaderStats stats_;
 
-  // Simple buffer object that remains locked while libcurl uploads data in
-  // |Upload|.  This second locking mechanism is in place to allow |mutex_| to
-  // be unlocked while uploads are in progress (which prevents public methods
-  // from blocking).
+  // Bounded queue of buffers waiting for upload. Has its own lock to allow
+  // |mutex_| to be unlocked while uploads are in progress (which prevents
+  // public methods from blocking).
   SharedBufferQueue buffer_q_;
 
   // The name of the file on the local system.  Note that it is not being read,
@@ -204,6 +210,11 @@ bool HttpUploader::WriteData(const SharedDataSinkBuffer& buffer) {
   return ptr_uploader_->EnqueueBuffer(buffer);
 }
 
+// Return result of |EnqueueWouldBlock| on |ptr_uploader_|.
+bool HttpUploader::WriteWouldBlock(const SharedDataSinkBuffer& buffer) {
+  return ptr_uploader_->EnqueueWouldBlock(buffer);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // HttpUploaderImpl
 //
@@ -214,7 +225,9 @@ HttpUploaderImpl::HttpUploaderImpl()
       ptr_form_end_(NULL),
       ptr_headers_(NULL),
       stop_(false),
-      upload_complete_(true) {
+      upload_complete_(true),
+      ptr_clock_(GetSystemClock()),
+      start_time_ms_(0) {
 }
 
 HttpUploaderImpl::~HttpUploaderImpl() {
@@ -241,6 +254,10 @@ bool HttpUploaderImpl::Init(const HttpUploaderSettings& settings) {
 
   // copy user settings
   settings_ = settings;
+  buffer_q_.Init(settings_.queue_options);
+  if (settings_.ptr_clock) {
+    ptr_clock_ = settings_.ptr_clock;
+  }
 
   // Init libcurl.
   ptr_curl_ = curl_easy_init();
@@ -250,7 +267,7 @@ bool HttpUploaderImpl::Init(const HttpUploaderSettings& settings) {
   }
 
   // Enable progress reports from libcurl.
-  CURLcode curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_NOPROGRESS, FALSE);
+  CURLcode curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_NOPROGRESS, 0L);
   if (curl_ret != CURLE_OK) {
     LOG_CURL_ERR(curl_ret, "curl progress enable failed.");
     return false;
@@ -299,23 +316,29 @@ bool HttpUploaderImpl::Run() {
   return true;
 }
 
-// Enqueue the user buffer. Does not lock |mutex_|; relies on
-// |upload_buffer_|'s internal lock.
+// Enqueue the user buffer. Does not lock |mutex_|; relies on |buffer_q_|'s
+// internal lock. Blocks or drops |buffer| when |buffer_q_| is full; a dropped
+// buffer is not a failure.
 bool HttpUploaderImpl::EnqueueBuffer(const SharedDataSinkBuffer& buffer) {
-  if (!buffer_q_.EnqueueBuffer(buffer)) {
-    LOG(ERROR) << "Upload buffer enqueue failed.";
+  const int status = buffer_q_.EnqueueBuffer(buffer);
+  if (status == SharedBufferQueue::kDropped) {
+    return true;
+  }
+  if (status) {
+    LOG(ERROR) << "Upload buffer enqueue failed: " << status;
     return false;
   }
-  // Wake |UploadThread|.
-  LOG(INFO) << "waking uploader with " << buffer->data.size() << " bytes";
-  wake_condition_.notify_one();
+  VLOG(1) << "queued " << buffer->data.size() << " bytes for upload";
   return true;
 }
 
+bool HttpUploaderImpl::EnqueueWouldBlock(const SharedDataSinkBuffer& buffer) {
+  return buffer_q_.WouldBlock(buffer);
+}
+
 // Stops UploadThread() by obtaining lock on |mutex_| and setting |stop_| to
-// true, and then waking the upload thread by calling notify_one() on
-// |wake_condition_|.
-// The lock on |mutex_| is released before calling notify_one() to ensure that
+// true, and then waking the upload thread by closing |buffer_q_|.
+// The lock on |mutex_| is released before closing |buffer_q_| to ensure that
 // a running upload stops when StopRequested() is called within the libcurl
 // callbacks.
 bool HttpUploaderImpl::Stop() {
@@ -328,7 +351,7 @@ bool HttpUploaderImpl::Stop() {
   mutex_.unlock();
 
   // Wake up the upload thread.
-  wake_condition_.notify_one();
+  buffer_q_.Close();
   // And wait for it to exit.
   upload_thread_->join();
   return true;
@@ -380,7 +403,7 @@ CURLcode HttpUploaderImpl::SetCurlCallbacks() {
 
 // Disable HTTP 100 responses (send empty Expect header), and pass user HTTP
 // headers into lib curl.
-CURLcode HttpUploaderImpl::SetHeaders(const std::string& content_id) {
+CURLcode HttpUploaderImpl::SetHeaders(const DataSinkBuffer& buffer) {
   FreeHeaders();
   // Tell libcurl to omit "Expect: 100-continue" from requests
   ptr_headers_ = curl_slist_append(ptr_headers_, kExpectHeader);
@@ -400,9 +423,21 @@ CURLcode HttpUploaderImpl::SetHeaders(const std::string& content_id) {
   // add session ID.
   const std::string session_id_header = kSessionIdHeader + settings_.session_id;
   ptr_headers_ = curl_slist_append(ptr_headers_, session_id_header.c_str());
-  // add |content_id|.
-  const std::string content_id_header = kContentIdHeader + content_id;
+  // add |buffer.id|.
+  const std::string content_id_header = kContentIdHeader + buffer.id;
   ptr_headers_ = curl_slist_append(ptr_headers_, content_id_header.c_str());
+  // add fragment position for progressive output.
+  if (buffer.continuation || !buffer.last_fragment) {
+    std::string fragment_header = kContentFragmentHeader;
+    if (!buffer.continuation) {
+      fragment_header += kFirstFragment;
+    } else if (!buffer.last_fragment) {
+      fragment_header += kContinuationFragment;
+    } else {
+      fragment_header += kLastFragment;
+    }
+    ptr_headers_ = curl_slist_append(ptr_headers_, fragment_header.c_str());
+  }
   const CURLcode err = curl_easy_setopt(ptr_curl_,
                                         CURLOPT_HTTPHEADER, ptr_headers_);
   if (err != CURLE_OK) {
@@ -489,20 +524,23 @@ bool HttpUploaderImpl::Upload(const SharedDataSinkBuffer& buffer) {
     LOG_CURL_ERR(err, "could not pass URL to curl.");
     return false;
   }
+  // The last fragment of a progressive chunk may be empty.
+  const uint8* const ptr_data =
+      buffer->data.empty() ? kNoData : &buffer->data[0];
   if (settings_.post_mode == webmlive::HTTP_FORM_POST) {
-    if (!SetupFormPost(&buffer->data[0], buffer->data.size())) {
+    if (!SetupFormPost(ptr_data, buffer->data.size())) {
       LOG(ERROR) << "SetupFormPost failed!";
       return false;
     }
   } else {
-    if (!SetupPost(&buffer->data[0], buffer->data.size())) {
+    if (!SetupPost(ptr_data, buffer->data.size())) {
       LOG(ERROR) << "SetupPost failed!";
       return false;
     }
   }
 
   // Disable HTTP 100 responses, and set user HTTP headers.
-  err = SetHeaders(buffer->id);
+  err = SetHeaders(*buffer);
   if (err) {
     LOG_CURL_ERR(err, "unable to set headers.");
     return false;
@@ -530,13 +568,6 @@ bool HttpUploaderImpl::Upload(const SharedDataSinkBuffer& buffer) {
   return true;
 }
 
-// Idle the upload thread while awaiting user data.
-void HttpUploaderImpl::WaitForUserData() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  wake_condition_.wait(lock);  // Unlock |mutex_| and idle the thread while we
-                               // wait for the next chunk of user data.
-}
-
 // Handle libcurl progress updates. Returns 1 to signal that libcurl should stop
 // sending data. Returns 0 otherwise.
 int HttpUploaderImpl::ProgressCallback(void* ptr_this,
@@ -553,11 +584,13 @@ int HttpUploaderImpl::ProgressCallback(void* ptr_this,
   std::lock_guard<std::mutex> lock(ptr_uploader_->mutex_);
   HttpUploaderStats& stats = ptr_uploader_->stats_;
   stats.bytes_sent_current = static_cast<int64>(upload_current);
-  double ticks_elapsed = clock() - ptr_uploader_->start_ticks_;
-  double ticks_per_sec = CLOCKS_PER_SEC;
-  stats.bytes_per_second =
-      (upload_current + stats.total_bytes_uploaded) /
-      (ticks_elapsed / ticks_per_sec);
+  const int64 ms_elapsed =
+      ptr_uploader_->ptr_clock_->NowMs() - ptr_uploader_->start_time_ms_;
+  if (ms_elapsed > 0) {
+    stats.bytes_per_second =
+        (upload_current + stats.total_bytes_uploaded) /
+        (ms_elapsed / 1000.0);
+  }
   VLOG(4) << "total=" << static_cast<int>(upload_total) << " bytes_per_sec="
           << static_cast<int>(stats.bytes_per_second);
   return CURLE_OK;
@@ -587,18 +620,18 @@ void HttpUploaderImpl::ResetStats() {
   stats_.bytes_per_second = 0;
   stats_.bytes_sent_current = 0;
   stats_.total_bytes_uploaded = 0;
-  start_ticks_ = clock();
+  start_time_ms_ = ptr_clock_->NowMs();
 }
 
 // Upload thread.  Wakes when user provides a buffer via call to
-// |UploadBuffer|.
+// |EnqueueBuffer|.
 void HttpUploaderImpl::UploadThread() {
-  while (!StopRequested() || buffer_q_.GetNumBuffers() > 0) {
+  ApplyThreadOptions(settings_.thread_options, "webmlive-upload");
+  for (;;) {
     SharedDataSinkBuffer buffer = buffer_q_.DequeueBuffer();
     if (buffer.get() == NULL) {
-      VLOG(1) << "upload thread waiting for buffer...";
-      WaitForUserData();
-      continue;
+      // |buffer_q_| closed and drained.
+      break;
     }
     VLOG(1) << "uploading buffer...";
     if (!Upload(buffer)) {
@@ -14,7 +14,9 @@
 #include <string>
 
 #include "encoder/basictypes.h"
+#include "encoder/clock.h"
 #include "encoder/data_sink.h"
+#include "encoder/thread_util.h"
 #include "encoder/encoder_base.h"
 
 namespace webmlive {
@@ -25,6 +27,8 @@ enum UploadMode {
 };
 
 struct HttpUploaderSettings {
+  HttpUploaderSettings() : ptr_clock(NULL) {}
+
   // Form variables and HTTP headers are stored within
   // map<std::string,std::string>.
   typedef std::map<std::string, std::string> StringMap;
@@ -48,6 +52,18 @@ struct HttpUploaderSettings {
 
   // Session ID.
   std::string session_id;
+
+  // Upload queue configuration. Controls how much data may wait for upload,
+  // and whether |HttpUploader::WriteData()| blocks or sheds data when the
+  // uploader falls behind.
+  SharedBufferQueue::Options queue_options;
+
+  // Scheduling settings applied to the upload thread.
+  ThreadOptions thread_options;
+
+  // Clock used to measure upload throughput. Not owned. The system clock is
+  // used when NULL.
+  ClockInterface* ptr_clock;
 };
 
 struct HttpUploaderStats {
@@ -97,6 +113,7 @@ class HttpUploader : public DataSinkInterface {
   // DataSinkInterface methods.
   bool WriteData(const SharedDataSinkBuffer& buffer) override;
   std::string Name() const override { return "HttpUploader"; }
+  bool WriteWouldBlock(const SharedDataSinkBuffer& buffer) override;
 
  private:
   // Pointer to uploader implementation.
@@ -0,0 +1,104 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/latency_histogram.h"
+
+#include <algorithm>
+
+namespace webmlive {
+
+LatencyHistogram::LatencyHistogram() {
+  for (int i = 0; i < kNumBuckets; ++i) {
+    buckets_[i].store(0);
+  }
+  count_.store(0);
+  sum_.store(0);
+  max_.store(0);
+}
+
+void LatencyHistogram::Record(int64 latency_us) {
+  const int64 value = std::max<int64>(latency_us, 0);
+  buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  int64 max_value = max_.load(std::memory_order_relaxed);
+  while (value > max_value &&
+         !max_.compare_exchange_weak(max_value, value,
+                                     std::memory_order_relaxed)) {
+  }
+
+  // Published last so that |Summarize()| never sees more samples than the
+  // buckets hold.
+  count_.fetch_add(1, std::memory_order_release);
+}
+
+LatencySummary LatencyHistogram::Summarize() const {
+  LatencySummary summary;
+  const int64 count = count_.load(std::memory_order_acquire);
+  if (count == 0) {
+    return summary;
+  }
+
+  // Samples recorded while the buckets are read may make the bucket total
+  // exceed |count|; percentiles are ranked against the bucket total.
+  int64 counts[kNumBuckets];
+  int64 total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  summary.count = total;
+  summary.mean_us = sum_.load(std::memory_order_relaxed) / count;
+  summary.max_us = max_.load(std::memory_order_relaxed);
+  summary.p50_us = std::min(Percentile(counts, total, 0.5), summary.max_us);
+  summary.p90_us = std::min(Percentile(counts, total, 0.9), summary.max_us);
+  summary.p99_us = std::min(Percentile(counts, total, 0.99), summary.max_us);
+  return summary;
+}
+
+int LatencyHistogram::BucketIndex(int64 value) {
+  if (value < kNumLinearBuckets) {
+    return static_cast<int>(value);
+  }
+  int octave = 0;
+  while ((value >> octave) >= 2 * kSubBucketsPerOctave) {
+    ++octave;
+  }
+  // |value| >> |octave| is in [kSubBucketsPerOctave, 2 * kSubBucketsPerOctave)
+  // and selects the sub bucket. Octave 2 starts at |kNumLinearBuckets|.
+  const int sub_bucket =
+      static_cast<int>(value >> octave) - kSubBucketsPerOctave;
+  const int bucket =
+      kNumLinearBuckets + (octave - 2) * kSubBucketsPerOctave + sub_bucket;
+  return std::min(bucket, kNumBuckets - 1);
+}
+
+int64 LatencyHistogram::BucketLimit(int bucket) {
+  if (bucket < kNumLinearBuckets) {
+    return bucket;
+  }
+  const int octave = (bucket - kNumLinearBuckets) / kSubBucketsPerOctave + 2;
+  const int sub_bucket = (bucket - kNumLinearBuckets) % kSubBucketsPerOctave;
+  return ((static_cast<int64>(kSubBucketsPerOctave + sub_bucket + 1))
+          << octave) - 1;
+}
+
+int64 LatencyHistogram::Percentile(const int64* counts, int64 count,
+                                   double fraction) {
+  // Rank of the sample, counting from 1.
+  const int64 rank = std::max<int64>(
+      static_cast<int64>(fraction * count + 0.999999), 1);
+  int64 seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return BucketLimit(i);
+    }
+  }
+  return BucketLimit(kNumBuckets - 1);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LATENCY_HISTOGRAM_H_
+#define WEBMLIVE_ENCODER_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Summary of the samples in a |LatencyHistogram|. All values are in
+// microseconds, and are 0 when there are no samples.
+struct LatencySummary {
+  LatencySummary()
+      : count(0),
+        mean_us(0),
+        p50_us(0),
+        p90_us(0),
+        p99_us(0),
+        max_us(0) {}
+
+  int64 count;
+  int64 mean_us;
+  int64 p50_us;
+  int64 p90_us;
+  int64 p99_us;
+  int64 max_us;
+};
+
+// Histogram of latency samples in microseconds. Values below 16 have their own
+// buckets; larger values share buckets four to an octave, so percentiles are
+// the upper bound of a bucket and overstate the true value by at most 25%.
+// |Record()| is lock free and may be called from one thread while others call
+// |Summarize()|.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  ~LatencyHistogram() {}
+
+  // Adds a sample of |latency_us| microseconds. Negative values count as 0.
+  void Record(int64 latency_us);
+
+  // Returns the sample count, mean, 50th, 90th and 99th percentiles and the
+  // maximum.
+  LatencySummary Summarize() const;
+
+ private:
+  static const int kNumLinearBuckets = 16;
+  static const int kSubBucketsPerOctave = 4;
+  static const int kNumOctaves = 40;
+  static const int kNumBuckets =
+      kNumLinearBuckets + kNumOctaves * kSubBucketsPerOctave;
+
+  // Returns the bucket for |value|, and the largest value held by |bucket|.
+  static int BucketIndex(int64 value);
+  static int64 BucketLimit(int bucket);
+
+  // Returns the upper bound of the bucket holding the sample ranked
+  // |fraction| of the way through |counts|.
+  static int64 Percentile(const int64* counts, int64 count, double fraction);
+
+  std::atomic<int64> buckets_[kNumBuckets];
+  std::atomic<int64> count_;
+  std::atomic<int64> sum_;
+  std::atomic<int64> max_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LATENCY_HISTOGRAM_H_
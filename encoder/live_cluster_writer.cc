@@ -0,0 +1,191 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/live_cluster_writer.h"
+
+#include <cstring>
+
+#include "glog/logging.h"
+#include "libwebm/mkvmuxer.hpp"
+#include "libwebm/mkvmuxerutil.hpp"
+#include "libwebm/webmids.hpp"
+
+namespace {
+
+// Cluster ID followed by the 8 byte EBML unknown size that libwebm writes for
+// clusters in live mode.
+const uint8 kClusterHeader[] = {
+  0x1F, 0x43, 0xB6, 0x75,
+  0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+const uint8 kTimecodeId = 0xE7;
+const uint8 kSimpleBlockId = 0xA3;
+const uint8 kSimpleBlockKeyFlag = 0x80;
+
+// Track number, block timecode and flags.
+const int32 kSimpleBlockHeaderLength = 4;
+
+// Largest values with EBML size codings of 1 to 8 bytes. The all ones value
+// of each length is reserved for unknown sizes.
+const uint64 kMaxCodedSizes[] = {
+  0x7EULL,
+  0x3FFEULL,
+  0x1FFFFEULL,
+  0x0FFFFFFEULL,
+  0x07FFFFFFFEULL,
+  0x03FFFFFFFFFEULL,
+  0x01FFFFFFFFFFFEULL,
+  0x00FFFFFFFFFFFFFEULL,
+};
+const int32 kMaxCodedSizeLength = 8;
+
+// Writes |value| to |ptr_dest| as an EBML coded size of the shortest length,
+// and returns the length. |value| must fit in 8 bytes.
+int32 WriteCodedSize(uint64 value, uint8* ptr_dest) {
+  int32 length = 1;
+  while (length < kMaxCodedSizeLength && value > kMaxCodedSizes[length - 1]) {
+    ++length;
+  }
+  const uint64 coded_value = value | (1ULL << (7 * length));
+  for (int32 i = 0; i < length; ++i) {
+    ptr_dest[i] = static_cast<uint8>(coded_value >> (8 * (length - 1 - i)));
+  }
+  return length;
+}
+
+// Writes |value| to |ptr_dest| in the fewest bytes that hold it, most
+// significant byte first, and returns the number of bytes written.
+int32 WriteUInt(uint64 value, uint8* ptr_dest) {
+  int32 length = 1;
+  while (length < 8 && (value >> (8 * length)) != 0) {
+    ++length;
+  }
+  for (int32 i = 0; i < length; ++i) {
+    ptr_dest[i] = static_cast<uint8>(value >> (8 * (length - 1 - i)));
+  }
+  return length;
+}
+
+}  // namespace
+
+namespace webmlive {
+
+LiveClusterWriter::LiveClusterWriter()
+    : ptr_writer_(NULL),
+      video_track_num_(0),
+      max_cluster_duration_(0),
+      cluster_timecode_(-1),
+      clusters_written_(0) {
+}
+
+int LiveClusterWriter::Init(mkvmuxer::IMkvWriter* ptr_writer,
+                            uint64 video_track_num,
+                            int64 max_cluster_duration_ms) {
+  if (!ptr_writer) {
+    LOG(ERROR) << "NULL writer.";
+    return kInvalidArg;
+  }
+  if (video_track_num > kMaxTrackNumber) {
+    LOG(ERROR) << "video track number out of range: " << video_track_num;
+    return kInvalidArg;
+  }
+  ptr_writer_ = ptr_writer;
+  video_track_num_ = video_track_num;
+  max_cluster_duration_ = max_cluster_duration_ms;
+  return kSuccess;
+}
+
+int LiveClusterWriter::WriteFrame(const uint8* ptr_data, int32 length,
+                                  uint64 track_num, int64 timestamp,
+                                  bool keyframe) {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "Cannot WriteFrame, not Initialized.";
+    return kInvalidArg;
+  }
+  if (!ptr_data || length <= 0 || track_num == 0 ||
+      track_num > kMaxTrackNumber || timestamp < 0) {
+    LOG(ERROR) << "invalid frame: length=" << length
+               << " track=" << track_num << " timestamp=" << timestamp;
+    return kInvalidArg;
+  }
+
+  if (NewClusterNeeded(track_num, timestamp, keyframe)) {
+    const int status = StartCluster(timestamp);
+    if (status) {
+      return status;
+    }
+  }
+
+  // Block timecodes are signed 16 bit values relative to the cluster.
+  const int64 block_timecode = timestamp - cluster_timecode_;
+  if (block_timecode < -mkvmuxer::kMaxBlockTimecode - 1) {
+    LOG(ERROR) << "timestamp " << timestamp << " is too far before cluster "
+               << "timecode " << cluster_timecode_;
+    return kInvalidArg;
+  }
+
+  // ID, size, track number, timecode and flags.
+  uint8 header[1 + kMaxCodedSizeLength + kSimpleBlockHeaderLength];
+  int32 header_length = 0;
+  header[header_length++] = kSimpleBlockId;
+  header_length += WriteCodedSize(
+      static_cast<uint64>(length) + kSimpleBlockHeaderLength,
+      &header[header_length]);
+  header[header_length++] = static_cast<uint8>(0x80 | track_num);
+  header[header_length++] = static_cast<uint8>(block_timecode >> 8);
+  header[header_length++] = static_cast<uint8>(block_timecode);
+  header[header_length++] = keyframe ? kSimpleBlockKeyFlag : 0;
+
+  if (ptr_writer_->Write(header, header_length) ||
+      ptr_writer_->Write(ptr_data, length)) {
+    LOG(ERROR) << "SimpleBlock write failed.";
+    return kWriteError;
+  }
+  return kSuccess;
+}
+
+bool LiveClusterWriter::NewClusterNeeded(uint64 track_num, int64 timestamp,
+                                         bool keyframe) const {
+  if (clusters_written_ == 0) {
+    return true;
+  }
+  if (keyframe && video_track_num_ != 0 && track_num == video_track_num_) {
+    return true;
+  }
+  const int64 cluster_duration = timestamp - cluster_timecode_;
+  if (cluster_duration > mkvmuxer::kMaxBlockTimecode) {
+    return true;
+  }
+  return max_cluster_duration_ > 0 &&
+         cluster_duration >= max_cluster_duration_;
+}
+
+int LiveClusterWriter::StartCluster(int64 timestamp) {
+  ptr_writer_->ElementStartNotify(mkvmuxer::kMkvCluster,
+                                  ptr_writer_->Position());
+
+  // Cluster header, then the Timecode element: ID, size, value.
+  uint8 header[sizeof(kClusterHeader) + 2 + 8];
+  memcpy(header, kClusterHeader, sizeof(kClusterHeader));
+  int32 header_length = sizeof(kClusterHeader);
+  header[header_length++] = kTimecodeId;
+  const int32 timecode_length =
+      WriteUInt(static_cast<uint64>(timestamp), &header[header_length + 1]);
+  header[header_length++] = static_cast<uint8>(0x80 | timecode_length);
+  header_length += timecode_length;
+
+  if (ptr_writer_->Write(header, header_length)) {
+    LOG(ERROR) << "Cluster write failed.";
+    return kWriteError;
+  }
+  cluster_timecode_ = timestamp;
+  ++clusters_written_;
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LIVE_CLUSTER_WRITER_H_
+#define WEBMLIVE_ENCODER_LIVE_CLUSTER_WRITER_H_
+
+#include "encoder/basictypes.h"
+
+namespace mkvmuxer {
+class IMkvWriter;
+}
+
+namespace webmlive {
+
+// Writes the Cluster and SimpleBlock elements of a live WebM stream without
+// going through |mkvmuxer::Segment|, which allocates and queues a frame
+// object for every frame it muxes. Element IDs are copied from constant byte
+// strings, sizes are coded with table lookups, and each frame costs two
+// |IMkvWriter::Write()| calls: one for the block header, built on the stack,
+// and one for the frame data. Nothing is allocated.
+//
+// Output matches libwebm's live mode: clusters have the 8 byte EBML unknown
+// size and contain a Timecode element followed by SimpleBlocks. A new cluster
+// starts before the first frame, before each video key frame, when the block
+// timecode would not fit in a SimpleBlock, and when the cluster reaches the
+// maximum duration. |IMkvWriter::ElementStartNotify()| is called at the start
+// of each cluster, as libwebm does.
+//
+// Timestamps are in milliseconds, so the segment must use a timecode scale of
+// |LiveWebmMuxer::kTimecodeScale|. Track numbers must be 1 to 126.
+class LiveClusterWriter {
+ public:
+  enum {
+    // |IMkvWriter::Write()| failed.
+    kWriteError = -2,
+
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Largest track number that has a one byte coding in a SimpleBlock header.
+  static const uint64 kMaxTrackNumber = 126;
+
+  LiveClusterWriter();
+  ~LiveClusterWriter() {}
+
+  // Stores |ptr_writer|, which is not owned and must outlive the cluster
+  // writer. |video_track_num| is 0 when the stream has no video. Clusters are
+  // limited to |max_cluster_duration_ms| when it is greater than 0. Returns
+  // |kInvalidArg| when |ptr_writer| is NULL or |video_track_num| is out of
+  // range.
+  int Init(mkvmuxer::IMkvWriter* ptr_writer, uint64 video_track_num,
+           int64 max_cluster_duration_ms);
+
+  // Writes |length| bytes from |ptr_data| as a SimpleBlock on |track_num|,
+  // starting a new cluster first when necessary, and returns |kSuccess|.
+  // Returns |kInvalidArg| when the frame is empty, |track_num| is out of
+  // range, or |timestamp| is negative or too far before the cluster
+  // timecode. Returns |kWriteError| when the writer fails.
+  int WriteFrame(const uint8* ptr_data, int32 length, uint64 track_num,
+                 int64 timestamp, bool keyframe);
+
+  // Accessors.
+  int64 clusters_written() const { return clusters_written_; }
+  int64 cluster_timecode() const { return cluster_timecode_; }
+
+ private:
+  // Returns true when the frame must start a new cluster.
+  bool NewClusterNeeded(uint64 track_num, int64 timestamp,
+                        bool keyframe) const;
+
+  // Notifies |ptr_writer_| and writes the cluster ID, size and timecode.
+  int StartCluster(int64 timestamp);
+
+  mkvmuxer::IMkvWriter* ptr_writer_;
+  uint64 video_track_num_;
+  int64 max_cluster_duration_;
+  int64 cluster_timecode_;
+  int64 clusters_written_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LiveClusterWriter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LIVE_CLUSTER_WRITER_H_
@@ -0,0 +1,175 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/media_source.h"
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+MediaDelivery::MediaDelivery()
+    : realtime_(true),
+      ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      ptr_video_allocator_(NULL),
+      ptr_acquired_frame_(NULL) {
+}
+
+void MediaDelivery::Init(bool realtime,
+                         AudioSamplesCallbackInterface* ptr_audio_callback,
+                         VideoFrameCallbackInterface* ptr_video_callback,
+                         VideoFrameAllocatorInterface* ptr_video_allocator,
+                         const RetryFunction& retry_func) {
+  realtime_ = realtime;
+  ptr_audio_callback_ = ptr_audio_callback;
+  ptr_video_callback_ = ptr_video_callback;
+  ptr_video_allocator_ = ptr_video_allocator;
+  retry_func_ = retry_func;
+}
+
+int MediaDelivery::DeliverVideoFrame(const VideoConfig& config,
+                                     int64 timestamp,
+                                     int64 duration,
+                                     const uint8* ptr_data,
+                                     int32 length) {
+  for (;;) {
+    VideoFrame* ptr_frame = &video_frame_;
+    bool dropped = false;
+    if (ptr_video_allocator_) {
+      const int status = ptr_video_allocator_->AcquireVideoFrame(&ptr_frame);
+      if (status && status != VideoFrameAllocatorInterface::kDropped) {
+        LOG(ERROR) << "AcquireVideoFrame failed: " << status;
+        return WebmEncoder::kVideoSinkError;
+      }
+      dropped = (status == VideoFrameAllocatorInterface::kDropped);
+    }
+    if (!dropped) {
+      int status = ptr_frame->Init(config, true, timestamp, duration,
+                                   ptr_data, length);
+      if (status) {
+        LOG(ERROR) << "VideoFrame Init failed: " << status;
+        if (ptr_video_allocator_) {
+          ptr_video_allocator_->CancelVideoFrame();
+        }
+        return WebmEncoder::kVideoSinkError;
+      }
+      if (ptr_video_allocator_) {
+        status = ptr_video_allocator_->PublishVideoFrame();
+        if (status) {
+          LOG(ERROR) << "PublishVideoFrame failed: " << status;
+          return WebmEncoder::kVideoSinkError;
+        }
+        return kSuccess;
+      }
+      status = ptr_video_callback_->OnVideoFrameReceived(ptr_frame);
+      if (status != VideoFrameCallbackInterface::kDropped) {
+        if (status) {
+          LOG(ERROR) << "OnVideoFrameReceived failed: " << status;
+          return WebmEncoder::kVideoSinkError;
+        }
+        return kSuccess;
+      }
+    }
+    if (realtime_) {
+      return kSuccess;
+    }
+    if (!retry_func_()) {
+      return kStopped;
+    }
+  }
+}
+
+int MediaDelivery::AcquireVideoFrame(int32 length, VideoFrame** ptr_frame) {
+  *ptr_frame = NULL;
+  for (;;) {
+    VideoFrame* ptr_pool_frame = NULL;
+    const int status =
+        ptr_video_allocator_->AcquireVideoFrame(&ptr_pool_frame);
+    if (status == VideoFrameAllocatorInterface::kSuccess) {
+      if (ptr_pool_frame->Reserve(length)) {
+        ptr_video_allocator_->CancelVideoFrame();
+        return WebmEncoder::kNoMemory;
+      }
+      ptr_acquired_frame_ = ptr_pool_frame;
+      *ptr_frame = ptr_pool_frame;
+      return kSuccess;
+    }
+    if (status != VideoFrameAllocatorInterface::kDropped) {
+      LOG(ERROR) << "AcquireVideoFrame failed: " << status;
+      return WebmEncoder::kVideoSinkError;
+    }
+    if (realtime_) {
+      return kSuccess;
+    }
+    if (!retry_func_()) {
+      return kStopped;
+    }
+  }
+}
+
+int MediaDelivery::PublishVideoFrame(const VideoConfig& config,
+                                     int64 timestamp,
+                                     int64 duration,
+                                     int32 length) {
+  VideoFrame* const ptr_frame = ptr_acquired_frame_;
+  if (!ptr_frame) {
+    LOG(ERROR) << "PublishVideoFrame called without an acquired frame.";
+    return WebmEncoder::kVideoSinkError;
+  }
+  ptr_acquired_frame_ = NULL;
+  int status = ptr_frame->InitInPlace(config, true, timestamp, duration,
+                                      length);
+  if (status) {
+    LOG(ERROR) << "VideoFrame InitInPlace failed: " << status;
+    ptr_video_allocator_->CancelVideoFrame();
+    return WebmEncoder::kVideoSinkError;
+  }
+  status = ptr_video_allocator_->PublishVideoFrame();
+  if (status) {
+    LOG(ERROR) << "PublishVideoFrame failed: " << status;
+    return WebmEncoder::kVideoSinkError;
+  }
+  return kSuccess;
+}
+
+void MediaDelivery::CancelVideoFrame() {
+  if (ptr_acquired_frame_) {
+    ptr_acquired_frame_ = NULL;
+    ptr_video_allocator_->CancelVideoFrame();
+  }
+}
+
+int MediaDelivery::DeliverAudioBuffer(const AudioConfig& config,
+                                      int64 timestamp,
+                                      int64 duration,
+                                      const uint8* ptr_samples,
+                                      int32 length) {
+  for (;;) {
+    int status = audio_buffer_.Init(config, timestamp, duration, ptr_samples,
+                                    length);
+    if (status) {
+      LOG(ERROR) << "AudioBuffer Init failed: " << status;
+      return WebmEncoder::kAudioSinkError;
+    }
+    status = ptr_audio_callback_->OnSamplesReceived(&audio_buffer_);
+    if (status != AudioSamplesCallbackInterface::kDropped) {
+      if (status) {
+        LOG(ERROR) << "OnSamplesReceived failed: " << status;
+        return WebmEncoder::kAudioSinkError;
+      }
+      return kSuccess;
+    }
+    if (realtime_) {
+      return kSuccess;
+    }
+    if (!retry_func_()) {
+      return kStopped;
+    }
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,142 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
+
+#include <functional>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Source of uncompressed audio and video for |WebmEncoder|. Implementations
+// deliver |AudioBuffer|s and |VideoFrame|s from their own threads through the
+// callback interfaces passed to |Init()|.
+class MediaSourceInterface {
+ public:
+  enum {
+    kSuccess = 0,
+
+    // Returned by |CheckStatus()| once all input has been delivered. Only
+    // sources with finite input return it.
+    kEndOfStream = 1,
+  };
+
+  virtual ~MediaSourceInterface() {}
+
+  // Prepares the source for delivery to the callbacks. Returns |kSuccess|
+  // upon success, or a |WebmEncoder| status code upon failure.
+  // |ptr_video_allocator| is optional; when non-NULL the source writes frames
+  // directly into storage obtained from it instead of using
+  // |ptr_video_callback|.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback,
+                   VideoFrameAllocatorInterface* ptr_video_allocator) = 0;
+
+  // Starts delivery. Returns |kSuccess| upon success, or a |WebmEncoder|
+  // status code upon failure.
+  virtual int Run() = 0;
+
+  // Returns |kSuccess| while the source is delivering, |kEndOfStream| when a
+  // finite source is done, or a |WebmEncoder| status code upon failure.
+  virtual int CheckStatus() = 0;
+
+  // Stops delivery. No callbacks are made after |Stop()| returns.
+  virtual void Stop() = 0;
+
+  // Format of the delivered audio and video. Valid after |Init()|.
+  virtual AudioConfig actual_audio_config() const = 0;
+  virtual VideoConfig actual_video_config() const = 0;
+};
+
+// Passes the frames and sample buffers of a |MediaSourceInterface|
+// implementation to the callbacks passed to its |Init()|. Buffers dropped
+// because the encoder is behind are gone for real time sources. Other
+// sources wait and offer them again until they are accepted. All other
+// failures end delivery.
+class MediaDelivery {
+ public:
+  // Waits before a dropped buffer is offered again. Returns false when the
+  // source is stopping and the buffer should be abandoned.
+  typedef std::function<bool()> RetryFunction;
+
+  enum {
+    kSuccess = 0,
+
+    // A dropped buffer was abandoned because |RetryFunction| returned false.
+    kStopped = 1,
+  };
+
+  MediaDelivery();
+
+  // Stores the callbacks. |ptr_video_allocator| may be NULL; frames are passed
+  // to |ptr_video_callback| when it is. |retry_func| is called only when
+  // |realtime| is false.
+  void Init(bool realtime,
+            AudioSamplesCallbackInterface* ptr_audio_callback,
+            VideoFrameCallbackInterface* ptr_video_callback,
+            VideoFrameAllocatorInterface* ptr_video_allocator,
+            const RetryFunction& retry_func);
+
+  // Copies |length| bytes from |ptr_data| into a frame and delivers it.
+  // Returns |kSuccess| when the frame is delivered, or dropped by a real time
+  // source. Returns |kStopped|, or |WebmEncoder::kVideoSinkError| when the
+  // encoder fails.
+  int DeliverVideoFrame(const VideoConfig& config, int64 timestamp,
+                        int64 duration, const uint8* ptr_data, int32 length);
+
+  // Obtains a frame with storage for |length| bytes from the video allocator
+  // for the source to write in place. Writes NULL to |ptr_frame| when a real
+  // time source drops the frame. Returns |kSuccess|, |kStopped|,
+  // |WebmEncoder::kNoMemory|, or |WebmEncoder::kVideoSinkError| when the
+  // encoder fails. Requires a video allocator.
+  int AcquireVideoFrame(int32 length, VideoFrame** ptr_frame);
+
+  // Sets up the frame obtained from |AcquireVideoFrame()| to hold |length|
+  // bytes written in place, and publishes it. Returns |kSuccess| or
+  // |WebmEncoder::kVideoSinkError|.
+  int PublishVideoFrame(const VideoConfig& config, int64 timestamp,
+                        int64 duration, int32 length);
+
+  // Returns the frame obtained from |AcquireVideoFrame()| without publishing
+  // it.
+  void CancelVideoFrame();
+
+  // Copies |length| bytes from |ptr_samples| into a buffer and delivers it.
+  // Returns as |DeliverVideoFrame()|, with |WebmEncoder::kAudioSinkError| when
+  // the encoder fails.
+  int DeliverAudioBuffer(const AudioConfig& config, int64 timestamp,
+                         int64 duration, const uint8* ptr_samples,
+                         int32 length);
+
+  bool has_video_allocator() const { return ptr_video_allocator_ != NULL; }
+
+ private:
+  bool realtime_;
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+  VideoFrameAllocatorInterface* ptr_video_allocator_;
+  RetryFunction retry_func_;
+
+  // Frame obtained from |AcquireVideoFrame()| and not yet published or
+  // canceled.
+  VideoFrame* ptr_acquired_frame_;
+
+  // Storage for buffers passed to the callbacks.
+  VideoFrame video_frame_;
+  AudioBuffer audio_buffer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MediaDelivery);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
@@ -0,0 +1,592 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pipe_media_source.h"
+
+#include "encoder/encoder_base.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Reads from a FIFO, a file or stdin. Waits for data in short intervals so
+// that reads give up promptly once |*ptr_stop| is set.
+class PipeReader {
+ public:
+  enum {
+    kReadError = -1,
+    kSuccess = 0,
+
+    // The writer closed the pipe.
+    kClosed = 1,
+
+    // |*ptr_stop| was set while waiting for data.
+    kStopped = 2,
+  };
+
+  explicit PipeReader(const std::atomic<bool>* ptr_stop);
+  ~PipeReader();
+
+  // Opens |name|, or stdin when |name| is |PipeMediaSource::kStdinName|, and
+  // returns true. Does not wait for a FIFO writer.
+  bool Open(const std::string& name);
+
+  // Reads exactly |length| bytes to |ptr_data|. Data read before the writer
+  // closes the pipe part way through is discarded.
+  int Read(uint8* ptr_data, int32 length);
+
+  // Reads one line to |ptr_line| without its line terminator.
+  int ReadLine(std::string* ptr_line);
+
+ private:
+  // Waits until the pipe is readable or closed, and returns true. Returns
+  // false when |*ptr_stop_| is set.
+  bool WaitReadable();
+
+  const std::atomic<bool>* const ptr_stop_;
+  int fd_;
+  bool owns_fd_;
+  std::string name_;
+  std::string line_buffer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PipeReader);
+};
+
+namespace {
+
+// Time between checks for stop requests while waiting for pipe data, and
+// between delivery attempts when the encoder refuses input.
+const int kPipeWaitTimeoutMs = 100;
+const int kRetryIntervalMs = 1;
+
+// Pipe buffer size requested on Linux. Larger pipe buffers let writers queue
+// whole frames, and reads return more data per call.
+const int kPipeBufferSize = 1024 * 1024;
+
+bool IsPlanar(VideoFormat format) {
+  return format == kVideoFormatI420 || format == kVideoFormatYV12;
+}
+
+}  // namespace
+
+PipeReader::PipeReader(const std::atomic<bool>* ptr_stop)
+    : ptr_stop_(ptr_stop),
+      fd_(-1),
+      owns_fd_(false) {
+}
+
+#ifdef _WIN32
+PipeReader::~PipeReader() {
+  if (owns_fd_) {
+    _close(fd_);
+  }
+}
+
+bool PipeReader::Open(const std::string& name) {
+  name_ = name;
+  if (name == PipeMediaSource::kStdinName) {
+    fd_ = _fileno(stdin);
+    _setmode(fd_, _O_BINARY);
+    return true;
+  }
+  fd_ = _open(name.c_str(), _O_RDONLY | _O_BINARY);
+  if (fd_ == -1) {
+    LOG(ERROR) << "cannot open " << name;
+    return false;
+  }
+  owns_fd_ = true;
+  return true;
+}
+
+bool PipeReader::WaitReadable() {
+  const HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd_));
+  for (;;) {
+    if (ptr_stop_->load()) {
+      return false;
+    }
+    DWORD bytes_available = 0;
+    if (!PeekNamedPipe(handle, NULL, 0, NULL, &bytes_available, NULL) ||
+        bytes_available > 0) {
+      // Data is available, the writer is gone, or |fd_| is not a pipe; in
+      // every case the read does not block indefinitely.
+      return true;
+    }
+    Sleep(kRetryIntervalMs);
+  }
+}
+
+int PipeReader::Read(uint8* ptr_data, int32 length) {
+  int32 bytes_read = 0;
+  while (bytes_read < length) {
+    if (!WaitReadable()) {
+      return kStopped;
+    }
+    const int result = _read(fd_, ptr_data + bytes_read,
+                             static_cast<unsigned int>(length - bytes_read));
+    if (result > 0) {
+      bytes_read += result;
+    } else if (result == 0) {
+      if (bytes_read > 0) {
+        LOG(WARNING) << name_ << " closed after a partial read of "
+                     << bytes_read << " of " << length << " bytes.";
+      }
+      return kClosed;
+    } else {
+      LOG(ERROR) << "read from " << name_ << " failed.";
+      return kReadError;
+    }
+  }
+  return kSuccess;
+}
+#else
+PipeReader::~PipeReader() {
+  if (owns_fd_) {
+    close(fd_);
+  }
+}
+
+bool PipeReader::Open(const std::string& name) {
+  name_ = name;
+  if (name == PipeMediaSource::kStdinName) {
+    fd_ = STDIN_FILENO;
+  } else {
+    // Opening a FIFO for reading blocks until a writer opens it unless
+    // O_NONBLOCK is used. Reads wait in |WaitReadable()| instead, so that the
+    // writer may open the video and audio FIFOs in either order.
+    fd_ = open(name.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd_ == -1) {
+      LOG(ERROR) << "cannot open " << name;
+      return false;
+    }
+    owns_fd_ = true;
+  }
+#ifdef F_SETPIPE_SZ
+  // Fails for anything but a pipe, or beyond the system limit; both leave the
+  // default size in place.
+  fcntl(fd_, F_SETPIPE_SZ, kPipeBufferSize);
+#endif
+  return true;
+}
+
+bool PipeReader::WaitReadable() {
+  for (;;) {
+    if (ptr_stop_->load()) {
+      return false;
+    }
+    struct pollfd poll_fd;
+    poll_fd.fd = fd_;
+    poll_fd.events = POLLIN;
+    poll_fd.revents = 0;
+    const int result = poll(&poll_fd, 1, kPipeWaitTimeoutMs);
+    if (result > 0 || (result < 0 && errno != EINTR)) {
+      // Errors are reported by the read that follows.
+      return true;
+    }
+  }
+}
+
+int PipeReader::Read(uint8* ptr_data, int32 length) {
+  int32 bytes_read = 0;
+  while (bytes_read < length) {
+    if (!WaitReadable()) {
+      return kStopped;
+    }
+    const ssize_t result = read(fd_, ptr_data + bytes_read,
+                                static_cast<size_t>(length - bytes_read));
+    if (result > 0) {
+      bytes_read += static_cast<int32>(result);
+    } else if (result == 0) {
+      if (bytes_read > 0) {
+        LOG(WARNING) << name_ << " closed after a partial read of "
+                     << bytes_read << " of " << length << " bytes.";
+      }
+      return kClosed;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      LOG(ERROR) << "read from " << name_ << " failed: " << strerror(errno);
+      return kReadError;
+    }
+  }
+  return kSuccess;
+}
+#endif  // _WIN32
+
+int PipeReader::ReadLine(std::string* ptr_line) {
+  for (;;) {
+    const size_t newline = line_buffer_.find('\n');
+    if (newline != std::string::npos) {
+      ptr_line->assign(line_buffer_, 0, newline);
+      line_buffer_.erase(0, newline + 1);
+      break;
+    }
+
+    // Lines are short, and |Read()| waits for exactly the number of bytes
+    // requested; read a byte at a time.
+    uint8 data = 0;
+    const int status = Read(&data, 1);
+    if (status == kClosed && !line_buffer_.empty()) {
+      // Last line without a terminator.
+      ptr_line->swap(line_buffer_);
+      line_buffer_.clear();
+      break;
+    }
+    if (status) {
+      return status;
+    }
+    line_buffer_.push_back(static_cast<char>(data));
+  }
+  if (!ptr_line->empty() && (*ptr_line)[ptr_line->length() - 1] == '\r') {
+    ptr_line->erase(ptr_line->length() - 1);
+  }
+  return kSuccess;
+}
+
+const char PipeMediaSource::kStdinName[] = "-";
+
+PipeMediaSource::PipeMediaSource()
+    : video_frame_size_(0),
+      video_frame_duration_(0),
+      num_frames_read_(0),
+      audio_read_size_(0),
+      audio_blocks_read_(0),
+      stop_(false),
+      num_readers_(0),
+      status_(kSuccess) {
+}
+
+PipeMediaSource::~PipeMediaSource() {
+  Stop();
+}
+
+int PipeMediaSource::Init(const WebmEncoderConfig& config,
+                          AudioSamplesCallbackInterface* ptr_audio_callback,
+                          VideoFrameCallbackInterface* ptr_video_callback,
+                          VideoFrameAllocatorInterface* ptr_video_allocator) {
+  delivery_.Init(config.input_realtime, ptr_audio_callback,
+                 ptr_video_callback, ptr_video_allocator,
+                 std::bind(&PipeMediaSource::WaitToRetry, this));
+
+  if (!config.disable_video && !config.disable_audio &&
+      !config.input_video_pipe.empty() &&
+      config.input_video_pipe == config.input_audio_pipe) {
+    LOG(ERROR) << "video and audio cannot share the pipe "
+               << config.input_video_pipe;
+    return WebmEncoder::kInvalidArg;
+  }
+  if (!config.disable_video) {
+    if (config.input_video_pipe.empty()) {
+      LOG(ERROR) << "video enabled without an input pipe.";
+      return WebmEncoder::kNoVideoSource;
+    }
+    if (!ptr_video_callback && !ptr_video_allocator) {
+      LOG(ERROR) << "NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    int status = InitVideoFormat(config);
+    if (status) {
+      return status;
+    }
+    video_pipe_.reset(new (std::nothrow) PipeReader(&stop_));  // NOLINT
+    if (!video_pipe_) {
+      return WebmEncoder::kNoMemory;
+    }
+    if (!video_pipe_->Open(config.input_video_pipe)) {
+      return kPipeReadError;
+    }
+    if (!config.input_timestamp_pipe.empty()) {
+      timestamp_pipe_.reset(new (std::nothrow) PipeReader(&stop_));  // NOLINT
+      if (!timestamp_pipe_) {
+        return WebmEncoder::kNoMemory;
+      }
+      if (!timestamp_pipe_->Open(config.input_timestamp_pipe)) {
+        return kPipeReadError;
+      }
+    }
+  }
+  if (!config.disable_audio) {
+    if (config.input_audio_pipe.empty()) {
+      LOG(ERROR) << "audio enabled without an input pipe.";
+      return WebmEncoder::kNoAudioSource;
+    }
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    int status = InitAudioFormat(config);
+    if (status) {
+      return status;
+    }
+    audio_pipe_.reset(new (std::nothrow) PipeReader(&stop_));  // NOLINT
+    if (!audio_pipe_) {
+      return WebmEncoder::kNoMemory;
+    }
+    if (!audio_pipe_->Open(config.input_audio_pipe)) {
+      return kPipeReadError;
+    }
+  }
+  return kSuccess;
+}
+
+int PipeMediaSource::Run() {
+  if (video_thread_ || audio_thread_) {
+    LOG(ERROR) << "pipe source already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  num_readers_ = (video_pipe_ ? 1 : 0) + (audio_pipe_ ? 1 : 0);
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  if (video_pipe_) {
+    video_thread_ = shared_ptr<thread>(
+        new (nothrow) thread(bind(&PipeMediaSource::VideoThread,  // NOLINT
+                                  this)));
+    if (!video_thread_) {
+      LOG(ERROR) << "cannot start video pipe thread.";
+      return WebmEncoder::kRunFailed;
+    }
+  }
+  if (audio_pipe_) {
+    audio_thread_ = shared_ptr<thread>(
+        new (nothrow) thread(bind(&PipeMediaSource::AudioThread,  // NOLINT
+                                  this)));
+    if (!audio_thread_) {
+      LOG(ERROR) << "cannot start audio pipe thread.";
+      return WebmEncoder::kRunFailed;
+    }
+  }
+  return kSuccess;
+}
+
+int PipeMediaSource::CheckStatus() {
+  return status_.load();
+}
+
+void PipeMediaSource::Stop() {
+  stop_ = true;
+  if (video_thread_) {
+    video_thread_->join();
+    video_thread_.reset();
+  }
+  if (audio_thread_) {
+    audio_thread_->join();
+    audio_thread_.reset();
+  }
+}
+
+int PipeMediaSource::InitVideoFormat(const WebmEncoderConfig& config) {
+  if (!InitRawVideoConfig(config.input_video_fourcc,
+                          config.requested_video_config, &video_config_,
+                          &video_frame_size_)) {
+    return kUnsupportedFormat;
+  }
+  video_frame_duration_ =
+      static_cast<int64>(kTimebase / video_config_.frame_rate);
+  read_buffer_.reset(new (std::nothrow) uint8[video_frame_size_]);  // NOLINT
+  if (!read_buffer_) {
+    return WebmEncoder::kNoMemory;
+  }
+  LOG(INFO) << "video pipe input " << config.input_video_pipe << ": "
+            << config.input_video_fourcc << " " << video_config_.width << "x"
+            << video_config_.height << " @ " << video_config_.frame_rate
+            << " fps";
+  return kSuccess;
+}
+
+int PipeMediaSource::InitAudioFormat(const WebmEncoderConfig& config) {
+  const AudioConfig& requested = config.requested_audio_config;
+  if (requested.bits_per_sample == 16) {
+    audio_config_.format_tag = kAudioFormatPcm;
+  } else if (requested.bits_per_sample == 32) {
+    audio_config_.format_tag = kAudioFormatIeeeFloat;
+  } else {
+    LOG(ERROR) << "unsupported pipe audio sample size "
+               << requested.bits_per_sample;
+    return kUnsupportedFormat;
+  }
+  if (requested.channels == 0 || requested.sample_rate == 0) {
+    LOG(ERROR) << "pipe audio requires channels and sample rate.";
+    return WebmEncoder::kInvalidArg;
+  }
+  audio_config_.channels = requested.channels;
+  audio_config_.sample_rate = requested.sample_rate;
+  audio_config_.bits_per_sample = requested.bits_per_sample;
+  audio_config_.block_align =
+      static_cast<uint16>(requested.channels * requested.bits_per_sample / 8);
+  audio_config_.bytes_per_second =
+      audio_config_.block_align * audio_config_.sample_rate;
+  const uint32 blocks_per_read = std::max<uint32>(
+      audio_config_.sample_rate * kAudioBufferDurationMs / kTimebase, 1);
+  audio_read_size_ = blocks_per_read * audio_config_.block_align;
+  audio_read_buffer_.reset(
+      new (std::nothrow) uint8[audio_read_size_]);  // NOLINT
+  if (!audio_read_buffer_) {
+    return WebmEncoder::kNoMemory;
+  }
+  LOG(INFO) << "audio pipe input " << config.input_audio_pipe << ": "
+            << audio_config_.channels << " channels @ "
+            << audio_config_.sample_rate << " Hz";
+  return kSuccess;
+}
+
+void PipeMediaSource::VideoThread() {
+  bool done = false;
+  int status = kSuccess;
+  while (!done && status == kSuccess) {
+    status = ReadVideoFrame(&done);
+  }
+  LOG(INFO) << "video pipe closed after " << num_frames_read_ << " frames.";
+  ReaderDone(status);
+}
+
+void PipeMediaSource::AudioThread() {
+  bool done = false;
+  int status = kSuccess;
+  while (!done && status == kSuccess) {
+    status = ReadAudioBuffer(&done);
+  }
+  LOG(INFO) << "audio pipe closed after " << audio_blocks_read_
+            << " sample blocks.";
+  ReaderDone(status);
+}
+
+int PipeMediaSource::ReadVideoFrame(bool* ptr_done) {
+  // Frames stored without conversion are read straight into a pool frame.
+  VideoFrame* ptr_frame = NULL;
+  const bool read_in_place =
+      delivery_.has_video_allocator() && IsPlanar(video_config_.format);
+  if (read_in_place) {
+    const int status =
+        delivery_.AcquireVideoFrame(video_frame_size_, &ptr_frame);
+    if (status == MediaDelivery::kStopped) {
+      *ptr_done = true;
+      return kSuccess;
+    }
+    if (status) {
+      return status;
+    }
+  }
+
+  uint8* const ptr_data = ptr_frame ? ptr_frame->buffer() : read_buffer_.get();
+  int status = video_pipe_->Read(ptr_data, video_frame_size_);
+  int64 timestamp = 0;
+  if (status == PipeReader::kSuccess) {
+    status = NextVideoTimestamp(&timestamp, ptr_done);
+  } else if (status == PipeReader::kReadError) {
+    status = kPipeReadError;
+  } else {
+    *ptr_done = true;
+    status = kSuccess;
+  }
+  if (status || *ptr_done) {
+    delivery_.CancelVideoFrame();
+    return status;
+  }
+  ++num_frames_read_;
+
+  if (ptr_frame) {
+    return delivery_.PublishVideoFrame(video_config_, timestamp,
+                                       video_frame_duration_,
+                                       video_frame_size_);
+  }
+  if (read_in_place) {
+    // The pool was full under real time delivery.
+    return kSuccess;
+  }
+  return DeliverVideoFrame(timestamp);
+}
+
+int PipeMediaSource::DeliverVideoFrame(int64 timestamp) {
+  const int status = delivery_.DeliverVideoFrame(
+      video_config_, timestamp, video_frame_duration_, read_buffer_.get(),
+      video_frame_size_);
+  return status == MediaDelivery::kStopped ? kSuccess : status;
+}
+
+int PipeMediaSource::NextVideoTimestamp(int64* ptr_timestamp, bool* ptr_done) {
+  if (!timestamp_pipe_) {
+    *ptr_timestamp = static_cast<int64>(
+        num_frames_read_ * kTimebase / video_config_.frame_rate);
+    return kSuccess;
+  }
+  std::string line;
+  const int status = timestamp_pipe_->ReadLine(&line);
+  if (status == PipeReader::kReadError) {
+    return kPipeReadError;
+  }
+  if (status) {
+    *ptr_done = true;
+    return kSuccess;
+  }
+  char* ptr_end = NULL;
+  *ptr_timestamp = strtoll(line.c_str(), &ptr_end, 10);
+  if (line.empty() || *ptr_end != '\0') {
+    LOG(ERROR) << "invalid timestamp in side channel: " << line;
+    return kPipeReadError;
+  }
+  return kSuccess;
+}
+
+int PipeMediaSource::ReadAudioBuffer(bool* ptr_done) {
+  const int read_status =
+      audio_pipe_->Read(audio_read_buffer_.get(), audio_read_size_);
+  if (read_status == PipeReader::kReadError) {
+    return kPipeReadError;
+  }
+  if (read_status) {
+    *ptr_done = true;
+    return kSuccess;
+  }
+  const uint64 num_blocks = audio_read_size_ / audio_config_.block_align;
+  const int64 timestamp = static_cast<int64>(
+      audio_blocks_read_ * kTimebase / audio_config_.sample_rate);
+  const int64 duration = static_cast<int64>(
+      num_blocks * kTimebase / audio_config_.sample_rate);
+  audio_blocks_read_ += num_blocks;
+  const int status = delivery_.DeliverAudioBuffer(
+      audio_config_, timestamp, duration, audio_read_buffer_.get(),
+      audio_read_size_);
+  if (status == MediaDelivery::kStopped) {
+    *ptr_done = true;
+    return kSuccess;
+  }
+  return status;
+}
+
+void PipeMediaSource::ReaderDone(int status) {
+  int expected = kSuccess;
+  if (status) {
+    status_.compare_exchange_strong(expected, status);
+  }
+  if (--num_readers_ == 0) {
+    expected = kSuccess;
+    status_.compare_exchange_strong(expected, kEndOfStream);
+  }
+}
+
+bool PipeMediaSource::WaitToRetry() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(kRetryIntervalMs));
+  return !stop_.load();
+}
+
+}  // namespace webmlive
@@ -0,0 +1,143 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PIPE_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_PIPE_MEDIA_SOURCE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+class PipeReader;
+
+// Media source that reads raw video frames and interleaved PCM audio from
+// FIFOs, or from stdin, so that an upstream process can feed the encoder on
+// systems without DirectShow.
+//
+// Video is a headerless sequence of frames in |config.input_video_fourcc|
+// format, sized by |config.requested_video_config|. Frame timestamps are read
+// from |config.input_timestamp_pipe| when set, one decimal millisecond value
+// per line, and otherwise come from a frame clock running at the configured
+// frame rate. Audio is headerless interleaved 16 bit PCM, or 32 bit IEEE float
+// when |config.requested_audio_config.bits_per_sample| is 32; its timestamps
+// come from the sample count.
+//
+// Video and audio are read on separate threads so that a writer blocked on one
+// pipe never stalls the other. Frames that need no conversion are read
+// straight into frames obtained from the |VideoFrameAllocatorInterface|.
+// Input refused by the encoder is dropped when |config.input_realtime| is
+// true, and otherwise offered again, which stalls the writer. |CheckStatus()|
+// returns |kEndOfStream| once every pipe has been closed by its writer.
+class PipeMediaSource : public MediaSourceInterface {
+ public:
+  enum {
+    // A pipe could not be opened, or a read failed.
+    kPipeReadError = -311,
+
+    // The configured input format is not supported.
+    kUnsupportedFormat = -310,
+  };
+
+  // Duration of each delivered audio buffer.
+  static const int kAudioBufferDurationMs = 20;
+
+  // Pipe name that selects stdin.
+  static const char kStdinName[];
+
+  PipeMediaSource();
+  ~PipeMediaSource() override;
+
+  // Opens |config.input_video_pipe| unless |config.disable_video| is true, and
+  // |config.input_audio_pipe| unless |config.disable_audio| is true. Returns
+  // |WebmEncoder::kNoVideoSource| or |WebmEncoder::kNoAudioSource| when an
+  // enabled stream has no pipe.
+  int Init(const WebmEncoderConfig& config,
+           AudioSamplesCallbackInterface* ptr_audio_callback,
+           VideoFrameCallbackInterface* ptr_video_callback,
+           VideoFrameAllocatorInterface* ptr_video_allocator) override;
+  int Run() override;
+  int CheckStatus() override;
+  void Stop() override;
+  AudioConfig actual_audio_config() const override { return audio_config_; }
+  VideoConfig actual_video_config() const override { return video_config_; }
+
+ private:
+  // Validates |config| and stores the raw video and audio formats.
+  int InitVideoFormat(const WebmEncoderConfig& config);
+  int InitAudioFormat(const WebmEncoderConfig& config);
+
+  // Reader threads. Each delivers input until its pipe is closed, a read
+  // fails or |Stop()| is called.
+  void VideoThread();
+  void AudioThread();
+
+  // Reads and delivers one video frame or audio buffer. Sets |*ptr_done| to
+  // true when the pipe is closed or |Stop()| is called. Returns |kSuccess| or
+  // an error status.
+  int ReadVideoFrame(bool* ptr_done);
+  int ReadAudioBuffer(bool* ptr_done);
+
+  // Passes the frame in |read_buffer_| to the encoder, converting it when
+  // necessary. Returns |kSuccess| or an error status.
+  int DeliverVideoFrame(int64 timestamp);
+
+  // Reads the timestamp of the frame just read from the side channel, or
+  // takes it from the frame clock when there is none. Sets |*ptr_done| to
+  // true when the side channel is closed. Returns |kPipeReadError| when the
+  // side channel holds an invalid value.
+  int NextVideoTimestamp(int64* ptr_timestamp, bool* ptr_done);
+
+  // Records the exit of a reader thread with |status|. The source status
+  // becomes |kEndOfStream| when the last reader exits cleanly.
+  void ReaderDone(int status);
+
+  // Sleeps briefly before input refused by the encoder is offered again.
+  // Returns false when |Stop()| is called.
+  bool WaitToRetry();
+
+  MediaDelivery delivery_;
+
+  // Video input. Frames are |video_frame_size_| bytes. |read_buffer_| holds
+  // frames that are converted or dropped.
+  std::unique_ptr<PipeReader> video_pipe_;
+  std::unique_ptr<PipeReader> timestamp_pipe_;
+  VideoConfig video_config_;
+  int32 video_frame_size_;
+  int64 video_frame_duration_;
+  int64 num_frames_read_;
+  std::unique_ptr<uint8[]> read_buffer_;
+
+  // Audio input.
+  std::unique_ptr<PipeReader> audio_pipe_;
+  AudioConfig audio_config_;
+  int32 audio_read_size_;
+  uint64 audio_blocks_read_;
+  std::unique_ptr<uint8[]> audio_read_buffer_;
+
+  std::shared_ptr<std::thread> video_thread_;
+  std::shared_ptr<std::thread> audio_thread_;
+  std::atomic<bool> stop_;
+
+  // Reader threads still running.
+  std::atomic<int> num_readers_;
+
+  // |kSuccess| while reading, then |kEndOfStream| or an error status.
+  std::atomic<int> status_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PipeMediaSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PIPE_MEDIA_SOURCE_H_
@@ -0,0 +1,186 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/process_stats.h"
+
+#include "encoder/encoder_base.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+
+#ifdef _WIN32
+// Converts a FILETIME duration in 100 nanosecond units to seconds.
+double FileTimeToSeconds(const FILETIME& file_time) {
+  ULARGE_INTEGER value;
+  value.LowPart = file_time.dwLowDateTime;
+  value.HighPart = file_time.dwHighDateTime;
+  return value.QuadPart / 1e7;
+}
+
+bool GetThreadStats(std::vector<ThreadCpuStats>* ptr_threads) {
+  const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "CreateToolhelp32Snapshot failed.";
+    return false;
+  }
+  const DWORD process_id = GetCurrentProcessId();
+  THREADENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  for (BOOL more = Thread32First(snapshot, &entry); more;
+       more = Thread32Next(snapshot, &entry)) {
+    if (entry.th32OwnerProcessID != process_id) {
+      continue;
+    }
+    const HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE,
+                                     entry.th32ThreadID);
+    if (!thread) {
+      continue;
+    }
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (GetThreadTimes(thread, &creation_time, &exit_time, &kernel_time,
+                       &user_time)) {
+      ThreadCpuStats stats;
+      stats.thread_id = entry.th32ThreadID;
+      stats.user_seconds = FileTimeToSeconds(user_time);
+      stats.system_seconds = FileTimeToSeconds(kernel_time);
+      ptr_threads->push_back(stats);
+    }
+    CloseHandle(thread);
+  }
+  CloseHandle(snapshot);
+  return true;
+}
+#else
+// Reads the first line of |path| into |ptr_line|, without the newline.
+bool ReadLine(const std::string& path, std::string* ptr_line) {
+  FILE* const file = fopen(path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+  char buffer[1024] = {0};
+  const bool read_ok = fgets(buffer, sizeof(buffer), file) != NULL;
+  fclose(file);
+  if (!read_ok) {
+    return false;
+  }
+  *ptr_line = buffer;
+  const size_t newline = ptr_line->find('\n');
+  if (newline != std::string::npos) {
+    ptr_line->erase(newline);
+  }
+  return true;
+}
+
+// Reads the name and CPU times of thread |thread_id| from /proc.
+bool ReadThreadStats(const std::string& thread_id, ThreadCpuStats* ptr_stats) {
+  const std::string task_dir = "/proc/self/task/" + thread_id;
+  std::string stat_line;
+  if (!ReadLine(task_dir + "/stat", &stat_line)) {
+    return false;
+  }
+
+  // The thread name in the stat line may hold spaces and parentheses; the
+  // fields used here follow the last ')'. utime and stime are the 12th and
+  // 13th fields after it.
+  const size_t name_end = stat_line.rfind(')');
+  if (name_end == std::string::npos) {
+    return false;
+  }
+  const char* ptr_field = stat_line.c_str() + name_end + 1;
+  unsigned long long user_ticks = 0;  // NOLINT
+  unsigned long long system_ticks = 0;  // NOLINT
+  const char kStatFormat[] =
+      " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu";
+  if (sscanf(ptr_field, kStatFormat, &user_ticks, &system_ticks) != 2) {
+    return false;
+  }
+  const double ticks_per_second = static_cast<double>(sysconf(_SC_CLK_TCK));
+  ReadLine(task_dir + "/comm", &ptr_stats->name);
+  ptr_stats->thread_id = strtoll(thread_id.c_str(), NULL, 10);
+  ptr_stats->user_seconds = user_ticks / ticks_per_second;
+  ptr_stats->system_seconds = system_ticks / ticks_per_second;
+  return true;
+}
+
+bool GetThreadStats(std::vector<ThreadCpuStats>* ptr_threads) {
+  DIR* const task_dir = opendir("/proc/self/task");
+  if (!task_dir) {
+    LOG(ERROR) << "cannot open /proc/self/task.";
+    return false;
+  }
+  while (const struct dirent* ptr_entry = readdir(task_dir)) {
+    if (ptr_entry->d_name[0] == '.') {
+      continue;
+    }
+    ThreadCpuStats stats;
+    if (ReadThreadStats(ptr_entry->d_name, &stats)) {
+      ptr_threads->push_back(stats);
+    }
+  }
+  closedir(task_dir);
+  return true;
+}
+#endif  // _WIN32
+
+}  // namespace
+
+bool GetProcessStats(ProcessStats* ptr_stats) {
+  if (!ptr_stats) {
+    LOG(ERROR) << "NULL process stats.";
+    return false;
+  }
+  *ptr_stats = ProcessStats();
+#ifdef _WIN32
+  const HANDLE process = GetCurrentProcess();
+  PROCESS_MEMORY_COUNTERS memory_counters;
+  if (!GetProcessMemoryInfo(process, &memory_counters,
+                            sizeof(memory_counters))) {
+    LOG(ERROR) << "GetProcessMemoryInfo failed.";
+    return false;
+  }
+  ptr_stats->peak_rss_bytes = memory_counters.PeakWorkingSetSize;
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time,
+                       &user_time)) {
+    LOG(ERROR) << "GetProcessTimes failed.";
+    return false;
+  }
+  ptr_stats->user_seconds = FileTimeToSeconds(user_time);
+  ptr_stats->system_seconds = FileTimeToSeconds(kernel_time);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    LOG(ERROR) << "getrusage failed.";
+    return false;
+  }
+  // ru_maxrss is in kilobytes on Linux.
+  ptr_stats->peak_rss_bytes = static_cast<int64>(usage.ru_maxrss) * 1024;
+  ptr_stats->user_seconds =
+      usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  ptr_stats->system_seconds =
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+  return GetThreadStats(&ptr_stats->threads);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,50 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PROCESS_STATS_H_
+#define WEBMLIVE_ENCODER_PROCESS_STATS_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// CPU time used by one thread.
+struct ThreadCpuStats {
+  ThreadCpuStats() : thread_id(0), user_seconds(0), system_seconds(0) {}
+
+  // Thread name as set by |ApplyThreadOptions()|. Empty when unavailable.
+  std::string name;
+  int64 thread_id;
+  double user_seconds;
+  double system_seconds;
+};
+
+// Resource usage of the calling process.
+struct ProcessStats {
+  ProcessStats() : peak_rss_bytes(0), user_seconds(0), system_seconds(0) {}
+
+  // Peak resident set size (peak working set on Windows).
+  int64 peak_rss_bytes;
+
+  // CPU time used by all threads, including those that have exited.
+  double user_seconds;
+  double system_seconds;
+
+  // CPU time of each thread still running.
+  std::vector<ThreadCpuStats> threads;
+};
+
+// Fills |ptr_stats| with the resource usage of the calling process. Returns
+// false when it cannot be read; |ptr_stats| may then be partly filled.
+bool GetProcessStats(ProcessStats* ptr_stats);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PROCESS_STATS_H_
@@ -0,0 +1,600 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/test_pattern_source.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace {
+
+// Time between delivery attempts when the encoder refuses input.
+const int kRetryIntervalMs = 1;
+
+// Horizontal movement of the bars and text patterns per frame.
+const int kBarsScrollPixels = 4;
+const int kTextScrollPixels = 8;
+
+// Test tone frequency, and the peak level of the tone and noise relative to
+// full scale.
+const int kToneFrequencyHz = 1000;
+const double kAudioLevel = 0.25;
+
+// Seeds for the video and audio noise generators.
+const uint32 kVideoNoiseSeed = 0x2545F491;
+const uint32 kAudioNoiseSeed = 0x9E3779B9;
+
+// 75% color bars in BT.601 studio range YUV: white, yellow, cyan, green,
+// magenta, red, blue and black.
+struct YuvColor {
+  uint8 y;
+  uint8 u;
+  uint8 v;
+};
+const YuvColor kBarColors[] = {
+  {180, 128, 128},
+  {162, 44, 142},
+  {131, 156, 44},
+  {112, 72, 58},
+  {84, 184, 198},
+  {65, 100, 212},
+  {35, 212, 114},
+  {16, 128, 128},
+};
+const int kNumBars = sizeof(kBarColors) / sizeof(YuvColor);
+
+// Luma range of the text pattern.
+const uint8 kBlackLuma = 16;
+const uint8 kWhiteLuma = 235;
+const uint8 kNeutralChroma = 128;
+
+// 5x7 glyphs for the text pattern. Each byte is one row; bit 4 is the left
+// column.
+const int kGlyphWidth = 5;
+const int kGlyphHeight = 7;
+const char kGlyphChars[] = "0123456789:. ";
+const uint8 kGlyphs[][kGlyphHeight] = {
+  {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+  {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+  {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+  {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+  {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+  {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+  {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+  {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+  {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+  {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+  {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+// Returns the next value of a xorshift32 generator.
+uint32 NextRandom(uint32* ptr_state) {
+  uint32 x = *ptr_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *ptr_state = x;
+  return x;
+}
+
+void FillNoise(int32 length, uint32* ptr_state, uint8* ptr_data) {
+  int32 i = 0;
+  for (; i + 4 <= length; i += 4) {
+    const uint32 value = NextRandom(ptr_state);
+    memcpy(ptr_data + i, &value, 4);
+  }
+  if (i < length) {
+    const uint32 value = NextRandom(ptr_state);
+    memcpy(ptr_data + i, &value, length - i);
+  }
+}
+
+uint8 Clamp255(int value) {
+  return static_cast<uint8>(std::min(std::max(value, 0), 255));
+}
+
+// BT.601 studio range YUV to RGB.
+void YuvToRgb(uint8 y, uint8 u, uint8 v, uint8* ptr_r, uint8* ptr_g,
+              uint8* ptr_b) {
+  const int c = y - 16;
+  const int d = u - 128;
+  const int e = v - 128;
+  *ptr_r = Clamp255((298 * c + 409 * e + 128) >> 8);
+  *ptr_g = Clamp255((298 * c - 100 * d - 208 * e + 128) >> 8);
+  *ptr_b = Clamp255((298 * c + 516 * d + 128) >> 8);
+}
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+TestPatternSource::TestPatternSource()
+    : realtime_(true),
+      ptr_clock_(NULL),
+      start_time_ms_(0),
+      duration_limit_(0),
+      video_enabled_(false),
+      video_pattern_(kVideoPatternBars),
+      video_frame_length_(0),
+      num_frames_generated_(0),
+      video_noise_state_(kVideoNoiseSeed),
+      audio_enabled_(false),
+      audio_pattern_(kAudioPatternTone),
+      audio_blocks_generated_(0),
+      audio_noise_state_(kAudioNoiseSeed),
+      audio_samples_length_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+TestPatternSource::~TestPatternSource() {
+  Stop();
+}
+
+int TestPatternSource::Init(const WebmEncoderConfig& config,
+                            AudioSamplesCallbackInterface* ptr_audio_callback,
+                            VideoFrameCallbackInterface* ptr_video_callback,
+                            VideoFrameAllocatorInterface* ptr_video_allocator) {
+  realtime_ = config.input_realtime;
+  ptr_clock_ = config.ptr_clock ? config.ptr_clock : GetSystemClock();
+  duration_limit_ = config.input_test_duration;
+  delivery_.Init(realtime_, ptr_audio_callback, ptr_video_callback,
+                 ptr_video_allocator,
+                 std::bind(&TestPatternSource::WaitToRetry, this));
+
+  if (!config.disable_video) {
+    if (!ptr_video_callback && !ptr_video_allocator) {
+      LOG(ERROR) << "NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const int status = InitVideo(config);
+    if (status) {
+      return status;
+    }
+  }
+  if (!config.disable_audio) {
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const int status = InitAudio(config);
+    if (status) {
+      return status;
+    }
+  }
+  return kSuccess;
+}
+
+int TestPatternSource::Run() {
+  if (thread_) {
+    LOG(ERROR) << "test pattern source already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  start_time_ms_ = ptr_clock_->NowMs();
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&TestPatternSource::GeneratorThread,  // NOLINT
+                                this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot start test pattern thread.";
+    return WebmEncoder::kRunFailed;
+  }
+  return kSuccess;
+}
+
+int TestPatternSource::CheckStatus() {
+  return status_.load();
+}
+
+void TestPatternSource::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  if (thread_) {
+    thread_->join();
+    thread_.reset();
+  }
+}
+
+int TestPatternSource::InitVideo(const WebmEncoderConfig& config) {
+  if (config.input_test_pattern == "bars") {
+    video_pattern_ = kVideoPatternBars;
+  } else if (config.input_test_pattern == "noise") {
+    video_pattern_ = kVideoPatternNoise;
+  } else if (config.input_test_pattern == "text") {
+    video_pattern_ = kVideoPatternText;
+  } else {
+    LOG(ERROR) << "unsupported test pattern " << config.input_test_pattern;
+    return kUnsupportedPattern;
+  }
+  VideoConfig requested = config.requested_video_config;
+  if (requested.width <= 0 || requested.height <= 0) {
+    requested.width = 640;
+    requested.height = 480;
+  }
+  if (requested.width & 1 || requested.height & 1) {
+    LOG(ERROR) << "test patterns require even dimensions.";
+    return WebmEncoder::kInvalidArg;
+  }
+  if (!InitRawVideoConfig(config.input_video_fourcc, requested,
+                          &video_config_, &video_frame_length_)) {
+    return kUnsupportedPattern;
+  }
+  const int32 i420_length = video_config_.width * video_config_.height * 3 / 2;
+  i420_buffer_.reset(new (std::nothrow) uint8[i420_length]);  // NOLINT
+  frame_buffer_.reset(
+      new (std::nothrow) uint8[video_frame_length_]);  // NOLINT
+  if (!i420_buffer_ || !frame_buffer_) {
+    return WebmEncoder::kNoMemory;
+  }
+  video_enabled_ = true;
+  LOG(INFO) << "test pattern " << config.input_test_pattern << ": "
+            << config.input_video_fourcc << " " << video_config_.width << "x"
+            << video_config_.height << " @ " << video_config_.frame_rate
+            << " fps";
+  return kSuccess;
+}
+
+int TestPatternSource::InitAudio(const WebmEncoderConfig& config) {
+  if (config.input_test_audio == "tone") {
+    audio_pattern_ = kAudioPatternTone;
+  } else if (config.input_test_audio == "noise") {
+    audio_pattern_ = kAudioPatternNoise;
+  } else {
+    LOG(ERROR) << "unsupported test audio " << config.input_test_audio;
+    return kUnsupportedPattern;
+  }
+  const AudioConfig& requested = config.requested_audio_config;
+  if (requested.bits_per_sample == 16) {
+    audio_config_.format_tag = kAudioFormatPcm;
+  } else if (requested.bits_per_sample == 32) {
+    audio_config_.format_tag = kAudioFormatIeeeFloat;
+  } else {
+    LOG(ERROR) << "unsupported test audio sample size "
+               << requested.bits_per_sample;
+    return kUnsupportedPattern;
+  }
+  if (requested.channels == 0 || requested.sample_rate == 0) {
+    LOG(ERROR) << "test audio requires channels and sample rate.";
+    return WebmEncoder::kInvalidArg;
+  }
+  audio_config_.channels = requested.channels;
+  audio_config_.sample_rate = requested.sample_rate;
+  audio_config_.bits_per_sample = requested.bits_per_sample;
+  audio_config_.block_align =
+      static_cast<uint16>(requested.channels * requested.bits_per_sample / 8);
+  audio_config_.bytes_per_second =
+      audio_config_.block_align * audio_config_.sample_rate;
+  const int32 blocks_per_buffer = std::max<int32>(
+      audio_config_.sample_rate * kAudioBufferDurationMs / kTimebase, 1);
+  audio_samples_length_ = blocks_per_buffer * audio_config_.block_align;
+  audio_samples_.reset(
+      new (std::nothrow) uint8[audio_samples_length_]);  // NOLINT
+  if (!audio_samples_) {
+    return WebmEncoder::kNoMemory;
+  }
+  audio_enabled_ = true;
+  LOG(INFO) << "test audio " << config.input_test_audio << ": "
+            << audio_config_.channels << " channels @ "
+            << audio_config_.sample_rate << " Hz";
+  return kSuccess;
+}
+
+void TestPatternSource::GeneratorThread() {
+  const int64 kNoTimestamp = std::numeric_limits<int64>::max();
+  for (;;) {
+    const int64 video_timestamp = !video_enabled_ ? kNoTimestamp :
+        static_cast<int64>(num_frames_generated_ * kTimebase /
+                           video_config_.frame_rate);
+    const int64 audio_timestamp = !audio_enabled_ ? kNoTimestamp :
+        audio_blocks_generated_ * kTimebase / audio_config_.sample_rate;
+    const int64 timestamp = std::min(video_timestamp, audio_timestamp);
+    if (duration_limit_ > 0 && timestamp >= duration_limit_) {
+      break;
+    }
+    if (!WaitForTimestamp(timestamp)) {
+      LOG(INFO) << "test pattern source stopped.";
+      return;
+    }
+    const int status = video_timestamp < audio_timestamp ?
+        DeliverVideoFrame() : DeliverAudioBuffer();
+    if (status) {
+      LOG(ERROR) << "test pattern delivery failed: " << status;
+      status_.store(status);
+      return;
+    }
+  }
+  LOG(INFO) << "test pattern source reached its duration: "
+            << num_frames_generated_ << " frames, " << audio_blocks_generated_
+            << " audio sample blocks.";
+  status_.store(kEndOfStream);
+}
+
+int TestPatternSource::DeliverVideoFrame() {
+  const int64 timestamp = static_cast<int64>(
+      num_frames_generated_ * kTimebase / video_config_.frame_rate);
+  const int32 y_length = video_config_.width * video_config_.height;
+  const int32 uv_length = y_length / 4;
+  const bool is_i420 = video_config_.format == kVideoFormatI420;
+  const bool is_yv12 = video_config_.format == kVideoFormatYV12;
+  int status = kSuccess;
+
+  if ((is_i420 || is_yv12) && delivery_.has_video_allocator()) {
+    // Draw straight into a pool frame.
+    VideoFrame* ptr_frame = NULL;
+    status = delivery_.AcquireVideoFrame(video_frame_length_, &ptr_frame);
+    if (status == MediaDelivery::kStopped) {
+      return kSuccess;
+    }
+    if (status) {
+      return status;
+    }
+    if (ptr_frame) {
+      uint8* const ptr_y = ptr_frame->buffer();
+      uint8* const ptr_second = ptr_y + y_length;
+      uint8* const ptr_third = ptr_second + uv_length;
+      DrawFrame(ptr_y, is_yv12 ? ptr_third : ptr_second,
+                is_yv12 ? ptr_second : ptr_third);
+      const int64 duration =
+          static_cast<int64>(kTimebase / video_config_.frame_rate);
+      status = delivery_.PublishVideoFrame(video_config_, timestamp, duration,
+                                           video_frame_length_);
+    }
+  } else {
+    if (is_i420 || is_yv12) {
+      uint8* const ptr_y = frame_buffer_.get();
+      uint8* const ptr_second = ptr_y + y_length;
+      uint8* const ptr_third = ptr_second + uv_length;
+      DrawFrame(ptr_y, is_yv12 ? ptr_third : ptr_second,
+                is_yv12 ? ptr_second : ptr_third);
+    } else {
+      uint8* const ptr_y = i420_buffer_.get();
+      DrawFrame(ptr_y, ptr_y + y_length, ptr_y + y_length + uv_length);
+      PackFrame();
+    }
+    status = DeliverPackedFrame(timestamp);
+  }
+  ++num_frames_generated_;
+  return status;
+}
+
+int TestPatternSource::DeliverPackedFrame(int64 timestamp) {
+  const int64 duration =
+      static_cast<int64>(kTimebase / video_config_.frame_rate);
+  const int status = delivery_.DeliverVideoFrame(
+      video_config_, timestamp, duration, frame_buffer_.get(),
+      video_frame_length_);
+  return status == MediaDelivery::kStopped ? kSuccess : status;
+}
+
+void TestPatternSource::DrawFrame(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v) {
+  switch (video_pattern_) {
+    case kVideoPatternBars:
+      DrawBars(ptr_y, ptr_u, ptr_v);
+      break;
+    case kVideoPatternNoise:
+      DrawNoise(ptr_y, ptr_u, ptr_v);
+      break;
+    case kVideoPatternText:
+      DrawText(ptr_y, ptr_u, ptr_v);
+      break;
+  }
+}
+
+void TestPatternSource::DrawBars(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v) {
+  const int32 width = video_config_.width;
+  const int32 height = video_config_.height;
+  const int32 uv_width = width / 2;
+  const int64 offset = num_frames_generated_ * kBarsScrollPixels % width;
+
+  // Every row is the same; draw the first row of each plane and copy it.
+  for (int32 x = 0; x < width; ++x) {
+    const int bar = static_cast<int>((x + offset) % width * kNumBars / width);
+    ptr_y[x] = kBarColors[bar].y;
+  }
+  for (int32 x = 0; x < uv_width; ++x) {
+    const int bar =
+        static_cast<int>((2 * x + offset) % width * kNumBars / width);
+    ptr_u[x] = kBarColors[bar].u;
+    ptr_v[x] = kBarColors[bar].v;
+  }
+  for (int32 y = 1; y < height; ++y) {
+    memcpy(ptr_y + y * width, ptr_y, width);
+  }
+  for (int32 y = 1; y < height / 2; ++y) {
+    memcpy(ptr_u + y * uv_width, ptr_u, uv_width);
+    memcpy(ptr_v + y * uv_width, ptr_v, uv_width);
+  }
+}
+
+void TestPatternSource::DrawNoise(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v) {
+  const int32 y_length = video_config_.width * video_config_.height;
+  FillNoise(y_length, &video_noise_state_, ptr_y);
+  FillNoise(y_length / 4, &video_noise_state_, ptr_u);
+  FillNoise(y_length / 4, &video_noise_state_, ptr_v);
+}
+
+void TestPatternSource::DrawText(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v) {
+  const int32 width = video_config_.width;
+  const int32 height = video_config_.height;
+
+  // Background: a horizontal luma ramp with neutral chroma.
+  for (int32 x = 0; x < width; ++x) {
+    ptr_y[x] = static_cast<uint8>(
+        kBlackLuma + x * (kWhiteLuma - kBlackLuma) / width);
+  }
+  for (int32 y = 1; y < height; ++y) {
+    memcpy(ptr_y + y * width, ptr_y, width);
+  }
+  memset(ptr_u, kNeutralChroma, width * height / 4);
+  memset(ptr_v, kNeutralChroma, width * height / 4);
+
+  // Text: frame number and timestamp.
+  const int64 timestamp = static_cast<int64>(
+      num_frames_generated_ * kTimebase / video_config_.frame_rate);
+  char text[64];
+  snprintf(text, sizeof(text), "%08lld %02d:%02d:%02d.%03d",
+           static_cast<long long>(num_frames_generated_),  // NOLINT
+           static_cast<int>(timestamp / 3600000),
+           static_cast<int>(timestamp / 60000 % 60),
+           static_cast<int>(timestamp / 1000 % 60),
+           static_cast<int>(timestamp % 1000));
+  const int32 scale = std::max<int32>(1, height / 90);
+  const int32 advance = (kGlyphWidth + 1) * scale;
+  const int32 text_width = static_cast<int32>(strlen(text)) * advance;
+  const int64 left = width -
+      num_frames_generated_ * kTextScrollPixels % (width + text_width);
+  const int32 top = (height - kGlyphHeight * scale) / 2;
+  for (int32 i = 0; text[i] != '\0'; ++i) {
+    const char* const ptr_glyph_char = strchr(kGlyphChars, text[i]);
+    if (!ptr_glyph_char) {
+      continue;
+    }
+    const uint8* const ptr_glyph = kGlyphs[ptr_glyph_char - kGlyphChars];
+    for (int32 row = 0; row < kGlyphHeight * scale; ++row) {
+      const int32 y = top + row;
+      if (y < 0 || y >= height) {
+        continue;
+      }
+      const uint8 bits = ptr_glyph[row / scale];
+      for (int32 col = 0; col < kGlyphWidth * scale; ++col) {
+        const int64 x = left + i * advance + col;
+        if (x >= 0 && x < width && (bits & (0x10 >> (col / scale)))) {
+          ptr_y[y * width + x] = kWhiteLuma;
+        }
+      }
+    }
+  }
+}
+
+void TestPatternSource::PackFrame() {
+  const int32 width = video_config_.width;
+  const int32 height = video_config_.height;
+  const int32 stride = video_config_.stride;
+  const uint8* const ptr_y = i420_buffer_.get();
+  const uint8* const ptr_u = ptr_y + width * height;
+  const uint8* const ptr_v = ptr_u + width * height / 4;
+  uint8* const ptr_frame = frame_buffer_.get();
+
+  for (int32 y = 0; y < height; ++y) {
+    const uint8* const ptr_y_row = ptr_y + y * width;
+    const uint8* const ptr_u_row = ptr_u + y / 2 * (width / 2);
+    const uint8* const ptr_v_row = ptr_v + y / 2 * (width / 2);
+    switch (video_config_.format) {
+      case kVideoFormatYUY2:
+      case kVideoFormatYUYV:
+      case kVideoFormatUYVY: {
+        const bool uyvy = video_config_.format == kVideoFormatUYVY;
+        uint8* ptr_out = ptr_frame + y * stride;
+        for (int32 x = 0; x < width; x += 2) {
+          ptr_out[uyvy ? 1 : 0] = ptr_y_row[x];
+          ptr_out[uyvy ? 0 : 1] = ptr_u_row[x / 2];
+          ptr_out[uyvy ? 3 : 2] = ptr_y_row[x + 1];
+          ptr_out[uyvy ? 2 : 3] = ptr_v_row[x / 2];
+          ptr_out += 4;
+        }
+        break;
+      }
+      case kVideoFormatRGB:
+      case kVideoFormatRGBA: {
+        // Bottom up rows in DirectShow RGB24 and RGB32 byte order, which is
+        // what |VideoFrame::Init()| expects of captured RGB frames.
+        const int32 bytes_per_pixel =
+            video_config_.format == kVideoFormatRGB ? 3 : 4;
+        uint8* ptr_out = ptr_frame + (height - 1 - y) * stride;
+        for (int32 x = 0; x < width; ++x) {
+          YuvToRgb(ptr_y_row[x], ptr_u_row[x / 2], ptr_v_row[x / 2],
+                   &ptr_out[2], &ptr_out[1], &ptr_out[0]);
+          if (bytes_per_pixel == 4) {
+            ptr_out[3] = 255;
+          }
+          ptr_out += bytes_per_pixel;
+        }
+        break;
+      }
+      default:
+        LOG(ERROR) << "cannot pack video format " << video_config_.format;
+        return;
+    }
+  }
+}
+
+int TestPatternSource::DeliverAudioBuffer() {
+  const int64 num_blocks = audio_samples_length_ / audio_config_.block_align;
+  const int64 timestamp =
+      audio_blocks_generated_ * kTimebase / audio_config_.sample_rate;
+  const int64 duration = num_blocks * kTimebase / audio_config_.sample_rate;
+  GenerateAudio(num_blocks, audio_samples_.get());
+  audio_blocks_generated_ += num_blocks;
+  const int status = delivery_.DeliverAudioBuffer(
+      audio_config_, timestamp, duration, audio_samples_.get(),
+      audio_samples_length_);
+  return status == MediaDelivery::kStopped ? kSuccess : status;
+}
+
+void TestPatternSource::GenerateAudio(int64 num_blocks, uint8* ptr_samples) {
+  const double kTwoPi = 6.283185307179586;
+  const int64 sample_rate = audio_config_.sample_rate;
+  const bool is_float = audio_config_.format_tag == kAudioFormatIeeeFloat;
+  for (int64 block = 0; block < num_blocks; ++block) {
+    double value = 0;
+    if (audio_pattern_ == kAudioPatternTone) {
+      // The tone repeats every second; keep the phase argument small.
+      const int64 index = (audio_blocks_generated_ + block) % sample_rate;
+      value = kAudioLevel *
+          sin(kTwoPi * kToneFrequencyHz * index / sample_rate);
+    } else {
+      value = kAudioLevel *
+          (NextRandom(&audio_noise_state_) / 2147483648.0 - 1.0);
+    }
+    for (int channel = 0; channel < audio_config_.channels; ++channel) {
+      if (is_float) {
+        const float sample = static_cast<float>(value);
+        memcpy(ptr_samples, &sample, sizeof(sample));
+        ptr_samples += sizeof(sample);
+      } else {
+        const int16 sample = static_cast<int16>(value * 32767);
+        memcpy(ptr_samples, &sample, sizeof(sample));
+        ptr_samples += sizeof(sample);
+      }
+    }
+  }
+}
+
+bool TestPatternSource::WaitForTimestamp(int64 timestamp) {
+  const int64 wait_ms = ptr_clock_->AdvanceTo(start_time_ms_ + timestamp);
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (realtime_ && wait_ms > 0) {
+    wake_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                   [this]() { return stop_; });
+  }
+  return !stop_;
+}
+
+bool TestPatternSource::WaitToRetry() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  wake_.wait_for(lock, std::chrono::milliseconds(kRetryIntervalMs),
+                 [this]() { return stop_; });
+  return !stop_;
+}
+
+}  // namespace webmlive
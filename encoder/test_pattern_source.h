@@ -0,0 +1,166 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TEST_PATTERN_SOURCE_H_
+#define WEBMLIVE_ENCODER_TEST_PATTERN_SOURCE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/clock.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Media source that generates moving test patterns and test audio, for load
+// testing without capture devices. Output is deterministic: every run with
+// the same settings produces the same frames and samples.
+//
+// Video patterns, selected by |config.input_test_pattern|:
+// - "bars": color bars scrolling sideways.
+// - "noise": new random noise in every frame; the worst case for libvpx.
+// - "text": the frame number and timestamp scrolling over a luma ramp.
+// Frames use the dimensions and frame rate in |config.requested_video_config|,
+// or 640x480 at 30 fps when unset, and the |config.input_video_fourcc| pixel
+// format. Dimensions must be even. Formats other than I420 and YV12 pass
+// through the same conversion as captured frames.
+//
+// Audio, selected by |config.input_test_audio|, is a 1 kHz "tone" or white
+// "noise" using the channel count and rate in |config.requested_audio_config|.
+// Samples are 16 bit PCM, or 32 bit IEEE float when |bits_per_sample| is 32.
+//
+// Frames and buffers are generated in timestamp order on one thread, paced to
+// real time or, when |config.input_realtime| is false, as fast as the encoder
+// accepts them. |CheckStatus()| returns |kEndOfStream| after
+// |config.input_test_duration| milliseconds of output when it is nonzero.
+class TestPatternSource : public MediaSourceInterface {
+ public:
+  enum {
+    // |config.input_test_pattern| or |config.input_test_audio| is not a
+    // supported pattern name.
+    kUnsupportedPattern = -320,
+  };
+
+  // Duration of each delivered audio buffer.
+  static const int kAudioBufferDurationMs = 20;
+
+  TestPatternSource();
+  ~TestPatternSource() override;
+
+  int Init(const WebmEncoderConfig& config,
+           AudioSamplesCallbackInterface* ptr_audio_callback,
+           VideoFrameCallbackInterface* ptr_video_callback,
+           VideoFrameAllocatorInterface* ptr_video_allocator) override;
+  int Run() override;
+  int CheckStatus() override;
+  void Stop() override;
+  AudioConfig actual_audio_config() const override { return audio_config_; }
+  VideoConfig actual_video_config() const override { return video_config_; }
+
+ private:
+  enum VideoPattern {
+    kVideoPatternBars,
+    kVideoPatternNoise,
+    kVideoPatternText,
+  };
+  enum AudioPattern {
+    kAudioPatternTone,
+    kAudioPatternNoise,
+  };
+
+  int InitVideo(const WebmEncoderConfig& config);
+  int InitAudio(const WebmEncoderConfig& config);
+
+  // Generator thread. Delivers frames and buffers in timestamp order until
+  // the test duration is reached or |Stop()| is called.
+  void GeneratorThread();
+
+  // Generates and delivers the next video frame or audio buffer. Returns
+  // |kSuccess| or a |WebmEncoder| status code.
+  int DeliverVideoFrame();
+  int DeliverAudioBuffer();
+
+  // Passes the frame in |frame_buffer_| to the encoder. Returns |kSuccess| or
+  // a |WebmEncoder| status code.
+  int DeliverPackedFrame(int64 timestamp);
+
+  // Draws the current frame in I420 layout. |ptr_u| and |ptr_v| are planes of
+  // |video_config_.width| / 2 by |video_config_.height| / 2 samples.
+  void DrawFrame(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v);
+  void DrawBars(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v);
+  void DrawNoise(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v);
+  void DrawText(uint8* ptr_y, uint8* ptr_u, uint8* ptr_v);
+
+  // Converts the I420 frame in |i420_buffer_| to |video_config_.format| in
+  // |frame_buffer_|.
+  void PackFrame();
+
+  // Writes |num_blocks| sample blocks of the audio pattern to |ptr_samples|.
+  void GenerateAudio(int64 num_blocks, uint8* ptr_samples);
+
+  // Moves |ptr_clock_| to |timestamp| milliseconds after the start of
+  // delivery, and waits for it to get there when pacing to real time.
+  // Returns false when |Stop()| is called.
+  bool WaitForTimestamp(int64 timestamp);
+
+  // Sleeps briefly before input refused by the encoder is offered again.
+  // Returns false when |Stop()| is called.
+  bool WaitToRetry();
+
+  bool realtime_;
+
+  // Paces delivery. Not owned. |start_time_ms_| is the |ptr_clock_| time at
+  // which delivery started.
+  ClockInterface* ptr_clock_;
+  int64 start_time_ms_;
+  int64 duration_limit_;
+  MediaDelivery delivery_;
+
+  // Video state. Frames other than I420 and YV12 are drawn to |i420_buffer_|
+  // and packed into |frame_buffer_|; I420 and YV12 frames are drawn straight
+  // into frames obtained from |delivery_| when a video allocator is
+  // available.
+  bool video_enabled_;
+  VideoPattern video_pattern_;
+  VideoConfig video_config_;
+  int32 video_frame_length_;
+  int64 num_frames_generated_;
+  uint32 video_noise_state_;
+  std::unique_ptr<uint8[]> i420_buffer_;
+  std::unique_ptr<uint8[]> frame_buffer_;
+
+  // Audio state.
+  bool audio_enabled_;
+  AudioPattern audio_pattern_;
+  AudioConfig audio_config_;
+  int64 audio_blocks_generated_;
+  uint32 audio_noise_state_;
+  std::unique_ptr<uint8[]> audio_samples_;
+  int32 audio_samples_length_;
+
+  // Generator thread state. |stop_| is protected by |mutex_|, and |wake_|
+  // interrupts pacing waits when it is set.
+  std::shared_ptr<std::thread> thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+
+  // |kSuccess| while generating, then |kEndOfStream| or an error status.
+  std::atomic<int> status_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TestPatternSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TEST_PATTERN_SOURCE_H_
@@ -0,0 +1,185 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/thread_util.h"
+
+#include "encoder/encoder_base.h"
+
+#ifdef _WIN32
+#include <cwchar>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cstdlib>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+
+const int kMinNiceValue = -20;
+const int kMaxNiceValue = 19;
+
+#ifdef _WIN32
+// Available on Windows 10 1607 and later; looked up at runtime so that the
+// encoder still runs on older systems.
+typedef HRESULT (WINAPI* SetThreadDescriptionFunc)(HANDLE, PCWSTR);
+
+bool SetThreadName(const std::string& name) {
+  const HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+  SetThreadDescriptionFunc set_description = kernel32 ?
+      reinterpret_cast<SetThreadDescriptionFunc>(
+          GetProcAddress(kernel32, "SetThreadDescription")) : NULL;
+  if (!set_description) {
+    VLOG(1) << "SetThreadDescription unavailable; thread not named.";
+    return true;
+  }
+  const std::wstring wide_name(name.begin(), name.end());
+  return SUCCEEDED(set_description(GetCurrentThread(), wide_name.c_str()));
+}
+
+bool SetThreadCpus(const std::vector<int>& cpus) {
+  DWORD_PTR mask = 0;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i] >= static_cast<int>(sizeof(mask) * 8)) {
+      LOG(ERROR) << "CPU " << cpus[i] << " is outside the affinity mask.";
+      return false;
+    }
+    mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+  }
+  return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+bool SetThreadScheduling(bool realtime, int priority) {
+  int level = THREAD_PRIORITY_NORMAL;
+  if (realtime) {
+    level = THREAD_PRIORITY_TIME_CRITICAL;
+  } else if (priority <= -10) {
+    level = THREAD_PRIORITY_HIGHEST;
+  } else if (priority < 0) {
+    level = THREAD_PRIORITY_ABOVE_NORMAL;
+  } else if (priority >= 10) {
+    level = THREAD_PRIORITY_LOWEST;
+  } else if (priority > 0) {
+    level = THREAD_PRIORITY_BELOW_NORMAL;
+  }
+  return SetThreadPriority(GetCurrentThread(), level) != 0;
+}
+#else
+bool SetThreadName(const std::string& name) {
+  // Linux limits thread names to 16 bytes including the terminator.
+  const std::string short_name = name.substr(0, 15);
+  return pthread_setname_np(pthread_self(), short_name.c_str()) == 0;
+}
+
+bool SetThreadCpus(const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i] >= CPU_SETSIZE) {
+      LOG(ERROR) << "CPU " << cpus[i] << " exceeds CPU_SETSIZE.";
+      return false;
+    }
+    CPU_SET(cpus[i], &cpu_set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                &cpu_set) == 0;
+}
+
+bool SetThreadScheduling(bool realtime, int priority) {
+  if (realtime) {
+    sched_param param = {0};
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+  }
+  // On Linux nice values apply to individual threads when set by thread ID.
+  const id_t thread_id = static_cast<id_t>(syscall(SYS_gettid));
+  return setpriority(PRIO_PROCESS, thread_id, priority) == 0;
+}
+#endif  // _WIN32
+
+}  // namespace
+
+bool ApplyThreadOptions(const ThreadOptions& options) {
+  bool ok = true;
+  if (!options.name.empty() && !SetThreadName(options.name)) {
+    LOG(WARNING) << "cannot name thread " << options.name;
+    ok = false;
+  }
+  if (!options.cpus.empty() && !SetThreadCpus(options.cpus)) {
+    LOG(WARNING) << "cannot set CPU affinity of thread " << options.name;
+    ok = false;
+  }
+  if (options.realtime || options.priority != 0) {
+    const bool valid_priority = options.realtime ?
+        (options.priority >= 1 && options.priority <= 99) :
+        (options.priority >= kMinNiceValue &&
+         options.priority <= kMaxNiceValue);
+    if (!valid_priority) {
+      LOG(WARNING) << "invalid priority " << options.priority
+                   << " for thread " << options.name;
+      ok = false;
+    } else if (!SetThreadScheduling(options.realtime, options.priority)) {
+      LOG(WARNING) << "cannot set scheduling of thread " << options.name
+                   << " (insufficient privileges?)";
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool ApplyThreadOptions(const ThreadOptions& options,
+                        const std::string& default_name) {
+  if (!options.name.empty()) {
+    return ApplyThreadOptions(options);
+  }
+  ThreadOptions named_options = options;
+  named_options.name = default_name;
+  return ApplyThreadOptions(named_options);
+}
+
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* ptr_cpus) {
+  CHECK_NOTNULL(ptr_cpus);
+  std::vector<int> cpus;
+  std::istringstream list_stream(cpu_list);
+  std::string range;
+  while (std::getline(list_stream, range, ',')) {
+    char* ptr_end = NULL;
+    const long first = strtol(range.c_str(), &ptr_end, 10);  // NOLINT
+    long last = first;  // NOLINT
+    if (ptr_end == range.c_str() || first < 0) {
+      return false;
+    }
+    if (*ptr_end == '-') {
+      const char* const ptr_last = ptr_end + 1;
+      last = strtol(ptr_last, &ptr_end, 10);
+      if (ptr_end == ptr_last || last < first) {
+        return false;
+      }
+    }
+    if (*ptr_end != '\0') {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {  // NOLINT
+      cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+  if (cpus.empty()) {
+    return false;
+  }
+  ptr_cpus->swap(cpus);
+  return true;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,54 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_THREAD_UTIL_H_
+#define WEBMLIVE_ENCODER_THREAD_UTIL_H_
+
+#include <string>
+#include <vector>
+
+namespace webmlive {
+
+// Scheduling settings for one pipeline thread. Default values leave the
+// thread as the system created it.
+struct ThreadOptions {
+  ThreadOptions() : realtime(false), priority(0) {}
+
+  // Thread name shown by debuggers and system tools. Truncated to 15
+  // characters on Linux.
+  std::string name;
+
+  // CPUs the thread may run on. Empty means no restriction.
+  std::vector<int> cpus;
+
+  // Run the thread with the SCHED_FIFO policy on Linux, or at time critical
+  // priority on Windows. Usually requires elevated privileges.
+  bool realtime;
+
+  // When |realtime| is true, the SCHED_FIFO priority: 1 to 99. Otherwise a
+  // nice value from -20 (highest priority) to 19 (lowest priority). Windows
+  // maps nice values onto thread priority levels.
+  int priority;
+};
+
+// Applies |options| to the calling thread. Returns true when all options are
+// applied. Failures are logged, and do not prevent the remaining options from
+// being applied.
+bool ApplyThreadOptions(const ThreadOptions& options);
+
+// Behaves as |ApplyThreadOptions()| above, and names the thread
+// |default_name| when |options.name| is empty.
+bool ApplyThreadOptions(const ThreadOptions& options,
+                        const std::string& default_name);
+
+// Parses a CPU list such as "0-3,8,10-11" into |ptr_cpus|. Returns false when
+// |cpu_list| is malformed.
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* ptr_cpus);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_THREAD_UTIL_H_
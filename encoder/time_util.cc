@@ -14,16 +14,20 @@ namespace webmlive {
 const size_t kTimeUtilBufferSize = 256;
 
 std::string LocalDateString() {
+  return LocalDateString(static_cast<int64>(time(NULL)) * 1000);
+}
+
+std::string LocalDateString(int64 wall_time_ms) {
   char date_buffer[kTimeUtilBufferSize] = {0};
   // %Y - year
   // %m - month, zero padded (01-12)
   // %d - day of month, zero padded (01-31).
   const char format_string[] = "%Y%m%d";
-  const time_t raw_time_now = time(NULL);
-  const struct tm* time_now = localtime(&raw_time_now);
+  const time_t raw_time = static_cast<time_t>(wall_time_ms / 1000);
+  const struct tm* time_value = localtime(&raw_time);
 
   if (strftime(&date_buffer[0], sizeof(date_buffer), format_string,
-               time_now) == 0) {
+               time_value) == 0) {
     LOG(ERROR) << "DateString failed..";
     return "";
   }
@@ -33,16 +37,20 @@ std::string LocalDateString() {
 }
 
 std::string LocalTimeString() {
+  return LocalTimeString(static_cast<int64>(time(NULL)) * 1000);
+}
+
+std::string LocalTimeString(int64 wall_time_ms) {
   char time_buffer[kTimeUtilBufferSize] = {0};
   // %H - hour, zero padded, 24 hour clock (00-23)
   // %M - minute, zero padded (00-59)
   // %S - second, zero padded (00-61)
   const char format_string[] = "%H%M%S";
-  const time_t raw_time_now = time(NULL);
-  const struct tm* time_now = localtime(&raw_time_now);
+  const time_t raw_time = static_cast<time_t>(wall_time_ms / 1000);
+  const struct tm* time_value = localtime(&raw_time);
 
   if (strftime(&time_buffer[0], sizeof(time_buffer), format_string,
-               time_now) == 0) {
+               time_value) == 0) {
     LOG(ERROR) << "TimeString failed.";
     return "";
   }
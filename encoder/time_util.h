@@ -11,6 +11,8 @@
 #include <ctime>
 #include <string>
 
+#include "encoder/basictypes.h"
+
 namespace webmlive {
 
 // Time string utility functions. All return the string noted or an empty string
@@ -19,9 +21,17 @@ namespace webmlive {
 // Returns current date in the format: YYYYMMDD.
 std::string LocalDateString();
 
+// Returns the date |wall_time_ms| milliseconds after the Unix epoch in the
+// format: YYYYMMDD.
+std::string LocalDateString(int64 wall_time_ms);
+
 // Returns current time in the format: HHMMSS.
 std::string LocalTimeString();
 
+// Returns the time |wall_time_ms| milliseconds after the Unix epoch in the
+// format: HHMMSS.
+std::string LocalTimeString(int64 wall_time_ms);
+
 // Returns user requested time string.
 std::string StrFTime(const struct tm* time_value,
                      const std::string& format_string);
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/timestamp_merger.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+TimestampMerger::TimestampMerger()
+    : max_latency_(kDefaultMaxLatencyMs),
+      last_released_timestamp_(-1),
+      num_late_packets_(0) {
+}
+
+TimestampMerger::TimestampMerger(int64 max_latency)
+    : max_latency_(max_latency),
+      last_released_timestamp_(-1),
+      num_late_packets_(0) {
+}
+
+int TimestampMerger::AddTrack(TrackInterface* ptr_track) {
+  CHECK_NOTNULL(ptr_track);
+  tracks_.push_back(ptr_track);
+  produced_timestamps_.push_back(-1);
+  packet_waiting_.push_back(false);
+  return static_cast<int>(tracks_.size()) - 1;
+}
+
+int TimestampMerger::NextTrack(bool flush) {
+  const int num_tracks = static_cast<int>(tracks_.size());
+
+  // Read the produced timestamps before peeking at the tracks: every packet
+  // produced up to a track's timestamp is then visible to |PeekTimestamp()|.
+  int64 newest_timestamp = -1;
+  for (int i = 0; i < num_tracks; ++i) {
+    produced_timestamps_[i] = tracks_[i]->ProducedTimestamp();
+    newest_timestamp = std::max(newest_timestamp, produced_timestamps_[i]);
+  }
+
+  // Find the oldest waiting packet.
+  int next_track = kNoTrack;
+  int64 next_timestamp = 0;
+  for (int i = 0; i < num_tracks; ++i) {
+    int64 timestamp = 0;
+    packet_waiting_[i] = tracks_[i]->PeekTimestamp(&timestamp);
+    if (packet_waiting_[i] &&
+        (next_track == kNoTrack || timestamp < next_timestamp)) {
+      next_track = i;
+      next_timestamp = timestamp;
+    }
+  }
+  if (next_track == kNoTrack || flush) {
+    return next_track;
+  }
+
+  // Wait for empty tracks that may still produce an older packet, unless
+  // they have fallen more than |max_latency_| behind the newest track.
+  const int64 stall_timestamp = newest_timestamp - max_latency_;
+  for (int i = 0; i < num_tracks; ++i) {
+    const int64 produced = produced_timestamps_[i];
+    if (!packet_waiting_[i] && produced < next_timestamp &&
+        produced >= stall_timestamp) {
+      VLOG(4) << "waiting for track " << i << " produced=" << produced
+              << " next=" << next_timestamp;
+      return kNoTrack;
+    }
+  }
+  return next_track;
+}
+
+void TimestampMerger::ReleasePacket(int track, int64* ptr_timestamp) {
+  CHECK_NOTNULL(ptr_timestamp);
+  if (*ptr_timestamp < last_released_timestamp_) {
+    VLOG(1) << "late packet on track " << track << ": ts=" << *ptr_timestamp
+            << " last released=" << last_released_timestamp_;
+    *ptr_timestamp = last_released_timestamp_;
+    ++num_late_packets_;
+  }
+  last_released_timestamp_ = *ptr_timestamp;
+}
+
+}  // namespace webmlive
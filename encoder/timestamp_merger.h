@@ -0,0 +1,95 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TIMESTAMP_MERGER_H_
+#define WEBMLIVE_ENCODER_TIMESTAMP_MERGER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// K-way merge of encoded packet streams. Decides which track's oldest packet
+// must be passed to the muxer next so that packets reach the muxer in
+// timestamp order. Packets stay in the tracks; the merger only reads their
+// timestamps.
+//
+// A packet is released once it is the oldest waiting packet and every other
+// track has either a packet waiting or has produced packets past its
+// timestamp. A track that falls more than |max_latency| milliseconds behind
+// the newest track is not waited for, which bounds the delay a stalled
+// encoder imposes on the other tracks. Packets that such a track produces
+// later are late, and |ReleasePacket()| raises their timestamps so that the
+// timestamps passed to the muxer never decrease.
+//
+// Not thread safe; all methods must be called from the muxing thread. Tracks
+// may be filled from other threads.
+class TimestampMerger {
+ public:
+  // Returned by |NextTrack()| when no packet can be released.
+  static const int kNoTrack = -1;
+
+  static const int64 kDefaultMaxLatencyMs = 500;
+
+  // Source of encoded packets for one track.
+  class TrackInterface {
+   public:
+    virtual ~TrackInterface() {}
+
+    // Writes the timestamp of the oldest packet waiting in the track to
+    // |ptr_timestamp| and returns true. Returns false when no packet is
+    // waiting.
+    virtual bool PeekTimestamp(int64* ptr_timestamp) = 0;
+
+    // Returns the timestamp of the last packet produced by the track, or a
+    // negative value when the track has not produced a packet. Packets
+    // produced later have greater timestamps. Must be updated after the
+    // packet is visible to |PeekTimestamp()|.
+    virtual int64 ProducedTimestamp() = 0;
+  };
+
+  TimestampMerger();
+  explicit TimestampMerger(int64 max_latency);
+  ~TimestampMerger() {}
+
+  // Adds |ptr_track| to the merge and returns its index. Ties between
+  // packets with equal timestamps go to the track added first. |ptr_track|
+  // is not owned, and must outlive the merger.
+  int AddTrack(TrackInterface* ptr_track);
+
+  // Returns the index of the track holding the next packet in timestamp
+  // order, or |kNoTrack| when no packet is waiting or the next packet may
+  // still come from a track that has not produced it. When |flush| is true
+  // returns the track holding the oldest waiting packet without waiting for
+  // the other tracks.
+  int NextTrack(bool flush);
+
+  // Records the release of the oldest packet in |track|, whose timestamp is
+  // |*ptr_timestamp|. Raises |*ptr_timestamp| to the last released timestamp
+  // when the packet is late.
+  void ReleasePacket(int track, int64* ptr_timestamp);
+
+  // Returns the number of packets whose timestamps were raised by
+  // |ReleasePacket()|.
+  int64 num_late_packets() const { return num_late_packets_; }
+
+ private:
+  int64 max_latency_;
+  int64 last_released_timestamp_;
+  int64 num_late_packets_;
+  std::vector<TrackInterface*> tracks_;
+
+  // Per track scratch storage used by |NextTrack()|.
+  std::vector<int64> produced_timestamps_;
+  std::vector<bool> packet_waiting_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TimestampMerger);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TIMESTAMP_MERGER_H_
@@ -7,6 +7,7 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/video_encoder.h"
 
+#include <cstring>
 #include <new>
 
 #include "glog/logging.h"
@@ -76,10 +77,89 @@ bool FourCCToVideoFormat(uint32 fourcc,
   return converted;
 }
 
+bool InitRawVideoConfig(const std::string& format_name,
+                        const VideoConfig& requested,
+                        VideoConfig* ptr_config,
+                        int32* ptr_frame_length) {
+  struct RawVideoFormat {
+    const char* name;
+    uint32 fourcc;
+    uint16 bits_per_pixel;
+  };
+  // RGB formats have no four character code; |FourCCToVideoFormat()| takes 0.
+  const RawVideoFormat kRawVideoFormats[] = {
+    {"I420", libyuv::FOURCC_I420, kI420BitCount},
+    {"YV12", libyuv::FOURCC_YV12, kYV12BitCount},
+    {"YUY2", libyuv::FOURCC_YUY2, kYUY2BitCount},
+    {"YUYV", libyuv::FOURCC_YUYV, kYUYVBitCount},
+    {"UYVY", libyuv::FOURCC_UYVY, kUYVYBitCount},
+    {"RGB24", 0, kRGBBitCount},
+    {"RGBA", 0, kRGBABitCount},
+  };
+  if (!ptr_config || !ptr_frame_length) {
+    return false;
+  }
+  const RawVideoFormat* ptr_raw_format = NULL;
+  for (size_t i = 0; i < sizeof(kRawVideoFormats) / sizeof(RawVideoFormat);
+       ++i) {
+    if (format_name == kRawVideoFormats[i].name) {
+      ptr_raw_format = &kRawVideoFormats[i];
+      break;
+    }
+  }
+  VideoFormat format = kVideoFormatI420;
+  if (!ptr_raw_format ||
+      !FourCCToVideoFormat(ptr_raw_format->fourcc,
+                           ptr_raw_format->bits_per_pixel, &format)) {
+    LOG(ERROR) << "unsupported raw video format " << format_name;
+    return false;
+  }
+  if (requested.width <= 0 || requested.height <= 0) {
+    LOG(ERROR) << "raw video requires a width and height.";
+    return false;
+  }
+  const bool is_rgb = format == kVideoFormatRGB || format == kVideoFormatRGBA;
+  if (!is_rgb && (requested.width & 1 || requested.height & 1)) {
+    LOG(ERROR) << format_name << " video requires even dimensions.";
+    return false;
+  }
+  ptr_config->format = format;
+  ptr_config->width = requested.width;
+  ptr_config->height = requested.height;
+  ptr_config->frame_rate =
+      requested.frame_rate > 0 ? requested.frame_rate : 30.0;
+  if (format == kVideoFormatI420 || format == kVideoFormatYV12) {
+    ptr_config->stride = requested.width;
+    *ptr_frame_length = requested.width * requested.height * 3 / 2;
+  } else {
+    ptr_config->stride = requested.width * ptr_raw_format->bits_per_pixel / 8;
+    *ptr_frame_length = ptr_config->stride * requested.height;
+  }
+  return true;
+}
+
+int32 VideoFrameCapacity(const VideoConfig& config) {
+  const int32 height = abs(config.height);
+  if (config.width <= 0 || height == 0) {
+    return 0;
+  }
+
+  // Frames that |VideoFrame::Init()| stores without conversion keep the
+  // source stride. All other formats are converted to I420 with stride equal
+  // to width.
+  int32 stride = config.width;
+  if ((config.format == kVideoFormatI420 ||
+       config.format == kVideoFormatYV12) && config.stride > stride) {
+    stride = config.stride;
+  }
+  return stride * height * 3 / 2;
+}
+
 VideoFrame::VideoFrame()
     : keyframe_(false),
       timestamp_(0),
       duration_(0),
+      pipeline_time_us_(0),
       buffer_capacity_(0),
       buffer_length_(0) {
 }
@@ -151,6 +231,7 @@ int VideoFrame::Clone(VideoFrame* ptr_frame) const {
   ptr_frame->keyframe_ = keyframe_;
   ptr_frame->timestamp_ = timestamp_;
   ptr_frame->duration_ = duration_;
+  ptr_frame->pipeline_time_us_ = pipeline_time_us_;
   return kSuccess;
 }
 
@@ -174,6 +255,10 @@ void VideoFrame::Swap(VideoFrame* ptr_frame) {
   duration_ = ptr_frame->duration_;
   ptr_frame->duration_ = temp_time;
 
+  temp_time = pipeline_time_us_;
+  pipeline_time_us_ = ptr_frame->pipeline_time_us_;
+  ptr_frame->pipeline_time_us_ = temp_time;
+
   buffer_.swap(ptr_frame->buffer_);
 
   int32 temp = buffer_capacity_;
@@ -185,6 +270,46 @@ void VideoFrame::Swap(VideoFrame* ptr_frame) {
   ptr_frame->buffer_length_ = temp;
 }
 
+int VideoFrame::Reserve(int32 capacity) {
+  if (capacity <= 0) {
+    LOG(ERROR) << "VideoFrame cannot Reserve " << capacity << " bytes.";
+    return kInvalidArg;
+  }
+  if (capacity > buffer_capacity_) {
+    buffer_.reset(new (std::nothrow) uint8[capacity]);  // NOLINT
+    if (!buffer_) {
+      LOG(ERROR) << "VideoFrame Reserve cannot allocate buffer.";
+      buffer_capacity_ = 0;
+      buffer_length_ = 0;
+      return kNoMemory;
+    }
+    buffer_capacity_ = capacity;
+    buffer_length_ = 0;
+  }
+  return kSuccess;
+}
+
+int VideoFrame::InitInPlace(const VideoConfig& config,
+                            bool keyframe,
+                            int64 timestamp,
+                            int64 duration,
+                            int32 data_length) {
+  if (config.format != kVideoFormatI420 && config.format != kVideoFormatYV12) {
+    LOG(ERROR) << "VideoFrame InitInPlace requires I420 or YV12 data.";
+    return kInvalidArg;
+  }
+  if (data_length <= 0 || data_length > buffer_capacity_) {
+    LOG(ERROR) << "VideoFrame InitInPlace invalid length " << data_length;
+    return kInvalidArg;
+  }
+  buffer_length_ = data_length;
+  config_ = config;
+  keyframe_ = keyframe;
+  timestamp_ = timestamp;
+  duration_ = duration;
+  return kSuccess;
+}
+
 int VideoFrame::ConvertToI420(const VideoConfig& source_config,
                               const uint8* ptr_data) {
   // Allocate storage for the I420 frame.
@@ -11,6 +11,7 @@
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
@@ -74,6 +75,23 @@ struct VideoConfig {
   double frame_rate;    // Frame rate in frames per second.
 };
 
+// Utility function for sources that produce raw frames in a format chosen by
+// name: "I420", "YV12", "YUY2", "YUYV", "UYVY", "RGB24" or "RGBA". Writes the
+// tightly packed layout of |format_name| frames with the dimensions and frame
+// rate of |requested| to |ptr_config|, writes the length in bytes of one frame
+// to |ptr_frame_length|, and returns true. The frame rate defaults to 30 when
+// |requested| has none. Returns false when the name is not recognized, when
+// |requested| has no dimensions, or when a YUV format has odd dimensions.
+bool InitRawVideoConfig(const std::string& format_name,
+                        const VideoConfig& requested,
+                        VideoConfig* ptr_config,
+                        int32* ptr_frame_length);
+
+// Returns the buffer capacity in bytes required to store a frame described by
+// |config| after |VideoFrame::Init()|. Returns 0 when |config| has no
+// dimensions.
+int32 VideoFrameCapacity(const VideoConfig& config);
+
 // Storage class for I420, YV12, and VPx video frames. The main idea here is to
 // store frames in such a way that they can easily be obtained from the capture
 // source and passed to the libvpx VPx encoder.
@@ -119,6 +137,23 @@ class VideoFrame {
   // must have non-NULL buffers.
   void Swap(VideoFrame* ptr_frame);
 
+  // Allocates storage for at least |capacity| bytes when |buffer_capacity_| is
+  // smaller than |capacity|, and returns |kSuccess|. Frame data is discarded
+  // when allocation occurs. Returns |kInvalidArg| when |capacity| is <= 0.
+  // Returns |kNoMemory| when memory allocation fails.
+  int Reserve(int32 capacity);
+
+  // Sets internal fields for |data_length| bytes of frame data the caller has
+  // written to |buffer()| after |Reserve()|, and returns |kSuccess|. Allows
+  // sources to read frames straight into |buffer()|. Returns |kInvalidArg|
+  // when |data_length| is <= 0 or exceeds |buffer_capacity()|, or when
+  // |config.format| would require conversion by |Init()|.
+  int InitInPlace(const VideoConfig& config,
+                  bool keyframe,
+                  int64 timestamp,
+                  int64 duration,
+                  int32 data_length);
+
   // Accessors/Mutators.
   bool keyframe() const { return keyframe_; }
   int32 width() const { return config_.width; }
@@ -127,6 +162,8 @@ class VideoFrame {
   int64 timestamp() const { return timestamp_; }
   void set_timestamp(int64 timestamp) { timestamp_ = timestamp; }
   int64 duration() const { return duration_; }
+  int64 pipeline_time_us() const { return pipeline_time_us_; }
+  void set_pipeline_time_us(int64 time_us) { pipeline_time_us_ = time_us; }
   uint8* buffer() const { return buffer_.get(); }
   int32 buffer_length() const { return buffer_length_; }
   int32 buffer_capacity() const { return buffer_capacity_; }
@@ -144,6 +181,11 @@ class VideoFrame {
   bool keyframe_;
   int64 timestamp_;
   int64 duration_;
+
+  // |SteadyTimeUs()| value when the frame entered its current pipeline stage.
+  // Used only for latency statistics. Carried by |Clone()| and |Swap()|, and
+  // left alone by |Init()| and |InitInPlace()|.
+  int64 pipeline_time_us_;
   std::unique_ptr<uint8[]> buffer_;
   int32 buffer_capacity_;
   int32 buffer_length_;
@@ -156,7 +198,8 @@ class VideoFrame {
 class VideoFrameCallbackInterface {
  public:
   enum {
-    // Returned by |OnVideoFrameReceived| when |ptr_frame| is NULL or empty.
+    // Returned by |OnVideoFrameReceived| when |ptr_frame| is NULL or empty,
+    // or cannot be stored.
     kInvalidArg = -2,
     kSuccess = 0,
     // Returned by |OnVideoFrameReceived| when |ptr_frame| is dropped.
@@ -170,6 +213,36 @@ class VideoFrameCallbackInterface {
   virtual int OnVideoFrameReceived(VideoFrame* ptr_frame) = 0;
 };
 
+// Pure interface class that allows capture sources to write video frames
+// directly into storage owned by the implementor instead of passing frames
+// through |VideoFrameCallbackInterface|. Calls to |AcquireVideoFrame()| must be
+// followed by one call to |PublishVideoFrame()| or |CancelVideoFrame()|.
+class VideoFrameAllocatorInterface {
+ public:
+  enum {
+    // Returned when called out of order, when |ptr_frame| is NULL, or when no
+    // frame can be provided for reasons other than load.
+    kInvalidArg = -2,
+    kSuccess = 0,
+    // Returned by |AcquireVideoFrame| when no frame is available, and the
+    // frame must be dropped.
+    kDropped = 1,
+  };
+  virtual ~VideoFrameAllocatorInterface() {}
+
+  // Writes a pointer to a writable |VideoFrame| to |ptr_frame|. The frame
+  // remains owned by the implementor.
+  virtual int AcquireVideoFrame(VideoFrame** ptr_frame) = 0;
+
+  // Passes the frame obtained from |AcquireVideoFrame()| to the implementor
+  // for processing.
+  virtual int PublishVideoFrame() = 0;
+
+  // Returns the frame obtained from |AcquireVideoFrame()| to the implementor
+  // without processing it.
+  virtual void CancelVideoFrame() = 0;
+};
+
 struct VpxConfig {
   // Special value that means use the default value for the current option.
   static const int kUseDefault = -200;
@@ -14,6 +14,8 @@
 #endif
 #include "encoder/vpx_encoder.h"
 
+#include <cstring>
+
 #include "encoder/webm_encoder.h"
 #include "glog/logging.h"
 
@@ -13,9 +13,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <sstream>
+#include <vector>
 
 #include "encoder/buffer_pool-inl.h"
 #include "encoder/dash_writer.h"
+#include "encoder/file_media_source.h"
+#include "encoder/media_source.h"
+#include "encoder/pipe_media_source.h"
+#include "encoder/test_pattern_source.h"
+#include "encoder/timestamp_merger.h"
 #include "encoder/webm_mux.h"
 #ifdef _WIN32
 #include "encoder/win/media_source_dshow.h"
@@ -28,6 +34,61 @@ const char kMuxedId[] = "muxed";
 const char kAudioId[] = "audio";
 const char kVideoId[] = "video";
 
+// Maximum time the encoder threads block waiting for input before checking
+// media source status and stop requests.
+const int kInputWaitTimeoutMs = 100;
+
+// Size of the compressed frame and buffer pools between the encode threads
+// and the mux thread. The pools grow by up to |kMaxCompressedOverflowBuffers|
+// buffer objects while the mux thread is blocked, and the encode threads wait
+// beyond that.
+const int kCompressedPoolBufferCount = 8;
+const int kMaxCompressedOverflowBuffers = 120;
+
+// Duration of audio preallocated in each |AudioBuffer| stored in the audio
+// pool. Larger buffers from the media source cause reallocation.
+const int kAudioBufferCapacityMs = 500;
+
+// Maximum number of overflow buffers held by the audio pool when the encoder
+// falls behind audio capture. Audio is dropped only beyond this limit, which
+// caps the pool near 25 MB of 48 kHz stereo 16 bit storage.
+const int kMaxAudioOverflowBuffers = 256;
+
+void LogPoolStats(const char* pool_name,
+                  const webmlive::BufferPoolStats& stats) {
+  LOG(INFO) << pool_name << " pool stats: committed=" << stats.num_committed
+            << " overflowed=" << stats.num_overflowed
+            << " dropped_newest=" << stats.num_dropped_newest
+            << " dropped_oldest=" << stats.num_dropped_oldest
+            << " decimated=" << stats.num_decimated;
+}
+
+// Exposes a compressed |BufferPool| to |TimestampMerger|. |ptr_produced|
+// holds the timestamp of the last buffer the encode thread committed to the
+// pool, or processed without output.
+template <class T>
+class PoolMergeTrack : public webmlive::TimestampMerger::TrackInterface {
+ public:
+  PoolMergeTrack(webmlive::BufferPool<T>* ptr_pool,
+                 const std::atomic<int64>* ptr_produced)
+      : ptr_pool_(ptr_pool),
+        ptr_produced_(ptr_produced) {}
+  virtual ~PoolMergeTrack() {}
+
+  bool PeekTimestamp(int64* ptr_timestamp) override {
+    return ptr_pool_->ActiveBufferTimestamp(ptr_timestamp) ==
+           webmlive::BufferPool<T>::kSuccess;
+  }
+  int64 ProducedTimestamp() override {
+    return ptr_produced_->load(std::memory_order_acquire);
+  }
+
+ private:
+  webmlive::BufferPool<T>* const ptr_pool_;
+  const std::atomic<int64>* const ptr_produced_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PoolMergeTrack);
+};
+
 // Adds |timestamp_offset| to the timestamp value of |ptr_sample|, and returns
 // |WebmEncoder::kSuccess|. Returns |WebmEncoder::kInvalidArg| when |ptr_sample|
 // is NULL.
@@ -43,7 +104,43 @@ int OffsetTimestamp(int64 timestamp_offset, T* ptr_sample) {
   return WebmEncoder::kSuccess;
 }
 
-int InitMuxer(int chunk_duration, const std::string& muxer_id,
+// Returns true when the source created by |CreateMediaSource()| offers
+// buffers the encoder refuses again instead of dropping them.
+bool MediaSourceRetries(const webmlive::WebmEncoderConfig& config) {
+  const bool capture_source = config.input_video_pipe.empty() &&
+                              config.input_audio_pipe.empty() &&
+                              config.input_video_file.empty() &&
+                              config.input_audio_file.empty() &&
+                              config.input_test_pattern.empty();
+  return !capture_source && !config.input_realtime;
+}
+
+// Returns a |PipeMediaSource| when |config| names an input pipe, a
+// |FileMediaSource| when it names an input file, a |TestPatternSource| when it
+// names a test pattern, and the platform capture source otherwise. Returns
+// NULL when the platform has no capture source, or when construction fails.
+webmlive::MediaSourceInterface* CreateMediaSource(
+    const webmlive::WebmEncoderConfig& config) {
+  if (!config.input_video_pipe.empty() || !config.input_audio_pipe.empty()) {
+    return new (std::nothrow) webmlive::PipeMediaSource();  // NOLINT
+  }
+  if (!config.input_video_file.empty() || !config.input_audio_file.empty()) {
+    return new (std::nothrow) webmlive::FileMediaSource();  // NOLINT
+  }
+  if (!config.input_test_pattern.empty()) {
+    return new (std::nothrow) webmlive::TestPatternSource();  // NOLINT
+  }
+#ifdef _WIN32
+  return new (std::nothrow) webmlive::MediaSourceImpl();  // NOLINT
+#else
+  LOG(ERROR) << "no capture source on this platform; use file, pipe or test "
+             << "pattern input.";
+  return NULL;
+#endif
+}
+
+int InitMuxer(const webmlive::LiveWebmMuxer::Options& options,
+              const std::string& muxer_id,
               std::unique_ptr<webmlive::LiveWebmMuxer>* muxer) {
   CHECK_NOTNULL(muxer);
   (*muxer).reset(new (std::nothrow) webmlive::LiveWebmMuxer());  // NOLINT
@@ -51,7 +148,7 @@ int InitMuxer(int chunk_duration, const std::string& muxer_id,
     LOG(ERROR) << "cannot construct live muxer!";
     return webmlive::WebmEncoder::kInitFailed;
   }
-  const int status = (*muxer)->Init(chunk_duration, muxer_id);
+  const int status = (*muxer)->Init(options, muxer_id);
   if (status) {
     LOG(ERROR) << "live muxer Init failed " << status;
     return webmlive::WebmEncoder::kInitFailed;
@@ -66,18 +163,43 @@ namespace webmlive {
 WebmEncoder::WebmEncoder()
     : initialized_(false),
       stop_(false),
-      chunk_buffer_size_(0),
+      interleave_streams_(false),
+      input_retries_(false),
+      ptr_audio_muxer_(NULL),
+      ptr_video_muxer_(NULL),
+      encode_status_(kSuccess),
+      finished_(false),
+      ptr_worker_pool_(NULL),
+      pool_stages_enabled_(false),
+      sink_blocked_(false),
+      video_encoded_timestamp_(-1),
       encoded_duration_(0),
-      ptr_encode_func_(NULL),
-      timestamp_offset_(0) {
+      audio_packets_pending_(false),
+      audio_encoded_timestamp_(-1),
+      audio_track_index_(TimestampMerger::kNoTrack),
+      video_track_index_(TimestampMerger::kNoTrack),
+      timestamp_offset_(0),
+      ptr_acquired_video_frame_(NULL),
+      video_frames_encoded_(0),
+      video_frames_dropped_by_encoder_(0),
+      video_frames_muxed_(0),
+      audio_buffers_muxed_(0),
+      chunks_out_(0),
+      bytes_out_(0) {
 }
 
 WebmEncoder::~WebmEncoder() {
 }
 
-// Constructs media source object and calls its |Init| method.
 int WebmEncoder::Init(const WebmEncoderConfig& config,
                       DataSink* ptr_data_sink) {
+  return Init(config, ptr_data_sink, NULL);
+}
+
+// Constructs media source object and calls its |Init| method.
+int WebmEncoder::Init(const WebmEncoderConfig& config,
+                      DataSink* ptr_data_sink,
+                      WorkerPool* ptr_worker_pool) {
   if (config.disable_audio && config.disable_video) {
     LOG(ERROR) << "Audio and video are disabled!";
     return kInvalidArg;
@@ -88,24 +210,25 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
   }
 
   config_ = config;
+  if (!config_.ptr_clock) {
+    config_.ptr_clock = GetSystemClock();
+  }
   ptr_data_sink_ = ptr_data_sink;
+  ptr_worker_pool_ = ptr_worker_pool;
 
-  // Allocate the chunk buffer.
-  chunk_buffer_.reset(
-      new (std::nothrow) uint8[kDefaultChunkBufferSize]);  // NOLINT
-  if (!chunk_buffer_) {
-    LOG(ERROR) << "Unable to allocate chunk buffer!";
-    return kNoMemory;
-  }
-  chunk_buffer_size_ = kDefaultChunkBufferSize;
+  // Stage tasks schedule each other instead of waking threads, so the
+  // compressed pools only signal |EncoderThread()| in thread mode.
+  BufferPoolSignal* const compressed_signal =
+      ptr_worker_pool_ ? NULL : &mux_signal_;
 
   // Construct and initialize the media source(s).
-  ptr_media_source_.reset(new (std::nothrow) MediaSourceImpl());  // NOLINT
+  ptr_media_source_.reset(CreateMediaSource(config_));
+  input_retries_ = MediaSourceRetries(config_);
   if (!ptr_media_source_) {
     LOG(ERROR) << "cannot construct media source!";
     return kInitFailed;
   }
-  int status = ptr_media_source_->Init(config_, this, this);
+  int status = ptr_media_source_->Init(config_, this, this, this);
   if (status) {
     LOG(ERROR) << "media source Init failed " << status;
     return kInitFailed;
@@ -122,14 +245,21 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
   LiveWebmMuxer* video_muxer = NULL;
 
   // Construct and initialize the muxer(s).
+  LiveWebmMuxer::Options muxer_options;
+  muxer_options.known_size_clusters = config_.known_size_clusters;
+  muxer_options.progressive = config_.progressive_clusters;
+  muxer_options.live_cluster_writer = config_.live_cluster_writer;
+  interleave_streams_ = false;
   if (config_.dash_encode) {
-    status = InitMuxer(config_.vpx_config.keyframe_interval, kAudioId,
-                       &ptr_muxer_aud_);
+    LiveWebmMuxer::Options audio_muxer_options = muxer_options;
+    audio_muxer_options.cluster_duration_milliseconds =
+        config_.vpx_config.keyframe_interval;
+    status = InitMuxer(audio_muxer_options, kAudioId, &ptr_muxer_aud_);
     if (status) {
       LOG(ERROR) << "InitMuxer (A) failed: " << status;
       return status;
     }
-    status = InitMuxer(0, kVideoId, &ptr_muxer_vid_);
+    status = InitMuxer(muxer_options, kVideoId, &ptr_muxer_vid_);
     if (status) {
       LOG(ERROR) << "InitMuxer (V) failed: " << status;
       return status;
@@ -137,33 +267,61 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     audio_muxer = ptr_muxer_aud_.get();
     video_muxer = ptr_muxer_vid_.get();
   } else {
-    status = InitMuxer(0, kMuxedId, &ptr_muxer_);
+    status = InitMuxer(muxer_options, kMuxedId, &ptr_muxer_);
     if (status) {
       LOG(ERROR) << "InitMuxer failed: " << status;
       return status;
     }
     audio_muxer = ptr_muxer_.get();
     video_muxer = ptr_muxer_.get();
+    interleave_streams_ = !config_.disable_audio && !config_.disable_video;
   }
+  ptr_audio_muxer_ = audio_muxer;
+  ptr_video_muxer_ = video_muxer;
 
   if (config_.disable_video == false) {
     config_.actual_video_config = ptr_media_source_->actual_video_config();
 
-    // Initialize the video frame pool.
-    const int default_count = BufferPool<VideoFrame>::kDefaultBufferCount;
-    const double& fps = config_.actual_video_config.frame_rate;
-
-    // Buffer up to half a second of video when audio is enabled.
-    // TODO(tomfinegan): Add a VPx frame pool to store compressed frames while
-    //                   waiting for audio instead of throwing memory at the
-    //                   problem.
-    const int num_video_buffers =
-        config_.disable_audio ? default_count : static_cast<int>(fps / 2.0);
-    if (video_pool_.Init(false, num_video_buffers)) {
+    // Initialize the video frame pool. Frames no longer wait in the pool for
+    // audio; compressed frames wait in |vpx_pool_| instead.
+    video_pool_.set_signal(&input_signal_);
+
+    // Preallocate pool frames at their final size so that frames move
+    // between the capture and encoder threads without allocation.
+    BufferPoolOptions video_pool_options;
+    video_pool_options.drop_policy = config_.video_drop_policy;
+    video_pool_options.buffer_capacity =
+        VideoFrameCapacity(config_.actual_video_config);
+    if (video_pool_.Init(video_pool_options)) {
       LOG(ERROR) << "BufferPool<VideoFrame> Init failed!";
       return kInitFailed;
     }
 
+    // Initialize the compressed frame pool.
+    if (compressed_signal) {
+      vpx_pool_.set_signal(compressed_signal);
+    }
+    BufferPoolOptions vpx_pool_options;
+    vpx_pool_options.drop_policy = kNeverDropBuffers;
+    vpx_pool_options.num_buffers = kCompressedPoolBufferCount;
+    vpx_pool_options.max_overflow_buffers = kMaxCompressedOverflowBuffers;
+    if (vpx_pool_.Init(vpx_pool_options)) {
+      LOG(ERROR) << "BufferPool<VideoFrame> (VPx) Init failed!";
+      return kInitFailed;
+    }
+
+    // Size the libvpx worker count to the CPUs given to the video encode
+    // thread. The workers are not pinned: VP8 creates them in
+    // |VideoEncoder::Init()| below, on the thread calling |Init()|, so they
+    // take that thread's affinity rather than the video thread's.
+    const std::vector<int>& video_cpus = config_.video_thread_options.cpus;
+    const int max_vpx_threads = static_cast<int>(video_cpus.size());
+    if (max_vpx_threads > 0 &&
+        config_.vpx_config.thread_count > max_vpx_threads) {
+      LOG(INFO) << "capping libvpx threads at " << max_vpx_threads;
+      config_.vpx_config.thread_count = max_vpx_threads;
+    }
+
     // Initialize the video encoder.
     status = video_encoder_.Init(config_);
     if (status) {
@@ -185,12 +343,31 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     config_.actual_audio_config = ptr_media_source_->actual_audio_config();
 
     // Initialize the audio buffer pool.
-    const int num_audio_buffers = BufferPool<AudioBuffer>::kDefaultBufferCount;
-    if (audio_pool_.Init(true, num_audio_buffers)) {
+    audio_pool_.set_signal(&input_signal_);
+    BufferPoolOptions audio_pool_options;
+    audio_pool_options.drop_policy = kNeverDropBuffers;
+    audio_pool_options.buffer_capacity =
+        AudioBufferCapacity(config_.actual_audio_config,
+                            kAudioBufferCapacityMs);
+    audio_pool_options.max_overflow_buffers = kMaxAudioOverflowBuffers;
+    if (audio_pool_.Init(audio_pool_options)) {
       LOG(ERROR) << "BufferPool<AudioBuffer> Init failed!";
       return kInitFailed;
     }
 
+    // Initialize the compressed audio pool.
+    if (compressed_signal) {
+      vorbis_pool_.set_signal(compressed_signal);
+    }
+    BufferPoolOptions vorbis_pool_options;
+    vorbis_pool_options.drop_policy = kNeverDropBuffers;
+    vorbis_pool_options.num_buffers = kCompressedPoolBufferCount;
+    vorbis_pool_options.max_overflow_buffers = kMaxCompressedOverflowBuffers;
+    if (vorbis_pool_.Init(vorbis_pool_options)) {
+      LOG(ERROR) << "BufferPool<AudioBuffer> (Vorbis) Init failed!";
+      return kInitFailed;
+    }
+
     // Initialize the vorbis encoder.
     status = vorbis_encoder_.Init(config_.actual_audio_config,
                                   config_.vorbis_config);
@@ -216,14 +393,36 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     }
   }
 
-  if (config_.dash_encode) {
-    ptr_encode_func_ = &WebmEncoder::DashEncode;
-  } else if (config_.disable_audio) {
-    ptr_encode_func_ = &WebmEncoder::EncodeVideoFrame;
-  } else if (config_.disable_video) {
-    ptr_encode_func_ = &WebmEncoder::EncodeAudioOnly;
-  } else {
-    ptr_encode_func_ = &WebmEncoder::AVEncode;
+  // Register the compressed pools with |merger_|. Audio is added first so
+  // that audio wins timestamp ties.
+  if (config_.disable_audio == false) {
+    audio_merge_track_.reset(
+        new (std::nothrow) PoolMergeTrack<AudioBuffer>(  // NOLINT
+            &vorbis_pool_, &audio_encoded_timestamp_));
+    if (!audio_merge_track_) {
+      LOG(ERROR) << "cannot construct audio merge track!";
+      return kNoMemory;
+    }
+    audio_track_index_ = merger_.AddTrack(audio_merge_track_.get());
+  }
+  if (config_.disable_video == false) {
+    video_merge_track_.reset(
+        new (std::nothrow) PoolMergeTrack<VideoFrame>(  // NOLINT
+            &vpx_pool_, &video_encoded_timestamp_));
+    if (!video_merge_track_) {
+      LOG(ERROR) << "cannot construct video merge track!";
+      return kNoMemory;
+    }
+    video_track_index_ = merger_.AddTrack(video_merge_track_.get());
+  }
+
+  if (ptr_worker_pool_) {
+    if (InitPoolStage(&WebmEncoder::RunAudioStage, &audio_stage_) ||
+        InitPoolStage(&WebmEncoder::RunVideoStage, &video_stage_) ||
+        InitPoolStage(&WebmEncoder::RunMuxStage, &mux_stage_)) {
+      LOG(ERROR) << "cannot construct pool stages!";
+      return kNoMemory;
+    }
   }
 
   initialized_ = true;
@@ -252,13 +451,11 @@ int WebmEncoder::Run() {
   return kSuccess;
 }
 
-// Sets |stop_| to true and calls join on |encode_thread_| to wait for
-// |EncoderThread| to finish.
+// Sets |stop_| to true, wakes the encoder threads if they are waiting, and
+// calls join on |encode_thread_| to wait for |EncoderThread| to finish.
 void WebmEncoder::Stop() {
   CHECK(encode_thread_);
-  mutex_.lock();
-  stop_ = true;
-  mutex_.unlock();
+  RequestStop();
   encode_thread_->join();
 }
 
@@ -268,31 +465,106 @@ int64 WebmEncoder::encoded_duration() const {
   return encoded_duration_;
 }
 
+WebmEncoderStats WebmEncoder::GetStats() const {
+  WebmEncoderStats stats;
+  stats.audio_pool = audio_pool_.GetStats();
+  stats.video_pool = video_pool_.GetStats();
+  stats.video_frames_encoded = video_frames_encoded_.load();
+  stats.video_frames_dropped_by_encoder =
+      video_frames_dropped_by_encoder_.load();
+  stats.video_frames_muxed = video_frames_muxed_.load();
+  stats.audio_buffers_muxed = audio_buffers_muxed_.load();
+  stats.chunks_out = chunks_out_.load();
+  stats.bytes_out = bytes_out_.load();
+  stats.encode_latency = encode_latency_.Summarize();
+  stats.mux_latency = mux_latency_.Summarize();
+  stats.sink_latency = sink_latency_.Summarize();
+  return stats;
+}
+
+bool WebmEncoder::RawInputDrained() const {
+  return audio_pool_.IsEmpty() && video_pool_.IsEmpty() &&
+         !audio_packets_pending_;
+}
+
 // AudioSamplesCallbackInterface
-bool WebmEncoder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+int WebmEncoder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+  // Sources that are not real time offer the buffer again until it fits, so
+  // a full pool is back-pressure rather than a drop. Refuse those buffers
+  // before |Commit()| counts them as dropped.
+  if (input_retries_ && audio_pool_.IsFull()) {
+    VLOG(1) << "AudioBuffer pool full, waiting for the audio encode stage.";
+    return AudioSamplesCallbackInterface::kDropped;
+  }
   const int status = audio_pool_.Commit(ptr_buffer);
   if (status) {
-    LOG(ERROR) << "AudioBuffer pool Commit failed! " << status;
-    return false;
+    if (status != BufferPool<AudioBuffer>::kFull &&
+        status != BufferPool<AudioBuffer>::kDropped) {
+      LOG(ERROR) << "AudioBuffer pool Commit failed! " << status;
+      return AudioSamplesCallbackInterface::kInvalidArg;
+    }
+    LOG(WARNING) << "AudioBuffer pool dropped samples: " << status;
+    return AudioSamplesCallbackInterface::kDropped;
   }
   LOG(INFO) << "OnSamplesReceived committed an audio buffer.";
-  return true;
+  ScheduleStage(&audio_stage_);
+  return kSuccess;
 }
 
 // VideoFrameCallbackInterface
 int WebmEncoder::OnVideoFrameReceived(VideoFrame* ptr_frame) {
+  ptr_frame->set_pipeline_time_us(SteadyTimeUs());
   const int status = video_pool_.Commit(ptr_frame);
   if (status) {
-    if (status != BufferPool<VideoFrame>::kFull) {
+    if (status != BufferPool<VideoFrame>::kFull &&
+        status != BufferPool<VideoFrame>::kDropped) {
       LOG(ERROR) << "VideoFrame pool Commit failed: " << status;
+      return VideoFrameCallbackInterface::kInvalidArg;
     }
-    LOG(INFO) << "VideoFrame pool dropped frame (no buffers).";
+    VLOG(1) << "VideoFrame pool dropped frame: " << status;
     return VideoFrameCallbackInterface::kDropped;
   }
   LOG(INFO) << "OnVideoFrameReceived committed a frame.";
+  ScheduleStage(&video_stage_);
   return kSuccess;
 }
 
+// VideoFrameAllocatorInterface
+int WebmEncoder::AcquireVideoFrame(VideoFrame** ptr_frame) {
+  const int status = video_pool_.AcquireWriteBuffer(ptr_frame);
+  if (status) {
+    if (status != BufferPool<VideoFrame>::kFull &&
+        status != BufferPool<VideoFrame>::kDropped) {
+      LOG(ERROR) << "VideoFrame pool AcquireWriteBuffer failed: " << status;
+      return VideoFrameAllocatorInterface::kInvalidArg;
+    }
+    VLOG(1) << "VideoFrame pool dropped frame: " << status;
+    return VideoFrameAllocatorInterface::kDropped;
+  }
+  ptr_acquired_video_frame_ = *ptr_frame;
+  return kSuccess;
+}
+
+int WebmEncoder::PublishVideoFrame() {
+  if (ptr_acquired_video_frame_) {
+    ptr_acquired_video_frame_->set_pipeline_time_us(SteadyTimeUs());
+    ptr_acquired_video_frame_ = NULL;
+  }
+  const int status = video_pool_.PublishWriteBuffer();
+  if (status) {
+    LOG(ERROR) << "VideoFrame pool PublishWriteBuffer failed: " << status;
+    return VideoFrameAllocatorInterface::kInvalidArg;
+  }
+  VLOG(1) << "PublishVideoFrame committed a frame.";
+  ScheduleStage(&video_stage_);
+  return kSuccess;
+}
+
+void WebmEncoder::CancelVideoFrame() {
+  ptr_acquired_video_frame_ = NULL;
+  video_pool_.CancelWriteBuffer();
+}
+
 // Tries to obtain lock on |mutex_| and returns value of |stop_| if lock is
 // obtained. Assumes no stop requested and returns false if unable to obtain
 // the lock.
@@ -305,41 +577,79 @@ bool WebmEncoder::StopRequested() {
   return stop_requested;
 }
 
-bool WebmEncoder::ReadChunkFromMuxer(std::unique_ptr<LiveWebmMuxer>* muxer,
-                                     int32 chunk_length) {
-  // Confirm that there's enough space in the chunk buffer.
-  if (chunk_length > chunk_buffer_size_) {
-    const int32 new_size = chunk_length * 2;
-    chunk_buffer_.reset(new (std::nothrow) uint8[new_size]);  // NOLINT
-    if (!chunk_buffer_) {
-      LOG(ERROR) << "chunk buffer reallocation failed!";
-      return false;
-    }
-    chunk_buffer_size_ = new_size;
+void WebmEncoder::RequestStop() {
+  mutex_.lock();
+  stop_ = true;
+  mutex_.unlock();
+  input_signal_.Notify();
+  mux_signal_.Notify();
+}
+
+SharedDataSinkBuffer WebmEncoder::ReadChunkFromMuxer(
+    std::unique_ptr<LiveWebmMuxer>* muxer,
+    const std::string& id,
+    int32 chunk_length) {
+  SharedDataSinkBuffer buffer = ptr_data_sink_->AcquireBuffer(chunk_length);
+  if (!buffer) {
+    LOG(ERROR) << "cannot allocate chunk buffer!";
+    return SharedDataSinkBuffer();
   }
 
-  // Read the chunk into |chunk_buffer_|.
-  const int status = (*muxer)->ReadChunk(chunk_buffer_size_,
-                                         chunk_buffer_.get());
+  // The first chunk is the stream header; sinks must never drop it.
+  buffer->stream = (*muxer)->muxer_id();
+  buffer->droppable = (*muxer)->chunks_read() > 0;
+  buffer->continuation = (*muxer)->chunk_bytes_read() > 0;
+  buffer->keyframe =
+      !buffer->continuation && (*muxer)->ChunkStartsWithKeyframe();
+
+  // Move the chunk into |buffer|.
+  const int status = (*muxer)->ReadChunk(&buffer->data);
   if (status) {
     LOG(ERROR) << "error reading chunk: " << status;
-    return false;
+    return SharedDataSinkBuffer();
   }
 
-  return true;
+  buffer->id = id;
+  return buffer;
+}
+
+SharedDataSinkBuffer WebmEncoder::ReadFragmentFromMuxer(
+    std::unique_ptr<LiveWebmMuxer>* muxer,
+    const std::string& id,
+    int32 fragment_length) {
+  SharedDataSinkBuffer buffer =
+      ptr_data_sink_->AcquireBuffer(fragment_length);
+  if (!buffer) {
+    LOG(ERROR) << "cannot allocate fragment buffer!";
+    return SharedDataSinkBuffer();
+  }
+
+  // Fragments only come from clusters, never from the stream header.
+  buffer->stream = (*muxer)->muxer_id();
+  buffer->droppable = true;
+  buffer->continuation = (*muxer)->chunk_bytes_read() > 0;
+  buffer->last_fragment = false;
+  buffer->keyframe =
+      !buffer->continuation && (*muxer)->ChunkStartsWithKeyframe();
+
+  const int status = (*muxer)->ReadFragment(&buffer->data);
+  if (status) {
+    LOG(ERROR) << "error reading fragment: " << status;
+    return SharedDataSinkBuffer();
+  }
+
+  buffer->id = id;
+  return buffer;
 }
 
 void WebmEncoder::EncoderThread() {
   LOG(INFO) << "EncoderThread started.";
+  ApplyThreadOptions(config_.mux_thread_options, "webmlive-mux");
 
-  // Set to true the encode loop breaks because |StopRequested()| returns true.
+  // Set to true the encode loop breaks because |StopRequested()| returns true,
+  // or because the media source reached the end of its input.
   bool user_initiated_stop = false;
 
-  if (!ptr_encode_func_) {
-    // NULL encode function pointer; fatal/die:
-    LOG(FATAL) << "NULL encode function pointer!";
-  }
-
   // Run the media source to get samples flowing.
   int status = ptr_media_source_->Run();
   if (status) {
@@ -365,6 +675,7 @@ void WebmEncoder::EncoderThread() {
         config_.dash_name + ".mpd",
         reinterpret_cast<const uint8*>(dash_manifest.data()),
         dash_manifest.length());
+    bytes_out_ += dash_manifest.length();
   }
 
   // Wait for an input sample from each input stream-- this sets the
@@ -373,6 +684,10 @@ void WebmEncoder::EncoderThread() {
   status = WaitForSamples();
   if (status) {
     LOG(ERROR) << "WaitForSamples failed: " << status;
+  } else if (StartEncodeThreads() != kSuccess) {
+    LOG(ERROR) << "StartEncodeThreads failed.";
+    StopEncodeThreads();
+    ptr_media_source_->Stop();
   } else {
     for (;;) {
       if (StopRequested()) {
@@ -380,44 +695,78 @@ void WebmEncoder::EncoderThread() {
         user_initiated_stop = true;
         break;
       }
-      status = ptr_media_source_->CheckStatus();
+      status = encode_status_.load();
       if (status) {
+        LOG(ERROR) << "encoding failed: " << status;
+        break;
+      }
+      status = ptr_media_source_->CheckStatus();
+      if (status == MediaSourceInterface::kEndOfStream) {
+        if (RawInputDrained()) {
+          // All input has been encoded, or is being encoded by the encode
+          // threads; finish the output the same way a stop request does.
+          LOG(INFO) << "End of input, stopping...";
+          user_initiated_stop = true;
+          break;
+        }
+      } else if (status) {
         LOG(ERROR) << "Media source in a bad state, stopping: " << status;
         break;
       }
-      status = (this->*ptr_encode_func_)();
+      if (ptr_worker_pool_) {
+        // The stages run on the worker pool; wake only for stop requests and
+        // stage errors.
+        WaitForInput(&mux_signal_, [this]() {
+          return encode_status_.load() != kSuccess;
+        });
+        continue;
+      }
+      const bool have_input = WaitForInput(&mux_signal_, [this]() {
+        return NextMuxTrack(false) != TimestampMerger::kNoTrack ||
+               encode_status_.load() != kSuccess;
+      });
+      if (!have_input) {
+        // Timed out; check for stop request and media source errors.
+        continue;
+      }
+      status = MuxCompressedInput(false);
       if (status) {
-        LOG(ERROR) << "encoding failed: " << status;
+        LOG(ERROR) << "muxing failed: " << status;
         break;
       }
-      if (config_.dash_encode) {
-        if (!config_.disable_audio) {
-          status = WriteMuxerChunkToDataSink(&ptr_muxer_aud_);
-          if (status) {
-            LOG(ERROR) << "chunk write (A) failed: " << status;
-            break;
-          }
-        }
-        if (!config_.disable_video) {
-          status = WriteMuxerChunkToDataSink(&ptr_muxer_vid_);
-          if (status) {
-            LOG(ERROR) << "chunk write (V) failed: " << status;
-            break;
-          }
-        }
-      } else {
-        status = WriteMuxerChunkToDataSink(&ptr_muxer_);
-        if (status) {
-          LOG(ERROR) << "muxed chunk write failed: " << status;
-          break;
-        }
+      status = WriteChunksToDataSink();
+      if (status) {
+        break;
       }
     }
 
+    // Stop the encode threads before draining the compressed pools so that
+    // nothing is committed after the drain.
+    StopEncodeThreads();
+
     if (user_initiated_stop) {
       // When |user_initiated_stop| is true the encode loop has been broken
-      // cleanly (without error). Call |LiveWebmMuxer::Finalize()| to flush any
+      // cleanly (without error). Mux the compressed input left by the encode
+      // threads, and then call |LiveWebmMuxer::Finalize()| to flush any
       // buffered samples, and upload the final chunk if one becomes available.
+      status = MuxCompressedInput(true);
+
+      // Commit the compressed audio that did not fit in |vorbis_pool_| before
+      // the stages stopped, muxing as the pool fills.
+      while (status == kSuccess && audio_packets_pending_) {
+        status = WriteChunksToDataSink();
+        if (status == kSuccess) {
+          status = CommitVorbisAudio();
+        }
+        if (status == kSuccess) {
+          status = MuxCompressedInput(true);
+        }
+      }
+      if (status) {
+        LOG(ERROR) << "Failed to mux remaining compressed input: " << status;
+      } else {
+        status = WriteChunksToDataSink();
+      }
       if (config_.dash_encode) {
         if (!config_.disable_audio) {
           status = WriteLastMuxerChunkToDataSink(&ptr_muxer_aud_);
@@ -437,301 +786,518 @@ void WebmEncoder::EncoderThread() {
           LOG(ERROR) << "Failed to write last non-dash chunk";
         }
       }
+
+      // The stages are stopped, so this thread may wait on the sinks.
+      status = WriteDeferredChunks(true);
+      if (status) {
+        LOG(ERROR) << "Failed to write deferred chunks: " << status;
+      }
     }
 
     ptr_media_source_->Stop();
   }
+  if (!config_.disable_audio) {
+    LogPoolStats("audio", audio_pool_.GetStats());
+    LogPoolStats("vorbis", vorbis_pool_.GetStats());
+  }
+  if (!config_.disable_video) {
+    LogPoolStats("video", video_pool_.GetStats());
+    LogPoolStats("vpx", vpx_pool_.GetStats());
+  }
+  if (merger_.num_late_packets() > 0) {
+    LOG(INFO) << "late packets muxed: " << merger_.num_late_packets();
+  }
+  finished_ = true;
   LOG(INFO) << "EncoderThread finished.";
 }
 
-// On each encoding pass:
-// - Attempts to read one uncompressed audio buffer from |audio_pool_|, and
-//   feeds it |vorbis_encoder_| for compression when successful.
-// - Passes all available compressed audio produced by |vorbis_encoder_| to
-//   |ptr_muxer_| for muxing.
-int WebmEncoder::EncodeAudioOnly() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
-  if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
-  }
-
-  // Read and mux vorbis data until no more is available from |vorbis_encoder_|.
-  AudioBuffer* vb = &vorbis_audio_buffer_;
-  VorbisEncoder* ve = &vorbis_encoder_;
-  while ((status = ve->ReadCompressedAudio(vb)) == kSuccess) {
-    // Mux the vorbis data.
-    const int mux_status = ptr_muxer_->WriteAudioBuffer(*vb);
-    if (mux_status) {
-      LOG(ERROR) << "Audio buffer mux failed " << mux_status;
-      return mux_status;
+int WebmEncoder::StartEncodeThreads() {
+  if (ptr_worker_pool_) {
+    {
+      std::lock_guard<std::mutex> lock(stage_mutex_);
+      pool_stages_enabled_ = true;
     }
-    VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
-
-    // Update encoded duration if able to obtain the lock.
-    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-    if (lock.owns_lock()) {
-      encoded_duration_ = vb->timestamp();
+    // Pick up the input that arrived while waiting for samples.
+    ScheduleStage(&audio_stage_);
+    ScheduleStage(&video_stage_);
+    return kSuccess;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  if (!config_.disable_audio) {
+    audio_encode_thread_ = shared_ptr<thread>(
+        new (nothrow) thread(bind(&WebmEncoder::AudioEncoderThread,  // NOLINT
+                                  this)));
+    if (!audio_encode_thread_) {
+      LOG(ERROR) << "cannot start audio encode thread!";
+      return kRunFailed;
     }
   }
-  if (status < 0) {
-    LOG(ERROR) << "Error reading vorbis samples: " << status;
-    return kAudioEncoderError;
+  if (!config_.disable_video) {
+    video_encode_thread_ = shared_ptr<thread>(
+        new (nothrow) thread(bind(&WebmEncoder::VideoEncoderThread,  // NOLINT
+                                  this)));
+    if (!video_encode_thread_) {
+      LOG(ERROR) << "cannot start video encode thread!";
+      return kRunFailed;
+    }
   }
   return kSuccess;
 }
 
-// On each encoding pass:
-// - Attempts to read an uncompressed audio buffer from |audio_pool_|, and
-//   passes it to |vorbis_encoder_| when a buffer is available.
-// - Stores the timestamp of the first available video frame from |video_pool_|
-//   in |video_timestamp|, or uses the last encoded timestamp added to the
-//   calculated time per frame if no frame is available.
-// - Reads one compressed audio buffer from |vorbis_encoder_| into
-//   |vorbis_audio_buffer_|, and
-//   - Passes it to |ptr_muxer_| when the compressed audio buffer timestamp is
-//     less than the stored video timestamp, or
-//   - Stores the compressed audio buffer and sets the |vorbis_buffered| flag
-//     to true, and then waits to mux the audio until:
-// - When the stored |video_timestamp| is less than or equal to the _estimated_
-//   timestamp of the next compressed audio buffer from |vorbis_encoder_|, calls
-//   |EncodeVideoFrame()| to attempt to read and encode a video frame. This is
-//   repeated until no video frames are available, or the next frame available
-//   would cause video to get ahead of audio.
-// - When the |vorbis_buffered| flag was set because the audio timestamp
-//   produced by |vorbis_encoder_| was greater than |video_timestamp|, passes
-//   |vorbis_audio_buffer_| to |ptr_muxer_|.
-int WebmEncoder::AVEncode() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
-  if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+void WebmEncoder::StopEncodeThreads() {
+  RequestStop();
+  if (ptr_worker_pool_) {
+    {
+      std::lock_guard<std::mutex> lock(stage_mutex_);
+      pool_stages_enabled_ = false;
+    }
+    audio_stage_.runner->WaitIdle();
+    video_stage_.runner->WaitIdle();
+    mux_stage_.runner->WaitIdle();
   }
-
-  // Store the next video timestamp.
-  int64 video_timestamp = 0;
-  status = PeekVideoTimestamp(&video_timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "Video timestamp peek failed: " << status;
-    return status;
+  if (audio_encode_thread_) {
+    audio_encode_thread_->join();
+    audio_encode_thread_.reset();
   }
+  if (video_encode_thread_) {
+    video_encode_thread_->join();
+    video_encode_thread_.reset();
+  }
+}
 
-  // Read compressed audio until no more remains, or the compressed buffer
-  // timestamp is greater than |video_timestamp|.
-  bool vorbis_buffered = false;
-  AudioBuffer& vorb_buf = vorbis_audio_buffer_;
-  VorbisEncoder& vorb_enc = vorbis_encoder_;
-  if (vorb_enc.time_encoded() <= video_timestamp) {
-    while ((status = vorb_enc.ReadCompressedAudio(&vorb_buf)) == kSuccess) {
-      if (video_timestamp < vorb_buf.timestamp()) {
-        vorbis_buffered = true;
-        break;
-      }
-      status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
-      if (status) {
-        LOG(ERROR) << "audio mux failed: " << status;
-        return status;
-      }
-      vorbis_buffered = false;
-      VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+void WebmEncoder::SetEncodeStatus(int status) {
+  int expected = kSuccess;
+  encode_status_.compare_exchange_strong(expected, status);
+  mux_signal_.Notify();
+}
+
+void WebmEncoder::AudioEncoderThread() {
+  LOG(INFO) << "AudioEncoderThread started.";
+  ApplyThreadOptions(config_.audio_thread_options, "webmlive-aenc");
+  for (;;) {
+    if (StopRequested()) {
+      break;
+    }
+    const bool have_input = WaitForInput(&input_signal_, [this]() {
+      return CanEncodeAudio();
+    });
+    if (!have_input) {
+      continue;
+    }
+    const int status = EncodeAudioBuffer();
+    if (status) {
+      LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
+      SetEncodeStatus(status);
+      break;
     }
   }
+  LOG(INFO) << "AudioEncoderThread finished.";
+}
 
-  // Attempt to encode video frames when |video_timestamp| is less than the
-  // next estimated compressed audio buffer timestamp.
-  while (status != BufferPool<VideoFrame>::kEmpty &&
-         video_timestamp <= vorb_enc.time_encoded()) {
-    VLOG(3) << "attempting video mux vid_ts=" << video_timestamp
-              << " vorb_enc time_encoded=" << vorb_enc.time_encoded();
-    status = EncodeVideoFrame();
+void WebmEncoder::VideoEncoderThread() {
+  LOG(INFO) << "VideoEncoderThread started.";
+  ApplyThreadOptions(config_.video_thread_options, "webmlive-venc");
+  for (;;) {
+    if (StopRequested()) {
+      break;
+    }
+    const bool have_input = WaitForInput(&input_signal_, [this]() {
+      return CanEncodeVideo();
+    });
+    if (!have_input) {
+      continue;
+    }
+    const int status = EncodeVideoFrame();
     if (status) {
       LOG(ERROR) << "EncodeVideoFrame failed: " << status;
-      return status;
-    }
-    status = PeekVideoTimestamp(&video_timestamp);
-    if (status < 0) {
-      LOG(ERROR) << "Video timestamp peek failed: " << status;
-      return status;
+      SetEncodeStatus(status);
+      break;
     }
   }
+  LOG(INFO) << "VideoEncoderThread finished.";
+}
 
-  // TODO(tomfinegan): Update libwebm to handle non-monotonic timestamps on
-  //                   audio by buffering samples in some way, and get rid
-  //                   of this extra bit of audio handling code.
-
-  // Mux compressed audio stored because its buffer timestamp was greater than
-  // |video_timestamp|.
-  if (vorbis_buffered) {
-    status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
-    if (status) {
-      LOG(ERROR) << "buffered audio mux failed: " << status;
-      return status;
-    }
-    VLOG(4) << "muxed (buf, A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+int WebmEncoder::InitPoolStage(void (WebmEncoder::*run_func)(),
+                               PoolStage* ptr_stage) {
+  ptr_stage->runner.reset(
+      new (std::nothrow) SerialTaskRunner(ptr_worker_pool_));  // NOLINT
+  if (!ptr_stage->runner) {
+    return kNoMemory;
   }
+  ptr_stage->task = std::bind(run_func, this);
   return kSuccess;
 }
 
-int WebmEncoder::DashEncode() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
+void WebmEncoder::ScheduleStage(PoolStage* ptr_stage) {
+  if (!ptr_worker_pool_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(stage_mutex_);
+  if (pool_stages_enabled_ && !ptr_stage->scheduled.exchange(true)) {
+    ptr_stage->runner->Post(ptr_stage->task);
+  }
+}
+
+void WebmEncoder::RunAudioStage() {
+  // Clear the flag before reading input: input that arrives during the run
+  // queues another run.
+  audio_stage_.scheduled.store(false);
+  if (StopRequested() || encode_status_.load() != kSuccess ||
+      !CanEncodeAudio()) {
+    return;
+  }
+  const int status = EncodeAudioBuffer();
   if (status) {
     LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+    SetEncodeStatus(status);
+    return;
+  }
+  ScheduleStage(&mux_stage_);
+  if (CanEncodeAudio()) {
+    ScheduleStage(&audio_stage_);
+  }
+}
+
+void WebmEncoder::RunVideoStage() {
+  video_stage_.scheduled.store(false);
+  if (StopRequested() || encode_status_.load() != kSuccess ||
+      !CanEncodeVideo()) {
+    return;
+  }
+  const int status = EncodeVideoFrame();
+  if (status) {
+    LOG(ERROR) << "EncodeVideoFrame failed: " << status;
+    SetEncodeStatus(status);
+    return;
+  }
+  ScheduleStage(&mux_stage_);
+  if (CanEncodeVideo()) {
+    ScheduleStage(&video_stage_);
+  }
+}
+
+void WebmEncoder::RunMuxStage() {
+  mux_stage_.scheduled.store(false);
+  if (StopRequested() || encode_status_.load() != kSuccess) {
+    return;
+  }
+
+  // While a sink is full leave the compressed input in its pools: the encode
+  // stages stop on the full pools, and the pipeline backs up to the raw input
+  // pools instead of holding a worker.
+  int status = WriteDeferredChunks(false);
+  if (status) {
+    SetEncodeStatus(status);
+    return;
+  }
+  if (SinkBlocked()) {
+    return;
+  }
+  status = MuxCompressedInput(false);
+  if (status) {
+    LOG(ERROR) << "muxing failed: " << status;
+    SetEncodeStatus(status);
+    return;
   }
+  status = WriteChunksToDataSink();
+  if (status) {
+    SetEncodeStatus(status);
+    return;
+  }
+  if (SinkBlocked()) {
+    return;
+  }
+
+  // Restart encode stages that stopped on a full compressed pool. Runs with
+  // nothing to encode return at once.
+  ScheduleStage(&audio_stage_);
+  ScheduleStage(&video_stage_);
+}
+
+void WebmEncoder::OnSinkSpaceAvailable() {
+  if (sink_blocked_.exchange(false)) {
+    ScheduleStage(&mux_stage_);
+  }
+}
+
+bool WebmEncoder::SinkBlocked() {
+  if (deferred_chunks_.empty()) {
+    return false;
+  }
+  sink_blocked_.store(true);
 
-  int64 video_timestamp;
-  status = PeekVideoTimestamp(&video_timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "Video timestamp peek failed: " << status;
+  // The sink may have made room before |sink_blocked_| was set, in which case
+  // no |OnSinkSpaceAvailable()| call will follow.
+  if (!ptr_data_sink_->WriteWouldBlock(deferred_chunks_.front())) {
+    OnSinkSpaceAvailable();
+  }
+  VLOG(1) << "mux stage waiting for sink, chunks deferred: "
+          << deferred_chunks_.size();
+  return true;
+}
+
+bool WebmEncoder::CanEncodeAudio() const {
+  return (audio_packets_pending_ || !audio_pool_.IsEmpty()) &&
+         !vorbis_pool_.IsFull();
+}
+
+bool WebmEncoder::CanEncodeVideo() const {
+  return !video_pool_.IsEmpty() && !vpx_pool_.IsFull();
+}
+
+// Reads and compresses one audio buffer.
+// - Commits compressed audio left over from the previous buffer.
+// - Attempts to borrow one buffer from |audio_pool_|, and passes it to
+//   |vorbis_encoder_| when a buffer is available and |vorbis_pool_| has room.
+// - Commits compressed audio available from |vorbis_encoder_| to
+//   |vorbis_pool_|.
+int WebmEncoder::EncodeAudioBuffer() {
+  int status = CommitVorbisAudio();
+  if (status || audio_packets_pending_) {
+    // Failed, or |vorbis_pool_| is at its size limit.
     return status;
   }
 
-  // Read compressed audio until no more remains, or the compressed buffer
-  // timestamp is greater than |video_timestamp|.
-  bool vorbis_buffered = false;
-  AudioBuffer& vorb_buf = vorbis_audio_buffer_;
-  VorbisEncoder& vorb_enc = vorbis_encoder_;
-  while ((status = vorb_enc.ReadCompressedAudio(&vorb_buf)) == kSuccess) {
-    status = ptr_muxer_aud_->WriteAudioBuffer(vorb_buf);
-    if (status) {
-      LOG(ERROR) << "audio mux failed: " << status;
-      return status;
+  // Try reading an audio buffer from the pool.
+  AudioBuffer* ptr_raw_buffer = NULL;
+  status = audio_pool_.BorrowActiveBuffer(&ptr_raw_buffer);
+  if (status) {
+    if (status != BufferPool<AudioBuffer>::kEmpty) {
+      // Really an error; not just an empty pool.
+      LOG(ERROR) << "AudioBuffer pool BorrowActiveBuffer failed! " << status;
+      return kAudioSinkError;
     }
-    VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+    VLOG(4) << "No buffers in AudioBuffer pool";
+    return kSuccess;
+  }
 
-    // Keep stream time reasonably close.
-    if (vorb_enc.time_encoded() > video_timestamp)
-      break;
+  VLOG(4) << "Audio encoder thread read raw audio buffer.";
+
+  status = OffsetTimestamp(timestamp_offset_, ptr_raw_buffer);
+  if (status) {
+    LOG(ERROR) << "audio timestamp offset failed: " << status;
+    audio_pool_.ReleaseActiveBuffer();
+    return kAudioEncoderError;
   }
 
-  // Attempt to encode video frames when |video_timestamp| is less than the
-  // next estimated compressed audio buffer timestamp.
-  while (status != BufferPool<VideoFrame>::kEmpty) {
-    VLOG(3) << "attempting video mux vid_ts=" << video_timestamp
-            << " vorb_enc time_encoded=" << vorb_enc.time_encoded();
-    status = EncodeVideoFrame();
+  // Pass the uncompressed audio to libvorbis, and then return the buffer to
+  // the pool.
+  status = vorbis_encoder_.Encode(*ptr_raw_buffer);
+  audio_pool_.ReleaseActiveBuffer();
+  if (status) {
+    LOG(ERROR) << "vorbis encode failed " << status;
+    return kAudioEncoderError;
+  }
+
+  audio_packets_pending_ = true;
+  return CommitVorbisAudio();
+}
+
+// Passes compressed audio to the mux stage until no more is available from
+// |vorbis_encoder_|, or |vorbis_pool_| is at its size limit.
+int WebmEncoder::CommitVorbisAudio() {
+  AudioBuffer* vb = &vorbis_audio_buffer_;
+  while (audio_packets_pending_) {
+    if (vorbis_pool_.IsFull()) {
+      VLOG(1) << "Vorbis pool full, waiting for the mux stage.";
+      return kSuccess;
+    }
+    int status = vorbis_encoder_.ReadCompressedAudio(vb);
     if (status) {
-      LOG(ERROR) << "EncodeVideoFrame failed: " << status;
-      return status;
+      if (status < 0) {
+        LOG(ERROR) << "Error reading vorbis samples: " << status;
+        return kAudioEncoderError;
+      }
+      audio_packets_pending_ = false;
+      break;
     }
-    status = PeekVideoTimestamp(&video_timestamp);
-    if (status < 0) {
-      LOG(ERROR) << "Video timestamp peek failed: " << status;
-      return status;
+    const int64 timestamp = vb->timestamp();
+    status = vorbis_pool_.Commit(vb);
+    if (status) {
+      LOG(ERROR) << "Vorbis pool commit failed: " << status;
+      return kAudioEncoderError;
     }
-
-    // Keep stream time reasonably close.
-    if (video_timestamp > vorb_enc.time_encoded())
-      break;
+    audio_encoded_timestamp_.store(timestamp, std::memory_order_release);
   }
   return kSuccess;
 }
 
-
-// Reads, compresses and muxes one video frame.
-// - Attempts to read one frame from |video_pool_|, and compresses it using
-//   |video_encoder_| when a frame is available.
-// - Passes the compressed frame to the video muxer for muxing.
+// Reads and compresses one video frame.
+// - Attempts to borrow one frame from |video_pool_|, and compresses it in
+//   place using |video_encoder_| when a frame is available.
+// - Commits the compressed frame to |vpx_pool_|.
 int WebmEncoder::EncodeVideoFrame() {
-  LiveWebmMuxer* video_muxer;
-  if (config_.dash_encode) {
-    video_muxer = ptr_muxer_vid_.get();
-  } else {
-    video_muxer = ptr_muxer_.get();
+  if (vpx_pool_.IsFull()) {
+    VLOG(1) << "VPx pool full, waiting for the mux stage.";
+    return kSuccess;
   }
 
-  // Try reading a video frame from the pool.
-  int status = video_pool_.Decommit(&raw_frame_);
+  // Try borrowing a video frame from the pool. The frame is encoded in place,
+  // and returned to the pool once |video_encoder_| is done with it.
+  VideoFrame* ptr_raw_frame = NULL;
+  int status = video_pool_.BorrowActiveBuffer(&ptr_raw_frame);
   if (status) {
     if (status != BufferPool<VideoFrame>::kEmpty) {
-      LOG(ERROR) << "VideoFrame pool Decommit failed! " << status;
+      LOG(ERROR) << "VideoFrame pool BorrowActiveBuffer failed! " << status;
       return kVideoSinkError;
     }
     VLOG(4) << "No frames in VideoFrame pool";
     return kSuccess;
   }
 
-  VLOG(4) << "Encoder thread read raw frame.";
+  VLOG(4) << "Video encoder thread read raw frame.";
 
-  status = OffsetTimestamp(timestamp_offset_, &raw_frame_);
+  status = OffsetTimestamp(timestamp_offset_, ptr_raw_frame);
   if (status) {
     LOG(ERROR) << "Video frame timestamp offset failed: " << status;
+    video_pool_.ReleaseActiveBuffer();
     return kVideoEncoderError;
   }
+  const int64 timestamp = ptr_raw_frame->timestamp();
+  const int64 arrival_time_us = ptr_raw_frame->pipeline_time_us();
+
+  // Encode the video frame, and pass it to the mux thread.
+  status = video_encoder_.EncodeFrame(*ptr_raw_frame, &vpx_frame_);
+  video_pool_.ReleaseActiveBuffer();
+  if (status == VideoEncoder::kDropped) {
+    ++video_frames_dropped_by_encoder_;
+  } else {
+    if (status) {
+      LOG(ERROR) << "Video frame encode failed: " << status;
+      return kVideoEncoderError;
+    }
+    const int64 encoded_time_us = SteadyTimeUs();
+    encode_latency_.Record(encoded_time_us - arrival_time_us);
+    vpx_frame_.set_pipeline_time_us(encoded_time_us);
+    ++video_frames_encoded_;
+    status = vpx_pool_.Commit(&vpx_frame_);
+    if (status) {
+      LOG(ERROR) << "VPx pool commit failed: " << status;
+      return kVideoEncoderError;
+    }
+  }
 
-  // Encode the video frame, and pass it to the muxer.
-  status = video_encoder_.EncodeFrame(raw_frame_, &vpx_frame_);
-  if (status == kDropped) {
-    return kSuccess;
-  } else if (status) {
-    LOG(ERROR) << "Video frame encode failed: " << status;
-    return kVideoEncoderError;
+  // Frames encoded later have greater timestamps, dropped or not. Publish the
+  // timestamp so the mux stage can mux audio up to it. Pool stages schedule
+  // the mux stage instead of signaling it.
+  video_encoded_timestamp_.store(timestamp, std::memory_order_release);
+  if (!ptr_worker_pool_) {
+    mux_signal_.Notify();
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::NextMuxTrack(bool flush) {
+  return merger_.NextTrack(flush || !interleave_streams_);
+}
+
+int WebmEncoder::MuxCompressedInput(bool flush) {
+  int status = kSuccess;
+  for (;;) {
+    const int track = NextMuxTrack(flush);
+    if (track == TimestampMerger::kNoTrack) {
+      break;
+    }
+    status = (track == audio_track_index_) ? MuxAudioBuffer() : MuxVideoFrame();
+    if (status) {
+      break;
+    }
   }
 
+  // Wake encode threads waiting for room in the compressed pools.
+  input_signal_.Notify();
+  return status;
+}
+
+int WebmEncoder::MuxAudioBuffer() {
+  int status = vorbis_pool_.Decommit(&mux_audio_buffer_);
+  if (status) {
+    LOG(ERROR) << "Vorbis pool Decommit failed: " << status;
+    return kAudioSinkError;
+  }
+  if (interleave_streams_) {
+    int64 timestamp = mux_audio_buffer_.timestamp();
+    merger_.ReleasePacket(audio_track_index_, &timestamp);
+    mux_audio_buffer_.set_timestamp(timestamp);
+  }
+  status = ptr_audio_muxer_->WriteAudioBuffer(mux_audio_buffer_);
+  if (status) {
+    LOG(ERROR) << "audio mux failed: " << status;
+    return status;
+  }
+  VLOG(4) << "muxed (A) " << mux_audio_buffer_.timestamp() / 1000.0;
+  ++audio_buffers_muxed_;
+
   // Update encoded duration if able to obtain the lock.
   std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
   if (lock.owns_lock()) {
-    encoded_duration_ = std::max(vpx_frame_.timestamp(), encoded_duration_);
+    encoded_duration_ =
+        std::max(mux_audio_buffer_.timestamp(), encoded_duration_);
   }
+  return kSuccess;
+}
 
-  status = video_muxer->WriteVideoFrame(vpx_frame_);
+int WebmEncoder::MuxVideoFrame() {
+  int status = vpx_pool_.Decommit(&mux_video_frame_);
   if (status) {
-    LOG(ERROR) << "Video frame mux failed: " << status;
+    LOG(ERROR) << "VPx pool Decommit failed: " << status;
+    return kVideoSinkError;
   }
-  VLOG(3) << "muxed (V) " << vpx_frame_.timestamp() / 1000.0;
-  return status;
-}
-
-int WebmEncoder::EncodeAudioBuffer() {
-  // Try reading an audio buffer from the pool.
-  int status = audio_pool_.Decommit(&raw_audio_buffer_);
+  if (interleave_streams_) {
+    int64 timestamp = mux_video_frame_.timestamp();
+    merger_.ReleasePacket(video_track_index_, &timestamp);
+    mux_video_frame_.set_timestamp(timestamp);
+  }
+  status = ptr_video_muxer_->WriteVideoFrame(mux_video_frame_);
   if (status) {
-    if (status != BufferPool<AudioBuffer>::kEmpty) {
-      // Really an error; not just an empty pool.
-      LOG(ERROR) << "AudioBuffer pool Decommit failed! " << status;
-      return kAudioSinkError;
-    }
-    VLOG(4) << "No buffers in AudioBuffer pool";
-  } else {
-    VLOG(4) << "Encoder thread read raw audio buffer.";
-
-    status = OffsetTimestamp(timestamp_offset_, &raw_audio_buffer_);
-    if (status) {
-      LOG(ERROR) << "audio timestamp offset failed: " << status;
-      return kAudioEncoderError;
-    }
+    LOG(ERROR) << "Video frame mux failed: " << status;
+    return status;
+  }
+  VLOG(3) << "muxed (V) " << mux_video_frame_.timestamp() / 1000.0;
+  mux_latency_.Record(SteadyTimeUs() - mux_video_frame_.pipeline_time_us());
+  ++video_frames_muxed_;
 
-    // Pass the uncompressed audio to libvorbis.
-    status = vorbis_encoder_.Encode(raw_audio_buffer_);
-    if (status) {
-      LOG(ERROR) << "vorbis encode failed " << status;
-      return kAudioEncoderError;
-    }
+  // Update encoded duration if able to obtain the lock.
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    encoded_duration_ =
+        std::max(mux_video_frame_.timestamp(), encoded_duration_);
   }
   return kSuccess;
 }
 
+bool WebmEncoder::WaitForInput(BufferPoolSignal* ptr_signal,
+                               const std::function<bool()>& have_input) {
+  if (have_input()) {
+    return true;
+  }
+  const std::chrono::milliseconds timeout(kInputWaitTimeoutMs);
+  return ptr_signal->Wait(timeout, [&]() {
+    return have_input() || StopRequested();
+  });
+}
+
 int WebmEncoder::WaitForSamples() {
   // Wait for samples from the input stream(s).
-  bool got_audio = config_.disable_audio;
-  bool got_video = config_.disable_video;
+  auto have_samples = [this]() {
+    const bool got_audio = config_.disable_audio || !audio_pool_.IsEmpty();
+    const bool got_video = config_.disable_video || !video_pool_.IsEmpty();
+    return got_audio && got_video;
+  };
+  const std::chrono::milliseconds timeout(kInputWaitTimeoutMs);
   for (;;) {
     if (StopRequested()) {
       return kSuccess;
     }
-    if (!got_audio) {
-      got_audio = !audio_pool_.IsEmpty();
-    }
-    if (!got_video) {
-      got_video = !video_pool_.IsEmpty();
-    }
-    if (got_audio && got_video) {
+    const bool signaled = input_signal_.Wait(timeout, [&]() {
+      return have_samples() || StopRequested();
+    });
+    if (signaled && have_samples()) {
       break;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
 
   int64 first_audio_timestamp = 0;
@@ -769,23 +1335,28 @@ int WebmEncoder::WaitForSamples() {
   return kSuccess;
 }
 
-int WebmEncoder::PeekVideoTimestamp(int64* timestamp) {
-  CHECK_NOTNULL(timestamp);
-  const int status = video_pool_.ActiveBufferTimestamp(timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "VideoFrame pool timestamp check failed: " << status;
-    return kVideoSinkError;
-  }
-  if (status == BufferPool<VideoFrame>::kEmpty) {
-    // When |video_pool_| is empty use the timestamp of the last encoded video
-    // frame added to the calculated time per frame.
-    const int time_per_frame =
-        static_cast<int>(kTimebase / config_.actual_video_config.frame_rate);
-    *timestamp = video_encoder_.last_timestamp() + time_per_frame;
-    VLOG(3) << "NO video frame available ts=" << *timestamp;
+int WebmEncoder::WriteChunksToDataSink() {
+  int status = kSuccess;
+  if (config_.dash_encode) {
+    if (!config_.disable_audio) {
+      status = WriteMuxerChunkToDataSink(&ptr_muxer_aud_);
+      if (status) {
+        LOG(ERROR) << "chunk write (A) failed: " << status;
+        return status;
+      }
+    }
+    if (!config_.disable_video) {
+      status = WriteMuxerChunkToDataSink(&ptr_muxer_vid_);
+      if (status) {
+        LOG(ERROR) << "chunk write (V) failed: " << status;
+        return status;
+      }
+    }
   } else {
-    *timestamp += timestamp_offset_;
-    VLOG(3) << "video frame available ts=" << *timestamp;
+    status = WriteMuxerChunkToDataSink(&ptr_muxer_);
+    if (status) {
+      LOG(ERROR) << "muxed chunk write failed: " << status;
+    }
   }
   return status;
 }
@@ -798,14 +1369,34 @@ int WebmEncoder::WriteMuxerChunkToDataSink(
     const int64 chunk_num = (*muxer)->chunks_read();
     const std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
     // A complete chunk is waiting in |muxer|'s buffer.
-    if (!ReadChunkFromMuxer(muxer, chunk_length)) {
+    const SharedDataSinkBuffer chunk =
+        ReadChunkFromMuxer(muxer, id, chunk_length);
+    if (!chunk) {
       LOG(ERROR) << "cannot read WebM chunk from muxer_id: "
                  << (*muxer)->muxer_id();
       return kWebmMuxerError;
     }
 
     // Pass the chunk to |ptr_data_sink_|.
-    if (!ptr_data_sink_->WriteData(id, chunk_buffer_.get(), chunk_length)) {
+    if (!WriteChunk(chunk)) {
+      LOG(ERROR) << "data sink write failed!";
+      return kDataSinkWriteFail;
+    }
+  }
+
+  // In progressive mode, pass on the part of the next chunk muxed so far.
+  int32 fragment_length = 0;
+  if ((*muxer)->FragmentReady(&fragment_length)) {
+    const int64 chunk_num = (*muxer)->chunks_read();
+    const std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
+    const SharedDataSinkBuffer fragment =
+        ReadFragmentFromMuxer(muxer, id, fragment_length);
+    if (!fragment) {
+      LOG(ERROR) << "cannot read WebM fragment from muxer_id: "
+                 << (*muxer)->muxer_id();
+      return kWebmMuxerError;
+    }
+    if (!WriteChunk(fragment)) {
       LOG(ERROR) << "data sink write failed!";
       return kDataSinkWriteFail;
     }
@@ -827,9 +1418,10 @@ int WebmEncoder::WriteLastMuxerChunkToDataSink(
     const int64 chunk_num = (*muxer)->chunks_read();
     const std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
 
-    if (ReadChunkFromMuxer(muxer, chunk_length)) {
-      const bool sink_write_ok =
-          ptr_data_sink_->WriteData(id, chunk_buffer_.get(), chunk_length);
+    const SharedDataSinkBuffer chunk =
+        ReadChunkFromMuxer(muxer, id, chunk_length);
+    if (chunk) {
+      const bool sink_write_ok = WriteChunk(chunk);
       if (!sink_write_ok) {
         LOG(ERROR) << "data sink write fail on final chunk for muxer_id:"
                    << (*muxer)->muxer_id();
@@ -841,6 +1433,46 @@ int WebmEncoder::WriteLastMuxerChunkToDataSink(
   return status;
 }
 
+bool WebmEncoder::WriteChunk(const SharedDataSinkBuffer& chunk) {
+  // Pool tasks must not wait on a sink; the task that drains it may be queued
+  // behind them.
+  if (ptr_worker_pool_ &&
+      (!deferred_chunks_.empty() || ptr_data_sink_->WriteWouldBlock(chunk))) {
+    deferred_chunks_.push_back(chunk);
+    return true;
+  }
+  return SendChunk(chunk);
+}
+
+bool WebmEncoder::SendChunk(const SharedDataSinkBuffer& chunk) {
+  const int64 chunk_size = chunk->data.size();
+  const int64 start_time_us = SteadyTimeUs();
+  const bool write_ok = ptr_data_sink_->WriteData(chunk);
+  sink_latency_.Record(SteadyTimeUs() - start_time_us);
+  if (write_ok) {
+    if (chunk->last_fragment) {
+      ++chunks_out_;
+    }
+    bytes_out_ += chunk_size;
+  }
+  return write_ok;
+}
+
+int WebmEncoder::WriteDeferredChunks(bool wait) {
+  while (!deferred_chunks_.empty()) {
+    const SharedDataSinkBuffer chunk = deferred_chunks_.front();
+    if (!wait && ptr_data_sink_->WriteWouldBlock(chunk)) {
+      break;
+    }
+    deferred_chunks_.pop_front();
+    if (!SendChunk(chunk)) {
+      LOG(ERROR) << "data sink write failed!";
+      return kDataSinkWriteFail;
+    }
+  }
+  return kSuccess;
+}
+
 std::string WebmEncoder::NextChunkId(const std::string& muxer_id,
                                      int64 chunk_num) const {
   std::string id;
@@ -8,17 +8,26 @@
 #ifndef WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 #define WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
 #include "encoder/audio_encoder.h"
 #include "encoder/basictypes.h"
 #include "encoder/buffer_pool.h"
+#include "encoder/clock.h"
 #include "encoder/encoder_base.h"
 #include "encoder/data_sink.h"
+#include "encoder/latency_histogram.h"
+#include "encoder/thread_util.h"
+#include "encoder/timestamp_merger.h"
 #include "encoder/video_encoder.h"
 #include "encoder/vorbis_encoder.h"
+#include "encoder/worker_pool.h"
 
 namespace webmlive {
 // All timestamps are in milliseconds.
@@ -43,6 +52,15 @@ struct WebmEncoderConfig {
         disable_video(false),
         audio_device_index(kUseDefaultDevice),
         video_device_index(kUseDefaultDevice),
+        video_drop_policy(kDropNewestBuffer),
+        input_video_fourcc("I420"),
+        input_test_audio("tone"),
+        input_test_duration(0),
+        input_realtime(true),
+        ptr_clock(NULL),
+        known_size_clusters(false),
+        progressive_clusters(false),
+        live_cluster_writer(false),
         dash_encode(false),
         dash_name("webmlive"),
         dash_dir("./"),
@@ -85,6 +103,75 @@ struct WebmEncoderConfig {
   // Source device options.
   UserInterfaceOptions ui_opts;
 
+  // Frame drop policy used when the encoder falls behind video capture.
+  // Audio is never dropped until the audio pool reaches its size limit.
+  BufferDropPolicy video_drop_policy;
+
+  // Scheduling settings for the mux, audio encode and video encode threads.
+  // The libvpx thread count is capped to the number of CPUs in
+  // |video_thread_options.cpus|. The options do not apply to the libvpx
+  // threads, which may be created by |WebmEncoder::Init()|.
+  ThreadOptions mux_thread_options;
+  ThreadOptions audio_thread_options;
+  ThreadOptions video_thread_options;
+
+  // File input. When either file is set the encoder reads Y4M video and WAV
+  // audio from disk instead of capturing from devices; every enabled stream
+  // then needs a file. The output is finalized at the end of the input.
+  std::string input_video_file;
+  std::string input_audio_file;
+
+  // Pipe input. When either pipe is set the encoder reads raw video frames
+  // and interleaved PCM audio from FIFOs, or from stdin when the name is "-".
+  // Frames are in |input_video_fourcc| format with the dimensions and frame
+  // rate in |requested_video_config|, and audio uses the channel count, rate
+  // and sample size in |requested_audio_config|. See |PipeMediaSource|.
+  std::string input_video_pipe;
+  std::string input_audio_pipe;
+  std::string input_video_fourcc;
+
+  // Optional video timestamp side channel for pipe input: one timestamp in
+  // milliseconds per frame, as a line of text. Timestamps come from a frame
+  // clock when empty.
+  std::string input_timestamp_pipe;
+
+  // Test pattern input. When |input_test_pattern| is set the encoder encodes
+  // generated video ("bars", "noise" or "text") and audio ("tone" or "noise")
+  // in the formats described for pipe input. Output is finalized after
+  // |input_test_duration| milliseconds, or runs until stopped when it is 0.
+  // See |TestPatternSource|.
+  std::string input_test_pattern;
+  std::string input_test_audio;
+  int64 input_test_duration;
+
+  // Deliver file and test pattern input at its real time rate. When false,
+  // input is delivered as fast as the encoder accepts it. For pipe input,
+  // false means input the encoder refuses is offered again instead of
+  // dropped, which stalls the writer.
+  bool input_realtime;
+
+  // Clock used to pace file and test pattern input, and for the times
+  // written to the DASH manifest. Not owned; must outlive the encoder. The
+  // system clock is used when NULL. With a |SimulatedClock| and
+  // |input_realtime| false, file and test pattern input runs as fast as the
+  // encoder accepts it while the clock follows the input timestamps.
+  ClockInterface* ptr_clock;
+
+  // Write the real size of each cluster into its size field instead of the
+  // EBML unknown size. Clusters are buffered whole before they are output,
+  // so this adds no latency.
+  bool known_size_clusters;
+
+  // Write each cluster to the data sink in fragments as it is muxed, instead
+  // of once it is complete. Fragments after the first are marked as
+  // continuations of the same chunk id, and the last one ends the chunk; see
+  // |DataSinkBuffer|. Overrides |known_size_clusters|.
+  bool progressive_clusters;
+
+  // Mux clusters with |LiveClusterWriter|, which writes frames straight into
+  // the muxer's output buffer instead of queueing them in libwebm.
+  bool live_cluster_writer;
+
   // Enable DASH encoding mode.
   bool dash_encode;
 
@@ -98,17 +185,75 @@ struct WebmEncoderConfig {
   std::string dash_start_number;
 };
 
+// Pipeline counters and latencies reported by |WebmEncoder::GetStats()|.
+// Latencies are measured on the monotonic clock, so they are real processing
+// times even when the encoder runs on a |SimulatedClock|.
+struct WebmEncoderStats {
+  WebmEncoderStats()
+      : video_frames_encoded(0),
+        video_frames_dropped_by_encoder(0),
+        video_frames_muxed(0),
+        audio_buffers_muxed(0),
+        chunks_out(0),
+        bytes_out(0) {}
+
+  // Raw input pool counters. |video_pool.num_committed| is the number of
+  // frames accepted from the media source.
+  BufferPoolStats audio_pool;
+  BufferPoolStats video_pool;
+
+  // Frames compressed by |VideoEncoder|, and frames it chose to drop.
+  int64 video_frames_encoded;
+  int64 video_frames_dropped_by_encoder;
+
+  // Compressed frames and buffers written to the muxers.
+  int64 video_frames_muxed;
+  int64 audio_buffers_muxed;
+
+  // Chunks and bytes passed to the data sink, including the DASH manifest.
+  int64 chunks_out;
+  int64 bytes_out;
+
+  // Per-frame video latencies:
+  // - |encode_latency|: from arrival in the raw pool to the end of the encode.
+  // - |mux_latency|: from the end of the encode to the end of the mux write.
+  // Per-chunk |sink_latency| is the time spent in |DataSink::WriteData()|.
+  LatencySummary encode_latency;
+  LatencySummary mux_latency;
+  LatencySummary sink_latency;
+};
+
 class DashWriter;
-class MediaSourceImpl;
 class LiveWebmMuxer;
+class MediaSourceInterface;
 
 // Top level WebM encoder class. Manages capture from A/V input devices, VPx
 // encoding, Vorbis encoding, and muxing into a WebM stream.
+//
+// Encoding is pipelined across three threads so that a slow video frame does
+// not delay audio, or the reverse:
+// - |VideoEncoderThread()| compresses frames from |video_pool_| into
+//   |vpx_pool_|.
+// - |AudioEncoderThread()| compresses buffers from |audio_pool_| into
+//   |vorbis_pool_|.
+// - |EncoderThread()| muxes compressed frames and buffers in the order chosen
+//   by |merger_|, and writes finished chunks to the data sink.
+// The compressed pools never drop; an encode thread stops reading input
+// while its compressed pool is at its size limit, and resumes once the mux
+// stage drains it.
+//
+// When initialized with a |WorkerPool| the three stages run as serial tasks
+// on the pool instead of on their own threads: capture callbacks schedule
+// the encode stages, and the encode stages schedule the mux stage. Stage
+// tasks never block, so many encoders can share a small pool: chunks that a
+// full sink queue cannot take yet wait in the encoder, and the mux stage
+// stops muxing until the sink has room.
+// |EncoderThread()| then only runs the media source, watches for stop
+// requests and errors, and finalizes the muxers.
 class WebmEncoder : public AudioSamplesCallbackInterface,
+                    public VideoFrameAllocatorInterface,
                     public VideoFrameCallbackInterface {
  public:
-  // Default size of |chunk_buffer_|.
-  static const int kDefaultChunkBufferSize = 100 * 1024;
   enum {
     // Data sink write failed.
     kDataSinkWriteFail = -117,
@@ -176,6 +321,13 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // |ptr_data_sink| is NULL.
   int Init(const WebmEncoderConfig& config, DataSink* ptr_data_sink);
 
+  // Behaves as |Init()| above, and runs the encode and mux stages on
+  // |ptr_worker_pool| when it is non-NULL. |ptr_worker_pool| is not owned,
+  // and must keep running until |Stop()| returns.
+  int Init(const WebmEncoderConfig& config,
+           DataSink* ptr_data_sink,
+           WorkerPool* ptr_worker_pool);
+
   // Runs the encoder. Returns |kSuccess| when successful, or one of the above
   // status codes upon failure.
   int Run();
@@ -186,57 +338,167 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // Returns encoded duration in milliseconds.
   int64 encoded_duration() const;
 
+  // Returns true once the encoder has stopped on its own: at the end of file
+  // input, or upon failure. |Stop()| must still be called.
+  bool finished() const { return finished_.load(); }
+
+  // Returns a snapshot of the pipeline counters and latencies. May be called
+  // from any thread while the encoder runs.
+  WebmEncoderStats GetStats() const;
+
   // Returns |WebmEncoderConfig| with fields set to default values.
   static WebmEncoderConfig DefaultConfig();
   WebmEncoderConfig config() const { return config_; }
 
   // |AudioSamplesCallbackInterface| methods
   // Method used by |MediaSourceImpl| to push audio buffers into encoding
-  // threads.
-  bool OnSamplesReceived(AudioBuffer* ptr_buffer) override;
+  // threads. Returns |kDropped| when |audio_pool_| is full; only real time
+  // input counts and logs that as a drop.
+  int OnSamplesReceived(AudioBuffer* ptr_buffer) override;
 
   // |VideoFrameCallbackInterface| methods
   // Method used by |MediaSourceImpl| to push video frames into encoding
   // threads.
   int OnVideoFrameReceived(VideoFrame* ptr_frame) override;
 
- private:
-  // Function pointer type used for indirect access to the encoder loop
-  // methods from |EncoderThread()|.
-  typedef int (WebmEncoder::*EncoderLoopFunc)();
+  // |VideoFrameAllocatorInterface| methods
+  // Methods used by |MediaSourceImpl| to write video frames directly into
+  // |video_pool_|.
+  int AcquireVideoFrame(VideoFrame** ptr_frame) override;
+  int PublishVideoFrame() override;
+  void CancelVideoFrame() override;
+
+  // Restarts the mux stage when it stopped on a full sink. Set as the
+  // |SharedBufferQueue::SpaceCallback| of the sink queues in |WorkerPool|
+  // mode. May be called from any thread.
+  void OnSinkSpaceAvailable();
 
+ private:
   // Returns true when user wants the encode thread to stop.
   bool StopRequested();
 
-  // Reads chunk from |muxer| and reallocates |chunk_buffer_| when necessary.
-  // Returns true when successful.
-  bool ReadChunkFromMuxer(std::unique_ptr<LiveWebmMuxer>* muxer,
-                          int32 chunk_length);
-
-  // Encoding thread function.
+  // Sets |stop_|. Used to stop the encode threads when |EncoderThread()|
+  // exits on its own.
+  void RequestStop();
+
+  // Moves the |chunk_length| byte chunk waiting in |muxer| into a
+  // |DataSinkBuffer| named |id| obtained from |ptr_data_sink_|. Returns an
+  // empty |SharedDataSinkBuffer| upon failure. In progressive mode the buffer
+  // is the last fragment of the chunk.
+  SharedDataSinkBuffer ReadChunkFromMuxer(
+      std::unique_ptr<LiveWebmMuxer>* muxer,
+      const std::string& id,
+      int32 chunk_length);
+
+  // Copies the |fragment_length| byte fragment waiting in |muxer| into a
+  // |DataSinkBuffer| named |id| obtained from |ptr_data_sink_|. Returns an
+  // empty |SharedDataSinkBuffer| upon failure.
+  SharedDataSinkBuffer ReadFragmentFromMuxer(
+      std::unique_ptr<LiveWebmMuxer>* muxer,
+      const std::string& id,
+      int32 fragment_length);
+
+  // Mux thread function. Runs the media source, starts the encode threads,
+  // and muxes their output.
   void EncoderThread();
 
-  // Audio/Video |EncoderLoopFunc|s. Called by |EncoderThread()| via
-  // |ptr_encode_func_|. All loop functions return |kSuccess| when the encode
-  // pass succeeds.
-  int EncodeAudioOnly();
-  int AVEncode();
-  int EncodeVideoFrame();
-  int DashEncode();
+  // Encode thread functions. Run until a stop is requested or encoding fails.
+  // Failures are reported to |EncoderThread()| via |encode_status_|.
+  void AudioEncoderThread();
+  void VideoEncoderThread();
+
+  // Starts the encode threads for the enabled streams, or enables and
+  // schedules the pool stages. Returns |kSuccess|, or |kRunFailed| when a
+  // thread cannot be started.
+  int StartEncodeThreads();
+
+  // Stops and joins the encode threads, or disables the pool stages and waits
+  // for their tasks to finish.
+  void StopEncodeThreads();
+
+  // Pipeline stage run as a |WorkerPool| task. |scheduled| is true while a
+  // run of |task| is queued and has not yet started, which limits each stage
+  // to one queued run.
+  struct PoolStage {
+    PoolStage() : scheduled(false) {}
+    std::unique_ptr<SerialTaskRunner> runner;
+    SerialTaskRunner::Task task;
+    std::atomic<bool> scheduled;
+  };
 
-  // Utility function used to encode a single audio input buffer.
+  // Creates |ptr_stage|'s runner on |ptr_worker_pool_| and sets its task to
+  // |run_func|. Returns |kSuccess|, or |kNoMemory|.
+  int InitPoolStage(void (WebmEncoder::*run_func)(), PoolStage* ptr_stage);
+
+  // Queues a run of |ptr_stage| unless one is already queued. Does nothing
+  // unless the pool stages are enabled.
+  void ScheduleStage(PoolStage* ptr_stage);
+
+  // Pool stage tasks. The encode stages compress one raw buffer per run, and
+  // the mux stage muxes all releasable input and writes finished chunks.
+  void RunAudioStage();
+  void RunVideoStage();
+  void RunMuxStage();
+
+  // Stores |status| in |encode_status_| and wakes |EncoderThread()|.
+  void SetEncodeStatus(int status);
+
+  // Returns true when the audio or video encode stage can make progress:
+  // raw input or unread compressed audio is waiting, and the compressed pool
+  // has room.
+  bool CanEncodeAudio() const;
+  bool CanEncodeVideo() const;
+
+  // Commits compressed audio left in |vorbis_encoder_| to |vorbis_pool_|, and
+  // then compresses one buffer from |audio_pool_| and commits its output.
+  // Stops committing when |vorbis_pool_| is at its size limit; the rest is
+  // committed by the next call.
   int EncodeAudioBuffer();
 
+  // Commits compressed audio from |vorbis_encoder_| to |vorbis_pool_| until
+  // none is left or the pool is at its size limit.
+  int CommitVorbisAudio();
+
+  // Compresses one frame from |video_pool_| and commits it to |vpx_pool_|.
+  // Does nothing while |vpx_pool_| is at its size limit.
+  int EncodeVideoFrame();
+
+  // Returns the |merger_| index of the track that |EncoderThread()| must mux
+  // next, or |TimestampMerger::kNoTrack| when muxing must wait for input.
+  // Streams written to separate muxers are not held back for each other.
+  // |flush| releases all waiting input.
+  int NextMuxTrack(bool flush);
+
+  // Muxes compressed input until |NextMuxTrack()| returns
+  // |TimestampMerger::kNoTrack|.
+  int MuxCompressedInput(bool flush);
+
+  // Mux one buffer from |vorbis_pool_| or |vpx_pool_|.
+  int MuxAudioBuffer();
+  int MuxVideoFrame();
+
+  // Blocks until |have_input()| returns true, a stop is requested, or a
+  // timeout expires. |ptr_signal| must be the signal of the pool(s) checked
+  // by |have_input()|. Returns false on timeout.
+  bool WaitForInput(BufferPoolSignal* ptr_signal,
+                    const std::function<bool()>& have_input);
+
+  // Returns true when the raw input pools are empty and no compressed audio
+  // waits for room in |vorbis_pool_|. Used to finish encoding at the end of
+  // file input.
+  bool RawInputDrained() const;
+
   // Waits for input samples from |ptr_media_source_| and sets
   // |timestamp_offset_| when one or both streams start with a negative
   // timestamp.
   int WaitForSamples();
 
-  // Returns the timestamp of the next available video frame via |timestamp|.
-  int PeekVideoTimestamp(int64* timestamp);
+  // Writes ready chunks from all muxers to |ptr_data_sink_|.
+  int WriteChunksToDataSink();
 
   // Writes |muxer| chunk to |ptr_data_sink_| when |muxer->ChunkReady()|
-  // returns true.
+  // returns true, and then the |muxer| fragment when
+  // |muxer->FragmentReady()| returns true.
   int WriteMuxerChunkToDataSink(std::unique_ptr<LiveWebmMuxer>* muxer);
 
   // Writes last chunk from |muxer| to |ptr_data_sink_| and finalizes |muxer|.
@@ -246,19 +508,43 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   std::string NextChunkId(const std::string& muxer_id,
                           int64 chunk_num) const;
 
+  // Passes |chunk| to |ptr_data_sink_| via |SendChunk()|. In |WorkerPool|
+  // mode appends |chunk| to |deferred_chunks_| instead when chunks are
+  // already waiting or a sink would block, and returns true.
+  bool WriteChunk(const SharedDataSinkBuffer& chunk);
+
+  // Passes |chunk| to |ptr_data_sink_|, and records its size and the time the
+  // sink took to accept it. Returns the result of |DataSink::WriteData()|.
+  bool SendChunk(const SharedDataSinkBuffer& chunk);
+
+  // Sends |deferred_chunks_| in order. Stops at the first chunk a sink cannot
+  // take without blocking unless |wait| is true. Returns |kSuccess|, or
+  // |kDataSinkWriteFail|.
+  int WriteDeferredChunks(bool wait);
+
+  // Returns true when |deferred_chunks_| is not empty, after arranging for
+  // |OnSinkSpaceAvailable()| to schedule the mux stage once the sink has
+  // room.
+  bool SinkBlocked();
+
   // Set to true when |Init()| is successful.
   bool initialized_;
 
-  // Flag protected by |mutex_| and used by |EncoderThread()| via
+  // Flag protected by |mutex_| and used by the encoder threads via
   // |StopRequested()| to determine when to terminate.
   bool stop_;
 
-  // Temporary storage for chunks about to be passed to |ptr_data_sink_|.
-  std::unique_ptr<uint8[]> chunk_buffer_;
-  int32 chunk_buffer_size_;
+  // True when audio and video are muxed into the same chunks.
+  bool interleave_streams_;
+
+  // Audio/video source: a platform specific capture source, or a file
+  // source.
+  std::unique_ptr<MediaSourceInterface> ptr_media_source_;
 
-  // Pointer to platform specific audio/video source object implementation.
-  std::unique_ptr<MediaSourceImpl> ptr_media_source_;
+  // True when |ptr_media_source_| offers refused buffers again instead of
+  // dropping them: file, pipe and test pattern input with
+  // |WebmEncoderConfig::input_realtime| false.
+  bool input_retries_;
 
   // Pointer to live WebM muxer. |ptr_muxer_| is used for muxed A/V output and
   // single stream output.
@@ -271,25 +557,73 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   std::unique_ptr<LiveWebmMuxer> ptr_muxer_aud_;
   std::unique_ptr<LiveWebmMuxer> ptr_muxer_vid_;
 
+  // Muxers receiving each stream. Point to |ptr_muxer_|, or to
+  // |ptr_muxer_aud_| and |ptr_muxer_vid_|.
+  LiveWebmMuxer* ptr_audio_muxer_;
+  LiveWebmMuxer* ptr_video_muxer_;
+
   // Mutex providing synchronization between user interface and encoder thread.
   mutable std::mutex mutex_;
 
-  // Encoder thread object.
+  // Encoder thread objects. |encode_thread_| runs |EncoderThread()|, which
+  // owns the audio and video encode threads.
   std::shared_ptr<std::thread> encode_thread_;
+  std::shared_ptr<std::thread> audio_encode_thread_;
+  std::shared_ptr<std::thread> video_encode_thread_;
+
+  // First error returned by an encode thread, or |kSuccess|.
+  std::atomic<int> encode_status_;
+
+  // Set when |EncoderThread()| exits.
+  std::atomic<bool> finished_;
 
   // Data sink to which WebM chunks are written.
   DataSink* ptr_data_sink_;
 
+  // Signal shared by |video_pool_| and |audio_pool_|. Wakes the encode
+  // threads when input arrives or |Stop()| is called.
+  BufferPoolSignal input_signal_;
+
+  // Signal shared by |vpx_pool_| and |vorbis_pool_|. Wakes |EncoderThread()|
+  // when compressed input arrives, an encode stage fails, or |Stop()| is
+  // called. The compressed pools keep their own signals in |WorkerPool| mode.
+  BufferPoolSignal mux_signal_;
+
+  // |WorkerPool| mode state. |pool_stages_enabled_| is protected by
+  // |stage_mutex_|, which is held while stage runs are queued so that no run
+  // is queued after |StopEncodeThreads()| disables the stages.
+  WorkerPool* ptr_worker_pool_;
+  std::mutex stage_mutex_;
+  bool pool_stages_enabled_;
+  PoolStage audio_stage_;
+  PoolStage video_stage_;
+  PoolStage mux_stage_;
+
+  // Chunks read from the muxers in |WorkerPool| mode that a sink could not
+  // take without blocking, oldest first. Used by the mux stage, and by
+  // |EncoderThread()| once the stages are stopped. |sink_blocked_| is set
+  // while the mux stage waits for |OnSinkSpaceAvailable()|.
+  std::deque<SharedDataSinkBuffer> deferred_chunks_;
+  std::atomic<bool> sink_blocked_;
+
   // Buffer object used to push |VideoFrame|s from |MediaSourceImpl| into
-  // |EncoderThread()|.
+  // |VideoEncoderThread()|.
   BufferPool<VideoFrame> video_pool_;
 
-  // Most recent frame from |video_pool_|.
-  VideoFrame raw_frame_;
+  // Compressed frames passed from |VideoEncoderThread()| to
+  // |EncoderThread()|.
+  BufferPool<VideoFrame> vpx_pool_;
 
   // Most recent frame from |video_encoder_|.
   VideoFrame vpx_frame_;
 
+  // Frame read from |vpx_pool_| by |EncoderThread()|.
+  VideoFrame mux_video_frame_;
+
+  // Timestamp of the last frame processed by |VideoEncoderThread()|, or -1.
+  // Compressed frames committed later have greater timestamps.
+  std::atomic<int64> video_encoded_timestamp_;
+
   // Video encoder.
   VideoEncoder video_encoder_;
 
@@ -297,30 +631,64 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   int64 encoded_duration_;
 
   // Buffer object used to push |AudioBuffer|s from |MediaSourceImpl| into
-  // |EncoderThread()|.
+  // |AudioEncoderThread()|.
   BufferPool<AudioBuffer> audio_pool_;
 
-  // Most recent uncompressed audio buffer from |audio_pool_|.
-  AudioBuffer raw_audio_buffer_;
+  // Compressed audio passed from |AudioEncoderThread()| to |EncoderThread()|.
+  BufferPool<AudioBuffer> vorbis_pool_;
 
   // Most recent vorbis audio buffer from |vorbis_encoder_|.
   AudioBuffer vorbis_audio_buffer_;
 
+  // True when |vorbis_encoder_| may hold compressed audio not yet committed
+  // to |vorbis_pool_|. Set by the audio encode stage, and read by
+  // |EncoderThread()| to decide when file input is fully encoded.
+  std::atomic<bool> audio_packets_pending_;
+
+  // Buffer read from |vorbis_pool_| by |EncoderThread()|.
+  AudioBuffer mux_audio_buffer_;
+
+  // Timestamp of the last buffer committed to |vorbis_pool_|, or -1.
+  std::atomic<int64> audio_encoded_timestamp_;
+
+  // Orders compressed input from |vorbis_pool_| and |vpx_pool_| for muxing.
+  // |audio_merge_track_| and |video_merge_track_| expose the pools to the
+  // merger; |audio_track_index_| and |video_track_index_| are their merger
+  // indexes.
+  TimestampMerger merger_;
+  std::unique_ptr<TimestampMerger::TrackInterface> audio_merge_track_;
+  std::unique_ptr<TimestampMerger::TrackInterface> video_merge_track_;
+  int audio_track_index_;
+  int video_track_index_;
+
   // Vorbis encoder object.
   VorbisEncoder vorbis_encoder_;
 
   // Encoder configuration.
   WebmEncoderConfig config_;
 
-  // Encoder loop function pointer.
-  EncoderLoopFunc ptr_encode_func_;
-
   // DASH manifest writer.
   std::unique_ptr<DashWriter> dash_writer_;
 
   // Timestamp adjustment value. Expressed in milliseconds. Used to change
   // input buffer timestamps when a stream starts with a timestamp less than 0.
   int64 timestamp_offset_;
+
+  // Frame obtained by |AcquireVideoFrame()| and not yet published or
+  // cancelled. Used to stamp its arrival time.
+  VideoFrame* ptr_acquired_video_frame_;
+
+  // |WebmEncoderStats| counters and histograms. Updated by the stage that owns
+  // each value, and read by |GetStats()|.
+  std::atomic<int64> video_frames_encoded_;
+  std::atomic<int64> video_frames_dropped_by_encoder_;
+  std::atomic<int64> video_frames_muxed_;
+  std::atomic<int64> audio_buffers_muxed_;
+  std::atomic<int64> chunks_out_;
+  std::atomic<int64> bytes_out_;
+  LatencyHistogram encode_latency_;
+  LatencyHistogram mux_latency_;
+  LatencyHistogram sink_latency_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmEncoder);
 };
 
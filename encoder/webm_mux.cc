@@ -8,15 +8,147 @@
 
 #include "encoder/webm_mux.h"
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <new>
+#include <utility>
 #include <vector>
 
+#include "encoder/live_cluster_writer.h"
 #include "glog/logging.h"
 #include "libwebm/mkvmuxer.hpp"
+#include "libwebm/mkvmuxerutil.hpp"
 #include "libwebm/webmids.hpp"
 
 namespace {
 const int kAutoAssignTrackNum = 0;
+
+// Size of the blocks |WebmMuxWriter| stores libwebm output in. Chunks that fit
+// in one block are handed to the user without a copy.
+const int32 kWriteBlockSize = 128 * 1024;
+
+// Number of emptied blocks |WebmMuxWriter| keeps for reuse.
+const size_t kMaxFreeBlocks = 16;
+
+// libwebm writes live mode cluster sizes as 8 byte EBML unknown sizes.
+const int32 kClusterIdLength = 4;
+const int32 kClusterSizeLength = 8;
+const uint64 kEbmlUnknownSize8 = 0x01FFFFFFFFFFFFFFULL;
+
+typedef std::vector<uint8> WriteBlock;
+typedef std::deque<std::unique_ptr<WriteBlock> > WriteBlockList;
+
+// Returns the address of the byte |pos| bytes into the data stored in
+// |blocks|. |pos| must be less than the total size of |blocks|.
+uint8* BlockChainByte(const WriteBlockList& blocks, int64 pos) {
+  size_t block_index = 0;
+  while (pos >= static_cast<int64>(blocks[block_index]->size())) {
+    pos -= blocks[block_index]->size();
+    ++block_index;
+  }
+  return &(*blocks[block_index])[static_cast<size_t>(pos)];
+}
+
+// Read only view of the first |length| bytes stored in |blocks|.
+class BlockChainView {
+ public:
+  BlockChainView(const WriteBlockList& blocks, int64 length)
+      : blocks_(blocks),
+        length_(length) {}
+
+  int64 length() const { return length_; }
+
+  // Returns the byte at |pos|, which must be less than |length()|.
+  uint8 at(int64 pos) const { return *BlockChainByte(blocks_, pos); }
+
+ private:
+  const WriteBlockList& blocks_;
+  const int64 length_;
+};
+
+// Returns the length of the EBML variable length integer that begins with
+// |first_byte|, or 0 when |first_byte| is not a valid first byte.
+int32 EbmlVintLength(uint8 first_byte) {
+  int32 length = 1;
+  for (uint8 mask = 0x80; mask != 0; mask >>= 1, ++length) {
+    if (first_byte & mask) {
+      return length;
+    }
+  }
+  return 0;
+}
+
+// Reads an EBML element ID (|keep_marker| true) or element size at |pos| in
+// |chunk|, and returns its length in bytes. Returns 0 when the bytes from
+// |pos| to |end| do not contain a complete value.
+int32 ReadEbmlVint(const BlockChainView& chunk, int64 pos, int64 end,
+                   bool keep_marker, uint64* ptr_value) {
+  if (pos >= end) {
+    return 0;
+  }
+  const uint8 first_byte = chunk.at(pos);
+  const int32 length = EbmlVintLength(first_byte);
+  if (length == 0 || length > end - pos) {
+    return 0;
+  }
+  uint64 value = keep_marker ? first_byte : first_byte & (0xFF >> length);
+  for (int32 i = 1; i < length; ++i) {
+    value = (value << 8) | chunk.at(pos + i);
+  }
+  *ptr_value = value;
+  return length;
+}
+
+// Walks the children of the cluster in |chunk| until it finds a SimpleBlock on
+// |video_track_num|, and returns the block's key frame flag. Returns true when
+// |chunk| is not a cluster, and |no_video_result| when it contains no video
+// blocks.
+bool ClusterStartsWithKeyframe(const BlockChainView& chunk,
+                               uint64 video_track_num,
+                               bool no_video_result) {
+  const int32 kSimpleBlockFlagsOffset = 2;  // Skips the block timecode.
+  const uint8 kSimpleBlockKeyFlag = 0x80;
+  const int64 chunk_length = chunk.length();
+  uint64 id = 0;
+  uint64 size = 0;
+  int64 pos = ReadEbmlVint(chunk, 0, chunk_length, true, &id);
+  if (pos == 0 || id != mkvmuxer::kMkvCluster) {
+    return true;
+  }
+  int32 length = ReadEbmlVint(chunk, pos, chunk_length, false, &size);
+  pos += length;
+  while (length > 0 && pos < chunk_length) {
+    length = ReadEbmlVint(chunk, pos, chunk_length, true, &id);
+    if (length == 0) {
+      break;
+    }
+    pos += length;
+    length = ReadEbmlVint(chunk, pos, chunk_length, false, &size);
+    if (length == 0) {
+      break;
+    }
+    pos += length;
+    if (size > static_cast<uint64>(chunk_length - pos)) {
+      break;
+    }
+    if (id == mkvmuxer::kMkvSimpleBlock) {
+      const int64 block_end = pos + static_cast<int64>(size);
+      uint64 track_num = 0;
+      const int32 track_length =
+          ReadEbmlVint(chunk, pos, block_end, false, &track_num);
+      const int64 flags_pos = pos + track_length + kSimpleBlockFlagsOffset;
+      if (track_length > 0 && track_num == video_track_num &&
+          flags_pos < block_end) {
+        return (chunk.at(flags_pos) & kSimpleBlockKeyFlag) != 0;
+      }
+    }
+    pos += static_cast<int64>(size);
+  }
+  return no_video_result;
+}
+
 }  // namespace
 
 namespace webmlive {
@@ -26,52 +158,128 @@ T milliseconds_to_timecode_ticks(T milliseconds) {
   return milliseconds * LiveWebmMuxer::kTimecodeScale;
 }
 
-// Buffer object implementing libwebm's IMkvWriter interface.
+// Buffer object implementing libwebm's IMkvWriter interface. Written data is
+// stored in a chain of |kWriteBlockSize| byte blocks, so buffered data is
+// never moved while a cluster grows. The data that follows a chunk always
+// starts a new block, which allows the chunk to be detached from the front of
+// the chain without touching the data buffered after it.
+//
+// In progressive mode the data of the cluster being written can be read in
+// fragments before the cluster is complete. Fragments are copied out; the
+// cluster stays buffered until the next cluster starts, and reading the chunk
+// then returns only the data not already read as fragments.
 class WebmMuxWriter : public mkvmuxer::IMkvWriter {
  public:
   enum {
     kNotImplemented = -200,
-    kNotInitialized = -2,
+    kNoMemory = -2,
     kInvalidArg = -1,
     kSuccess = 0,
   };
   WebmMuxWriter();
   virtual ~WebmMuxWriter();
 
-  // Stores |ptr_buffer| and returns |kSuccess|.
-  int32 Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer,
-             const std::string& id);
+  // Stores the cluster options from |options| and |id|, and returns
+  // |kSuccess|.
+  int32 Init(const LiveWebmMuxer::Options& options, const std::string& id);
 
   // Accessors.
+  int64 bytes_buffered() const { return bytes_buffered_; }
   int64 bytes_written() const { return bytes_written_; }
   int64 chunk_end() const { return chunk_end_; }
-
-  // Erases chunk from |ptr_write_buffer_|, resets |chunk_end_| to 0, and
-  // updates |bytes_buffered_|.
-  void EraseChunk();
-
-  // mkvmuxer::IMkvWriter methods
+  int64 fragment_bytes_read() const { return fragment_bytes_read_; }
+
+  // Returns the length of the fragment available to |ReadFragment()|, or 0
+  // when there is none: progressive mode is off, a chunk is ready, no cluster
+  // has started, or all buffered data has been read.
+  int64 FragmentLength() const;
+
+  // Returns the result of |ClusterStartsWithKeyframe()| for the chunk, or for
+  // the buffered part of the cluster being written when no chunk is ready.
+  // A finished cluster without video blocks holds only audio, and returns
+  // true; the cluster being written may still get a video block that is not
+  // a key frame, so without one it returns false. There must be buffered
+  // data.
+  bool ChunkStartsWithKeyframe(uint64 video_track_num) const;
+
+  // Moves the part of the chunk not read by |ReadFragment()| into
+  // |ptr_chunk|, discarding its existing contents, and discards the chunk. A
+  // whole chunk stored in one block is swapped into |ptr_chunk| and the
+  // previous storage of |ptr_chunk| is kept as a free block. Otherwise the
+  // data is copied. There must be a chunk ready.
+  void ReadChunk(LiveWebmMuxer::WriteBuffer* ptr_chunk);
+
+  // Copies the part of the chunk not read by |ReadFragment()| to |ptr_buf|,
+  // and discards the chunk. There must be a chunk ready.
+  void ReadChunk(uint8* ptr_buf);
+
+  // Copies the |FragmentLength()| byte fragment into |ptr_fragment|,
+  // discarding its existing contents.
+  void ReadFragment(LiveWebmMuxer::WriteBuffer* ptr_fragment);
+
+  // mkvmuxer::IMkvWriter methods. These use the libwebm integer types, which
+  // differ from ours on LP64 systems.
   // Returns total bytes of data passed to |Write|.
-  virtual int64 Position() const { return bytes_written_; }
+  virtual mkvmuxer::int64 Position() const { return bytes_written_; }
 
   // Not seekable, return |kNotImplemented| on seek attempts.
-  virtual int32 Position(int64) { return kNotImplemented; }  // NOLINT
+  virtual int32 Position(mkvmuxer::int64) {  // NOLINT
+    return kNotImplemented;
+  }
 
   // Always returns false: |WebmMuxWriter| is never seekable. Written data
-  // goes into a vector, and data is buffered only until a chunk is completed.
+  // goes into memory, and data is buffered only until a chunk is completed.
   virtual bool Seekable() const { return false; }
 
-  // Writes |ptr_buffer| contents to |ptr_write_buffer_|.
+  // Appends |ptr_buffer| contents to |blocks_|.
   virtual int32 Write(const void* ptr_buffer, uint32 buffer_length);
 
-  // Called by libwebm, and notifies writer of element start position.
-  virtual void ElementStartNotify(uint64 element_id, int64 position);
+  // Called by libwebm, and notifies writer of element start position. The
+  // start of a cluster completes the chunk, and when |known_size_clusters_|
+  // is true, the cluster that it follows.
+  virtual void ElementStartNotify(mkvmuxer::uint64 element_id,
+                                  mkvmuxer::int64 position);
 
  private:
+  // Appends the buffered data from |begin| to |end| to |ptr_buffer|.
+  void AppendBuffered(int64 begin, int64 end,
+                      LiveWebmMuxer::WriteBuffer* ptr_buffer) const;
+
+  // Replaces the unknown size of the cluster that starts |cluster_start_|
+  // bytes into the stream with the size of the data that follows its header.
+  // Leaves the cluster unchanged when its size is not the 8 byte unknown size
+  // written by libwebm.
+  void WriteClusterSize();
+
+  // Appends an empty block to |blocks_|, reusing one from |free_blocks_| when
+  // possible. Returns false when out of memory.
+  bool AddBlock();
+
+  // Removes the chunk's blocks from the front of |blocks_|, keeps up to
+  // |kMaxFreeBlocks| of them in |free_blocks_|, and resets |chunk_end_| and
+  // |fragment_bytes_read_|.
+  void DiscardChunk();
+
   int64 bytes_buffered_;
   int64 bytes_written_;
+
+  // Length of the chunk in bytes, and the number of blocks it occupies at
+  // the front of |blocks_|.
   int64 chunk_end_;
-  LiveWebmMuxer::WriteBuffer* ptr_write_buffer_;
+  size_t chunk_blocks_;
+
+  // Stream position of the cluster being written, or -1 before the first
+  // cluster.
+  int64 cluster_start_;
+  bool known_size_clusters_;
+
+  // Progressive mode state. |fragment_bytes_read_| is the number of buffered
+  // bytes, counted from the start of the chunk, already read as fragments.
+  bool progressive_;
+  int64 fragment_bytes_read_;
+
+  WriteBlockList blocks_;
+  std::vector<std::unique_ptr<WriteBlock> > free_blocks_;
   std::string id_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmMuxWriter);
 };
@@ -80,60 +288,191 @@ WebmMuxWriter::WebmMuxWriter()
     : bytes_buffered_(0),
       bytes_written_(0),
       chunk_end_(0),
-      ptr_write_buffer_(NULL) {
+      chunk_blocks_(0),
+      cluster_start_(-1),
+      known_size_clusters_(false),
+      progressive_(false),
+      fragment_bytes_read_(0) {
 }
 
 WebmMuxWriter::~WebmMuxWriter() {
 }
 
-int32 WebmMuxWriter::Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer,
+int32 WebmMuxWriter::Init(const LiveWebmMuxer::Options& options,
                           const std::string& id) {
-  if (!ptr_write_buffer) {
-    LOG(ERROR) << "Cannot Init, NULL write buffer.";
-    return kInvalidArg;
-  }
-  ptr_write_buffer_ = ptr_write_buffer;
+  // Fragments leave the writer before the size of their cluster is known.
+  known_size_clusters_ = options.known_size_clusters && !options.progressive;
+  progressive_ = options.progressive;
   id_ = id;
   return kSuccess;
 }
 
-void WebmMuxWriter::EraseChunk() {
-  if (ptr_write_buffer_) {
-    LiveWebmMuxer::WriteBuffer::iterator erase_end_pos =
-        ptr_write_buffer_->begin() + static_cast<int32>(chunk_end_);
-    ptr_write_buffer_->erase(ptr_write_buffer_->begin(), erase_end_pos);
-    bytes_buffered_ = ptr_write_buffer_->size();
-    chunk_end_ = 0;
+int64 WebmMuxWriter::FragmentLength() const {
+  if (!progressive_ || chunk_end_ > 0 || cluster_start_ < 0) {
+    return 0;
   }
+  return bytes_buffered_ - fragment_bytes_read_;
 }
 
-int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
-  if (!ptr_write_buffer_) {
-    LOG(ERROR) << "Cannot Write, not Initialized.";
-    return kNotInitialized;
+bool WebmMuxWriter::ChunkStartsWithKeyframe(uint64 video_track_num) const {
+  const bool chunk_ready = chunk_end_ > 0;
+  const int64 length = chunk_ready ? chunk_end_ : bytes_buffered_;
+  return ClusterStartsWithKeyframe(BlockChainView(blocks_, length),
+                                   video_track_num, chunk_ready);
+}
+
+void WebmMuxWriter::ReadChunk(LiveWebmMuxer::WriteBuffer* ptr_chunk) {
+  if (chunk_blocks_ == 1 && fragment_bytes_read_ == 0) {
+    ptr_chunk->swap(*blocks_.front());
+  } else {
+    ptr_chunk->clear();
+    ptr_chunk->reserve(static_cast<size_t>(chunk_end_ - fragment_bytes_read_));
+    AppendBuffered(fragment_bytes_read_, chunk_end_, ptr_chunk);
   }
+  DiscardChunk();
+}
+
+void WebmMuxWriter::ReadChunk(uint8* ptr_buf) {
+  int64 pos = 0;
+  for (size_t i = 0; i < chunk_blocks_; ++i) {
+    const int64 block_size = static_cast<int64>(blocks_[i]->size());
+    if (pos + block_size > fragment_bytes_read_) {
+      const int64 offset = std::max<int64>(fragment_bytes_read_ - pos, 0);
+      const size_t length = static_cast<size_t>(block_size - offset);
+      memcpy(ptr_buf, &(*blocks_[i])[static_cast<size_t>(offset)], length);
+      ptr_buf += length;
+    }
+    pos += block_size;
+  }
+  DiscardChunk();
+}
+
+void WebmMuxWriter::ReadFragment(LiveWebmMuxer::WriteBuffer* ptr_fragment) {
+  ptr_fragment->clear();
+  ptr_fragment->reserve(
+      static_cast<size_t>(bytes_buffered_ - fragment_bytes_read_));
+  AppendBuffered(fragment_bytes_read_, bytes_buffered_, ptr_fragment);
+  fragment_bytes_read_ = bytes_buffered_;
+}
+
+void WebmMuxWriter::AppendBuffered(
+    int64 begin, int64 end, LiveWebmMuxer::WriteBuffer* ptr_buffer) const {
+  int64 pos = 0;
+  for (size_t i = 0; i < blocks_.size() && pos < end; ++i) {
+    const WriteBlock& block = *blocks_[i];
+    const int64 block_end = pos + static_cast<int64>(block.size());
+    if (block_end > begin) {
+      const int64 copy_begin = std::max(begin, pos) - pos;
+      const int64 copy_end = std::min(end, block_end) - pos;
+      ptr_buffer->insert(ptr_buffer->end(),
+                         block.begin() + static_cast<size_t>(copy_begin),
+                         block.begin() + static_cast<size_t>(copy_end));
+    }
+    pos = block_end;
+  }
+}
+
+bool WebmMuxWriter::AddBlock() {
+  std::unique_ptr<WriteBlock> block;
+  if (!free_blocks_.empty()) {
+    block = std::move(free_blocks_.back());
+    free_blocks_.pop_back();
+    block->clear();
+  } else {
+    block.reset(new (std::nothrow) WriteBlock());  // NOLINT
+    if (!block) {
+      return false;
+    }
+  }
+  block->reserve(kWriteBlockSize);
+  blocks_.push_back(std::move(block));
+  return true;
+}
+
+void WebmMuxWriter::DiscardChunk() {
+  for (size_t i = 0; i < chunk_blocks_; ++i) {
+    if (free_blocks_.size() < kMaxFreeBlocks) {
+      free_blocks_.push_back(std::move(blocks_.front()));
+    }
+    blocks_.pop_front();
+  }
+  bytes_buffered_ -= chunk_end_;
+  chunk_end_ = 0;
+  chunk_blocks_ = 0;
+  fragment_bytes_read_ = 0;
+}
+
+int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
   if (!ptr_buffer || !buffer_length) {
     LOG(ERROR) << "returning kInvalidArg to libwebm: NULL/0 length buffer.";
     return kInvalidArg;
   }
   const uint8* ptr_data = reinterpret_cast<const uint8*>(ptr_buffer);
-  ptr_write_buffer_->insert(ptr_write_buffer_->end(),
-                            ptr_data,
-                            ptr_data + buffer_length);
-  bytes_written_ += buffer_length;
-  bytes_buffered_ = ptr_write_buffer_->size();
+  uint32 bytes_remaining = buffer_length;
+  while (bytes_remaining > 0) {
+    // Data that follows the chunk always goes into a new block.
+    if (blocks_.size() == chunk_blocks_ ||
+        blocks_.back()->size() >= static_cast<size_t>(kWriteBlockSize)) {
+      if (!AddBlock()) {
+        LOG(ERROR) << "cannot allocate write block.";
+        return kNoMemory;
+      }
+    }
+    WriteBlock* const ptr_block = blocks_.back().get();
+    const uint32 block_space =
+        static_cast<uint32>(kWriteBlockSize - ptr_block->size());
+    const uint32 write_length = std::min(bytes_remaining, block_space);
+    ptr_block->insert(ptr_block->end(), ptr_data, ptr_data + write_length);
+    ptr_data += write_length;
+    bytes_remaining -= write_length;
+    bytes_written_ += write_length;
+    bytes_buffered_ += write_length;
+  }
   return kSuccess;
 }
 
-void WebmMuxWriter::ElementStartNotify(uint64 element_id, int64 position) {
+void WebmMuxWriter::ElementStartNotify(mkvmuxer::uint64 element_id,
+                                       mkvmuxer::int64 position) {
   if (element_id == mkvmuxer::kMkvCluster) {
+    if (known_size_clusters_ && cluster_start_ >= 0) {
+      WriteClusterSize();
+    }
+    cluster_start_ = bytes_written_;
     chunk_end_ = bytes_buffered_;
+    chunk_blocks_ = blocks_.size();
     if (id_ == "video") {
       LOG(INFO) << "video chunk_end_=" << chunk_end_<< " position=" << position;
     }
   }
 }
 
+void WebmMuxWriter::WriteClusterSize() {
+  const int64 header_length = kClusterIdLength + kClusterSizeLength;
+  const int64 cluster_length = bytes_written_ - cluster_start_;
+  if (cluster_length < header_length) {
+    return;
+  }
+
+  // The cluster is not part of a chunk yet, so all of it is still buffered.
+  int64 pos = cluster_start_ - (bytes_written_ - bytes_buffered_) +
+      kClusterIdLength;
+  uint64 size = 0;
+  for (int32 i = 0; i < kClusterSizeLength; ++i) {
+    size = (size << 8) | *BlockChainByte(blocks_, pos + i);
+  }
+  if (size != kEbmlUnknownSize8) {
+    LOG(WARNING) << "cluster size is not unknown, not writing size.";
+    return;
+  }
+
+  // Write the size as an 8 byte EBML integer, most significant byte first.
+  // The first byte is the length marker.
+  size = (cluster_length - header_length) | (1ULL << 56);
+  for (int32 shift = 56; shift >= 0; shift -= 8, ++pos) {
+    *BlockChainByte(blocks_, pos) = static_cast<uint8>(size >> shift);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // LiveWebmMuxer
 //
@@ -141,6 +480,8 @@ void WebmMuxWriter::ElementStartNotify(uint64 element_id, int64 position) {
 LiveWebmMuxer::LiveWebmMuxer()
     : audio_track_num_(0),
       video_track_num_(0),
+      cluster_duration_(0),
+      header_written_(false),
       muxer_time_(0),
       chunks_read_(0) {
 }
@@ -150,7 +491,17 @@ LiveWebmMuxer::~LiveWebmMuxer() {
 
 int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
                         const std::string& muxer_id) {
+  Options options;
+  options.cluster_duration_milliseconds = cluster_duration_milliseconds;
+  return Init(options, muxer_id);
+}
+
+int LiveWebmMuxer::Init(const Options& options, const std::string& muxer_id) {
   muxer_id_ = muxer_id;
+  if (options.known_size_clusters && options.progressive) {
+    LOG(WARNING) << "known size clusters are not available in progressive "
+                 << "mode.";
+  }
 
   // Construct and Init |WebmMuxWriter|-- it handles writes coming from libwebm.
   ptr_writer_.reset(new (std::nothrow) WebmMuxWriter());  // NOLINT
@@ -158,7 +509,7 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
     LOG(ERROR) << "cannot construct WebmWriteBuffer.";
     return kNoMemory;
   }
-  if (ptr_writer_->Init(&buffer_, muxer_id)) {
+  if (ptr_writer_->Init(options, muxer_id)) {
     LOG(ERROR) << "cannot Init WebmWriteBuffer.";
     return kMuxerError;
   }
@@ -176,9 +527,9 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
   }
 
   ptr_segment_->set_mode(mkvmuxer::Segment::kLive);
-  if (cluster_duration_milliseconds > 0) {
+  if (options.cluster_duration_milliseconds > 0) {
     const uint64 max_cluster_duration =
-        milliseconds_to_timecode_ticks(cluster_duration_milliseconds);
+        milliseconds_to_timecode_ticks(options.cluster_duration_milliseconds);
     ptr_segment_->set_max_cluster_duration(max_cluster_duration);
   }
 
@@ -196,6 +547,16 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
   app_name += " v";
   app_name += kEncoderVersion;
   ptr_segment_info->set_writing_app(app_name.c_str());
+
+  cluster_duration_ = options.cluster_duration_milliseconds;
+  if (options.live_cluster_writer) {
+    ptr_cluster_writer_.reset(
+        new (std::nothrow) LiveClusterWriter());  // NOLINT
+    if (!ptr_cluster_writer_) {
+      LOG(ERROR) << "cannot construct LiveClusterWriter.";
+      return kNoMemory;
+    }
+  }
   return kSuccess;
 }
 
@@ -295,13 +656,15 @@ int LiveWebmMuxer::AddTrack(const VideoConfig& video_config) {
 }
 
 int LiveWebmMuxer::Finalize() {
-  if (!ptr_segment_->Finalize()) {
+  // |LiveClusterWriter| holds no frames, and |ptr_segment_| has not written
+  // anything when it's in use.
+  if (!ptr_cluster_writer_ && !ptr_segment_->Finalize()) {
     LOG(ERROR) << "libwebm mkvmuxer Finalize failed.";
     return kMuxerError;
   }
 
-  if (buffer_.size() > 0) {
-    // When data is in |buffer_| after the |mkvmuxer::Segment::Finalize()|
+  if (ptr_writer_->bytes_buffered() > 0) {
+    // When data is buffered after the |mkvmuxer::Segment::Finalize()|
     // call, make the last chunk available to the user by forcing
     // |ChunkReady()| to return true one final time. This last chunk will
     // contain any data passed to |mkvmuxer::Segment::AddFrame()| since the
@@ -327,6 +690,19 @@ int LiveWebmMuxer::WriteVideoFrame(const VideoFrame& vpx_frame) {
     LOG(ERROR) << "cannot write non-VPx frame.";
     return kInvalidArg;
   }
+  if (ptr_cluster_writer_) {
+    const int status = WriteLiveFrame(vpx_frame.buffer(),
+                                      vpx_frame.buffer_length(),
+                                      video_track_num_,
+                                      vpx_frame.timestamp(),
+                                      vpx_frame.keyframe());
+    if (status) {
+      LOG(ERROR) << "WriteLiveFrame (video) failed.";
+      return kVideoWriteError;
+    }
+    muxer_time_ = vpx_frame.timestamp();
+    return kSuccess;
+  }
   const int64 timecode = milliseconds_to_timecode_ticks(vpx_frame.timestamp());
   if (!ptr_segment_->AddFrame(vpx_frame.buffer(),
                               vpx_frame.buffer_length(),
@@ -353,6 +729,19 @@ int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& vorbis_buffer) {
     LOG(ERROR) << "cannot write non-Vorbis audio buffer.";
     return kInvalidArg;
   }
+  if (ptr_cluster_writer_) {
+    const int status = WriteLiveFrame(vorbis_buffer.buffer(),
+                                      vorbis_buffer.buffer_length(),
+                                      audio_track_num_,
+                                      vorbis_buffer.timestamp(),
+                                      true);
+    if (status) {
+      LOG(ERROR) << "WriteLiveFrame (audio) failed.";
+      return kAudioWriteError;
+    }
+    muxer_time_ = vorbis_buffer.timestamp();
+    return kSuccess;
+  }
   const int64 timecode =
       milliseconds_to_timecode_ticks(vorbis_buffer.timestamp());
   if (!ptr_segment_->AddFrame(vorbis_buffer.buffer(),
@@ -367,21 +756,47 @@ int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& vorbis_buffer) {
   return kSuccess;
 }
 
-// A chunk is ready when |WebmMuxWriter::chunk_length()| returns a value
-// greater than 0.
+// A chunk is ready when |WebmMuxWriter::chunk_end()| returns a value greater
+// than 0. The chunk length excludes data already read as fragments.
 bool LiveWebmMuxer::ChunkReady(int32* ptr_chunk_length) {
   if (ptr_chunk_length) {
-    const int32 chunk_length = static_cast<int32>(ptr_writer_->chunk_end());
-    if (chunk_length > 0) {
-      *ptr_chunk_length = chunk_length;
+    const int64 chunk_end = ptr_writer_->chunk_end();
+    if (chunk_end > 0) {
+      *ptr_chunk_length =
+          static_cast<int32>(chunk_end - ptr_writer_->fragment_bytes_read());
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LiveWebmMuxer::FragmentReady(int32* ptr_fragment_length) {
+  if (ptr_fragment_length) {
+    const int64 fragment_length = ptr_writer_->FragmentLength();
+    if (fragment_length > 0) {
+      *ptr_fragment_length = static_cast<int32>(fragment_length);
       return true;
     }
   }
   return false;
 }
 
-// Copies the buffered chunk data into |ptr_buf|, erases it from |buffer_|, and
-// calls |WebmMuxWriter::ResetChunkEnd()| to zero the chunk end position.
+int64 LiveWebmMuxer::chunk_bytes_read() const {
+  return ptr_writer_->fragment_bytes_read();
+}
+
+bool LiveWebmMuxer::ChunkStartsWithKeyframe() const {
+  if (ptr_writer_->chunk_end() <= 0 && ptr_writer_->FragmentLength() <= 0) {
+    return false;
+  }
+  if (video_track_num_ == 0) {
+    return true;
+  }
+  return ptr_writer_->ChunkStartsWithKeyframe(video_track_num_);
+}
+
+// Copies the chunk blocks into |ptr_buf| and returns them to the writer's free
+// list.
 int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
   if (!ptr_buf) {
     LOG(ERROR) << "NULL buffer pointer.";
@@ -403,13 +818,123 @@ int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
 
   LOG(INFO) << "ReadChunk capacity=" << buffer_capacity
             << " length=" << chunk_length
-            << " total buffered=" << buffer_.size();
+            << " total buffered=" << ptr_writer_->bytes_buffered();
 
-  // Copy chunk to user buffer, and erase it from |buffer_|.
-  memcpy(ptr_buf, &buffer_[0], chunk_length);
-  ptr_writer_->EraseChunk();
+  ptr_writer_->ReadChunk(ptr_buf);
   ++chunks_read_;
   return kSuccess;
 }
 
+// Detaches the chunk blocks from the writer. Data buffered after the chunk is
+// in later blocks, and is not moved.
+int LiveWebmMuxer::ReadChunk(WriteBuffer* ptr_chunk) {
+  if (!ptr_chunk) {
+    LOG(ERROR) << "NULL chunk pointer.";
+    return kInvalidArg;
+  }
+
+  // Make sure there's a chunk ready.
+  int32 chunk_length = 0;
+  if (!ChunkReady(&chunk_length)) {
+    LOG(ERROR) << "No chunk ready.";
+    return kNoChunkReady;
+  }
+
+  VLOG(1) << "ReadChunk length=" << chunk_length
+          << " total buffered=" << ptr_writer_->bytes_buffered();
+
+  ptr_writer_->ReadChunk(ptr_chunk);
+  ++chunks_read_;
+  return kSuccess;
+}
+
+// Copies the data buffered since the last fragment out of the writer. The
+// cluster stays buffered until it is complete.
+int LiveWebmMuxer::ReadFragment(WriteBuffer* ptr_fragment) {
+  if (!ptr_fragment) {
+    LOG(ERROR) << "NULL fragment pointer.";
+    return kInvalidArg;
+  }
+  int32 fragment_length = 0;
+  if (!FragmentReady(&fragment_length)) {
+    LOG(ERROR) << "No fragment ready.";
+    return kNoFragmentReady;
+  }
+  VLOG(1) << "ReadFragment length=" << fragment_length
+          << " total buffered=" << ptr_writer_->bytes_buffered();
+  ptr_writer_->ReadFragment(ptr_fragment);
+  return kSuccess;
+}
+
+int LiveWebmMuxer::WriteLiveFrame(const uint8* ptr_data, int32 length,
+                                  uint64 track_num, int64 timestamp,
+                                  bool keyframe) {
+  if (!header_written_) {
+    const int status = WriteSegmentHeader();
+    if (status) {
+      LOG(ERROR) << "WriteSegmentHeader failed: " << status;
+      return status;
+    }
+    header_written_ = true;
+  }
+  if (ptr_cluster_writer_->WriteFrame(ptr_data, length, track_num, timestamp,
+                                      keyframe)) {
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+// Writes the elements |mkvmuxer::Segment| writes before its first cluster in
+// live mode: the EBML header, the segment ID and unknown size, the segment
+// info, and the tracks.
+int LiveWebmMuxer::WriteSegmentHeader() {
+  mkvmuxer::IMkvWriter* const ptr_writer = ptr_writer_.get();
+  if (!mkvmuxer::WriteEbmlHeader(ptr_writer,
+                                 mkvmuxer::Segment::kDefaultDocTypeVersion)) {
+    LOG(ERROR) << "cannot write EBML header.";
+    return kMuxerError;
+  }
+  if (mkvmuxer::WriteID(ptr_writer, mkvmuxer::kMkvSegment) ||
+      mkvmuxer::SerializeInt(ptr_writer, mkvmuxer::kEbmlUnknownValue, 8)) {
+    LOG(ERROR) << "cannot write segment header.";
+    return kMuxerError;
+  }
+  if (!ptr_segment_->GetSegmentInfo()->Write(ptr_writer)) {
+    LOG(ERROR) << "cannot write segment info.";
+    return kMuxerError;
+  }
+
+  // Tracks are numbered in the order they were added, which is the order
+  // |mkvmuxer::Tracks| writes them.
+  const uint64 last_track_num = std::max(audio_track_num_, video_track_num_);
+  uint64 tracks_size = 0;
+  for (uint64 track_num = 1; track_num <= last_track_num; ++track_num) {
+    const mkvmuxer::Track* const ptr_track =
+        ptr_segment_->GetTrackByNumber(track_num);
+    if (ptr_track) {
+      tracks_size += ptr_track->Size();
+    }
+  }
+  if (!mkvmuxer::WriteEbmlMasterElement(ptr_writer, mkvmuxer::kMkvTracks,
+                                        tracks_size)) {
+    LOG(ERROR) << "cannot write tracks header.";
+    return kMuxerError;
+  }
+  for (uint64 track_num = 1; track_num <= last_track_num; ++track_num) {
+    const mkvmuxer::Track* const ptr_track =
+        ptr_segment_->GetTrackByNumber(track_num);
+    if (ptr_track && !ptr_track->Write(ptr_writer)) {
+      LOG(ERROR) << "cannot write track " << track_num << ".";
+      return kMuxerError;
+    }
+  }
+
+  if (ptr_cluster_writer_->Init(ptr_writer, video_track_num_,
+                                cluster_duration_)) {
+    LOG(ERROR) << "cannot Init LiveClusterWriter.";
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
 }  // namespace webmlive
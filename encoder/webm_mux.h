@@ -25,6 +25,9 @@ namespace webmlive {
 // Forward declaration of class implementing IMkvWriter interface for libwebm.
 class WebmMuxWriter;
 
+// Forward declaration of the cluster writer used in live cluster writer mode.
+class LiveClusterWriter;
+
 struct VorbisCodecPrivate {
   VorbisCodecPrivate()
       : ptr_ident(NULL),
@@ -52,7 +55,8 @@ struct VorbisCodecPrivate {
 // Notes:
 // - Only the first chunk written is metadata. All other chunks are clusters.
 //
-// - All element size values are set to unknown (an EBML encoded -1).
+// - All element size values are set to unknown (an EBML encoded -1), except
+//   cluster sizes when |Options::known_size_clusters| is set.
 //
 // - Users MUST call |Init()| before any other method.
 //
@@ -60,21 +64,58 @@ struct VorbisCodecPrivate {
 //   must buffer data in some situations to satisfy WebM container guidelines:
 //   http://www.webmproject.org/code/specs/container/
 //
+// - When |Options::live_cluster_writer| is set, clusters are written by
+//   |LiveClusterWriter|, which does not buffer or reorder frames.
+//
 // - Users are responsible for keeping memory usage reasonable by calling
 //   |ChunkReady()| periodically-- when |ChunkReady| returns true,
 //   |ReadChunk()| will return the complete chunk and discard it from the
 //   buffer.
 //
+// - In progressive mode the cluster being written is also available in
+//   fragments: when |FragmentReady()| returns true, |ReadFragment()| returns
+//   the data muxed since the last fragment. Fragments end on element
+//   boundaries. Once the cluster is complete |ReadChunk()| returns the rest
+//   of it, which may be empty. Read a ready chunk before the next fragment.
+//
 class LiveWebmMuxer {
  public:
   typedef std::vector<uint8> WriteBuffer;
   static const uint64 kTimecodeScale = 1000000;
 
+  struct Options {
+    Options()
+        : cluster_duration_milliseconds(0),
+          known_size_clusters(false),
+          progressive(false),
+          live_cluster_writer(false) {}
+
+    // Maximum cluster duration. Ignored when less than 1.
+    int32 cluster_duration_milliseconds;
+
+    // Write the real size of each cluster into its size field before the
+    // cluster is made available by |ChunkReady()|. Ignored in progressive
+    // mode, where parts of a cluster are read before its size is known.
+    bool known_size_clusters;
+
+    // Make the cluster being written available through |FragmentReady()| and
+    // |ReadFragment()| as it is muxed.
+    bool progressive;
+
+    // Write clusters and frames with |LiveClusterWriter| instead of
+    // |mkvmuxer::Segment|. libwebm still writes the metadata chunk. Frames
+    // must be written in timestamp order.
+    bool live_cluster_writer;
+  };
+
   // Status codes returned by class methods.
   enum {
     // Temporary return code for unimplemented operations.
     kNotImplemented = -200,
 
+    // |ReadFragment()| called when no fragment is ready.
+    kNoFragmentReady = -14,
+
     // Unable to write audio buffer.
     kAudioWriteError = -13,
 
@@ -128,6 +169,9 @@ class LiveWebmMuxer {
   // Returns |kSuccess| when successful.
   int Init(int32 cluster_duration_milliseconds, const std::string& muxer_id);
 
+  // Initializes libwebm as above, using the settings in |options|.
+  int Init(const Options& options, const std::string& muxer_id);
+
   // Adds an audio track to |ptr_segment_| and returns |kSuccess|. Returns
   // |kAudioTrackAlreadyExists| when the audio track has already been added.
   // Returns |kAudioTrackError| when adding the track to the segment fails.
@@ -156,26 +200,69 @@ class LiveWebmMuxer {
   // Returns |kVideoWriteError| when libwebm returns an error.
   int WriteVideoFrame(const VideoFrame& vpx_frame);
 
-  // Returns true and writes chunk length to |ptr_chunk_length| when |buffer_|
-  // contains a complete WebM chunk.
+  // Returns true and writes chunk length to |ptr_chunk_length| when a
+  // complete WebM chunk is buffered. In progressive mode the length excludes
+  // data already read as fragments, and may be 0.
   bool ChunkReady(int32* ptr_chunk_length);
 
-  // Moves WebM chunk data into |ptr_buf|. The data has been from removed from
-  // |buffer_| when |kSuccess| is returned.  Returns |kUserBufferTooSmall| if
-  // |buffer_capacity| is less than |chunk_length|.
+  // Progressive mode only. Returns true and writes fragment length to
+  // |ptr_fragment_length| when data of the cluster being written has been
+  // muxed since the last fragment was read, and no chunk is ready.
+  bool FragmentReady(int32* ptr_fragment_length);
+
+  // Returns true when the buffered chunk can be decoded without
+  // the chunks that preceded it: the first video block in the cluster is a
+  // key frame, or the cluster has no video blocks. Returns true for the
+  // metadata chunk, and false when no chunk is ready. In progressive mode,
+  // checks the cluster being written when only a fragment is ready; a
+  // cluster with a video track and no video block yet returns false, since
+  // its first video block is not known.
+  bool ChunkStartsWithKeyframe() const;
+
+  // Copies WebM chunk data into |ptr_buf|. The chunk has been discarded from
+  // the muxer's buffer when |kSuccess| is returned. Returns
+  // |kUserBufferTooSmall| if |buffer_capacity| is less than |chunk_length|.
   int ReadChunk(int32 buffer_capacity, uint8* ptr_buf);
 
+  // Moves the WebM chunk into |ptr_chunk| and returns |kSuccess|. The muxer
+  // buffers its output in fixed size blocks; a chunk that fits in one block
+  // is not copied, the block and |ptr_chunk| swap storage. Longer chunks are
+  // copied once into |ptr_chunk|. Data buffered after the chunk is never
+  // moved. Existing contents of |ptr_chunk| are discarded. Returns
+  // |kNoChunkReady| when no chunk is ready.
+  int ReadChunk(WriteBuffer* ptr_chunk);
+
+  // Copies the fragment into |ptr_fragment| and returns |kSuccess|. Existing
+  // contents of |ptr_fragment| are discarded. Returns |kNoFragmentReady| when
+  // no fragment is ready.
+  int ReadFragment(WriteBuffer* ptr_fragment);
+
+  // Returns the number of bytes of the chunk being written, or of the ready
+  // chunk, that have been read as fragments.
+  int64 chunk_bytes_read() const;
+
   // Accessors.
   int64 muxer_time() const { return muxer_time_; }
   int64 chunks_read() const { return chunks_read_; }
   std::string muxer_id() const { return muxer_id_; }
 
  private:
+  // Writes the frame with |ptr_cluster_writer_|. Writes the EBML header,
+  // segment info, and tracks elements first when they have not been written.
+  int WriteLiveFrame(const uint8* ptr_data, int32 length, uint64 track_num,
+                     int64 timestamp, bool keyframe);
+
+  // Writes the metadata chunk using libwebm's element writers, and
+  // initializes |ptr_cluster_writer_|.
+  int WriteSegmentHeader();
+
   std::unique_ptr<WebmMuxWriter> ptr_writer_;
   std::unique_ptr<mkvmuxer::Segment> ptr_segment_;
+  std::unique_ptr<LiveClusterWriter> ptr_cluster_writer_;
   uint64 audio_track_num_;
   uint64 video_track_num_;
-  WriteBuffer buffer_;
+  int32 cluster_duration_;
+  bool header_written_;
   int64 muxer_time_;
   int64 chunks_read_;
   std::string muxer_id_;
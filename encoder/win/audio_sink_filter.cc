@@ -296,8 +296,11 @@ HRESULT AudioSinkFilter::OnSamplesReceived(IMediaSample* ptr_sample) {
       << "   duration= "      << duration << "\n"
       << "   size=" << sample_buffer_.buffer_length();
 
-  if (!ptr_samples_callback_->OnSamplesReceived(&sample_buffer_)) {
-    LOG(ERROR) << "OnSamplesReceived failed.";
+  const int samples_status =
+      ptr_samples_callback_->OnSamplesReceived(&sample_buffer_);
+  if (samples_status &&
+      samples_status != AudioSamplesCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnSamplesReceived failed, status=" << samples_status;
   }
   return S_OK;
 }
@@ -98,6 +98,7 @@ MediaSourceImpl::MediaSourceImpl()
       media_event_handle_(INVALID_HANDLE_VALUE),
       ptr_audio_callback_(NULL),
       ptr_video_callback_(NULL),
+      ptr_video_allocator_(NULL),
       audio_device_index_(0),
       video_device_index_(0) {
 }
@@ -121,7 +122,8 @@ MediaSourceImpl::~MediaSourceImpl() {
 // video source -> video sink
 int MediaSourceImpl::Init(const WebmEncoderConfig& config,
                           AudioSamplesCallbackInterface* ptr_audio_callback,
-                          VideoFrameCallbackInterface* ptr_video_callback) {
+                          VideoFrameCallbackInterface* ptr_video_callback,
+                          VideoFrameAllocatorInterface* ptr_video_allocator) {
   if (!config.disable_audio && !ptr_audio_callback) {
     LOG(ERROR) << "Null AudioSamplesCallbackInterface.";
     return kInvalidArg;
@@ -136,6 +138,7 @@ int MediaSourceImpl::Init(const WebmEncoderConfig& config,
   }
   ptr_audio_callback_ = ptr_audio_callback;
   ptr_video_callback_ = ptr_video_callback;
+  ptr_video_allocator_ = ptr_video_allocator;
   requested_audio_config_ = config.requested_audio_config;
   requested_video_config_ = config.requested_video_config;
   ui_opts_ = config.ui_opts;
@@ -303,6 +306,7 @@ int MediaSourceImpl::CreateVideoSink() {
       new (std::nothrow) VideoSinkFilter(filter_name.c_str(),  // NOLINT
                                          NULL,
                                          ptr_video_callback_,
+                                         ptr_video_allocator_,
                                          &status);
   if (!ptr_filter || FAILED(status)) {
     delete ptr_filter;
@@ -18,6 +18,7 @@
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
+#include "encoder/media_source.h"
 #include "encoder/webm_encoder.h"
 
 namespace webmlive {
@@ -89,7 +90,7 @@ class VideoFrameCallbackInterface;
 //
 // Captures video frames using a custom sink filter and passes them back to
 // users through VideoFrameCallbackInterface.
-class MediaSourceImpl {
+class MediaSourceImpl : public MediaSourceInterface {
  public:
   typedef WebmEncoderConfig::UserInterfaceOptions UserInterfaceOptions;
   enum {
@@ -139,23 +140,26 @@ class MediaSourceImpl {
     kGraphCompleted = 1,
   };
   MediaSourceImpl();
-  ~MediaSourceImpl();
+  ~MediaSourceImpl() override;
 
   // Creates video capture graph. Returns |kSuccess| upon success, or a
-  // |WebmEncoder| status code upon failure.
+  // |WebmEncoder| status code upon failure. |ptr_video_allocator| is
+  // optional; when non-NULL the video sink writes frames directly into
+  // storage obtained from it instead of using |ptr_video_callback|.
   int Init(const WebmEncoderConfig& config,
            AudioSamplesCallbackInterface* ptr_audio_callback,
-           VideoFrameCallbackInterface* ptr_video_callback);
+           VideoFrameCallbackInterface* ptr_video_callback,
+           VideoFrameAllocatorInterface* ptr_video_allocator) override;
 
   // Runs filter graph. Returns |kSuccess| upon success, or a |WebmEncoder|
   // status code upon failure.
-  int Run();
+  int Run() override;
 
   // Monitors filter graph state.
-  int CheckStatus();
+  int CheckStatus() override;
 
   // Stops filter graph.
-  void Stop();
+  void Stop() override;
 
   // Returns encoded duration in seconds.
   double encoded_duration();
@@ -164,13 +168,13 @@ class MediaSourceImpl {
   AudioConfig requested_audio_config() const {
     return requested_audio_config_;
   };
-  AudioConfig actual_audio_config() const {
+  AudioConfig actual_audio_config() const override {
     return actual_audio_config_;
   };
   VideoConfig requested_video_config() const {
     return requested_video_config_;
   };
-  VideoConfig actual_video_config() const {
+  VideoConfig actual_video_config() const override {
     return actual_video_config_;
   };
 
@@ -270,6 +274,10 @@ class MediaSourceImpl {
   // Callback interface used by video sink filter to deliver raw frames to
   // |WebmEncoder::EncoderThread|.
   VideoFrameCallbackInterface* ptr_video_callback_;
+
+  // Allocator interface used by video sink filter to write raw frames
+  // directly into |WebmEncoder| storage. May be NULL.
+  VideoFrameAllocatorInterface* ptr_video_allocator_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MediaSourceImpl);
 };
 
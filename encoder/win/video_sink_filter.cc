@@ -226,6 +226,7 @@ VideoSinkFilter::VideoSinkFilter(
     const TCHAR* ptr_filter_name,
     LPUNKNOWN ptr_iunknown,
     VideoFrameCallbackInterface* ptr_frame_callback,
+    VideoFrameAllocatorInterface* ptr_frame_allocator,
     HRESULT* ptr_result)
     : CBaseFilter(ptr_filter_name,
                   ptr_iunknown,
@@ -236,6 +237,7 @@ VideoSinkFilter::VideoSinkFilter(
     return;
   }
   ptr_frame_callback_ = ptr_frame_callback;
+  ptr_frame_allocator_ = ptr_frame_allocator;
   sink_pin_.reset(
       new (std::nothrow) VideoSinkPin(NAME("VideoSinkInputPin"),  // NOLINT
                                       this, &filter_lock_, ptr_result,
@@ -276,7 +278,8 @@ CBasePin* VideoSinkFilter::GetPin(int index) {
 }
 
 // Lock owned by |VideoSinkPin::Receive|. Copies buffer from |ptr_sample| into
-// |frame_|, and then passes |frame_| to
+// a frame leased from |ptr_frame_allocator_| and publishes it, or copies
+// buffer into |frame_|, and then passes |frame_| to
 // |VideoFrameCallbackInterface::OnVideoFrameReceived|.
 HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
   if (!ptr_sample) {
@@ -317,17 +320,31 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
     duration = media_time_to_milliseconds(video_format.avg_time_per_frame());
   }
 
-  // TODO(tomfinegan): Write an allocator that retrieves frames from
-  //                   |WebmEncoder::EncoderThread| and avoid this extra copy.
+  // Write the frame directly into allocator storage when possible to avoid
+  // copying it a second time.
+  VideoFrame* ptr_frame = &frame_;
+  if (ptr_frame_allocator_) {
+    const int alloc_status =
+        ptr_frame_allocator_->AcquireVideoFrame(&ptr_frame);
+    if (alloc_status == VideoFrameAllocatorInterface::kDropped) {
+      return S_OK;
+    } else if (alloc_status) {
+      LOG(ERROR) << "AcquireVideoFrame failed, status=" << alloc_status;
+      return E_FAIL;
+    }
+  }
 
-  const int status = frame_.Init(sink_pin_->actual_config_,
-                                 true,  // always "keyframes"
-                                 timestamp,
-                                 duration,
-                                 ptr_sample_buffer,
-                                 ptr_sample->GetActualDataLength());
+  const int status = ptr_frame->Init(sink_pin_->actual_config_,
+                                     true,  // always "keyframes"
+                                     timestamp,
+                                     duration,
+                                     ptr_sample_buffer,
+                                     ptr_sample->GetActualDataLength());
   if (status) {
     LOG(ERROR) << "OnFrameReceived frame init failed: " << status;
+    if (ptr_frame_allocator_) {
+      ptr_frame_allocator_->CancelVideoFrame();
+    }
     return E_FAIL;
   }
   LOG(INFO) << "OnFrameReceived received a frame:"
@@ -339,7 +356,14 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
             << " timestamp="      << timestamp
             << " duration(sec)= " << (duration / 1000.0)
             << " duration= "      << duration
-            << " size=" << frame_.buffer_length();
+            << " size=" << ptr_frame->buffer_length();
+  if (ptr_frame_allocator_) {
+    const int publish_status = ptr_frame_allocator_->PublishVideoFrame();
+    if (publish_status) {
+      LOG(ERROR) << "PublishVideoFrame failed, status=" << publish_status;
+    }
+    return S_OK;
+  }
   int frame_status = ptr_frame_callback_->OnVideoFrameReceived(&frame_);
   if (frame_status && frame_status != VideoFrameCallbackInterface::kDropped) {
     LOG(ERROR) << "OnVideoFrameReceived failed, status=" << frame_status;
@@ -110,8 +110,9 @@ class VideoSinkPin : public CBaseInputPin {
 // DirectShow filter via |VideoSinkPin|.
 class VideoSinkFilter : public CBaseFilter {
  public:
-  // Stores |ptr_frame_callback|, constructs CBaseFilter and |VideoSinkPin, and
-  // returns result via |ptr_result|.
+  // Stores |ptr_frame_callback| and |ptr_frame_allocator|, constructs
+  // CBaseFilter and |VideoSinkPin, and returns result via |ptr_result|.
+  // |ptr_frame_allocator| may be NULL.
   // Return values:
   // S_OK - success.
   // E_INVALIDARG - |ptr_Frame_callback| is NULL.
@@ -119,6 +120,7 @@ class VideoSinkFilter : public CBaseFilter {
   VideoSinkFilter(const TCHAR* ptr_filter_name,
                   LPUNKNOWN ptr_iunknown,
                   VideoFrameCallbackInterface* ptr_frame_callback,
+                  VideoFrameAllocatorInterface* ptr_frame_allocator,
                   HRESULT* ptr_result);
   virtual ~VideoSinkFilter();
 
@@ -138,7 +140,9 @@ class VideoSinkFilter : public CBaseFilter {
   virtual CBasePin* GetPin(int index);
 
  private:
-  // Copes video frame from |ptr_sample| to |frame_|, and passes |frame_| to
+  // Copies video frame from |ptr_sample| into a frame obtained from
+  // |ptr_frame_allocator_| and publishes it. When |ptr_frame_allocator_| is
+  // NULL copies the frame to |frame_|, and passes |frame_| to
   // |VideoFrameCallbackInterface::OnVideoFrameReceived| for processing.
   // Returns S_OK when successful.
   HRESULT OnFrameReceived(IMediaSample* ptr_sample);
@@ -146,6 +150,7 @@ class VideoSinkFilter : public CBaseFilter {
   VideoFrame frame_;
   std::unique_ptr<VideoSinkPin> sink_pin_;
   VideoFrameCallbackInterface* ptr_frame_callback_;
+  VideoFrameAllocatorInterface* ptr_frame_allocator_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoSinkFilter);
 
   // |VideoSinkPin| requires access to private member |filter_lock_|, and
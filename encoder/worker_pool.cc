@@ -0,0 +1,241 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/worker_pool.h"
+
+#include <new>
+#include <sstream>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+WorkerPool::WorkerPool()
+    : next_worker_(0),
+      num_queued_(0),
+      running_(false),
+      stopping_(false) {
+}
+
+WorkerPool::~WorkerPool() {
+  Stop();
+}
+
+bool WorkerPool::Init(int num_workers) {
+  return Init(num_workers, ThreadOptions());
+}
+
+bool WorkerPool::Init(int num_workers, const ThreadOptions& thread_options) {
+  if (num_workers < 0) {
+    LOG(ERROR) << "invalid worker count " << num_workers;
+    return false;
+  }
+  if (!workers_.empty()) {
+    LOG(ERROR) << "worker pool already running.";
+    return false;
+  }
+  if (num_workers == 0) {
+    num_workers = static_cast<int>(std::thread::hardware_concurrency());
+    if (num_workers <= 0) {
+      num_workers = 1;
+    }
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    std::unique_ptr<Worker> worker(new (std::nothrow) Worker());  // NOLINT
+    if (!worker) {
+      LOG(ERROR) << "out of memory creating worker " << i;
+      Stop();
+      return false;
+    }
+    worker->thread = std::shared_ptr<std::thread>(
+        new (std::nothrow) std::thread(  // NOLINT
+            std::bind(&WorkerPool::WorkerThread, this, i, thread_options)));
+    if (!worker->thread) {
+      LOG(ERROR) << "cannot start worker " << i;
+      Stop();
+      return false;
+    }
+    worker->thread_id = worker->thread->get_id();
+    workers_.push_back(std::move(worker));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = true;
+  LOG(INFO) << "worker pool running with " << num_workers << " workers.";
+  return true;
+}
+
+bool WorkerPool::Post(const Task& task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int current_worker = CurrentWorker();
+
+  // Once |Stop()| begins only workers may queue tasks: they run them before
+  // exiting.
+  if (!running_ || (stopping_ && current_worker < 0)) {
+    return false;
+  }
+  const int index = current_worker >= 0 ?
+      current_worker : static_cast<int>(next_worker_++ % workers_.size());
+  Worker* const ptr_worker = workers_[index].get();
+  {
+    std::lock_guard<std::mutex> worker_lock(ptr_worker->mutex);
+    ptr_worker->tasks.push_back(task);
+    ++num_queued_;
+  }
+  wake_.notify_one();
+  return true;
+}
+
+void WorkerPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i]->thread->join();
+  }
+  workers_.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = false;
+  stopping_ = false;
+}
+
+void WorkerPool::WorkerThread(int index, const ThreadOptions& thread_options) {
+  std::ostringstream name;
+  name << (thread_options.name.empty() ?
+           "webmlive-work" : thread_options.name) << index;
+  ThreadOptions named_options = thread_options;
+  named_options.name = name.str();
+  ApplyThreadOptions(named_options);
+
+  for (;;) {
+    Task task;
+    if (NextTask(index, &task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (num_queued_ == 0 && !stopping_) {
+      wake_.wait(lock);
+    }
+    if (num_queued_ == 0 && stopping_) {
+      break;
+    }
+  }
+  VLOG(1) << "worker " << index << " done.";
+}
+
+int WorkerPool::CurrentWorker() const {
+  const std::thread::id thread_id = std::this_thread::get_id();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    if (workers_[i]->thread_id == thread_id) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+bool WorkerPool::NextTask(int index, Task* ptr_task) {
+  if (num_queued_ == 0) {
+    return false;
+  }
+  const int num_workers = static_cast<int>(workers_.size());
+  for (int i = 0; i < num_workers; ++i) {
+    const int victim = (index + i) % num_workers;
+    Worker* const ptr_worker = workers_[victim].get();
+    std::lock_guard<std::mutex> lock(ptr_worker->mutex);
+    if (ptr_worker->tasks.empty()) {
+      continue;
+    }
+    // Own tasks come from the front, in the order they were queued. Stolen
+    // tasks come from the back, away from the owner.
+    if (victim == index) {
+      ptr_task->swap(ptr_worker->tasks.front());
+      ptr_worker->tasks.pop_front();
+    } else {
+      ptr_task->swap(ptr_worker->tasks.back());
+      ptr_worker->tasks.pop_back();
+    }
+    --num_queued_;
+    return true;
+  }
+  return false;
+}
+
+SerialTaskRunner::SerialTaskRunner(WorkerPool* ptr_pool)
+    : ptr_pool_(ptr_pool),
+      scheduled_(false) {
+  CHECK_NOTNULL(ptr_pool_);
+}
+
+SerialTaskRunner::~SerialTaskRunner() {
+  WaitIdle();
+}
+
+bool SerialTaskRunner::Post(const Task& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+    if (scheduled_) {
+      return true;
+    }
+    scheduled_ = true;
+  }
+  if (!ptr_pool_->Post(std::bind(&SerialTaskRunner::RunTasks, this))) {
+    LOG(ERROR) << "worker pool refused task.";
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.clear();
+    scheduled_ = false;
+    idle_.notify_all();
+    return false;
+  }
+  return true;
+}
+
+void SerialTaskRunner::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (scheduled_) {
+    idle_.wait(lock);
+  }
+}
+
+void SerialTaskRunner::RunTasks() {
+  for (int i = 0; i < kMaxTasksPerRun; ++i) {
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (tasks_.empty()) {
+        scheduled_ = false;
+        idle_.notify_all();
+        return;
+      }
+      task.swap(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+
+  // Yield the worker, and continue in a new pool task.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      scheduled_ = false;
+      idle_.notify_all();
+      return;
+    }
+  }
+  if (!ptr_pool_->Post(std::bind(&SerialTaskRunner::RunTasks, this))) {
+    LOG(ERROR) << "worker pool refused task; dropping queued tasks.";
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.clear();
+    scheduled_ = false;
+    idle_.notify_all();
+  }
+}
+
+}  // namespace webmlive
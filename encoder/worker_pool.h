@@ -0,0 +1,141 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WORKER_POOL_H_
+#define WEBMLIVE_ENCODER_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/thread_util.h"
+
+namespace webmlive {
+
+// Fixed set of worker threads shared by many encoding sessions. Each worker
+// owns a task queue. Tasks posted from a worker are queued on that worker,
+// and tasks posted from other threads are spread across the workers. Idle
+// workers steal tasks from the back of other workers' queues.
+//
+// Tasks run in no particular order and may run concurrently; use
+// |SerialTaskRunner| for tasks that must not overlap. Tasks must not block
+// for long periods, since a blocked task holds a worker that all sessions
+// share.
+class WorkerPool {
+ public:
+  typedef std::function<void()> Task;
+
+  WorkerPool();
+  ~WorkerPool();
+
+  // Starts |num_workers| worker threads and returns true. Uses one worker per
+  // CPU when |num_workers| is 0. Returns false when |num_workers| is negative,
+  // when the pool is already running, or when a thread cannot be started.
+  bool Init(int num_workers);
+
+  // Behaves as |Init()| above, and applies |thread_options| to each worker.
+  // Workers are named after |thread_options.name| with the worker index
+  // appended.
+  bool Init(int num_workers, const ThreadOptions& thread_options);
+
+  // Queues |task| and returns true. Returns false when the pool is not
+  // running.
+  bool Post(const Task& task);
+
+  // Runs all queued tasks, and then stops and joins the workers. Tasks posted
+  // during the shutdown still run.
+  void Stop();
+
+  int num_workers() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::shared_ptr<std::thread> thread;
+
+    // Written before |running_| is set, and read only while it is set.
+    std::thread::id thread_id;
+  };
+
+  void WorkerThread(int index, const ThreadOptions& thread_options);
+
+  // Returns the index of the calling worker, or -1 when called from a thread
+  // that does not belong to the pool.
+  int CurrentWorker() const;
+
+  // Pops a task from the front of worker |index|'s queue, or steals one from
+  // the back of another worker's queue. Returns false when all queues are
+  // empty.
+  bool NextTask(int index, Task* ptr_task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Next worker to receive a task posted from outside the pool.
+  std::atomic<uint32> next_worker_;
+
+  // Number of queued tasks across all workers.
+  std::atomic<int32> num_queued_;
+
+  // Protects |running_| and |stopping_|, and is used with |wake_| to put idle
+  // workers to sleep.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool running_;
+  bool stopping_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+// Runs tasks one at a time, in the order they are posted, on a
+// |WorkerPool|. Consecutive tasks may run on different workers; each task
+// sees the effects of the tasks that ran before it. Used to run pipeline
+// stages that keep state between tasks.
+class SerialTaskRunner {
+ public:
+  typedef WorkerPool::Task Task;
+
+  // Maximum number of tasks run per worker pool task before the runner
+  // yields its worker to other runners.
+  static const int kMaxTasksPerRun = 8;
+
+  explicit SerialTaskRunner(WorkerPool* ptr_pool);
+
+  // Waits for queued tasks to run.
+  ~SerialTaskRunner();
+
+  // Queues |task| and returns true. Returns false when the worker pool
+  // refuses the task.
+  bool Post(const Task& task);
+
+  // Blocks until all posted tasks have run. Must not be called from a task
+  // run by this runner.
+  void WaitIdle();
+
+ private:
+  // Worker pool task. Runs up to |kMaxTasksPerRun| tasks, and reposts itself
+  // when tasks remain.
+  void RunTasks();
+
+  WorkerPool* const ptr_pool_;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::deque<Task> tasks_;
+
+  // True while a |RunTasks()| task is queued on or running in |ptr_pool_|.
+  bool scheduled_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SerialTaskRunner);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WORKER_POOL_H_